@@ -22,6 +22,16 @@
 
 #include "lex.h"
 #include <locale.h>
+#include <cctype>
+#include <climits>
+
+#if LEX_SIMD && ( defined( __x86_64__ ) || defined( __i386__ ) ) && defined( __SSE2__ )
+#define LEX_SIMD_X86 1
+#include <immintrin.h>
+#elif LEX_SIMD && defined( __aarch64__ ) && defined( __ARM_NEON )
+#define LEX_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
 
 
 template struct pg::lex::basic_match_result< char >;
@@ -39,19 +49,44 @@ template struct pg::lex::detail::pattern_context< wchar_t >;
 template struct pg::lex::detail::pattern_context< char16_t >;
 template struct pg::lex::detail::pattern_context< char32_t >;
 
+template class pg::lex::basic_pattern< char >;
+template class pg::lex::basic_pattern< wchar_t >;
+template class pg::lex::basic_pattern< char16_t >;
+template class pg::lex::basic_pattern< char32_t >;
+
+template class pg::lex::basic_replacement< char >;
+template class pg::lex::basic_replacement< wchar_t >;
+template class pg::lex::basic_replacement< char16_t >;
+template class pg::lex::basic_replacement< char32_t >;
+
+template class pg::lex::basic_pattern_set< char >;
+template class pg::lex::basic_pattern_set< wchar_t >;
+template class pg::lex::basic_pattern_set< char16_t >;
+template class pg::lex::basic_pattern_set< char32_t >;
 
-pg::lex::detail::matchdepth_sentinel::matchdepth_sentinel( int &counter )
-    : m_counter( counter )
+
+pg::lex::backtrack_stack & pg::lex::detail::thread_backtrack_stack() noexcept
 {
-    if( --m_counter < 0 )
-    {
-        throw lex_error( pattern_too_complex );
-    }
+    static thread_local backtrack_stack stack;
+
+    return stack;
+}
+
+pg::lex::memo_table & pg::lex::detail::thread_memo_table() noexcept
+{
+    static thread_local memo_table table;
+
+    return table;
 }
 
-pg::lex::detail::matchdepth_sentinel::~matchdepth_sentinel()
+void pg::lex::detail::throw_pattern_too_complex()
 {
-    ++m_counter;
+    throw lex_error( pattern_too_complex );
+}
+
+void pg::lex::detail::throw_step_limit_exceeded()
+{
+    throw lex_error( match_step_limit_exceeded );
 }
 
 static const char * lex_error_text( pg::lex::error_type code ) noexcept
@@ -69,6 +104,8 @@ static const char * lex_error_text( pg::lex::error_type code ) noexcept
     case pg::lex::capture_not_finished:                 return "unfinished capture";
     case pg::lex::capture_out_of_range:                 return "capture out of range";
     case pg::lex::percent_invalid_use_in_replacement:   return "invalid use of '%' in replacement string";
+    case pg::lex::match_step_limit_exceeded:            return "step limit of the matcher exceeded";
+    case pg::lex::string_too_long:                      return "input string too long for 32-bit offsets";
     default:                                            return "lex error";
     }
 }
@@ -82,6 +119,15 @@ pg::lex::lex_error::lex_error( pg::lex::error_type ec ) noexcept
 
 bool pg::lex::detail::match_class( int c, int cl ) noexcept
 {
+    if( cl < 0 || cl > UCHAR_MAX )
+    {
+        return cl == c;
+    }
+    if( c < 0 || c > UCHAR_MAX )  /* the <cctype> functions are only defined for the values of an unsigned char */
+    {
+        return is_class( cl ) ? std::isupper( cl ) : cl == c;
+    }
+
     bool res;
     switch( std::tolower( cl ) )
     {
@@ -100,3 +146,179 @@ bool pg::lex::detail::match_class( int c, int cl ) noexcept
     }
     return std::islower( cl ) ? res : !res;
 }
+
+
+namespace
+{
+
+#include "lex_unicode.inc"
+
+}
+
+std::uint16_t pg::lex::detail::unicode_class_bits( char32_t c ) noexcept
+{
+    if( c < 128 )
+    {
+        return ascii_classes.bits[ c ];
+    }
+    if( c > 0x10FFFF )
+    {
+        return 0;  /* not a code point */
+    }
+
+    /* the last run that starts at or before 'c' */
+    const auto run = std::upper_bound( std::begin( unicode_class_runs ), std::end( unicode_class_runs ), ( static_cast< std::uint32_t >( c ) << 8 ) | 0xFF );
+    return static_cast< std::uint16_t >( *( run - 1 ) & 0xFF );
+}
+
+
+namespace
+{
+
+using run_length_kernel = std::size_t ( * )( const pg::lex::detail::byte_ranges &, const std::uint64_t ( & )[ 4 ], const char *, const char * );
+
+
+std::size_t run_length_scalar( const pg::lex::detail::byte_ranges &, const std::uint64_t ( & table )[ 4 ], const char * s, const char * e ) noexcept
+{
+    auto p = s;
+    for( ; p < e ; ++p )
+    {
+        const auto c = static_cast< unsigned char >( *p );
+        if( !( ( table[ c >> 6 ] >> ( c & 63 ) ) & 1u ) )
+        {
+            break;
+        }
+    }
+    return p - s;
+}
+
+
+#if defined( LEX_SIMD_X86 )
+
+/* A char 'c' is in the range [lo, lo + span] when the saturated difference ( c - lo ) - span is zero. */
+std::size_t run_length_sse2( const pg::lex::detail::byte_ranges & r, const std::uint64_t ( & table )[ 4 ], const char * s, const char * e ) noexcept
+{
+    __m128i lo[ pg::lex::detail::byte_ranges::max_ranges ];
+    __m128i span[ pg::lex::detail::byte_ranges::max_ranges ];
+    for( int i = 0 ; i < r.count ; ++i )
+    {
+        lo[ i ]   = _mm_set1_epi8( static_cast< char >( r.lo[ i ] ) );
+        span[ i ] = _mm_set1_epi8( static_cast< char >( r.span[ i ] ) );
+    }
+
+    const auto zero = _mm_setzero_si128();
+    auto       p    = s;
+    for( ; r.count && e - p >= 16 ; p += 16 )
+    {
+        const auto x = _mm_loadu_si128( reinterpret_cast< const __m128i * >( p ) );
+        auto       m = zero;
+        for( int i = 0 ; i < r.count ; ++i )
+        {
+            m = _mm_or_si128( m, _mm_cmpeq_epi8( _mm_subs_epu8( _mm_sub_epi8( x, lo[ i ] ), span[ i ] ), zero ) );
+        }
+        const unsigned mask = _mm_movemask_epi8( m );
+        if( mask != 0xFFFFu )
+        {
+            return p - s + __builtin_ctz( ~mask );
+        }
+    }
+    return p - s + run_length_scalar( r, table, p, e );
+}
+
+
+__attribute__(( target( "avx2" ) ))
+std::size_t run_length_avx2( const pg::lex::detail::byte_ranges & r, const std::uint64_t ( & table )[ 4 ], const char * s, const char * e ) noexcept
+{
+    __m256i lo[ pg::lex::detail::byte_ranges::max_ranges ];
+    __m256i span[ pg::lex::detail::byte_ranges::max_ranges ];
+    for( int i = 0 ; i < r.count ; ++i )
+    {
+        lo[ i ]   = _mm256_set1_epi8( static_cast< char >( r.lo[ i ] ) );
+        span[ i ] = _mm256_set1_epi8( static_cast< char >( r.span[ i ] ) );
+    }
+
+    const auto zero = _mm256_setzero_si256();
+    auto       p    = s;
+    for( ; r.count && e - p >= 32 ; p += 32 )
+    {
+        const auto x = _mm256_loadu_si256( reinterpret_cast< const __m256i * >( p ) );
+        auto       m = zero;
+        for( int i = 0 ; i < r.count ; ++i )
+        {
+            m = _mm256_or_si256( m, _mm256_cmpeq_epi8( _mm256_subs_epu8( _mm256_sub_epi8( x, lo[ i ] ), span[ i ] ), zero ) );
+        }
+        const unsigned mask = _mm256_movemask_epi8( m );
+        if( mask != 0xFFFFFFFFu )
+        {
+            return p - s + __builtin_ctz( ~mask );
+        }
+    }
+    return p - s + run_length_sse2( r, table, p, e );
+}
+
+
+run_length_kernel select_run_length_kernel() noexcept
+{
+#if defined( __GNUC__ )
+    __builtin_cpu_init();
+    if( __builtin_cpu_supports( "avx2" ) )
+    {
+        return run_length_avx2;
+    }
+#endif
+    return run_length_sse2;
+}
+
+#elif defined( LEX_SIMD_NEON )
+
+std::size_t run_length_neon( const pg::lex::detail::byte_ranges & r, const std::uint64_t ( & table )[ 4 ], const char * s, const char * e ) noexcept
+{
+    uint8x16_t lo[ pg::lex::detail::byte_ranges::max_ranges ];
+    uint8x16_t span[ pg::lex::detail::byte_ranges::max_ranges ];
+    for( int i = 0 ; i < r.count ; ++i )
+    {
+        lo[ i ]   = vdupq_n_u8( r.lo[ i ] );
+        span[ i ] = vdupq_n_u8( r.span[ i ] );
+    }
+
+    auto p = s;
+    for( ; r.count && e - p >= 16 ; p += 16 )
+    {
+        const auto x = vld1q_u8( reinterpret_cast< const std::uint8_t * >( p ) );
+        auto       m = vdupq_n_u8( 0 );
+        for( int i = 0 ; i < r.count ; ++i )
+        {
+            m = vorrq_u8( m, vcleq_u8( vsubq_u8( x, lo[ i ] ), span[ i ] ) );
+        }
+        if( vminvq_u8( m ) != 0xFF )
+        {
+            break;  /* the scalar kernel finds the end of the run in this block */
+        }
+    }
+    return p - s + run_length_scalar( r, table, p, e );
+}
+
+
+run_length_kernel select_run_length_kernel() noexcept
+{
+    return run_length_neon;
+}
+
+#else
+
+run_length_kernel select_run_length_kernel() noexcept
+{
+    return run_length_scalar;
+}
+
+#endif
+
+}  // namespace
+
+
+std::size_t pg::lex::detail::run_length( const byte_ranges & r, const std::uint64_t ( & table )[ 4 ], const char * s, const char * e ) noexcept
+{
+    static const run_length_kernel kernel = select_run_length_kernel();
+
+    return kernel( r, table, s, e );
+}
@@ -21,8 +21,13 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 // SOFTWARE.
 
+#pragma once
+
+#include <cctype>
+#include <climits>
 #include <cstring>
 #include <cassert>
+#include <cstdint>
 
 #include <string>
 #include <string_view>
@@ -30,9 +35,12 @@
 #include <algorithm>
 #include <utility>
 #include <type_traits>
+#include <vector>
+#include <iterator>
+#include <memory>
 
 
-/* maximum recursion depth for 'match' */
+/* default maximum recursion depth for 'match'; see pg::lex::match_options */
 #if !defined(MAXCCALLS)
 #define MAXCCALLS   200
 #endif
@@ -42,6 +50,20 @@
 #define MAXCAPTURES     32
 #endif
 
+/* enables the vectorized (SSE2/AVX2 or NEON) kernels for runs of a char class; 0 selects the scalar kernel */
+#if !defined(LEX_SIMD)
+#define LEX_SIMD    1
+#endif
+
+/* records the counters of pg::lex::match_options::stats; must have the same value in every translation unit */
+#if !defined(LEX_INSTRUMENTATION)
+#define LEX_INSTRUMENTATION    0
+#endif
+
+#if LEX_INSTRUMENTATION
+#include <chrono>
+#endif
+
 
 namespace pg
 {
@@ -72,6 +94,9 @@ template< typename T >                                      struct string_traits
 template< typename, typename, typename >
 struct match_state;
 
+template< typename, typename, typename >
+struct compiled_match_state;
+
 enum cap_state : long
 {
     unfinished = -1,
@@ -85,10 +110,46 @@ struct capture
     long          len  = cap_state::unfinished;
 };
 
+/* A match result type records the captures of the pattern; the matchers skip the capture items when it only needs the whole match. */
+template< typename MR >
+struct records_captures : std::true_type {};
+
+enum class frame_type : unsigned char
+{
+    optional,            /* retry the position without the optional char */
+    max_expand,          /* retry with one repetition less */
+    min_expand,          /* retry with one repetition more */
+    undo_start_capture,  /* the capture is removed when backtracking */
+    undo_end_capture     /* the capture is unfinished again when backtracking */
+};
+
+/* A backtrack point or an undo action of the non-recursive matcher; positions are offsets so the frames don't depend on the char types */
+struct backtrack_frame
+{
+    frame_type     type;
+    std::ptrdiff_t item;   /* index of the pattern item */
+    std::ptrdiff_t pos;    /* offset in the input string */
+    std::ptrdiff_t count;  /* repetitions left for max_expand */
+};
+
+[[noreturn]] void throw_pattern_too_complex();
+[[noreturn]] void throw_step_limit_exceeded();
+
 struct matchdepth_sentinel
 {
-    matchdepth_sentinel( int &counter );
-    ~matchdepth_sentinel() noexcept;
+    matchdepth_sentinel( int &counter )
+        : m_counter( counter )
+    {
+        if( --m_counter < 0 )
+        {
+            throw_pattern_too_complex();
+        }
+    }
+
+    ~matchdepth_sentinel() noexcept
+    {
+        ++m_counter;
+    }
 
 private:
     int &m_counter;
@@ -98,6 +159,15 @@ private:
 template< typename >
 struct basic_match_result;
 
+template< typename >
+class basic_pattern;
+
+template< typename >
+class basic_replacement;
+
+template< typename >
+class basic_pattern_set;
+
 enum error_type
 {
     pattern_too_complex,
@@ -110,7 +180,9 @@ enum error_type
     capture_invalid_index,
     capture_not_finished,
     capture_out_of_range,
-    percent_invalid_use_in_replacement
+    percent_invalid_use_in_replacement,
+    match_step_limit_exceeded,
+    string_too_long
 };
 
 class lex_error : public std::runtime_error
@@ -249,351 +321,983 @@ using u32match_result = basic_match_result< char32_t >;
 namespace detail
 {
 
-template< typename StrCharT, typename PatCharT, typename MR >
-struct match_state
+struct compact_capture
 {
-    match_state( const StrCharT * str_begin, const StrCharT * str_end, const PatCharT * pat_end, MR &mr )
-        : s_begin( str_begin )
-        , s_end( str_end )
-        , p_end( pat_end )
-        , level( mr.level )
-        , captures( mr.captures )
-        , pos( mr.pos )
+    std::uint32_t init = 0;  /* offset of the capture in the input string */
+    std::uint32_t len  = 0;
+};
+
+/* Throws a 'string_too_long' when the offsets in an input string don't fit in the 32 bits of a compact result. */
+template< typename CharT >
+void check_compact_length( const CharT * begin, const CharT * end )
+{
+    if( static_cast< std::size_t >( end - begin ) > UINT32_MAX )
     {
-        reprepstate();
+        throw lex_error( string_too_long );
     }
+}
 
-    void reprepstate()
-    {
-        assert( matchdepth == MAXCCALLS );
+}
 
-        level = 0;
-        pos   = { -1l, -1l };
-    }
+/**
+ * \brief A match result with room for a fixed number of captures that are stored as offsets in the input string.
+ *
+ * A compact match result of a pattern with a few captures fits in a cache line and is cheap to copy.
+ * The functions that return compact match results throw a 'string_too_long' when the input string is longer than UINT32_MAX chars.
+ *
+ * \tparam CharT The character type of the match result.
+ * \tparam N     The maximum number of captures.
+ */
+template< typename CharT, size_t N >
+struct basic_compact_match_result
+{
+    static_assert( N > 0 && N <= MAXCAPTURES, "The number of captures is not in the range of 1 to MAXCAPTURES!" );
 
-    void check_captures() const
-    {
-        if( std::any_of( captures, captures + level, []( const auto &cap ){ return cap.len == detail::cap_state::unfinished ; } ) )
-        {
-            throw lex_error( capture_not_finished );
-        }
-    }
+private:
+    const CharT *           base  = nullptr;  /* the begin of the input string */
+    std::uint32_t           first = 0;        /* the offsets where the match starts and ends */
+    std::uint32_t           last  = 0;
+    detail::compact_capture captures[ N ];
+    std::uint8_t            level = 0;
 
-    const StrCharT * const s_begin;
-    const StrCharT * const s_end;
-    const PatCharT * const p_end;
-    int                    matchdepth = MAXCCALLS;  /* control for recursive depth (to avoid stack overflow) */
+public:
 
-    int &                         level;  /* total number of captures (finished or unfinished) */
-    detail::capture< StrCharT > * captures;// ( & captures )[ MAXCAPTURES ];
-    std::pair< long, long > &     pos;
-};
+    /**
+     * \brief Iterator for the captures
+     */
+    struct iterator
+    {
+        template< typename, size_t >
+        friend struct basic_compact_match_result;
 
+        iterator() noexcept = default;
 
-template< typename MS, typename StrCharT, typename PatCharT >
-const StrCharT * match( MS &ms, const StrCharT * s, const PatCharT * p );
+        const std::basic_string_view< CharT > & operator *() const noexcept { assert( mr ); return sv; }
+        const std::basic_string_view< CharT > * operator ->() const noexcept { assert( mr ); return &sv; }
 
-bool match_class( int c, int cl ) noexcept;
+        iterator & operator ++() noexcept { move( 1 ); return *this; }
+        iterator & operator --() noexcept { move( -1 ); return *this; }
+        iterator   operator ++( int ) noexcept { const auto tmp = *this; move( 1 ); return tmp; }
+        iterator   operator --( int ) noexcept { const auto tmp = *this; move( -1 ); return tmp; }
+        iterator & operator +=( int i ) noexcept { move( i ); return *this; }
+        iterator & operator -=( int i ) noexcept { move( -i ); return *this; }
+        iterator   operator +( int i ) const noexcept { auto tmp = *this; tmp.move( i ); return tmp; }
+        iterator   operator -( int i ) const noexcept { auto tmp = *this; tmp.move( -i ); return tmp; }
+        bool       operator ==( const iterator &other ) const noexcept { return mr == other.mr && index == other.index; }
+        bool       operator !=( const iterator &other ) const noexcept { return !( *this == other ); }
 
+    private:
+        const basic_compact_match_result * mr    = nullptr;
+        size_t                             index = 0;
+        std::basic_string_view< CharT >    sv;
 
-template< typename MS, typename PatCharT >
-const PatCharT * classend( const MS &ms, const PatCharT * p )
-{
-    switch( *p++ )
-    {
-    case '%':
-        if( p == ms.p_end )
+        iterator( const basic_compact_match_result * r, size_t i ) noexcept
+            : mr( r )
+            , index( i )
         {
-            throw lex_error( pattern_ends_with_percent );
+            assert( mr );
+            update();
         }
-        return p + 1;
 
-    case '[':
-        if( *p == '^' )
+        void move( int i ) noexcept
         {
-            ++p;
+            assert( mr );
+            index += i;
+            update();
         }
-        do  /* look for a ']' */
+
+        void update() noexcept
         {
-            if( p == ms.p_end )
-            {
-                throw lex_error( pattern_missing_closing_bracket );
-            }
-            if( *p++ == '%' && p < ms.p_end )
+            if( index < mr->size() )
             {
-                ++p;  /* skip escapes (e.g. '%]') */
+                sv = mr->at( index );
             }
-        } while( *p != ']' );
-
-        return p + 1;
-
-    default:
-        return p;
-    }
-}
-
-
-template< typename StrCharT, typename PatCharT >
-bool matchbracketclass( StrCharT c, const PatCharT * p, const PatCharT * ep ) noexcept
-{
-    using unsigned_c_t = typename std::make_unsigned< StrCharT >::type;
-    using unsigned_p_t = typename std::make_unsigned< PatCharT >::type;
+        }
+    };
 
-    const auto c_ = static_cast< unsigned_c_t >( c );
+    basic_compact_match_result() noexcept = default;
 
-    bool ret = true;
-    if( *( p + 1 ) == '^' )
-    {
-        ret = false;
-        p++;  /* skip the '^' */
-    }
-    while( ++p < ep )
+    /**
+     * \brief Compacts a match result of a match in the input string that begins at 'str'.
+     *
+     * Throws a 'capture_too_many' when the match result has more than N captures.
+     */
+    basic_compact_match_result( const basic_match_result< CharT > & mr, const CharT * str )
+        : base( str )
     {
-        if( *p == '%' )
+        if( mr.size() > N )
         {
-            p++;
-            if( match_class( c_, *p ) )
-            {
-                return ret;
-            }
+            throw lex_error( capture_too_many );
         }
-        else if( ( *( p + 1 ) == '-' ) && ( p + 2 < ep ) )
+        if( !mr )
         {
-            p += 2;
-            const auto min = static_cast< unsigned_p_t >( *( p - 2 ) );
-            const auto max = static_cast< unsigned_p_t >( *p );
-            if( min <= c_ && c_ <= max )
-            {
-                return ret;
-            }
+            return;
         }
-        else if( static_cast<unsigned_p_t>( *p ) == c_ )
+
+        first = static_cast< std::uint32_t >( mr.position().first );
+        last  = static_cast< std::uint32_t >( mr.position().second );
+        level = static_cast< std::uint8_t >( mr.size() );
+        for( size_t i = 0 ; i < mr.size() ; ++i )
         {
-            return ret;
+            const auto cap = mr.at( i );
+            captures[ i ]  = { static_cast< std::uint32_t >( cap.data() - str ), static_cast< std::uint32_t >( cap.size() ) };
         }
     }
-    return !ret;
-}
-
-
-template< typename MS, typename StrCharT, typename PatCharT >
-bool singlematch( const MS &ms, const StrCharT * s, const PatCharT * p, const PatCharT * ep )
-{
-    if( s < ms.s_end )
-    {
-        using unsigned_str_char_type = typename std::make_unsigned< StrCharT >::type;
-        using unsigned_pat_char_type = typename std::make_unsigned< PatCharT >::type;
-
-        const auto c = static_cast< unsigned_str_char_type >( *s );
-
-        switch( *p )
-        {
-        case '.':
-            return true;  /* matches any char */
-
-        case '%':
-            return match_class( c, *( p + 1 ) );
 
-        case '[':
-            return matchbracketclass( c, p, ep - 1 );
+    /**
+     * \brief Returns an iterator to the begin of the capture list.
+     */
+    iterator begin() const noexcept { return { this, 0 }; }
 
-        default:
-            return static_cast< unsigned_pat_char_type >( *p ) == c;
-        }
-    }
+    /**
+     * \brief Returns an iterator to the end of the capture list,
+     */
+    iterator end() const noexcept { return { this, size() }; }
 
-    return false;
-}
+    /**
+     * \brief Returns the number of captures.
+     */
+    size_t size() const noexcept { return level; }
 
+    /**
+     * \brief
+     */
+    operator bool() const noexcept { return level > 0; }
 
-template< typename MS, typename StrCharT, typename PatCharT >
-const StrCharT * matchbalance( const MS &ms, const StrCharT * s, const PatCharT * p )
-{
-    if( p >= ms.p_end )
-    {
-        throw lex_error( balanced_no_arguments );
-    }
-    if( static_cast< char32_t >( *s ) != static_cast< char32_t >( *p ) )
-    {
-        return nullptr;
-    }
-    else
+    /**
+     * \brief Returns a std::string_view of the requested capture.
+     *
+     * This function thows an 'capture_out_of_range' when match result doesn't have a capture at the requested index.
+     */
+    std::basic_string_view< CharT > at( size_t i ) const
     {
-        const auto b = static_cast< char32_t >( *p );
-        const auto e = static_cast< char32_t >( *( p + 1 ) );
-        int count    = 1;
-        while( ++s < ms.s_end )
+        if( i >= level )
         {
-            if( static_cast< char32_t >( *s ) == e )
-            {
-                if( --count == 0 )
-                {
-                    return s + 1;
-                }
-            }
-            else if( static_cast< char32_t >( *s ) == b )
-            {
-              ++count;
-            }
+            throw lex_error( capture_out_of_range );
         }
+        return { base + captures[ i ].init, captures[ i ].len };
     }
-    return nullptr;
-}
 
-
-template< typename MS, typename StrCharT, typename PatCharT >
-const StrCharT * max_expand( MS &ms, const StrCharT * s, const PatCharT * p, const PatCharT * ep )
-{
-    ptrdiff_t i = 0;
-    while( singlematch( ms, s + i, p, ep ) )
-    {
-        ++i;
-    }
-    /* keeps trying to match with the maximum repetitions */
-    while( i >= 0 )
+    /**
+     * \brief Returns a pair of indices that tells the position of the match in a string.
+     *
+     * First is the start index of the match and second one past the last character of the match.
+     */
+    std::pair< long, long > position() const noexcept
     {
-        if( auto res = match( ms, s + i, ep + 1 ) )
-        {
-            return res;
-        }
-        --i;
+        return level ? std::pair< long, long >{ first, last } : std::pair< long, long >{ -1, -1 };
     }
 
-    return nullptr;
-}
+    /**
+     * \brief Returns the length of the match.
+     */
+    size_t length() const noexcept { return last - first; }
+};
 
+template< size_t N > using compact_match_result    = basic_compact_match_result< char, N >;
+template< size_t N > using wcompact_match_result   = basic_compact_match_result< wchar_t, N >;
+template< size_t N > using u16compact_match_result = basic_compact_match_result< char16_t, N >;
+template< size_t N > using u32compact_match_result = basic_compact_match_result< char32_t, N >;
 
-template< typename MS, typename StrCharT, typename PatCharT >
-const StrCharT * min_expand( MS &ms, const StrCharT * s, const PatCharT * p, const PatCharT * ep )
+/**
+ * \brief The output of a replacement function of gsub that writes its replacement instead of returning a string.
+ *
+ * A function that accepts a match result and a sink appends the replacement to the sink, the replacement doesn't need a string of its own.
+ *
+ * \tparam CharT The char type of the input string.
+ */
+template< typename CharT >
+class basic_replacement_sink
 {
-    for( ; ; )
-    {
-        if( auto res = match( ms, s, ep + 1 )  )
-        {
-            return res;
-        }
-        else if( singlematch( ms, s, p, ep ) )
-        {
-            ++s;
-        }
-        else
-        {
-            return nullptr;
-        }
-    }
-}
+    void * const target;
+    void ( * const write )( void * target, const CharT * s, std::size_t n );
 
+public:
 
-template< typename MS, typename StrCharT, typename PatCharT >
-auto start_capture( MS &ms, const StrCharT * s, const PatCharT * p )
+    template< typename Result >
+    explicit basic_replacement_sink( Result & result ) noexcept
+        : target( &result )
+        , write( []( void * t, const CharT * s, std::size_t n ){ static_cast< Result * >( t )->append( s, n ); } )
+    {}
+
+    /**
+     * \brief Appends a string to the replacement.
+     */
+    void append( std::basic_string_view< CharT > str ) { write( target, str.data(), str.size() ); }
+
+    /**
+     * \brief Appends a char to the replacement.
+     */
+    void push_back( CharT c ) { write( target, &c, 1 ); }
+};
+
+using replacement_sink    = basic_replacement_sink< char >;
+using wreplacement_sink   = basic_replacement_sink< wchar_t >;
+using u16replacement_sink = basic_replacement_sink< char16_t >;
+using u32replacement_sink = basic_replacement_sink< char32_t >;
+
+/**
+ * \brief The stack of the non-recursive matcher.
+ *
+ * The stack grows when a match needs more backtrack points and keeps its memory for the next matches.
+ * A stack must not be shared between threads.
+ *
+ * \see pg::lex::match_options
+ */
+class backtrack_stack
 {
-    assert( s );
+    template< typename, typename, typename >
+    friend struct detail::compiled_match_state;
 
-    if( ms.level >= MAXCAPTURES )
+    std::vector< detail::backtrack_frame > frames;
+
+public:
+
+    /**
+     * \brief Reserves memory for a number of backtrack points.
+     */
+    void reserve( size_t n ) { frames.reserve( n ); }
+
+    /**
+     * \brief Returns the number of backtrack points that fit in the reserved memory.
+     */
+    size_t capacity() const noexcept { return frames.capacity(); }
+};
+
+/**
+ * \brief The table of the memoized matcher with the failed states of the items of a compiled pattern.
+ *
+ * The table grows to the number of items times the length of the input string and keeps its memory for the next matches.
+ * A match clears only the parts of the table that it used, so a match of a few chars in a long input string stays cheap.
+ * A table must not be shared between threads.
+ *
+ * \see pg::lex::match_options
+ */
+class memo_table
+{
+    template< typename, typename, typename >
+    friend struct detail::compiled_match_state;
+
+    std::vector< std::uint64_t > visited;  /* bitmap of the visited (item, position) states */
+    std::vector< std::size_t >   touched;  /* the words of 'visited' that have bits set */
+    bool                         in_use = false;
+
+public:
+
+    /**
+     * \brief Returns the number of states that fit in the table.
+     */
+    size_t capacity() const noexcept { return visited.size() * 64; }
+};
+
+/**
+ * \brief Selects the definition of the character classes like '%a' and '%d'.
+ */
+enum class class_mode : unsigned char
+{
+    locale,  ///< The <cctype> functions with the global C locale, like Lua; chars above 255 are not members of a class.
+    ascii,   ///< Tables of the ASCII classes of the "C" locale; chars above 127 are not members of a class. Independent of the locale.
+    unicode  ///< Tables of the Unicode general categories for the chars above 127, chars are code points; meant for wide strings.
+};
+
+/**
+ * \brief Counters of the matcher that show where the time of a pattern goes.
+ *
+ * The counters are only recorded when the library is compiled with LEX_INSTRUMENTATION defined as 1, otherwise the counting code is left out.
+ * The counters of the calls with the same stats accumulate; keep a stats object per pattern to find the patterns that backtrack a lot.
+ * The counters are not atomic, a stats object must not be shared between threads; the parallel functions count every chunk separately and add the counts when they are done.
+ *
+ * \see pg::lex::match_options
+ */
+struct match_stats
+{
+    std::uint64_t searches        = 0;  ///< The number of searches, e.g. a call of match or a step of a gmatch iterator.
+    std::uint64_t starts          = 0;  ///< The positions of the input string where the search started a match.
+    std::uint64_t match_calls     = 0;  ///< The calls of the recursive matcher.
+    std::uint64_t steps           = 0;  ///< The steps of the matcher, the same steps that match_options::max_steps limits.
+    std::uint64_t max_backtracks  = 0;  ///< The retries of a greedy repetition with one repetition less.
+    std::uint64_t min_expansions  = 0;  ///< The retries of a lazy repetition with one repetition more.
+    std::uint64_t peak_depth      = 0;  ///< The deepest recursion of the recursive matcher or the most backtrack points of the non-recursive matchers.
+    std::uint64_t nanoseconds     = 0;  ///< The time spent in the searches.
+
+    /**
+     * \brief Adds the counters of another stats object; the peak depth is the deepest of both.
+     */
+    match_stats & operator +=( const match_stats & other ) noexcept
     {
-        throw lex_error( capture_too_many );
+        searches       += other.searches;
+        starts         += other.starts;
+        match_calls    += other.match_calls;
+        steps          += other.steps;
+        max_backtracks += other.max_backtracks;
+        min_expansions += other.min_expansions;
+        peak_depth      = std::max( peak_depth, other.peak_depth );
+        nanoseconds    += other.nanoseconds;
+        return *this;
     }
+};
 
-    ms.captures[ ms.level ].init = s;
+/**
+ * \brief Options that control the matching of a pattern in a single call.
+ */
+struct match_options
+{
+    int               max_depth = MAXCCALLS;  ///< The maximum recursion depth of the matcher; a deeper match throws pattern_too_complex.
+    bool              iterative = false;      ///< Matches compiled patterns without recursion; max_depth does not apply.
+    backtrack_stack * stack     = nullptr;    ///< The stack of the non-recursive matcher; nullptr selects a stack owned by the calling thread.
+    bool              memoize   = false;      ///< Remembers the failed positions of the items of a compiled pattern without back-references.
+    memo_table *      memo      = nullptr;    ///< The table of the memoized matcher; nullptr selects a table owned by the calling thread.
+    long              max_steps = -1;         ///< The maximum number of matcher steps of a call, negative for unlimited; more steps throw match_step_limit_exceeded.
+    bool              threaded  = false;      ///< Matches compiled patterns with threaded code; patterns with '%b' or back-references, and memoized matches, use the interpreter.
+    match_stats *     stats     = nullptr;    ///< The counters of the matcher; only recorded when LEX_INSTRUMENTATION is 1.
+    class_mode        classes   = class_mode::locale;  ///< The character classes of pattern strings; a compiled pattern has the classes it was compiled with.
+    bool              utf8      = false;      ///< Matches char pattern strings against char input strings by UTF-8 code points instead of by bytes.
+};
 
-    if( *p == ')' )
+namespace detail
+{
+
+backtrack_stack & thread_backtrack_stack() noexcept;
+memo_table & thread_memo_table() noexcept;
+
+template< typename StrCharT, typename PatCharT, typename MR >
+struct match_state
+{
+    using str_char_type = StrCharT;
+
+    static constexpr bool skip_captures = !records_captures< MR >::value;  /* the pattern has no back-references and the result needs only the whole match */
+
+    match_state( const StrCharT * str_begin, const StrCharT * str_end, const PatCharT * pat_begin, const PatCharT * pat_end, MR &mr,
+                 const match_options & opts = {} )
+        : s_begin( str_begin )
+        , s_end( str_end )
+        , p_begin( pat_begin )
+        , p_end( pat_end )
+        , max_depth( opts.max_depth )
+        , matchdepth( opts.max_depth )
+        , steps_left( opts.max_steps )
+        , level( mr.level )
+        , captures( mr.captures )
+        , pos( mr.pos )
+        , classes( opts.classes )
+        , utf8( opts.utf8 && sizeof( StrCharT ) == 1 && sizeof( PatCharT ) == 1 )  /* the items of a compiled pattern are never UTF-8 */
+#if LEX_INSTRUMENTATION
+        , stats( opts.stats )
+#endif
     {
-        ms.captures[ ms.level ].len = cap_state::position;
-        ++p;
+        reprepstate();
     }
-    else
+
+    void reprepstate()
     {
-        ms.captures[ ms.level ].len = cap_state::unfinished;
-    }
+        assert( matchdepth == max_depth );
 
-    ms.level++;
+        level = 0;
+        pos   = { -1l, -1l };
+    }
 
-    auto res = match( ms, s, p );
-    if( !res )
+    /* Counts a step of the matcher against the step budget */
+    void step()
     {
-        // Undo capture when the match has failed
-        --ms.level;
-        ms.captures[ ms.level ].len = cap_state::unfinished;
+        count( &match_stats::steps );
+        if( steps_left-- == 0 )
+        {
+            throw_step_limit_exceeded();
+        }
     }
-    return res;
-}
 
+#if LEX_INSTRUMENTATION
+    /* Increments a counter of the stats */
+    void count( std::uint64_t match_stats::* counter ) const noexcept
+    {
+        if( stats )
+        {
+            ++( stats->*counter );
+        }
+    }
 
-template< typename MS, typename StrCharT, typename PatCharT >
-auto end_capture( MS &ms, const StrCharT * s, const PatCharT * p )
-{
-    int i = ms.level;
-    for( --i ; i >= 0 ; --i )
+    /* Records the depth of the recursion or the number of backtrack points */
+    void reached( std::size_t depth ) const noexcept
     {
-        auto& cap = ms.captures[ i ];
-        if( cap.len == cap_state::unfinished )
+        if( stats && depth > stats->peak_depth )
         {
-            cap.len = static_cast< long >( s - cap.init );
+            stats->peak_depth = depth;
+        }
+    }
+#else
+    void count( std::uint64_t match_stats::* ) const noexcept {}
 
-            auto res = match( ms, s, p );
-            if( !res )
-            {
-                // Undo capture when the match has failed
-                cap.len = cap_state::unfinished ;
-            }
-            return res;
+    void reached( std::size_t ) const noexcept {}
+#endif
+
+    void check_captures() const
+    {
+        if( std::any_of( captures, captures + level, []( const auto &cap ){ return cap.len == detail::cap_state::unfinished ; } ) )
+        {
+            throw lex_error( capture_not_finished );
         }
     }
 
-    throw lex_error( capture_invalid_pattern );
-}
+    const StrCharT * const s_begin;
+    const StrCharT * const s_end;
+    const PatCharT * const p_begin;
+    const PatCharT * const p_end;
+    const int              max_depth;
+    int                    matchdepth;  /* control for recursive depth (to avoid stack overflow) */
+    long                   steps_left;  /* the step budget; negative for an unlimited budget */
+
+    int &                         level;  /* total number of captures (finished or unfinished) */
+    detail::capture< StrCharT > * captures;// ( & captures )[ MAXCAPTURES ];
+    std::pair< long, long > &     pos;
+    const class_mode              classes;
+    const bool                    utf8;     /* the chars of the pattern and the input string are UTF-8 sequences */
+#if LEX_INSTRUMENTATION
+    match_stats * const           stats;
+#endif
+};
 
 
 template< typename MS, typename StrCharT, typename PatCharT >
-const StrCharT * match_capture( MS &ms, const StrCharT * s, PatCharT c )
+const StrCharT * match( MS &ms, const StrCharT * s, const PatCharT * p );
+
+bool match_class( int c, int cl ) noexcept;
+
+/* The class bits of a char in the class tables */
+enum class_bits : std::uint16_t
 {
-    const int i = c - '1';
+    alpha_bit  = 1 << 0,
+    cntrl_bit  = 1 << 1,
+    digit_bit  = 1 << 2,
+    graph_bit  = 1 << 3,
+    lower_bit  = 1 << 4,
+    punct_bit  = 1 << 5,
+    space_bit  = 1 << 6,
+    upper_bit  = 1 << 7,
+    xdigit_bit = 1 << 8,
+    zero_bit   = 1 << 9
+};
 
-    if( i < 0 || i >= ms.level ||
-        ms.captures[ i ].len == cap_state::unfinished  )
+/* Returns the class bits that a char must have to be a member of class 'cl', zero when 'cl' is not the letter of a class */
+constexpr std::uint16_t class_bits_of( int cl ) noexcept
+{
+    switch( cl | 0x20 )  /* lower case; only 'A' to 'Z' become a letter */
     {
-        throw lex_error( capture_invalid_index );
+    case 'a': return alpha_bit;
+    case 'c': return cntrl_bit;
+    case 'd': return digit_bit;
+    case 'g': return graph_bit;
+    case 'l': return lower_bit;
+    case 'p': return punct_bit;
+    case 's': return space_bit;
+    case 'u': return upper_bit;
+    case 'w': return alpha_bit | digit_bit;
+    case 'x': return xdigit_bit;
+    case 'z': return zero_bit;
+    default:  return 0;
     }
+}
 
-    const size_t len = ms.captures[ i ].len;
-    if( static_cast< size_t >( ms.s_end - s ) >= len &&
-        memcmp( ms.captures[ i ].init, s, len * sizeof( c ) ) == 0 )
+/* The class bits of the ASCII chars in the "C" locale */
+struct ascii_class_table
+{
+    constexpr ascii_class_table() noexcept
     {
-        return s + len;
+        for( int c = 0 ; c < 128 ; ++c )
+        {
+            const bool lower = c >= 'a' && c <= 'z';
+            const bool upper = c >= 'A' && c <= 'Z';
+            const bool digit = c >= '0' && c <= '9';
+            const bool graph = c > ' ' && c < 127;
+
+            bits[ c ] = static_cast< std::uint16_t >( ( lower || upper ? alpha_bit : 0 ) |
+                                                      ( c < ' ' || c == 127 ? cntrl_bit : 0 ) |
+                                                      ( digit ? digit_bit : 0 ) |
+                                                      ( graph ? graph_bit : 0 ) |
+                                                      ( lower ? lower_bit : 0 ) |
+                                                      ( graph && !lower && !upper && !digit ? punct_bit : 0 ) |
+                                                      ( c == ' ' || ( c >= '\t' && c <= '\r' ) ? space_bit : 0 ) |
+                                                      ( upper ? upper_bit : 0 ) |
+                                                      ( digit || ( c >= 'a' && c <= 'f' ) || ( c >= 'A' && c <= 'F' ) ? xdigit_bit : 0 ) |
+                                                      ( c == 0 ? zero_bit : 0 ) );
+        }
     }
 
-    return nullptr;
+    std::uint16_t bits[ 128 ] = {};
+};
+
+inline constexpr ascii_class_table ascii_classes;
+
+/* Returns the class bits of a code point above 127 from the tables of the Unicode general categories */
+std::uint16_t unicode_class_bits( char32_t c ) noexcept;
+
+/* Tests a char against class 'cl' with the classes of a class mode; the table driven modes don't depend on the locale */
+inline bool match_class( int c, int cl, class_mode mode ) noexcept
+{
+    if( mode == class_mode::locale )
+    {
+        return match_class( c, cl );
+    }
+
+    const auto wanted = class_bits_of( cl );
+    if( !wanted )
+    {
+        return cl == c;
+    }
+
+    std::uint16_t bits = 0;
+    if( c >= 0 && c < 128 )
+    {
+        bits = ascii_classes.bits[ c ];
+    }
+    else if( c > 0 && mode == class_mode::unicode )
+    {
+        bits = unicode_class_bits( static_cast< char32_t >( c ) );
+    }
+    const bool res = bits & wanted;
+    return cl >= 'a' ? res : !res;  /* an upper case letter is the complement of its class */
 }
 
 
-template< typename MS, typename StrCharT, typename PatCharT >
-const StrCharT * match( MS &ms, const StrCharT * s, const PatCharT * p )
+/* Decodes the UTF-8 sequence at 's' in 'c' and returns its length; an invalid or a truncated sequence is a char with the value of its first byte. */
+inline std::size_t utf8_decode( const char * s, const char * e, char32_t & c ) noexcept
 {
-	const matchdepth_sentinel mds( ms.matchdepth );
+    const auto b = static_cast< unsigned char >( *s );
+    c = b;
+    if( b < 0x80 )
+    {
+        return 1;  /* ASCII */
+    }
 
-    init: /* using goto's to optimize tail recursion */
-    if( p == ms.p_end )
+    std::size_t n   = 0;
+    char32_t    cp  = 0;
+    char32_t    min = 0;
+    if( b >= 0xC2 && b <= 0xDF )
     {
-        return s;
+        n = 2, cp = b & 0x1F, min = 0x80;
+    }
+    else if( b >= 0xE0 && b <= 0xEF )
+    {
+        n = 3, cp = b & 0x0F, min = 0x800;
+    }
+    else if( b >= 0xF0 && b <= 0xF4 )
+    {
+        n = 4, cp = b & 0x07, min = 0x10000;
     }
     else
     {
-        switch( *p )
+        return 1;
+    }
+    if( static_cast< std::size_t >( e - s ) < n )
+    {
+        return 1;
+    }
+    for( std::size_t i = 1 ; i < n ; ++i )
+    {
+        const auto cont = static_cast< unsigned char >( s[ i ] );
+        if( ( cont & 0xC0 ) != 0x80 )
         {
-        case '(':  /* start capture */
-            return start_capture( ms, s, p + 1 );
+            return 1;
+        }
+        cp = ( cp << 6 ) | ( cont & 0x3F );
+    }
+    if( cp < min || cp > 0x10FFFF || ( cp >= 0xD800 && cp <= 0xDFFF ) )  /* overlong sequences and surrogates */
+    {
+        return 1;
+    }
+    c = cp;
+    return n;
+}
 
-        case ')':  /* end capture */
-            return end_capture( ms, s, p + 1 );
+/* Returns the start of the UTF-8 sequence that ends at 's'; the sequence doesn't start before 'begin'. */
+inline const char * utf8_previous( const char * begin, const char * s ) noexcept
+{
+    for( std::size_t n = 1 ; n <= 4 && s - n >= begin ; ++n )
+    {
+        if( ( static_cast< unsigned char >( *( s - n ) ) & 0xC0 ) != 0x80 )
+        {
+            char32_t c;
+            return utf8_decode( s - n, s, c ) == n ? s - n : s - 1;
+        }
+    }
+    return s - 1;
+}
 
-        case '$':
-            if( ( p + 1 ) != ms.p_end )  /* is the '$' the last char in pattern? */
+/* Reads the char at 's' in 'c' and returns the position of the next char; a char is a UTF-8 sequence in UTF-8 mode. */
+template< typename MS, typename CharT >
+const CharT * read_char( const MS &ms, const CharT * s, const CharT * end, char32_t & c ) noexcept
+{
+    if constexpr( sizeof( CharT ) == 1 )
+    {
+        if( ms.utf8 )
+        {
+            return s + utf8_decode( reinterpret_cast< const char * >( s ), reinterpret_cast< const char * >( end ), c );
+        }
+    }
+    c = static_cast< typename std::make_unsigned< CharT >::type >( *s );
+    return s + 1;
+}
+
+/* Returns the position of the char after the char at 's' */
+template< typename MS, typename CharT >
+const CharT * skip_char( const MS &ms, const CharT * s, const CharT * end ) noexcept
+{
+    if constexpr( sizeof( CharT ) == 1 )
+    {
+        if( ms.utf8 )
+        {
+            char32_t c;
+            return s + utf8_decode( reinterpret_cast< const char * >( s ), reinterpret_cast< const char * >( end ), c );
+        }
+    }
+    return s + 1;
+}
+
+/* Returns the position of the char before 's'; the char doesn't start before 'begin' */
+template< typename MS, typename CharT >
+const CharT * previous_char( const MS &ms, const CharT * begin, const CharT * s ) noexcept
+{
+    if constexpr( sizeof( CharT ) == 1 )
+    {
+        if( ms.utf8 )
+        {
+            const auto b = reinterpret_cast< const char * >( begin );
+            return begin + ( utf8_previous( b, reinterpret_cast< const char * >( s ) ) - b );
+        }
+    }
+    return s - 1;
+}
+
+/* Returns the next start position of a search; the start of the next char in UTF-8 mode */
+template< typename MS, typename StrCharT >
+const StrCharT * next_start( const MS &ms, const StrCharT * s ) noexcept
+{
+    return s < ms.s_end ? skip_char( ms, s, ms.s_end ) : s + 1;
+}
+
+
+template< typename MS, typename PatCharT >
+const PatCharT * classend( const MS &ms, const PatCharT * p )
+{
+    switch( *p++ )
+    {
+    case '%':
+        if( p == ms.p_end )
+        {
+            throw lex_error( pattern_ends_with_percent );
+        }
+        return skip_char( ms, p, ms.p_end );
+
+    case '[':
+        if( *p == '^' )
+        {
+            ++p;
+        }
+        do  /* look for a ']' */
+        {
+            if( p == ms.p_end )
             {
-                goto dflt;  /* no; go to default */
+                throw lex_error( pattern_missing_closing_bracket );
             }
-            if( s == ms.s_end )
+            if( *p++ == '%' && p < ms.p_end )
             {
-                return s;  /* check end of string */
+                ++p;  /* skip escapes (e.g. '%]') */
+            }
+        } while( *p != ']' );
+
+        return p + 1;
+
+    default:
+        return skip_char( ms, p - 1, ms.p_end );
+    }
+}
+
+
+template< typename MS, typename PatCharT >
+bool matchbracketclass( const MS &ms, char32_t c, const PatCharT * p, const PatCharT * ep ) noexcept
+{
+    bool ret = true;
+    if( *( p + 1 ) == '^' )
+    {
+        ret = false;
+        p++;  /* skip the '^' */
+    }
+    while( ++p < ep )
+    {
+        char32_t lo;
+        if( *p == '%' )
+        {
+            p = read_char( ms, p + 1, ep, lo ) - 1;
+            if( match_class( c, lo, ms.classes ) )
+            {
+                return ret;
+            }
+            continue;
+        }
+
+        const auto next = read_char( ms, p, ep, lo );
+        if( ( *next == '-' ) && ( next + 1 < ep ) )
+        {
+            char32_t hi;
+            p = read_char( ms, next + 1, ep, hi ) - 1;
+            if( lo <= c && c <= hi )
+            {
+                return ret;
+            }
+        }
+        else
+        {
+            p = next - 1;
+            if( lo == c )
+            {
+                return ret;
+            }
+        }
+    }
+    return !ret;
+}
+
+
+template< typename MS, typename StrCharT, typename PatCharT >
+bool singlematch( const MS &ms, const StrCharT * s, const PatCharT * p, const PatCharT * ep )
+{
+    if( s < ms.s_end )
+    {
+        if( *p == '.' )
+        {
+            return true;  /* matches any char */
+        }
+
+        char32_t c;
+        read_char( ms, s, ms.s_end, c );
+
+        char32_t pc;
+        switch( *p )
+        {
+        case '%':
+            read_char( ms, p + 1, ms.p_end, pc );
+            return match_class( c, pc, ms.classes );
+
+        case '[':
+            return matchbracketclass( ms, c, p, ep - 1 );
+
+        default:
+            read_char( ms, p, ms.p_end, pc );
+            return pc == c;
+        }
+    }
+
+    return false;
+}
+
+
+template< typename MS, typename StrCharT, typename PatCharT >
+const StrCharT * matchbalance( const MS &ms, const StrCharT * s, const PatCharT * p )
+{
+    if( p >= ms.p_end )
+    {
+        throw lex_error( balanced_no_arguments );
+    }
+
+    char32_t   b;
+    char32_t   e;
+    const auto q = read_char( ms, p, ms.p_end, b );
+    read_char( ms, q, ms.p_end, e );
+
+    char32_t c;
+    if( s >= ms.s_end || ( s = read_char( ms, s, ms.s_end, c ), c != b ) )
+    {
+        return nullptr;
+    }
+    int count = 1;
+    while( s < ms.s_end )
+    {
+        s = read_char( ms, s, ms.s_end, c );
+        if( c == e )
+        {
+            if( --count == 0 )
+            {
+                return s;
+            }
+        }
+        else if( c == b )
+        {
+            ++count;
+        }
+    }
+    return nullptr;
+}
+
+
+template< typename MS, typename StrCharT, typename PatCharT >
+const StrCharT * max_expand( MS &ms, const StrCharT * s, const PatCharT * p, const PatCharT * ep )
+{
+    auto e = s;
+    while( singlematch( ms, e, p, ep ) )
+    {
+        e = skip_char( ms, e, ms.s_end );
+    }
+    /* keeps trying to match with the maximum repetitions */
+    for( ; ; )
+    {
+        if( auto res = match( ms, e, ep + 1 ) )
+        {
+            return res;
+        }
+        ms.count( &match_stats::max_backtracks );
+        if( e == s )
+        {
+            return nullptr;
+        }
+        e = previous_char( ms, s, e );
+    }
+}
+
+
+template< typename MS, typename StrCharT, typename PatCharT >
+const StrCharT * min_expand( MS &ms, const StrCharT * s, const PatCharT * p, const PatCharT * ep )
+{
+    for( ; ; )
+    {
+        if( auto res = match( ms, s, ep + 1 )  )
+        {
+            return res;
+        }
+        else if( singlematch( ms, s, p, ep ) )
+        {
+            ms.count( &match_stats::min_expansions );
+            s = skip_char( ms, s, ms.s_end );
+        }
+        else
+        {
+            return nullptr;
+        }
+    }
+}
+
+
+template< typename MS, typename StrCharT, typename PatCharT >
+auto start_capture( MS &ms, const StrCharT * s, const PatCharT * p )
+{
+    assert( s );
+
+    if constexpr( MS::skip_captures )
+    {
+        return match( ms, s, *p == ')' ? p + 1 : p );
+    }
+
+    if( ms.level >= MAXCAPTURES )
+    {
+        throw lex_error( capture_too_many );
+    }
+
+    ms.captures[ ms.level ].init = s;
+
+    if( *p == ')' )
+    {
+        ms.captures[ ms.level ].len = cap_state::position;
+        ++p;
+    }
+    else
+    {
+        ms.captures[ ms.level ].len = cap_state::unfinished;
+    }
+
+    ms.level++;
+
+    auto res = match( ms, s, p );
+    if( !res )
+    {
+        // Undo capture when the match has failed
+        --ms.level;
+        ms.captures[ ms.level ].len = cap_state::unfinished;
+    }
+    return res;
+}
+
+
+template< typename MS, typename StrCharT, typename PatCharT >
+auto end_capture( MS &ms, const StrCharT * s, const PatCharT * p )
+{
+    if constexpr( MS::skip_captures )
+    {
+        return match( ms, s, p );
+    }
+
+    int i = ms.level;
+    for( --i ; i >= 0 ; --i )
+    {
+        auto& cap = ms.captures[ i ];
+        if( cap.len == cap_state::unfinished )
+        {
+            cap.len = static_cast< long >( s - cap.init );
+
+            auto res = match( ms, s, p );
+            if( !res )
+            {
+                // Undo capture when the match has failed
+                cap.len = cap_state::unfinished ;
+            }
+            return res;
+        }
+    }
+
+    throw lex_error( capture_invalid_pattern );
+}
+
+
+template< typename MS, typename StrCharT, typename PatCharT >
+const StrCharT * match_capture( MS &ms, const StrCharT * s, PatCharT c )
+{
+    const int i = c - '1';
+
+    if( i < 0 || i >= ms.level ||
+        ms.captures[ i ].len == cap_state::unfinished  )
+    {
+        throw lex_error( capture_invalid_index );
+    }
+
+    const size_t len = ms.captures[ i ].len;
+    if( static_cast< size_t >( ms.s_end - s ) >= len &&
+        memcmp( ms.captures[ i ].init, s, len * sizeof( StrCharT ) ) == 0 )
+    {
+        return s + len;
+    }
+
+    return nullptr;
+}
+
+
+template< typename MS, typename StrCharT, typename PatCharT >
+const StrCharT * match( MS &ms, const StrCharT * s, const PatCharT * p )
+{
+    const matchdepth_sentinel mds( ms.matchdepth );
+    ms.count( &match_stats::match_calls );
+    ms.reached( ms.max_depth - ms.matchdepth );
+
+    init: /* using goto's to optimize tail recursion */
+    ms.step();
+    if( p == ms.p_end )
+    {
+        return s;
+    }
+    else
+    {
+        switch( *p )
+        {
+        case '(':  /* start capture */
+            return start_capture( ms, s, p + 1 );
+
+        case ')':  /* end capture */
+            return end_capture( ms, s, p + 1 );
+
+        case '$':
+            if( ( p + 1 ) != ms.p_end )  /* is the '$' the last char in pattern? */
+            {
+                goto dflt;  /* no; go to default */
+            }
+            if( s == ms.s_end )
+            {
+                return s;  /* check end of string */
             }
             break;
 
@@ -603,8 +1307,8 @@ const StrCharT * match( MS &ms, const StrCharT * s, const PatCharT * p )
             case 'b':  /* balanced string? */
                 if( auto res = matchbalance( ms, s, p + 2 ) )
                 {
-                    s  = res;
-                    p += 4;
+                    s = res;
+                    p = skip_char( ms, skip_char( ms, p + 2, ms.p_end ), ms.p_end );
                     goto init;  /* return match( ms, s, p + 4 ); */
                 }
                 return nullptr;
@@ -617,10 +1321,19 @@ const StrCharT * match( MS &ms, const StrCharT * s, const PatCharT * p )
                 }
                 else
                 {
-                    const PatCharT * ep = classend( ms, p );  /* points to what is next */
-                    auto previous   = ( s == ms.s_begin ) ? '\0' : *( s - 1 );
-                    if( !matchbracketclass( previous, p, ep - 1 ) &&
-                         matchbracketclass( *s, p, ep - 1 ) )
+                    const PatCharT * ep       = classend( ms, p );  /* points to what is next */
+                    char32_t         previous = 0;
+                    char32_t         current  = 0;
+                    if( s != ms.s_begin )
+                    {
+                        read_char( ms, previous_char( ms, ms.s_begin, s ), s, previous );
+                    }
+                    if( s < ms.s_end )
+                    {
+                        read_char( ms, s, ms.s_end, current );
+                    }
+                    if( !matchbracketclass( ms, previous, p, ep - 1 ) &&
+                         matchbracketclass( ms, current, p, ep - 1 ) )
                     {
                         p = ep;
                         goto init;  /* return match( ms, s, ep ); */
@@ -636,522 +1349,5734 @@ const StrCharT * match( MS &ms, const StrCharT * s, const PatCharT * p )
                     p += 2;
                     goto init;  /* return match( ms, s, p + 2 ) */
                 }
-                break;
+                return nullptr;
             }
 
-        // Fallthrough
-        default:  /* pattern class plus optional suffix */
-        dflt:
-        {
-            const PatCharT * ep = classend( ms, p );  /* points to optional suffix */
-            if( !singlematch( ms, s, p, ep ) )
-            {
-                if( *ep == '*' || *ep == '?' || *ep == '-' )  /* accept empty? */
-                {
-                    p = ep + 1;
-                    goto init;  /* return match( ms, s, ep + 1 ); */
-                }
-                /* '+' or no suffix */
-                return nullptr;
-            }
-            else  /* matched once */
-            {
-                switch( *ep )  /* handle optional suffix */
-                {
-                case '?':  /* optional */
-                    if( auto res = match( ms, s + 1, ep + 1 ) )
-                    {
-                        return res;
-                    }
-                    p = ep + 1;
-                    goto init;  /* else return match( ms, s, ep + 1 ); */
+        // Fallthrough
+        default:  /* pattern class plus optional suffix */
+        dflt:
+        {
+            const PatCharT * ep = classend( ms, p );  /* points to optional suffix */
+            if( !singlematch( ms, s, p, ep ) )
+            {
+                if( *ep == '*' || *ep == '?' || *ep == '-' )  /* accept empty? */
+                {
+                    p = ep + 1;
+                    goto init;  /* return match( ms, s, ep + 1 ); */
+                }
+                /* '+' or no suffix */
+                return nullptr;
+            }
+            else  /* matched once */
+            {
+                switch( *ep )  /* handle optional suffix */
+                {
+                case '?':  /* optional */
+                    if( auto res = match( ms, skip_char( ms, s, ms.s_end ), ep + 1 ) )
+                    {
+                        return res;
+                    }
+                    p = ep + 1;
+                    goto init;  /* else return match( ms, s, ep + 1 ); */
+
+                case '+':   /* 1 or more repetitions */
+                    s = skip_char( ms, s, ms.s_end );  /* 1 match already done */
+                    /* FALLTHROUGH */
+                case '*':   /* 0 or more repetitions */
+                    return max_expand( ms, s, p, ep );
+
+                case '-':   /* 0 or more repetitions (minimum) */
+                    return min_expand( ms, s, p, ep );
+
+                default:    /* no suffix */
+                    p = ep;
+                    s = skip_char( ms, s, ms.s_end );
+                    goto init;  /* return match( ms, s + 1, ep ); */
+                }
+            }
+            break;
+        }
+        }
+    }
+
+    return nullptr;
+}
+
+
+template< typename Result >
+void append_number( Result & str, ptrdiff_t number )
+{
+    assert( number >= 0 );
+
+    if( number > 9 )
+    {
+        append_number( str, number / 10 );
+    }
+    str.append( 1u, '0' + ( number % 10 ) );
+}
+
+template< typename CharT >
+struct string_context
+{
+    string_context( const CharT * s ) noexcept
+        : string_context( s, std::char_traits< CharT >::length( s ) )
+    {}
+
+    string_context( const CharT * s, size_t l ) noexcept
+        : begin( s )
+        , end( s + l )
+    {}
+
+    template< size_t N >
+    string_context( const CharT( & s )[ N ] ) noexcept
+        : string_context( s, N )
+    {}
+
+    template< typename Traits, typename Allocator >
+    string_context( const std::basic_string< CharT, Traits, Allocator > & s ) noexcept
+        : string_context( s.data(), s.size() )
+    {}
+
+    template< typename Traits >
+    string_context( const std::basic_string_view< CharT, Traits > & s ) noexcept
+        : string_context( s.data(), s.size() )
+    {}
+
+    const CharT * const begin = nullptr;
+    const CharT * const end   = nullptr;
+};
+
+extern template struct string_context< char >;
+extern template struct string_context< wchar_t >;
+extern template struct string_context< char16_t >;
+extern template struct string_context< char32_t >;
+
+
+template< typename CharT >
+struct pattern_context
+{
+    pattern_context( const CharT * p ) noexcept
+        : pattern_context( p, std::char_traits< CharT >::length( p ) )
+    {}
+
+    pattern_context( const CharT * p, size_t l ) noexcept
+        : end( p + l )
+        , anchor( p < end && *p == '^' )
+        , begin( anchor ? p + 1 : p )
+    {}
+
+    template< size_t N >
+    pattern_context( const CharT( & p )[ N ] ) noexcept
+        : pattern_context( p, N )
+    {}
+
+    template< typename Traits, typename Allocator >
+    pattern_context( const std::basic_string< CharT, Traits, Allocator > & s ) noexcept
+        : pattern_context( s.data(), s.size() )
+    {}
+
+    template< typename Traits >
+    pattern_context( const std::basic_string_view< CharT, Traits > & s ) noexcept
+        : pattern_context( s.data(), s.size() )
+    {}
+
+    const CharT * const end    = nullptr;
+    const bool          anchor = false;
+    const CharT * const begin  = nullptr;
+};
+
+extern template struct pattern_context< char >;
+extern template struct pattern_context< wchar_t >;
+extern template struct pattern_context< char16_t >;
+extern template struct pattern_context< char32_t >;
+
+
+/* A pattern string is converted to the char type of the input string when that type is as wide so the matcher compares chars of one type. */
+template< typename StrCharT, typename PatCharT >
+constexpr bool widens_pattern = !std::is_same< StrCharT, PatCharT >::value && sizeof( PatCharT ) <= sizeof( StrCharT );
+
+/* Returns a copy of pattern string 'pat' with the char type of the input string; the chars keep their unsigned values. */
+template< typename StrCharT, typename PatT >
+std::basic_string< StrCharT > widen_pattern( PatT && pat )
+{
+    using pat_char_type = typename string_traits< PatT >::char_type;
+
+    const pattern_context< pat_char_type > p = { pat };
+
+    std::basic_string< StrCharT > result;
+    result.reserve( p.end - p.begin + 1 );
+    for( auto c = p.anchor ? p.begin - 1 : p.begin ; c < p.end ; ++c )
+    {
+        result.push_back( static_cast< StrCharT >( static_cast< typename std::make_unsigned< pat_char_type >::type >( *c ) ) );
+    }
+    return result;
+}
+
+
+enum class item_type : unsigned char
+{
+    single,            /* single char class with an optional suffix */
+    start_capture,     /* '(' */
+    position_capture,  /* '()' */
+    end_capture,       /* ')' */
+    end_anchor,        /* '$' at the end of the pattern */
+    balance,           /* '%bxy' */
+    frontier,          /* '%f[set]' */
+    back_reference     /* '%1' - '%9' */
+};
+
+enum class quantifier : unsigned char
+{
+    one,       /* no suffix */
+    optional,  /* '?' */
+    star,      /* '*' */
+    plus,      /* '+' */
+    minus      /* '-' */
+};
+
+enum class class_type : unsigned char
+{
+    any,      /* '.' */
+    literal,  /* a single char; also the escaped chars that are not a class */
+    escape,   /* '%a', '%d', '%S', ... */
+    set       /* '[...]' */
+};
+
+template< typename CharT >
+struct pattern_item
+{
+    using char_type = typename std::make_unsigned< CharT >::type;
+
+    item_type  type          = item_type::single;
+    class_type cls           = class_type::literal;
+    quantifier quant         = quantifier::one;
+    char_type  c             = 0;  /* the literal, the class letter or the open char of '%b' */
+    char_type  c2            = 0;  /* the close char of '%b' */
+    int        capture_index = 0;  /* index of a capture or of a back-reference */
+    int        set           = 0;  /* index of the bracket set of a class, a set or a frontier */
+};
+
+
+/* The members of a set of bytes as ranges of [lo, lo + span], the form that the vector kernels compare against. */
+struct byte_ranges
+{
+    static constexpr int max_ranges = 4;
+
+    unsigned char lo[ max_ranges ]   = {};
+    unsigned char span[ max_ranges ] = {};
+    int           count              = 0;  /* 0 when the set has more than 'max_ranges' ranges */
+};
+
+/* Returns the number of chars from 's' up to 'e' that are members of the set; 'table' is the membership bitmap of the set. */
+std::size_t run_length( const byte_ranges & r, const std::uint64_t ( & table )[ 4 ], const char * s, const char * e ) noexcept;
+
+
+template< typename CharT >
+struct bracket_set
+{
+    using char_type = typename std::make_unsigned< CharT >::type;
+
+    /* Tests if a char is member of the set; one bit test for chars below 256 */
+    template< typename C >
+    bool test( C c ) const noexcept
+    {
+        if constexpr( sizeof( C ) > 1 )
+        {
+            if( c > 255 )
+            {
+                return contains( c );
+            }
+        }
+        return ( table[ c >> 6 ] >> ( c & 63 ) ) & 1u;
+    }
+
+    /* Precomputes the membership of the chars below 256 */
+    void fill_table() noexcept
+    {
+        for( unsigned c = 0 ; c < 256 ; ++c )
+        {
+            if( contains( c ) )
+            {
+                table[ c >> 6 ] |= std::uint64_t( 1 ) << ( c & 63 );
+            }
+        }
+
+        fill_byte_ranges();
+    }
+
+    /* Collects the members of the table as byte ranges when there are few enough of them */
+    void fill_byte_ranges() noexcept
+    {
+        runs.count = 0;
+        for( unsigned c = 0 ; c < 256 ; )
+        {
+            if( !test( c ) )
+            {
+                ++c;
+                continue;
+            }
+            if( runs.count == byte_ranges::max_ranges )
+            {
+                runs.count = 0;
+                return;
+            }
+            const auto lo = c;
+            while( c < 256 && test( c ) )
+            {
+                ++c;
+            }
+            runs.lo[ runs.count ]   = static_cast< unsigned char >( lo );
+            runs.span[ runs.count ] = static_cast< unsigned char >( c - 1 - lo );
+            ++runs.count;
+        }
+    }
+
+    template< typename C >
+    bool contains( C c ) const noexcept
+    {
+        for( const auto &r : ranges )
+        {
+            if( r.first <= c && c <= r.second )
+            {
+                return !negated;
+            }
+        }
+        for( const auto cl : classes )
+        {
+            if( match_class( c, cl, mode ) )
+            {
+                return !negated;
+            }
+        }
+        return negated;
+    }
+
+    std::uint64_t                                    table[ 4 ] = {};     /* membership bitmap of the chars below 256 */
+    byte_ranges                                      runs;                /* the members of 'table' for the vector kernels */
+    bool                                             negated    = false;
+    class_mode                                       mode       = class_mode::locale;  /* the definition of the classes */
+    std::vector< std::pair< char_type, char_type > > ranges;   /* single chars are stored as a range of one char */
+    std::vector< char_type >                         classes;  /* the letters of the '%x' classes */
+};
+
+
+template< typename CharT >
+constexpr bool is_class( CharT cl ) noexcept
+{
+    switch( cl )
+    {
+    case 'a': case 'c': case 'd': case 'g': case 'l': case 'p':
+    case 's': case 'u': case 'w': case 'x': case 'z':
+    case 'A': case 'C': case 'D': case 'G': case 'L': case 'P':
+    case 'S': case 'U': case 'W': case 'X': case 'Z':
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+
+template< typename CharT >
+const CharT * compile_classend( const CharT * p, const CharT * p_end )
+{
+    switch( *p++ )
+    {
+    case '%':
+        if( p == p_end )
+        {
+            throw lex_error( pattern_ends_with_percent );
+        }
+        return p + 1;
+
+    case '[':
+        if( p < p_end && *p == '^' )
+        {
+            ++p;
+        }
+        do  /* look for a ']' */
+        {
+            if( p == p_end )
+            {
+                throw lex_error( pattern_missing_closing_bracket );
+            }
+            if( *p++ == '%' && p < p_end )
+            {
+                ++p;  /* skip escapes (e.g. '%]') */
+            }
+        } while( p == p_end || *p != ']' );
+
+        return p + 1;
+
+    default:
+        return p;
+    }
+}
+
+
+template< typename CharT >
+bracket_set< CharT > compile_set( const CharT * p, const CharT * ep, class_mode classes )
+{
+    using char_type = typename bracket_set< CharT >::char_type;
+
+    bracket_set< CharT > set;
+    set.mode = classes;
+    if( *( p + 1 ) == '^' )
+    {
+        set.negated = true;
+        p++;  /* skip the '^' */
+    }
+    while( ++p < ep )
+    {
+        if( *p == '%' )
+        {
+            p++;
+            if( is_class( *p ) )
+            {
+                set.classes.push_back( static_cast< char_type >( *p ) );
+            }
+            else
+            {
+                set.ranges.emplace_back( static_cast< char_type >( *p ), static_cast< char_type >( *p ) );
+            }
+        }
+        else if( ( *( p + 1 ) == '-' ) && ( p + 2 < ep ) )
+        {
+            p += 2;
+            set.ranges.emplace_back( static_cast< char_type >( *( p - 2 ) ), static_cast< char_type >( *p ) );
+        }
+        else
+        {
+            set.ranges.emplace_back( static_cast< char_type >( *p ), static_cast< char_type >( *p ) );
+        }
+    }
+    set.fill_table();
+    return set;
+}
+
+
+template< typename CharT >
+bracket_set< CharT > compile_class( CharT cl, class_mode classes )
+{
+    bracket_set< CharT > set;
+    set.mode = classes;
+    set.classes.push_back( static_cast< typename bracket_set< CharT >::char_type >( cl ) );
+    set.fill_table();
+    return set;
+}
+
+
+/* Decodes a pattern in items and bracket sets, returns the number of captures of the pattern. */
+template< typename CharT >
+int compile( const pattern_context< CharT > & pc, std::vector< pattern_item< CharT > > & items, std::vector< bracket_set< CharT > > & sets,
+             class_mode classes = class_mode::locale )
+{
+    using char_type = typename pattern_item< CharT >::char_type;
+
+    bool finished[ MAXCAPTURES ] = {};
+    int  level                   = 0;
+
+    const CharT * p = pc.begin;
+    while( p < pc.end )
+    {
+        pattern_item< CharT > item;
+
+        switch( *p )
+        {
+        case '(':  /* start capture */
+            if( level >= MAXCAPTURES )
+            {
+                throw lex_error( capture_too_many );
+            }
+            item.capture_index = level;
+            if( p + 1 < pc.end && *( p + 1 ) == ')' )
+            {
+                item.type         = item_type::position_capture;
+                finished[ level ] = true;
+                p += 2;
+            }
+            else
+            {
+                item.type         = item_type::start_capture;
+                finished[ level ] = false;
+                ++p;
+            }
+            ++level;
+            items.push_back( item );
+            continue;
+
+        case ')':  /* end capture */
+            item.capture_index = level - 1;
+            while( item.capture_index >= 0 && finished[ item.capture_index ] )
+            {
+                --item.capture_index;
+            }
+            if( item.capture_index < 0 )
+            {
+                throw lex_error( capture_invalid_pattern );
+            }
+            item.type                      = item_type::end_capture;
+            finished[ item.capture_index ] = true;
+            ++p;
+            items.push_back( item );
+            continue;
+
+        case '$':
+            if( p + 1 == pc.end )  /* is the '$' the last char in pattern? */
+            {
+                item.type = item_type::end_anchor;
+                ++p;
+                items.push_back( item );
+                continue;
+            }
+            break;
+
+        case '%':  /* escaped sequences not in the format class[*+?-]? */
+            if( p + 1 == pc.end )
+            {
+                throw lex_error( pattern_ends_with_percent );
+            }
+            switch( *( p + 1 ) )
+            {
+            case 'b':  /* balanced string? */
+                if( p + 3 >= pc.end )
+                {
+                    throw lex_error( balanced_no_arguments );
+                }
+                item.type = item_type::balance;
+                item.c    = static_cast< char_type >( *( p + 2 ) );
+                item.c2   = static_cast< char_type >( *( p + 3 ) );
+                p += 4;
+                items.push_back( item );
+                continue;
+
+            case 'f':  /* frontier? */
+                p += 2;
+                if( p == pc.end || *p != '[' )
+                {
+                    throw lex_error( frontier_no_open_bracket );
+                }
+                else
+                {
+                    const CharT * ep = compile_classend( p, pc.end );
+                    item.type = item_type::frontier;
+                    item.set  = static_cast< int >( sets.size() );
+                    sets.push_back( compile_set( p, ep - 1, classes ) );
+                    p = ep;
+                }
+                items.push_back( item );
+                continue;
+
+            case '0': case '1': case '2': case '3': case '4':
+            case '5': case '6': case '7': case '8': case '9':  /* capture results (%0-%9)? */
+                item.type          = item_type::back_reference;
+                item.capture_index = static_cast< int >( *( p + 1 ) ) - '1';
+                if( item.capture_index < 0 || item.capture_index >= level || !finished[ item.capture_index ] )
+                {
+                    throw lex_error( capture_invalid_index );
+                }
+                p += 2;
+                items.push_back( item );
+                continue;
+            }
+            break;
+        }
+
+        /* pattern class plus optional suffix */
+        const CharT * ep = compile_classend( p, pc.end );
+        switch( *p )
+        {
+        case '.':
+            item.cls = class_type::any;
+            break;
+
+        case '%':
+            item.c = static_cast< char_type >( *( p + 1 ) );
+            if( is_class( *( p + 1 ) ) )
+            {
+                item.cls = class_type::escape;
+                item.set = static_cast< int >( sets.size() );
+                sets.push_back( compile_class( *( p + 1 ), classes ) );
+            }
+            break;
+
+        case '[':
+            item.cls = class_type::set;
+            item.set = static_cast< int >( sets.size() );
+            sets.push_back( compile_set( p, ep - 1, classes ) );
+            break;
+
+        default:
+            item.c = static_cast< char_type >( *p );
+            break;
+        }
+
+        p = ep;
+        if( p < pc.end )
+        {
+            switch( *p )
+            {
+            case '?': item.quant = quantifier::optional; ++p; break;
+            case '*': item.quant = quantifier::star;     ++p; break;
+            case '+': item.quant = quantifier::plus;     ++p; break;
+            case '-': item.quant = quantifier::minus;    ++p; break;
+            }
+        }
+        items.push_back( item );
+    }
+
+    if( std::find( finished, finished + level, false ) != finished + level )
+    {
+        throw lex_error( capture_not_finished );
+    }
+
+    return level;
+}
+
+
+enum class prefilter_type : unsigned char
+{
+    none,     /* a match can start at every position */
+    literal,  /* every match starts with the prefix */
+    set       /* the first char of every match is a member of the set */
+};
+
+/* Describes where a match can start so the search loops can skip the positions where the matcher fails on the first item. */
+template< typename CharT >
+struct prefilter
+{
+    prefilter_type             type       = prefilter_type::none;
+    bool                       at_end     = false;  /* a match can also start at the end of the input string */
+    std::size_t                min_length = 0;      /* the minimum number of chars of a match */
+    std::ptrdiff_t             end_window = -1;     /* the maximum length of a match of a pattern anchored at the end; -1 for no bound */
+    std::basic_string< CharT > prefix;
+    bracket_set< CharT >       first;
+};
+
+
+template< typename CharT >
+std::ptrdiff_t max_length( const std::vector< pattern_item< CharT > > & items );
+
+template< typename CharT >
+std::size_t min_length( const std::vector< pattern_item< CharT > > & items );
+
+
+/* Analyses the items of a compiled pattern for a required literal prefix or the set of the first char. */
+template< typename CharT >
+prefilter< CharT > analyse_prefix( const std::vector< pattern_item< CharT > > & items, const std::vector< bracket_set< CharT > > & sets )
+{
+    prefilter< CharT > f;
+
+    for( const auto &item : items )
+    {
+        if( item.type == item_type::start_capture || item.type == item_type::position_capture || item.type == item_type::end_capture )
+        {
+            continue;  /* captures don't consume chars */
+        }
+
+        const bool required = item.quant == quantifier::one || item.quant == quantifier::plus;
+
+        if( item.type == item_type::single && item.cls == class_type::literal && required )
+        {
+            f.prefix.push_back( static_cast< CharT >( item.c ) );
+            if( item.quant == quantifier::one )
+            {
+                continue;
+            }
+        }
+        else if( f.prefix.empty() )
+        {
+            if( item.type == item_type::single && ( item.cls == class_type::escape || item.cls == class_type::set ) && required )
+            {
+                f.type  = prefilter_type::set;
+                f.first = sets[ item.set ];
+            }
+            else if( item.type == item_type::balance )
+            {
+                f.prefix.push_back( static_cast< CharT >( item.c ) );
+            }
+            else if( item.type == item_type::frontier )
+            {
+                f.type   = prefilter_type::set;
+                f.first  = sets[ item.set ];
+                f.at_end = f.first.test( 0u );
+            }
+        }
+        break;
+    }
+
+    if( !f.prefix.empty() )
+    {
+        f.type = prefilter_type::literal;
+    }
+
+    f.min_length = min_length( items );
+    if( !items.empty() && items.back().type == item_type::end_anchor )
+    {
+        f.end_window = max_length( items );
+    }
+
+    return f;
+}
+
+
+/* Returns the maximum length of a match of a compiled pattern or -1 when the length is unbounded. */
+template< typename CharT >
+std::ptrdiff_t max_length( const std::vector< pattern_item< CharT > > & items )
+{
+    std::ptrdiff_t length = 0;
+    std::ptrdiff_t started[ MAXCAPTURES ];
+    std::ptrdiff_t captured[ MAXCAPTURES ];
+
+    for( const auto &item : items )
+    {
+        switch( item.type )
+        {
+        case item_type::single:
+            if( item.quant != quantifier::one && item.quant != quantifier::optional )
+            {
+                return -1;
+            }
+            ++length;
+            break;
+
+        case item_type::start_capture:
+            started[ item.capture_index ] = length;
+            break;
+
+        case item_type::end_capture:
+            captured[ item.capture_index ] = length - started[ item.capture_index ];
+            break;
+
+        case item_type::position_capture:
+            captured[ item.capture_index ] = -1;  /* a back-reference to a position capture isn't a string */
+            break;
+
+        case item_type::back_reference:
+            if( captured[ item.capture_index ] < 0 )
+            {
+                return -1;
+            }
+            length += captured[ item.capture_index ];
+            break;
+
+        case item_type::balance:
+            return -1;
+
+        case item_type::end_anchor:
+        case item_type::frontier:
+            break;
+        }
+    }
+
+    return length;
+}
+
+/* Returns the minimum length of a match of a compiled pattern. */
+template< typename CharT >
+std::size_t min_length( const std::vector< pattern_item< CharT > > & items )
+{
+    std::size_t length = 0;
+    std::size_t started[ MAXCAPTURES ];
+    std::size_t captured[ MAXCAPTURES ];
+
+    for( const auto &item : items )
+    {
+        switch( item.type )
+        {
+        case item_type::single:
+            if( item.quant == quantifier::one || item.quant == quantifier::plus )
+            {
+                ++length;
+            }
+            break;
+
+        case item_type::start_capture:
+            started[ item.capture_index ] = length;
+            break;
+
+        case item_type::end_capture:
+            captured[ item.capture_index ] = length - started[ item.capture_index ];
+            break;
+
+        case item_type::position_capture:
+            captured[ item.capture_index ] = 0;
+            break;
+
+        case item_type::back_reference:
+            length += captured[ item.capture_index ];
+            break;
+
+        case item_type::balance:
+            length += 2;
+            break;
+
+        case item_type::end_anchor:
+        case item_type::frontier:
+            break;
+        }
+    }
+
+    return length;
+}
+
+
+/* The operations of the threaded code of a compiled pattern; one operation per item, specialized on the class and the suffix of a single char item */
+enum class threaded_code : unsigned char
+{
+    literal_one, literal_optional, literal_star, literal_plus, literal_minus,
+    any_one,     any_optional,     any_star,     any_plus,     any_minus,
+    set_one,     set_optional,     set_star,     set_plus,     set_minus,
+    start_capture,
+    position_capture,
+    end_capture,
+    end_anchor,
+    frontier,
+    match  /* the end of the pattern */
+};
+
+/* Lowers the items of a compiled pattern to threaded code; returns no code when the pattern has a balance or a back-reference. */
+template< typename CharT >
+std::vector< threaded_code > lower_threaded( const std::vector< pattern_item< CharT > > & items )
+{
+    std::vector< threaded_code > code;
+    code.reserve( items.size() + 1 );
+    for( const auto &item : items )
+    {
+        switch( item.type )
+        {
+        case item_type::start_capture:    code.push_back( threaded_code::start_capture );    break;
+        case item_type::position_capture: code.push_back( threaded_code::position_capture ); break;
+        case item_type::end_capture:      code.push_back( threaded_code::end_capture );      break;
+        case item_type::end_anchor:       code.push_back( threaded_code::end_anchor );       break;
+        case item_type::frontier:         code.push_back( threaded_code::frontier );         break;
+
+        case item_type::balance:
+        case item_type::back_reference:
+            return {};  /* left to the interpreter */
+
+        case item_type::single:
+        {
+            const auto base = item.cls == class_type::literal ? threaded_code::literal_one :
+                              item.cls == class_type::any     ? threaded_code::any_one : threaded_code::set_one;
+            code.push_back( static_cast< threaded_code >( static_cast< int >( base ) + static_cast< int >( item.quant ) ) );
+            break;
+        }
+        }
+    }
+    code.push_back( threaded_code::match );
+
+    return code;
+}
+
+/* The prefilter of a pattern that is not compiled; a literal first char when the first item is a char without an optional suffix.
+ * The multibyte chars of a pattern in UTF-8 mode are not analysed. */
+template< typename CharT >
+prefilter< CharT > analyse_prefix( const pattern_context< CharT > & pc, bool utf8 = false )
+{
+    prefilter< CharT > f;
+
+    auto p = pc.begin;
+    while( p < pc.end && *p == '(' )
+    {
+        ++p;  /* skip the start of captures */
+    }
+    if( utf8 && p < pc.end && static_cast< typename std::make_unsigned< CharT >::type >( *p ) >= 0x80 )
+    {
+        return f;
+    }
+    if( p < pc.end && p + 1 < pc.end && *( p + 1 ) != '*' && *( p + 1 ) != '?' && *( p + 1 ) != '-' )
+    {
+        switch( *p )
+        {
+        case '(': case ')': case '%': case '[': case '.': case '$':
+            break;
+
+        default:
+            f.type = prefilter_type::literal;
+            f.prefix.push_back( *p );
+        }
+    }
+    else if( p + 1 == pc.end && *p != ')' && *p != '%' && *p != '[' && *p != '.' && *p != '$' )
+    {
+        f.type = prefilter_type::literal;
+        f.prefix.push_back( *p );
+    }
+
+    return f;
+}
+
+
+/* Returns the first position from 's' where the first item of a match can start or nullptr when there are no such positions left. */
+template< typename StrCharT, typename CharT >
+const StrCharT * first_candidate( const prefilter< CharT > & f, const StrCharT * s, const StrCharT * s_end )
+{
+    using unsigned_str_char_type = typename std::make_unsigned< StrCharT >::type;
+    using unsigned_pat_char_type = typename std::make_unsigned< CharT >::type;
+
+    switch( f.type )
+    {
+    case prefilter_type::none:
+        return s;
+
+    case prefilter_type::literal:
+        if constexpr( std::is_same< StrCharT, CharT >::value )
+        {
+            const auto pos = std::basic_string_view< StrCharT >( s, s_end - s ).find( f.prefix.data(), 0, f.prefix.size() );
+            return pos == std::basic_string_view< StrCharT >::npos ? nullptr : s + pos;
+        }
+        else
+        {
+            const auto c = static_cast< unsigned_pat_char_type >( f.prefix.front() );
+            const auto r = std::find_if( s, s_end, [ c ]( StrCharT x ){ return static_cast< unsigned_str_char_type >( x ) == c; } );
+            return r == s_end ? nullptr : r;
+        }
+
+    case prefilter_type::set:
+        for( ; s < s_end ; ++s )
+        {
+            if( f.first.test( static_cast< unsigned_str_char_type >( *s ) ) )
+            {
+                return s;
+            }
+        }
+        return f.at_end ? s_end : nullptr;
+    }
+
+    return s;
+}
+
+/* Tests if a match can start at 's' by the length of the rest of the input string. */
+template< typename StrCharT, typename CharT >
+bool in_bounds( const prefilter< CharT > & f, const StrCharT * s, const StrCharT * s_end ) noexcept
+{
+    const auto rest = s_end - s;
+    return rest >= static_cast< std::ptrdiff_t >( f.min_length ) && ( f.end_window < 0 || rest <= f.end_window );
+}
+
+/* Returns the first position from 's' where a match can start or nullptr when there are no such positions left. */
+template< typename StrCharT, typename CharT >
+const StrCharT * next_candidate( const prefilter< CharT > & f, const StrCharT * s, const StrCharT * s_end )
+{
+    if( f.end_window >= 0 && s_end - s > f.end_window )
+    {
+        s = s_end - f.end_window;  /* a match of a pattern anchored at the end starts at most its maximum length before the end */
+    }
+    if( s_end - s < static_cast< std::ptrdiff_t >( f.min_length ) )
+    {
+        return nullptr;
+    }
+
+    const auto r = first_candidate( f, s, s_end );
+    return r && s_end - r >= static_cast< std::ptrdiff_t >( f.min_length ) ? r : nullptr;
+}
+
+
+template< typename StrCharT, typename PatCharT, typename MR >
+struct compiled_match_state : match_state< StrCharT, pattern_item< PatCharT >, MR >
+{
+    compiled_match_state( const StrCharT * str_begin, const StrCharT * str_end, const basic_pattern< PatCharT > & pat, MR &mr,
+                          const match_options & opts = {} )
+        : match_state< StrCharT, pattern_item< PatCharT >, MR >( str_begin, str_end, pat.items.data(), pat.items.data() + pat.items.size(), mr, opts )
+        , sets( pat.sets.data() )
+        , filter( pat.filter )
+        , code( opts.threaded && !opts.memoize && !pat.code.empty() ? pat.code.data() : nullptr )
+        , stack( opts.iterative || code ? &( opts.stack ? *opts.stack : thread_backtrack_stack() ).frames : nullptr )
+    {
+        if( opts.memoize && !pat.back_references )
+        {
+            auto &shared = opts.memo ? *opts.memo : thread_memo_table();
+            memo         = shared.in_use ? &own : &shared;  /* a memoized match in a replacement function of a memoized match */
+            memo->in_use = true;
+
+            positions        = ( str_end - str_begin ) + 1;
+            const auto words = ( pat.items.size() * positions + 63 ) / 64;
+            if( memo->visited.size() < words )
+            {
+                memo->visited.resize( words );
+            }
+        }
+    }
+
+    compiled_match_state( const compiled_match_state & ) = delete;
+    compiled_match_state & operator =( const compiled_match_state & ) = delete;
+
+    /* Leaves the table cleared for the next match */
+    ~compiled_match_state()
+    {
+        if( memo )
+        {
+            forget();
+            memo->in_use = false;
+        }
+    }
+
+    void check_captures() const noexcept
+    {
+        // The captures of a compiled pattern are checked when the pattern was compiled.
+    }
+
+    /*
+     * Marks the state of item 'p' at position 's' as visited and returns false when it was visited before.
+     * A visited state has failed; a match that succeeds ends the search, so the states of a successful match are forgotten.
+     * The outcome of a state depends only on the item and the position when the pattern has no back-references.
+     */
+    bool visit( const pattern_item< PatCharT > * p, const StrCharT * s )
+    {
+        if( !memo )
+        {
+            return true;
+        }
+
+        const auto i    = static_cast< std::size_t >( ( p - this->p_begin ) * positions + ( s - this->s_begin ) );
+        auto &     word = memo->visited[ i / 64 ];
+        const auto bit  = std::uint64_t( 1 ) << ( i % 64 );
+        if( word & bit )
+        {
+            return false;
+        }
+        if( !word )
+        {
+            memo->touched.push_back( i / 64 );
+        }
+        word |= bit;
+        return true;
+    }
+
+    /* Clears the visited states after a successful match */
+    void forget() noexcept
+    {
+        if( !memo )
+        {
+            return;
+        }
+        for( const auto w : memo->touched )
+        {
+            memo->visited[ w ] = 0;
+        }
+        memo->touched.clear();
+    }
+
+    const bracket_set< PatCharT > * const          sets;
+    const prefilter< PatCharT > &                  filter;
+    const threaded_code * const                    code;   /* the threaded code of the pattern; nullptr selects the interpreters */
+    std::vector< backtrack_frame > * const         stack;  /* the stack of the non-recursive matcher; nullptr selects the recursive matcher */
+    std::ptrdiff_t                                 positions = 0;
+    memo_table *                                   memo      = nullptr;  /* the table of the visited states when memoizing */
+    memo_table                                     own;                  /* the table when the shared table is in use */
+};
+
+
+template< typename MS, typename StrCharT, typename PatCharT >
+bool singlematch( const MS &ms, const StrCharT * s, const pattern_item< PatCharT > * p )
+{
+    if( s < ms.s_end )
+    {
+        using unsigned_str_char_type = typename std::make_unsigned< StrCharT >::type;
+
+        const auto c = static_cast< unsigned_str_char_type >( *s );
+
+        switch( p->cls )
+        {
+        case class_type::any:
+            return true;  /* matches any char */
+
+        case class_type::literal:
+            return p->c == c;
+
+        case class_type::escape:
+        case class_type::set:
+            return ms.sets[ p->set ].test( c );
+        }
+    }
+
+    return false;
+}
+
+
+template< typename MS, typename StrCharT, typename PatCharT >
+const StrCharT * matchbalance( const MS &ms, const StrCharT * s, const pattern_item< PatCharT > * p )
+{
+    using unsigned_str_char_type = typename std::make_unsigned< StrCharT >::type;
+
+    if( s >= ms.s_end || static_cast< unsigned_str_char_type >( *s ) != p->c )
+    {
+        return nullptr;
+    }
+
+    int count = 1;
+    while( ++s < ms.s_end )
+    {
+        const auto c = static_cast< unsigned_str_char_type >( *s );
+        if( c == p->c2 )
+        {
+            if( --count == 0 )
+            {
+                return s + 1;
+            }
+        }
+        else if( c == p->c )
+        {
+            ++count;
+        }
+    }
+    return nullptr;
+}
+
+
+template< typename MS, typename StrCharT, typename PatCharT >
+bool matchfrontier( const MS &ms, const StrCharT * s, const pattern_item< PatCharT > * p )
+{
+    using unsigned_str_char_type = typename std::make_unsigned< StrCharT >::type;
+
+    const auto previous = static_cast< unsigned_str_char_type >( ( s == ms.s_begin ) ? StrCharT( 0 ) : *( s - 1 ) );
+    const auto current  = static_cast< unsigned_str_char_type >( ( s < ms.s_end ) ? *s : StrCharT( 0 ) );
+    const auto & set    = ms.sets[ p->set ];
+
+    return !set.test( previous ) && set.test( current );
+}
+
+
+/* Returns the number of chars from 's' that match the single item 'p'. */
+template< typename MS, typename PatCharT >
+ptrdiff_t run_length( const MS &ms, const char * s, const pattern_item< PatCharT > * p ) noexcept
+{
+    if( p->cls == class_type::any )
+    {
+        return ms.s_end - s;
+    }
+
+    /* Most runs are short; the first chars are counted inline before the vector kernel takes over */
+    constexpr ptrdiff_t inline_run = 16;
+
+    const auto n = std::min( ms.s_end - s, inline_run );
+    for( ptrdiff_t i = 0 ; i < n ; ++i )
+    {
+        if( !singlematch( ms, s + i, p ) )
+        {
+            return i;
+        }
+    }
+    if( n < inline_run )
+    {
+        return n;
+    }
+
+    if( p->cls == class_type::literal )
+    {
+        byte_ranges   r;
+        std::uint64_t table[ 4 ] = {};
+        r.lo[ 0 ]             = static_cast< unsigned char >( p->c );
+        r.count               = 1;
+        table[ p->c >> 6 ]   |= std::uint64_t( 1 ) << ( p->c & 63 );  /* p->c is below 256 since it matched a char */
+        return n + run_length( r, table, s + n, ms.s_end );
+    }
+
+    const auto &set = ms.sets[ p->set ];
+    return n + run_length( set.runs, set.table, s + n, ms.s_end );
+}
+
+
+template< typename MS, typename StrCharT, typename PatCharT >
+const StrCharT * max_expand( MS &ms, const StrCharT * s, const pattern_item< PatCharT > * p )
+{
+    ptrdiff_t i = 0;
+    if constexpr( std::is_same< StrCharT, char >::value )
+    {
+        i = run_length( ms, s, p );
+    }
+    else
+    {
+        while( singlematch( ms, s + i, p ) )
+        {
+            ++i;
+        }
+    }
+    /* keeps trying to match with the maximum repetitions */
+    while( i >= 0 )
+    {
+        if( auto res = match( ms, s + i, p + 1 ) )
+        {
+            return res;
+        }
+        ms.count( &match_stats::max_backtracks );
+        --i;
+    }
+
+    return nullptr;
+}
+
+
+template< typename MS, typename StrCharT, typename PatCharT >
+const StrCharT * min_expand( MS &ms, const StrCharT * s, const pattern_item< PatCharT > * p )
+{
+    for( ; ; )
+    {
+        if( auto res = match( ms, s, p + 1 ) )
+        {
+            return res;
+        }
+        else if( singlematch( ms, s, p ) )
+        {
+            ms.count( &match_stats::min_expansions );
+            ++s;
+        }
+        else
+        {
+            return nullptr;
+        }
+    }
+}
+
+
+template< typename MS, typename StrCharT, typename PatCharT >
+const StrCharT * start_capture( MS &ms, const StrCharT * s, const pattern_item< PatCharT > * p, long what )
+{
+    assert( s );
+
+    if constexpr( MS::skip_captures )
+    {
+        return match( ms, s, p + 1 );
+    }
+
+    assert( ms.level == p->capture_index );
+
+    ms.captures[ ms.level ].init = s;
+    ms.captures[ ms.level ].len  = what;
+    ms.level++;
+
+    auto res = match( ms, s, p + 1 );
+    if( !res )
+    {
+        // Undo capture when the match has failed
+        --ms.level;
+        ms.captures[ ms.level ].len = cap_state::unfinished;
+    }
+    return res;
+}
+
+
+template< typename MS, typename StrCharT, typename PatCharT >
+const StrCharT * end_capture( MS &ms, const StrCharT * s, const pattern_item< PatCharT > * p )
+{
+    if constexpr( MS::skip_captures )
+    {
+        return match( ms, s, p + 1 );
+    }
+
+    auto& cap = ms.captures[ p->capture_index ];
+    assert( cap.len == cap_state::unfinished );
+
+    cap.len = static_cast< long >( s - cap.init );
+
+    auto res = match( ms, s, p + 1 );
+    if( !res )
+    {
+        // Undo capture when the match has failed
+        cap.len = cap_state::unfinished;
+    }
+    return res;
+}
+
+
+template< typename MS, typename StrCharT, typename PatCharT >
+const StrCharT * match_capture( MS &ms, const StrCharT * s, const pattern_item< PatCharT > * p )
+{
+    const auto & cap = ms.captures[ p->capture_index ];
+    assert( cap.len != cap_state::unfinished );
+
+    const size_t len = cap.len;
+    if( static_cast< size_t >( ms.s_end - s ) >= len &&
+        memcmp( cap.init, s, len * sizeof( StrCharT ) ) == 0 )
+    {
+        return s + len;
+    }
+
+    return nullptr;
+}
+
+
+template< typename MS, typename StrCharT, typename PatCharT >
+const StrCharT * match( MS &ms, const StrCharT * s, const pattern_item< PatCharT > * p )
+{
+    const matchdepth_sentinel mds( ms.matchdepth );
+    ms.count( &match_stats::match_calls );
+    ms.reached( ms.max_depth - ms.matchdepth );
+
+    init: /* using goto's to optimize tail recursion */
+    ms.step();
+    if( p == ms.p_end )
+    {
+        return s;
+    }
+    if( !ms.visit( p, s ) )
+    {
+        return nullptr;  /* failed before from this state */
+    }
+
+    switch( p->type )
+    {
+    case item_type::start_capture:
+        return start_capture( ms, s, p, cap_state::unfinished );
+
+    case item_type::position_capture:
+        return start_capture( ms, s, p, cap_state::position );
+
+    case item_type::end_capture:
+        return end_capture( ms, s, p );
+
+    case item_type::end_anchor:
+        return ( s == ms.s_end ) ? s : nullptr;  /* check end of string */
+
+    case item_type::balance:
+        if( auto res = matchbalance( ms, s, p ) )
+        {
+            s = res;
+            ++p;
+            goto init;  /* return match( ms, s, p + 1 ); */
+        }
+        return nullptr;
+
+    case item_type::frontier:
+        if( matchfrontier( ms, s, p ) )
+        {
+            ++p;
+            goto init;  /* return match( ms, s, p + 1 ); */
+        }
+        return nullptr;
+
+    case item_type::back_reference:
+        if( auto res = match_capture( ms, s, p ) )
+        {
+            s = res;
+            ++p;
+            goto init;  /* return match( ms, s, p + 1 ); */
+        }
+        return nullptr;
+
+    case item_type::single:
+        if( !singlematch( ms, s, p ) )
+        {
+            if( p->quant == quantifier::star || p->quant == quantifier::optional || p->quant == quantifier::minus )  /* accept empty? */
+            {
+                ++p;
+                goto init;  /* return match( ms, s, p + 1 ); */
+            }
+            /* '+' or no suffix */
+            return nullptr;
+        }
+
+        switch( p->quant )  /* matched once; handle optional suffix */
+        {
+        case quantifier::optional:
+            if( auto res = match( ms, s + 1, p + 1 ) )
+            {
+                return res;
+            }
+            ++p;
+            goto init;  /* else return match( ms, s, p + 1 ); */
+
+        case quantifier::plus:  /* 1 or more repetitions */
+            ++s;                /* 1 match already done */
+            /* FALLTHROUGH */
+        case quantifier::star:  /* 0 or more repetitions */
+            return max_expand( ms, s, p );
+
+        case quantifier::minus:  /* 0 or more repetitions (minimum) */
+            return min_expand( ms, s, p );
+
+        case quantifier::one:  /* no suffix */
+            ++s;
+            ++p;
+            goto init;  /* return match( ms, s + 1, p + 1 ); */
+        }
+    }
+
+    return nullptr;
+}
+
+
+/* Resumes at the last backtrack point above 'base' and undoes the captures on the way; returns false when there are no backtrack points left. */
+template< typename MS, typename StrCharT, typename PatCharT >
+bool backtrack( MS &ms, std::size_t base, const StrCharT * & s, const pattern_item< PatCharT > * & p )
+{
+    auto &stack = *ms.stack;
+    while( stack.size() > base )
+    {
+        auto &     f    = stack.back();
+        const auto item = ms.p_begin + f.item;
+        const auto pos  = ms.s_begin + f.pos;
+
+        switch( f.type )
+        {
+        case frame_type::undo_start_capture:
+            --ms.level;
+            ms.captures[ ms.level ].len = cap_state::unfinished;
+            break;
+
+        case frame_type::undo_end_capture:
+            ms.captures[ item->capture_index ].len = cap_state::unfinished;
+            break;
+
+        case frame_type::optional:
+            stack.pop_back();
+            s = pos;
+            p = item + 1;
+            return true;
+
+        case frame_type::max_expand:
+            ms.count( &match_stats::max_backtracks );
+            if( f.count > 0 )
+            {
+                --f.count;
+                s = pos + f.count;
+                p = item + 1;
+                return true;
+            }
+            break;
+
+        case frame_type::min_expand:
+            if( singlematch( ms, pos, item ) )
+            {
+                ms.count( &match_stats::min_expansions );
+                ++f.pos;
+                s = pos + 1;
+                p = item + 1;
+                return true;
+            }
+            break;
+        }
+        stack.pop_back();
+    }
+
+    return false;
+}
+
+
+/* The non-recursive version of 'match'; the backtrack points and the undo actions of captures are kept on the stack of the match state. */
+template< typename MS, typename StrCharT, typename PatCharT >
+const StrCharT * match_iterative( MS &ms, const StrCharT * s, const pattern_item< PatCharT > * p )
+{
+    auto &     stack = *ms.stack;
+    const auto base  = stack.size();
+
+    const auto push = [ & ]( frame_type type, const StrCharT * pos, std::ptrdiff_t count )
+    {
+        stack.push_back( { type, p - ms.p_begin, pos - ms.s_begin, count } );
+        ms.reached( stack.size() - base );
+    };
+
+    for( ; ; )
+    {
+        ms.step();
+        if( p == ms.p_end )
+        {
+            stack.resize( base );
+            return s;
+        }
+
+        if( !ms.visit( p, s ) )
+        {
+            if( !backtrack( ms, base, s, p ) )
+            {
+                return nullptr;
+            }
+            continue;  /* failed before from this state */
+        }
+
+        switch( p->type )
+        {
+        case item_type::start_capture:
+        case item_type::position_capture:
+            if constexpr( MS::skip_captures )
+            {
+                ++p;
+                continue;
+            }
+            assert( ms.level == p->capture_index );
+            ms.captures[ ms.level ].init = s;
+            ms.captures[ ms.level ].len  = p->type == item_type::start_capture ? cap_state::unfinished : cap_state::position;
+            ms.level++;
+            push( frame_type::undo_start_capture, s, 0 );
+            ++p;
+            continue;
+
+        case item_type::end_capture:
+            if constexpr( MS::skip_captures )
+            {
+                ++p;
+                continue;
+            }
+            assert( ms.captures[ p->capture_index ].len == cap_state::unfinished );
+            ms.captures[ p->capture_index ].len = static_cast< long >( s - ms.captures[ p->capture_index ].init );
+            push( frame_type::undo_end_capture, s, 0 );
+            ++p;
+            continue;
+
+        case item_type::end_anchor:
+            if( s == ms.s_end )  /* check end of string */
+            {
+                ++p;
+                continue;
+            }
+            break;
+
+        case item_type::balance:
+            if( auto res = matchbalance( ms, s, p ) )
+            {
+                s = res;
+                ++p;
+                continue;
+            }
+            break;
+
+        case item_type::frontier:
+            if( matchfrontier( ms, s, p ) )
+            {
+                ++p;
+                continue;
+            }
+            break;
+
+        case item_type::back_reference:
+            if( auto res = match_capture( ms, s, p ) )
+            {
+                s = res;
+                ++p;
+                continue;
+            }
+            break;
+
+        case item_type::single:
+            if( !singlematch( ms, s, p ) )
+            {
+                if( p->quant == quantifier::star || p->quant == quantifier::optional || p->quant == quantifier::minus )  /* accept empty? */
+                {
+                    ++p;
+                    continue;
+                }
+                break;  /* '+' or no suffix */
+            }
+
+            switch( p->quant )  /* matched once; handle optional suffix */
+            {
+            case quantifier::optional:
+                push( frame_type::optional, s, 0 );
+                ++s;
+                ++p;
+                continue;
+
+            case quantifier::plus:  /* 1 or more repetitions */
+                ++s;                /* 1 match already done */
+                [[fallthrough]];
+            case quantifier::star:  /* 0 or more repetitions */
+                {
+                    ptrdiff_t i = 0;
+                    if constexpr( std::is_same< StrCharT, char >::value )
+                    {
+                        i = run_length( ms, s, p );
+                    }
+                    else
+                    {
+                        while( singlematch( ms, s + i, p ) )
+                        {
+                            ++i;
+                        }
+                    }
+                    push( frame_type::max_expand, s, i );
+                    s += i;
+                    ++p;
+                    continue;
+                }
+
+            case quantifier::minus:  /* 0 or more repetitions (minimum) */
+                push( frame_type::min_expand, s, 0 );
+                ++p;
+                continue;
+
+            case quantifier::one:  /* no suffix */
+                ++s;
+                ++p;
+                continue;
+            }
+            break;
+        }
+
+        if( !backtrack( ms, base, s, p ) )
+        {
+            return nullptr;
+        }
+    }
+}
+
+
+/*
+ * The threaded version of 'match_iterative'.
+ * Every operation of the threaded code has its own label and ends with its own indirect jump to the next operation, compilers
+ * with the labels as values extension (GCC, Clang) jump through a table of label addresses, other compilers through a switch.
+ * The backtrack points are kept on the stack of the match state like the non-recursive matcher does.
+ */
+#if defined( __GNUC__ )
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+template< typename MS, typename StrCharT >
+const StrCharT * match_threaded( MS &ms, const StrCharT * s )
+{
+    using unsigned_str_char_type = typename std::make_unsigned< StrCharT >::type;
+
+    auto &     stack   = *ms.stack;
+    const auto base    = stack.size();
+    const auto code    = ms.code;
+    const auto p_begin = ms.p_begin;
+    const auto s_end   = ms.s_end;
+    auto       p       = p_begin;
+
+    const auto push = [ & ]( frame_type type, const StrCharT * pos, std::ptrdiff_t count )
+    {
+        stack.push_back( { type, p - p_begin, pos - ms.s_begin, count } );
+        ms.reached( stack.size() - base );
+    };
+    /* an undo action is only needed when there is a backtrack point to return to */
+    const auto push_undo = [ & ]( frame_type type, const StrCharT * pos )
+    {
+        if( stack.size() > base )
+        {
+            push( type, pos, 0 );
+        }
+    };
+    const auto literal = [ & ]( const StrCharT * x ){ return x < s_end && static_cast< unsigned_str_char_type >( *x ) == p->c; };
+    const auto member  = [ & ]( const StrCharT * x ){ return x < s_end && ms.sets[ p->set ].test( static_cast< unsigned_str_char_type >( *x ) ); };
+    const auto run     = [ & ]( const StrCharT * x, auto test )
+    {
+        ptrdiff_t i = 0;
+        if constexpr( std::is_same< StrCharT, char >::value )
+        {
+            i = run_length( ms, x, p );
+        }
+        else
+        {
+            while( test( x + i ) )
+            {
+                ++i;
+            }
+        }
+        return i;
+    };
+
+#if defined( __GNUC__ )
+    static void * const labels[] =
+    {
+        &&literal_one, &&literal_optional, &&literal_star, &&literal_plus, &&literal_minus,
+        &&any_one,     &&any_optional,     &&any_star,     &&any_plus,     &&any_minus,
+        &&set_one,     &&set_optional,     &&set_star,     &&set_plus,     &&set_minus,
+        &&start_capture,
+        &&position_capture,
+        &&end_capture,
+        &&end_anchor,
+        &&frontier,
+        &&match
+    };
+#define LEX_DISPATCH() do { ms.step(); goto *labels[ static_cast< int >( code[ p - p_begin ] ) ]; } while( false )
+#else
+#define LEX_DISPATCH() goto dispatch
+#endif
+#define LEX_NEXT( n ) do { s += ( n ); ++p; LEX_DISPATCH(); } while( false )
+
+#if !defined( __GNUC__ )
+    dispatch:
+    ms.step();
+    switch( code[ p - p_begin ] )
+    {
+    case threaded_code::literal_one:      goto literal_one;
+    case threaded_code::literal_optional: goto literal_optional;
+    case threaded_code::literal_star:     goto literal_star;
+    case threaded_code::literal_plus:     goto literal_plus;
+    case threaded_code::literal_minus:    goto literal_minus;
+    case threaded_code::any_one:          goto any_one;
+    case threaded_code::any_optional:     goto any_optional;
+    case threaded_code::any_star:         goto any_star;
+    case threaded_code::any_plus:         goto any_plus;
+    case threaded_code::any_minus:        goto any_minus;
+    case threaded_code::set_one:          goto set_one;
+    case threaded_code::set_optional:     goto set_optional;
+    case threaded_code::set_star:         goto set_star;
+    case threaded_code::set_plus:         goto set_plus;
+    case threaded_code::set_minus:        goto set_minus;
+    case threaded_code::start_capture:    goto start_capture;
+    case threaded_code::position_capture: goto position_capture;
+    case threaded_code::end_capture:      goto end_capture;
+    case threaded_code::end_anchor:       goto end_anchor;
+    case threaded_code::frontier:         goto frontier;
+    case threaded_code::match:            goto match;
+    }
+#endif
+
+    LEX_DISPATCH();
+
+    literal_one:
+    if( literal( s ) )
+    {
+        LEX_NEXT( 1 );
+    }
+    goto fail;
+
+    literal_optional:
+    if( literal( s ) )
+    {
+        push( frame_type::optional, s, 0 );
+        LEX_NEXT( 1 );
+    }
+    LEX_NEXT( 0 );
+
+    literal_plus:
+    if( !literal( s ) )
+    {
+        goto fail;
+    }
+    ++s;  /* 1 match already done */
+    /* FALLTHROUGH */
+    literal_star:
+    {
+        const auto i = run( s, literal );
+        if( i > 0 )
+        {
+            push( frame_type::max_expand, s, i );
+        }
+        LEX_NEXT( i );
+    }
+
+    literal_minus:
+    if( literal( s ) )
+    {
+        push( frame_type::min_expand, s, 0 );
+    }
+    LEX_NEXT( 0 );
+
+    any_one:
+    if( s < s_end )
+    {
+        LEX_NEXT( 1 );
+    }
+    goto fail;
+
+    any_optional:
+    if( s < s_end )
+    {
+        push( frame_type::optional, s, 0 );
+        LEX_NEXT( 1 );
+    }
+    LEX_NEXT( 0 );
+
+    any_plus:
+    if( s == s_end )
+    {
+        goto fail;
+    }
+    ++s;  /* 1 match already done */
+    /* FALLTHROUGH */
+    any_star:
+    if( s < s_end )
+    {
+        push( frame_type::max_expand, s, s_end - s );
+    }
+    LEX_NEXT( s_end - s );
+
+    any_minus:
+    if( s < s_end )
+    {
+        push( frame_type::min_expand, s, 0 );
+    }
+    LEX_NEXT( 0 );
+
+    set_one:
+    if( member( s ) )
+    {
+        LEX_NEXT( 1 );
+    }
+    goto fail;
+
+    set_optional:
+    if( member( s ) )
+    {
+        push( frame_type::optional, s, 0 );
+        LEX_NEXT( 1 );
+    }
+    LEX_NEXT( 0 );
+
+    set_plus:
+    if( !member( s ) )
+    {
+        goto fail;
+    }
+    ++s;  /* 1 match already done */
+    /* FALLTHROUGH */
+    set_star:
+    {
+        const auto i = run( s, member );
+        if( i > 0 )
+        {
+            push( frame_type::max_expand, s, i );
+        }
+        LEX_NEXT( i );
+    }
+
+    set_minus:
+    if( member( s ) )
+    {
+        push( frame_type::min_expand, s, 0 );
+    }
+    LEX_NEXT( 0 );
+
+    start_capture:
+    position_capture:
+    if constexpr( MS::skip_captures )
+    {
+        LEX_NEXT( 0 );
+    }
+    assert( ms.level == p->capture_index );
+    ms.captures[ ms.level ].init = s;
+    ms.captures[ ms.level ].len  = p->type == item_type::start_capture ? cap_state::unfinished : cap_state::position;
+    ms.level++;
+    push_undo( frame_type::undo_start_capture, s );
+    LEX_NEXT( 0 );
+
+    end_capture:
+    if constexpr( MS::skip_captures )
+    {
+        LEX_NEXT( 0 );
+    }
+    assert( ms.captures[ p->capture_index ].len == cap_state::unfinished );
+    ms.captures[ p->capture_index ].len = static_cast< long >( s - ms.captures[ p->capture_index ].init );
+    push_undo( frame_type::undo_end_capture, s );
+    LEX_NEXT( 0 );
+
+    end_anchor:
+    if( s == s_end )  /* check end of string */
+    {
+        LEX_NEXT( 0 );
+    }
+    goto fail;
+
+    frontier:
+    if( matchfrontier( ms, s, p ) )
+    {
+        LEX_NEXT( 0 );
+    }
+    goto fail;
+
+    fail:
+    if( backtrack( ms, base, s, p ) )
+    {
+        LEX_DISPATCH();
+    }
+    return nullptr;
+
+    match:
+    stack.resize( base );
+    return s;
+
+#undef LEX_NEXT
+#undef LEX_DISPATCH
+}
+#if defined( __GNUC__ )
+#pragma GCC diagnostic pop
+#endif
+
+
+/* Matches the whole pattern from position 's' of the input string. */
+template< typename StrCharT, typename PatCharT, typename MR >
+const StrCharT * start_match( match_state< StrCharT, PatCharT, MR > &ms, const StrCharT * s )
+{
+    ms.count( &match_stats::starts );
+    return match( ms, s, ms.p_begin );
+}
+
+template< typename StrCharT, typename PatCharT, typename MR >
+const StrCharT * start_match( compiled_match_state< StrCharT, PatCharT, MR > &ms, const StrCharT * s )
+{
+    ms.count( &match_stats::starts );
+    auto e = ms.code ? match_threaded( ms, s ) : ms.stack ? match_iterative( ms, s, ms.p_begin ) : match( ms, s, ms.p_begin );
+    if( e )
+    {
+        ms.forget();
+    }
+    return e;
+}
+
+
+/* Stores the position of a match and adds the whole match as capture when the pattern has no captures. */
+template< typename MS, typename StrCharT >
+void push_captures( MS &ms, const StrCharT * s, const StrCharT * e ) noexcept
+{
+    ms.pos = { static_cast< long >( s - ms.s_begin ), static_cast< long >( e - ms.s_begin ) };
+    if( ms.level == 0 )
+    {
+        ms.captures[ ms.level ] = { s, static_cast< long >( e - s ) };
+        ++ms.level;
+    }
+}
+
+
+/* Counts a search and adds the time of the search to the stats of a match state. */
+#if LEX_INSTRUMENTATION
+template< typename MS >
+struct search_timer
+{
+    explicit search_timer( const MS &ms ) noexcept
+        : stats( ms.stats )
+        , start( stats ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point() )
+    {}
+
+    ~search_timer() noexcept
+    {
+        if( stats )
+        {
+            ++stats->searches;
+            stats->nanoseconds += std::chrono::duration_cast< std::chrono::nanoseconds >( std::chrono::steady_clock::now() - start ).count();
+        }
+    }
+
+    match_stats * const                         stats;
+    const std::chrono::steady_clock::time_point start;
+};
+#else
+template< typename MS >
+struct search_timer
+{
+    explicit search_timer( const MS & ) noexcept {}
+};
+#endif
+
+
+/* Searches for the first match in the whole input string. */
+template< typename MS, typename CharT >
+void find_aux( MS &ms, bool anchor, const prefilter< CharT > & filter )
+{
+    const search_timer< MS > timer( ms );
+
+    for( auto s = ms.s_begin ; s <= ms.s_end ; s = next_start( ms, s ) )
+    {
+        if( anchor ? !in_bounds( filter, s, ms.s_end ) : !( s = next_candidate( filter, s, ms.s_end ) ) )
+        {
+            break;
+        }
+
+        if( auto e = start_match( ms, s ) )
+        {
+            ms.check_captures();
+            push_captures( ms, s, e );
+            return;
+        }
+
+        ms.reprepstate();  /* the threaded code doesn't undo its captures when it fails */
+
+        if( anchor )
+        {
+            break;
+        }
+    }
+}
+
+
+/*
+ * Searches for the next match from 'src' that starts at or before 'last_start'; an empty match at the end of the last match is skipped.
+ * A match can extend beyond 'last_start'.
+ */
+template< typename MS, typename CharT, typename StrCharT >
+bool gmatch_aux( MS &ms, const prefilter< CharT > & filter, const StrCharT * & src, const StrCharT * & last_match, const StrCharT * last_start )
+{
+    const search_timer< MS > timer( ms );
+
+    while( src <= last_start )
+    {
+        const auto next = next_candidate( filter, src, ms.s_end );
+        if( next != src )
+        {
+            last_match = nullptr;  /* the skipped positions have no match */
+            if( !next )
+            {
+                src = ms.s_end + 1;
+                break;
+            }
+            src = next;
+            if( src > last_start )
+            {
+                break;
+            }
+        }
+
+        auto e = start_match( ms, src );
+        if( !e || e == last_match )
+        {
+            src = next_start( ms, src );
+        }
+        else
+        {
+            ms.check_captures();
+            push_captures( ms, src, e );
+            last_match = e;
+            src        = e;
+
+            return true;
+        }
+        last_match = e;
+
+        ms.reprepstate();
+    }
+
+    return false;
+}
+
+template< typename MS, typename CharT, typename StrCharT >
+bool gmatch_aux( MS &ms, const prefilter< CharT > & filter, const StrCharT * & src, const StrCharT * & last_match )
+{
+    return gmatch_aux( ms, filter, src, last_match, ms.s_end );
+}
+
+
+/* Makes room in a string result for at least 'n' more chars without giving up the amortized growth of the string. */
+template< typename CharT, typename Traits, typename Allocator >
+void reserve_more( std::basic_string< CharT, Traits, Allocator > & result, std::size_t n )
+{
+    if( result.capacity() - result.size() < n )
+    {
+        result.reserve( std::max( result.size() + n, 2 * result.capacity() ) );
+    }
+}
+
+template< typename Result >
+void reserve_more( Result &, std::size_t ) noexcept
+{}
+
+
+/* Adapts an output iterator to the append functions of std::basic_string that are used by gsub. */
+template< typename CharT, typename OutIt >
+struct output_sink
+{
+    template< typename It >
+    void append( It first, It last ) { out = std::copy( first, last, out ); }
+
+    void append( const CharT * s, std::size_t n ) { out = std::copy_n( s, n, out ); }
+
+    void append( std::size_t n, CharT c ) { out = std::fill_n( out, n, c ); }
+
+    template< typename T >
+    void append( const T & str )
+    {
+        const std::basic_string_view< CharT > sv( str );
+        append( sv.data(), sv.size() );
+    }
+
+    OutIt out;
+};
+
+
+/*
+ * Substitutes matches in the input string; 'add_value' appends the replacement of a match to the result.
+ * The search starts at 'from' when the caller knows there is no match before it; the chars before 'from' are copied.
+ */
+template< typename MS, typename CharT, typename Result, typename AddValue >
+void gsub_aux( MS &ms, bool anchor, const prefilter< CharT > & filter, int count, Result & result, AddValue && add_value,
+               const typename MS::str_char_type * from = nullptr )
+{
+    using str_char_type = typename MS::str_char_type;
+
+    const search_timer< MS > timer( ms );
+    const str_char_type *    last_match = nullptr;
+    reserve_more( result, ms.s_end - ms.s_begin );
+
+    auto s = from ? from : ms.s_begin;
+    while( s <= ms.s_end && count != 0 )
+    {
+        if( anchor )
+        {
+            count = 0;  // break at first iteration
+            if( !in_bounds( filter, s, ms.s_end ) )
+            {
+                break;
+            }
+        }
+        else if( !( s = next_candidate( filter, s, ms.s_end ) ) )
+        {
+            break;
+        }
+
+        auto e = start_match( ms, s );
+        if( !e || e == last_match )
+        {
+            s = next_start( ms, s );
+        }
+        else
+        {
+            --count;
+
+            result.append( last_match ? last_match : ms.s_begin, s );
+
+            ms.check_captures();
+            push_captures( ms, s, e );
+            add_value( result, s, e );
+
+            last_match = e;
+            s          = e;
+        }
+
+        ms.reprepstate();
+    }
+
+    result.append( last_match ? last_match : ms.s_begin, ms.s_end );
+}
+
+
+/* Appends capture 'cap_index' of the match to the result; a position capture is appended as a number. */
+template< typename Result, typename MS >
+void add_capture( Result & result, const MS &ms, int cap_index )
+{
+    if( cap_index >= ms.level )
+    {
+        throw lex_error( capture_invalid_index );
+    }
+    const auto& cap = ms.captures[ cap_index ];
+    if( cap.len == cap_state::position  )
+    {
+        const ptrdiff_t pos = 1 + cap.init - ms.s_begin;
+        append_number( result, pos );
+    }
+    else
+    {
+        assert( cap.len != cap_state::unfinished );
+        result.append( cap.init, cap.len );
+    }
+}
+
+
+/*
+ * Appends the replacement of function 'func' for match result 'mr' to the result.
+ * The function returns a string or a string view, or it writes the replacement to a replacement sink.
+ */
+template< typename CharT, typename Result, typename Function, typename MR >
+void add_f( Result & result, Function & func, const MR & mr )
+{
+    if constexpr( std::is_invocable< Function &, const MR &, basic_replacement_sink< CharT > & >::value )
+    {
+        basic_replacement_sink< CharT > sink( result );
+        func( mr, sink );
+    }
+    else
+    {
+        result.append( func( mr ) );
+    }
+}
+
+
+/* Appends the replacement string 'r' of the match [s, e) to the result. */
+template< typename Result, typename MS, typename StrCharT, typename ReplCharT >
+void add_s( Result & result, const MS &ms, const StrCharT * s, const StrCharT * e, const string_context< ReplCharT > & r )
+{
+    auto r_begin = r.begin;
+    for( auto find = std::find( r_begin, r.end, '%' ) ;
+        find != r.end ;
+        r_begin = find + 1, find = std::find( r_begin, r.end, '%' ) )
+    {
+        result.append( r_begin, find );     // Copy pattern before '%'
+        ++find;                             // skip ESC
+
+        if( find == r.end )
+        {
+            throw lex_error( percent_invalid_use_in_replacement );
+        }
+
+        const StrCharT cap_char = *find;
+        if( cap_char == '%' )                          // %%
+        {
+            result.append( 1u, cap_char );
+        }
+        else if( cap_char == '0' )                     // %0
+        {
+            result.append( s, e );
+        }
+        else if( cap_char >= '1' && cap_char <= '9' )  // %n
+        {
+            add_capture( result, ms, static_cast< int >( cap_char - '1' ) );
+        }
+        else
+        {
+            throw lex_error( percent_invalid_use_in_replacement );
+        }
+    }
+
+    result.append( r_begin, r.end );
+}
+
+
+enum class segment_type : unsigned char
+{
+    literal,      /* a span of the decoded text */
+    whole_match,  /* '%0' */
+    capture       /* '%1' to '%9' */
+};
+
+struct replacement_segment
+{
+    segment_type type;
+    std::size_t  begin;          /* the span of a literal in the decoded text */
+    std::size_t  length;
+    int          capture_index;  /* zero based index of a capture */
+};
+
+
+/* Appends the compiled replacement 'r' of the match [s, e) to the result. */
+template< typename Result, typename MS, typename StrCharT, typename ReplCharT >
+void add_r( Result & result, const MS &ms, const StrCharT * s, const StrCharT * e, const basic_replacement< ReplCharT > & r )
+{
+    const auto text = r.text.data();
+    for( const auto &seg : r.segments )
+    {
+        switch( seg.type )
+        {
+        case segment_type::literal:
+            result.append( text + seg.begin, text + seg.begin + seg.length );
+            break;
+
+        case segment_type::whole_match:
+            result.append( s, e );
+            break;
+
+        case segment_type::capture:
+            add_capture( result, ms, seg.capture_index );
+            break;
+        }
+    }
+}
+
+}
+
+/**
+ * \brief A lex context is an input string combined with a pattern.
+ *
+ * You can iterate over all matches in a string calling the pg::lex::begin and pg::lex::end functions with a context object.
+ *
+ * \note A lex context keeps a reference to the input string and pattern.
+ *
+ * \tparam StrCharT The char type of the input string.
+ * \tparam PatCharT The char type of the pattern.
+ *
+ * \see pg::lex::begin
+ * \see pg::lex::end
+ */
+template< typename StrCharT, typename PatCharT >
+struct context
+{
+    const detail::string_context< StrCharT >  s;
+    const detail::pattern_context< PatCharT > p;
+    const match_options                       options;
+
+    template< typename StrT, typename PatT >
+    context( StrT && s_, PatT && p_, const match_options & opts = {} ) noexcept
+        : s( std::forward< StrT >( s_ ) )
+        , p( std::forward< PatT >( p_ ) )
+        , options( opts )
+    {
+        static_assert( detail::string_traits< StrT >::is_string, "String is not one of the supported string-like types!" );
+        static_assert( detail::string_traits< PatT >::is_string, "Pattern is not one of the supported string-like types!" );
+    }
+
+    bool operator ==( const context< StrCharT, PatCharT >& other ) const noexcept
+    {
+        return s.begin == other.s.begin && s.end == other.s.end &&
+               p.begin == other.p.begin && p.end == other.p.end;
+    }
+};
+
+template< typename StrT, typename PatT >
+context( StrT &&, PatT && ) noexcept ->
+context< typename detail::string_traits< StrT >::char_type,
+         typename detail::string_traits< PatT >::char_type >;
+
+template< typename StrT, typename PatT >
+context( StrT &&, PatT &&, const match_options & ) noexcept ->
+context< typename detail::string_traits< StrT >::char_type,
+         typename detail::string_traits< PatT >::char_type >;
+
+
+/**
+ * \brief Searches for the first match of a pattern in an input string.
+ *
+ * \return Returns a match result based on the character type of the input string.
+ */
+template< typename StrT, typename PatT,
+          typename std::enable_if< detail::string_traits< PatT >::is_string, int >::type = 0 >
+auto match( StrT&& str, PatT&& pat, const match_options & opts = {} )
+{
+    using str_char_type = typename detail::string_traits< StrT >::char_type;
+    using pat_char_type = typename detail::string_traits< PatT >::char_type;
+
+    if constexpr( detail::widens_pattern< str_char_type, pat_char_type > )
+    {
+        return match( std::forward< StrT >( str ), detail::widen_pattern< str_char_type >( pat ), opts );
+    }
+    else
+    {
+        context                             c = { std::forward< StrT >( str ), std::forward< PatT >( pat ) };
+        basic_match_result< str_char_type > mr;
+        detail::match_state                 ms = { c.s.begin, c.s.end, c.p.begin, c.p.end, mr, opts };
+
+        detail::find_aux( ms, c.p.anchor, detail::analyse_prefix( c.p, ms.utf8 ) );
+
+        return mr;
+    }
+}
+
+/**
+ * \brief Searches for the first match of a pattern in an input string and returns a compact match result.
+ *
+ * Throws a 'capture_too_many' when the match has more than N captures and a 'string_too_long' when the input string is longer than UINT32_MAX chars.
+ *
+ * \tparam N The maximum number of captures of the match result.
+ *
+ * \return Returns a compact match result based on the character type of the input string.
+ */
+template< size_t N, typename StrT, typename PatT,
+          typename std::enable_if< detail::string_traits< PatT >::is_string, int >::type = 0 >
+auto match( StrT&& str, PatT&& pat, const match_options & opts = {} )
+{
+    using str_char_type = typename detail::string_traits< StrT >::char_type;
+
+    const detail::string_context< str_char_type > s = { str };
+
+    detail::check_compact_length( s.begin, s.end );
+
+    return basic_compact_match_result< str_char_type, N >( match( std::forward< StrT >( str ), std::forward< PatT >( pat ), opts ), s.begin );
+}
+
+/**
+ * \brief An iterator for pg::lex::context objects.
+ *
+ * The constructor does not perform the first match so the match result is not yet valid.
+ * First you must increase the iterator before dereferencing it to search for the first match result.
+ *
+ * \see pg::lex::context
+ * \see pg::lex::begin
+ */
+template< typename StrCharT, typename PatCharT >
+struct gmatch_iterator
+{
+    gmatch_iterator( const context< StrCharT, PatCharT >& ctx, const StrCharT * start ) noexcept
+        : c( ctx )
+        , pos( start )
+    {}
+
+    /**
+     * \brief Iterates to the next match in the context.
+     *
+     * The match result is empty when the end is reached.
+     */
+    gmatch_iterator& operator ++()
+    {
+        detail::match_state ms = { c.s.begin, c.s.end, c.p.begin, c.p.end, mr, c.options };
+        detail::gmatch_aux( ms, detail::analyse_prefix( c.p, ms.utf8 ), pos, last_match );
+
+        return *this;
+    }
+
+    bool operator ==( const gmatch_iterator & other ) const noexcept
+    {
+        return c == other.c && pos == other.pos;
+    }
+
+    bool operator !=( const gmatch_iterator & other ) const noexcept
+    {
+        return !( *this == other );
+    }
+
+    /**
+     * \brief Dereferences to a match result.
+     */
+    const auto & operator *() const noexcept
+    {
+        return mr;
+    }
+
+    /**
+     * \brief Returns a pointer to a match result.
+     */
+    const auto operator ->() const noexcept
+    {
+        return &mr;
+    }
+
+private:
+
+    const context< StrCharT, PatCharT > c;
+    const StrCharT *                    pos        = nullptr;
+    const StrCharT *                    last_match = nullptr;
+    basic_match_result< StrCharT >      mr;
+};
+
+/**
+ * \brief Returns a pg::lex::gmatch_iterator of a lex context object.
+ *
+ * When the context contains matches, the iterator has initial the result of the first match.
+ * The iterator is equal to the end iterator when the context has no matches.
+ *
+ * \see pg::lex::gmatch_iterator
+ * \see pg::lex::end
+ */
+template< typename StrCharT, typename PatCharT >
+auto begin( const context< StrCharT, PatCharT > & c )
+{
+    auto it = gmatch_iterator( c, c.s.begin );
+    return ++it;
+}
+
+/**
+ * \brief Returns a pg::lex::gmatch_iterator that indicates the end of a lex context.
+ *
+ * The result of the end iterator is always an empty match result.
+ *
+ * \see pg::lex::gmatch_iterator
+ */
+template< typename StrCharT, typename PatCharT >
+auto end( const context< StrCharT, PatCharT > & c ) noexcept
+{
+    return gmatch_iterator( c, c.s.end + 1 );
+}
+
+/**
+ * \brief A replacement pattern for pg::lex::gsub that is decoded once so it can be used for many substitutions.
+ *
+ * The replacement is decoded into a list of literal text, whole match (%0) and capture (%1 to %9) segments.
+ * An invalid use of '%' throws a pg::lex::lex_error when the replacement is constructed.
+ *
+ * \tparam CharT The char type of the replacement.
+ */
+template< typename CharT >
+class basic_replacement
+{
+    template< typename Result, typename MS, typename StrCharT, typename ReplCharT >
+    friend void detail::add_r( Result &, const MS &, const StrCharT *, const StrCharT *, const basic_replacement< ReplCharT > & );
+
+    std::basic_string< CharT >                 text;  /* the decoded literals */
+    std::vector< detail::replacement_segment > segments;
+    size_t                                     max_index = 0;
+
+    void add_literal( const CharT * begin, const CharT * end )
+    {
+        if( begin == end )
+        {
+            return;
+        }
+        if( segments.empty() || segments.back().type != detail::segment_type::literal )
+        {
+            segments.push_back( { detail::segment_type::literal, text.size(), 0, 0 } );
+        }
+        text.append( begin, end );
+        segments.back().length += end - begin;
+    }
+
+public:
+
+    /**
+     * \brief Decodes a replacement pattern.
+     */
+    template< typename ReplT,
+              typename std::enable_if< detail::string_traits< ReplT >::is_string, int >::type = 0 >
+    basic_replacement( ReplT && repl )
+    {
+        const detail::string_context< CharT > r = { repl };
+
+        auto r_begin = r.begin;
+        for( auto find = std::find( r_begin, r.end, '%' ) ;
+            find != r.end ;
+            r_begin = find + 1, find = std::find( r_begin, r.end, '%' ) )
+        {
+            add_literal( r_begin, find );
+            ++find;  // skip ESC
+
+            if( find == r.end )
+            {
+                throw lex_error( percent_invalid_use_in_replacement );
+            }
+
+            if( *find == '%' )                       // %%
+            {
+                add_literal( find, find + 1 );
+            }
+            else if( *find == '0' )                  // %0
+            {
+                segments.push_back( { detail::segment_type::whole_match, 0, 0, 0 } );
+            }
+            else if( *find >= '1' && *find <= '9' )  // %n
+            {
+                const int cap_index = static_cast< int >( *find - '1' );
+                segments.push_back( { detail::segment_type::capture, 0, 0, cap_index } );
+                max_index = std::max( max_index, static_cast< size_t >( cap_index + 1 ) );
+            }
+            else
+            {
+                throw lex_error( percent_invalid_use_in_replacement );
+            }
+        }
+        add_literal( r_begin, r.end );
+    }
+
+    /**
+     * \brief Returns the highest capture index that is used by the replacement; 0 when it doesn't use captures.
+     */
+    size_t max_capture() const noexcept { return max_index; }
+};
+
+template< typename ReplT >
+basic_replacement( ReplT && ) -> basic_replacement< typename detail::string_traits< ReplT >::char_type >;
+
+extern template class basic_replacement< char >;
+extern template class basic_replacement< wchar_t >;
+extern template class basic_replacement< char16_t >;
+extern template class basic_replacement< char32_t >;
+
+using replacement    = basic_replacement< char >;
+using wreplacement   = basic_replacement< wchar_t >;
+using u16replacement = basic_replacement< char16_t >;
+using u32replacement = basic_replacement< char32_t >;
+
+namespace detail
+{
+
+template< typename >             struct is_replacement                             : std::false_type {};
+template< typename CharT >       struct is_replacement< basic_replacement< CharT > > : std::true_type  {};
+template< typename T >           struct is_replacement< const T >                  : is_replacement< T > {};
+template< typename T >           struct is_replacement< T & >                      : is_replacement< T > {};
+template< typename T >           struct is_replacement< T && >                     : is_replacement< T > {};
+
+template< typename Result, typename StrT, typename PatT, typename ReplT,
+          typename std::enable_if< string_traits< PatT >::is_string &&
+                                   string_traits< ReplT >::is_string, int >::type = 0 >
+void gsub_into( Result & result, StrT&& str, PatT&& pat, ReplT&& repl, int count, const match_options & opts )
+{
+    using str_char_type  = typename string_traits< StrT >::char_type;
+    using repl_char_type = typename string_traits< ReplT >::char_type;
+    using pat_char_type  = typename string_traits< PatT >::char_type;
+
+    if constexpr( widens_pattern< str_char_type, pat_char_type > )
+    {
+        gsub_into( result, std::forward< StrT >( str ), widen_pattern< str_char_type >( pat ), std::forward< ReplT >( repl ), count, opts );
+    }
+    else
+    {
+        const string_context< repl_char_type > r  = { repl };
+        const context                          c  = { std::forward< StrT >( str ), std::forward< PatT >( pat ) };
+        basic_match_result< str_char_type >    mr;
+        match_state                            ms = { c.s.begin, c.s.end, c.p.begin, c.p.end, mr, opts };
+
+        gsub_aux( ms, c.p.anchor, analyse_prefix( c.p, ms.utf8 ), count, result, [ & ]( auto &result, auto s, auto e )
+        {
+            add_s( result, ms, s, e, r );
+        } );
+    }
+}
+
+template< typename Result, typename StrT, typename PatT, typename Function,
+          typename std::enable_if< string_traits< PatT >::is_string &&
+                                   !string_traits< Function >::is_string &&
+                                   !is_replacement< Function >::value, int >::type = 0 >
+void gsub_into( Result & result, StrT&& str, PatT&& pat, Function&& func, int count, const match_options & opts )
+{
+    using str_char_type = typename string_traits< StrT >::char_type;
+    using pat_char_type = typename string_traits< PatT >::char_type;
+
+    if constexpr( widens_pattern< str_char_type, pat_char_type > )
+    {
+        gsub_into( result, std::forward< StrT >( str ), widen_pattern< str_char_type >( pat ), std::forward< Function >( func ), count, opts );
+    }
+    else
+    {
+        const context                       c  = { std::forward< StrT >( str ), std::forward< PatT >( pat ) };
+        basic_match_result< str_char_type > mr;
+        match_state                         ms = { c.s.begin, c.s.end, c.p.begin, c.p.end, mr, opts };
+
+        gsub_aux( ms, c.p.anchor, analyse_prefix( c.p, ms.utf8 ), count, result, [ & ]( auto &result, auto, auto )
+        {
+            add_f< str_char_type >( result, func, mr );
+        } );
+    }
+}
+
+template< typename Result, typename StrT, typename PatT, typename ReplCharT,
+          typename std::enable_if< string_traits< PatT >::is_string, int >::type = 0 >
+void gsub_into( Result & result, StrT&& str, PatT&& pat, const basic_replacement< ReplCharT > & repl, int count, const match_options & opts )
+{
+    using str_char_type = typename string_traits< StrT >::char_type;
+    using pat_char_type = typename string_traits< PatT >::char_type;
+
+    if constexpr( widens_pattern< str_char_type, pat_char_type > )
+    {
+        gsub_into( result, std::forward< StrT >( str ), widen_pattern< str_char_type >( pat ), repl, count, opts );
+    }
+    else
+    {
+        const context                       c  = { std::forward< StrT >( str ), std::forward< PatT >( pat ) };
+        basic_match_result< str_char_type > mr;
+        match_state                         ms = { c.s.begin, c.s.end, c.p.begin, c.p.end, mr, opts };
+
+        gsub_aux( ms, c.p.anchor, analyse_prefix( c.p, ms.utf8 ), count, result, [ & ]( auto &result, auto s, auto e )
+        {
+            add_r( result, ms, s, e, repl );
+        } );
+    }
+}
+
+}
+
+/**
+ * \brief Substitutes a replacement for a match found in the input string.
+ *
+ * \param str   The input string
+ * \param pat   The pattern used to find matches in the input string
+ * \param repl  The replacement pattern that substitutes the match.
+ * \param count The maximum number of substitutes; negative for unlimited an unlimited count.
+ * \param opts  The options of the matcher.
+ *
+ * \return returns a std::string based on the character type of the input string
+ */
+template< typename StrT, typename PatT, typename ReplT,
+          typename std::enable_if< detail::string_traits< PatT >::is_string &&
+                                   detail::string_traits< ReplT >::is_string, int >::type = 0 >
+auto gsub( StrT&& str, PatT&& pat, ReplT&& repl, int count = -1, const match_options & opts = {} )
+{
+    static_assert( detail::string_traits< ReplT >::is_string, "Replacement pattern is not one of the supported string-like types!" );
+
+    std::basic_string< typename detail::string_traits< StrT >::char_type > result;
+    detail::gsub_into( result, std::forward< StrT >( str ), std::forward< PatT >( pat ), std::forward< ReplT >( repl ), count, opts );
+
+    return result;
+}
+
+/**
+ * \brief Substitutes a replacement for a match found in the input string.
+ *
+ * \param str   The input string
+ * \param pat   The pattern used to find matches in the input string
+ * \param repl  A function that accepts a match result and returns the replacement.
+ * \param count The maximum number of substitutes; negative for unlimited an unlimited count.
+ * \param opts  The options of the matcher.
+ *
+ * \return returns a std::string based on the character type of the input string
+ */
+template< typename StrT, typename PatT, typename Function,
+          typename std::enable_if< detail::string_traits< PatT >::is_string &&
+                                   !detail::string_traits< Function >::is_string &&
+                                   !detail::is_replacement< Function >::value, int >::type = 0 >
+auto gsub( StrT&& str, PatT&& pat, Function&& func, int count = -1, const match_options & opts = {} )
+{
+    std::basic_string< typename detail::string_traits< StrT >::char_type > result;
+    detail::gsub_into( result, std::forward< StrT >( str ), std::forward< PatT >( pat ), std::forward< Function >( func ), count, opts );
+
+    return result;
+}
+
+/**
+ * \brief Substitutes a decoded replacement for a match found in the input string.
+ *
+ * \param str   The input string
+ * \param pat   The pattern used to find matches in the input string
+ * \param repl  The decoded replacement that substitutes the match.
+ * \param count The maximum number of substitutes; negative for unlimited an unlimited count.
+ * \param opts  The options of the matcher.
+ *
+ * \return returns a std::string based on the character type of the input string
+ */
+template< typename StrT, typename PatT, typename ReplCharT,
+          typename std::enable_if< detail::string_traits< PatT >::is_string, int >::type = 0 >
+auto gsub( StrT&& str, PatT&& pat, const basic_replacement< ReplCharT > & repl, int count = -1, const match_options & opts = {} )
+{
+    std::basic_string< typename detail::string_traits< StrT >::char_type > result;
+    detail::gsub_into( result, std::forward< StrT >( str ), std::forward< PatT >( pat ), repl, count, opts );
+
+    return result;
+}
+
+/**
+ * \brief A pattern that is compiled once so it can be used for many matches.
+ *
+ * The pattern is decoded and checked for errors when it is constructed.
+ * Errors are reported by throwing a pg::lex::lex_error at construction instead of when the malformed part of the pattern is matched.
+ *
+ * \tparam CharT The char type of the pattern.
+ */
+template< typename CharT >
+class basic_pattern
+{
+    template< typename, typename, typename >
+    friend struct detail::compiled_match_state;
+
+    template< typename >
+    friend class basic_pattern_set;
+
+    std::vector< detail::pattern_item< CharT > > items;
+    std::vector< detail::bracket_set< CharT > >  sets;
+    detail::prefilter< CharT >                   filter;
+    bool                                         anchor          = false;
+    bool                                         back_references = false;
+    int                                          level           = 0;  /* number of captures in the pattern */
+    std::ptrdiff_t                               longest         = -1;
+    std::vector< detail::threaded_code >         code;  /* empty when the pattern can't be lowered to threaded code */
+
+public:
+
+    /**
+     * \brief Compiles a pattern; 'classes' selects the definition of the character classes of the pattern.
+     */
+    template< typename PatT,
+              typename std::enable_if< detail::string_traits< PatT >::is_string, int >::type = 0 >
+    basic_pattern( PatT && pat, class_mode classes = class_mode::locale )
+        : basic_pattern( detail::pattern_context< CharT >( std::forward< PatT >( pat ) ), classes )
+    {}
+
+    /**
+     * \brief Compiles the pattern of a pattern context.
+     */
+    basic_pattern( const detail::pattern_context< CharT > & pc, class_mode classes = class_mode::locale )
+        : anchor( pc.anchor )
+    {
+        level           = detail::compile( pc, items, sets, classes );
+        filter          = detail::analyse_prefix( items, sets );
+        back_references = std::any_of( items.begin(), items.end(), []( const auto &item ){ return item.type == detail::item_type::back_reference; } );
+        longest         = detail::max_length( items );
+        code            = detail::lower_threaded( items );
+    }
+
+    using char_type = CharT;
+
+    /**
+     * \brief The value of max_length for a pattern with matches of any length.
+     */
+    static constexpr size_t unbounded = static_cast< size_t >( -1 );
+
+    /**
+     * \brief Returns the number of captures in the pattern.
+     */
+    size_t captures() const noexcept { return level; }
+
+    /**
+     * \brief Returns true when the pattern is anchored at the begin of the input string.
+     */
+    bool anchored() const noexcept { return anchor; }
+
+    /**
+     * \brief Returns true when the pattern refers to a capture with '%1' - '%9'.
+     */
+    bool has_back_references() const noexcept { return back_references; }
+
+    /**
+     * \brief Returns the maximum length of a match or 'unbounded' when the pattern has a repetition or a balance.
+     */
+    size_t max_length() const noexcept { return longest < 0 ? unbounded : static_cast< size_t >( longest ); }
+};
+
+template< typename PatT >
+basic_pattern( PatT && ) -> basic_pattern< typename detail::string_traits< PatT >::char_type >;
+
+template< typename PatT >
+basic_pattern( PatT &&, class_mode ) -> basic_pattern< typename detail::string_traits< PatT >::char_type >;
+
+extern template class basic_pattern< char >;
+extern template class basic_pattern< wchar_t >;
+extern template class basic_pattern< char16_t >;
+extern template class basic_pattern< char32_t >;
+
+using pattern    = basic_pattern< char >;
+using wpattern   = basic_pattern< wchar_t >;
+using u16pattern = basic_pattern< char16_t >;
+using u32pattern = basic_pattern< char32_t >;
+
+/**
+ * \brief A compiled context is an input string combined with a compiled pattern.
+ *
+ * You can iterate over all matches in a string calling the pg::lex::begin and pg::lex::end functions with a compiled context object.
+ *
+ * \note A compiled context keeps a reference to the input string and the compiled pattern.
+ *
+ * \tparam StrCharT The char type of the input string.
+ * \tparam PatCharT The char type of the pattern.
+ * \tparam MR       The type of the match results of the iterators.
+ *
+ * \see pg::lex::gmatch
+ */
+template< typename StrCharT, typename PatCharT, typename MR = basic_match_result< StrCharT > >
+struct compiled_context
+{
+    const detail::string_context< StrCharT > s;
+    const basic_pattern< PatCharT > &        p;
+    const match_options                      options;
+
+    template< typename StrT >
+    compiled_context( StrT && s_, const basic_pattern< PatCharT > & p_, const match_options & opts = {} ) noexcept
+        : s( std::forward< StrT >( s_ ) )
+        , p( p_ )
+        , options( opts )
+    {
+        static_assert( detail::string_traits< StrT >::is_string, "String is not one of the supported string-like types!" );
+    }
+
+    bool operator ==( const compiled_context & other ) const noexcept
+    {
+        return s.begin == other.s.begin && s.end == other.s.end && &p == &other.p;
+    }
+};
+
+template< typename StrT, typename PatCharT >
+compiled_context( StrT &&, const basic_pattern< PatCharT > & ) noexcept ->
+compiled_context< typename detail::string_traits< StrT >::char_type, PatCharT >;
+
+template< typename StrT, typename PatCharT >
+compiled_context( StrT &&, const basic_pattern< PatCharT > &, const match_options & ) noexcept ->
+compiled_context< typename detail::string_traits< StrT >::char_type, PatCharT >;
+
+/**
+ * \brief Searches for the first match of a compiled pattern in an input string.
+ *
+ * \return Returns a match result based on the character type of the input string.
+ */
+template< typename StrT, typename PatCharT >
+auto match( StrT&& str, const basic_pattern< PatCharT > & pat, const match_options & opts = {} )
+{
+    using str_char_type = typename detail::string_traits< StrT >::char_type;
+
+    const compiled_context              c  = { std::forward< StrT >( str ), pat };
+    basic_match_result< str_char_type > mr;
+    detail::compiled_match_state        ms = { c.s.begin, c.s.end, pat, mr, opts };
+
+    detail::find_aux( ms, pat.anchored(), ms.filter );
+
+    return mr;
+}
+
+/**
+ * \brief Searches for the first match of a compiled pattern in an input string and returns a compact match result.
+ *
+ * Throws a 'capture_too_many' before matching when the pattern has more than N captures.
+ *
+ * \tparam N The maximum number of captures of the match result.
+ *
+ * \return Returns a compact match result based on the character type of the input string.
+ */
+template< size_t N, typename StrT, typename PatCharT >
+auto match( StrT&& str, const basic_pattern< PatCharT > & pat, const match_options & opts = {} )
+{
+    using str_char_type = typename detail::string_traits< StrT >::char_type;
+
+    if( pat.captures() > N )
+    {
+        throw lex_error( capture_too_many );
+    }
+
+    const detail::string_context< str_char_type > s = { str };
+
+    detail::check_compact_length( s.begin, s.end );
+
+    return basic_compact_match_result< str_char_type, N >( match( std::forward< StrT >( str ), pat, opts ), s.begin );
+}
+
+/**
+ * \brief Returns a compiled context to iterate over the matches of a compiled pattern in an input string.
+ *
+ * \see pg::lex::compiled_context
+ */
+template< typename StrT, typename PatCharT >
+auto gmatch( StrT&& str, const basic_pattern< PatCharT > & pat, const match_options & opts = {} ) noexcept
+{
+    return compiled_context( std::forward< StrT >( str ), pat, opts );
+}
+
+/* The compiled context would keep a reference to the temporary pattern. */
+template< typename StrT, typename PatCharT >
+auto gmatch( StrT&& str, const basic_pattern< PatCharT > && pat, const match_options & opts = {} ) = delete;
+
+/**
+ * \brief Returns a compiled context to iterate over the matches of a compiled pattern with compact match results.
+ *
+ * Throws a 'capture_too_many' when the pattern has more than N captures and a 'string_too_long' when the input string is longer than UINT32_MAX chars.
+ *
+ * \tparam N The maximum number of captures of the match results.
+ *
+ * \see pg::lex::compiled_context
+ */
+template< size_t N, typename StrT, typename PatCharT >
+auto gmatch( StrT&& str, const basic_pattern< PatCharT > & pat, const match_options & opts = {} )
+{
+    using str_char_type = typename detail::string_traits< StrT >::char_type;
+
+    if( pat.captures() > N )
+    {
+        throw lex_error( capture_too_many );
+    }
+
+    const detail::string_context< str_char_type > s = { str };
+
+    detail::check_compact_length( s.begin, s.end );
+
+    return compiled_context< str_char_type, PatCharT, basic_compact_match_result< str_char_type, N > >( std::forward< StrT >( str ), pat, opts );
+}
+
+template< size_t N, typename StrT, typename PatCharT >
+auto gmatch( StrT&& str, const basic_pattern< PatCharT > && pat, const match_options & opts = {} ) = delete;
+
+/**
+ * \brief An iterator for pg::lex::compiled_context objects.
+ *
+ * \see pg::lex::gmatch_iterator
+ */
+template< typename StrCharT, typename PatCharT, typename MR = basic_match_result< StrCharT > >
+struct compiled_gmatch_iterator
+{
+    compiled_gmatch_iterator( const compiled_context< StrCharT, PatCharT, MR >& ctx, const StrCharT * start ) noexcept
+        : c( ctx )
+        , pos( start )
+    {}
+
+    /**
+     * \brief Iterates to the next match in the context.
+     *
+     * The match result is empty when the end is reached.
+     */
+    compiled_gmatch_iterator& operator ++()
+    {
+        if constexpr( std::is_same< MR, basic_match_result< StrCharT > >::value )
+        {
+            detail::compiled_match_state ms = { c.s.begin, c.s.end, c.p, mr, c.options };
+            detail::gmatch_aux( ms, ms.filter, pos, last_match );
+        }
+        else
+        {
+            basic_match_result< StrCharT > full;
+            detail::compiled_match_state   ms = { c.s.begin, c.s.end, c.p, full, c.options };
+            detail::gmatch_aux( ms, ms.filter, pos, last_match );
+            mr = MR( full, c.s.begin );
+        }
+
+        return *this;
+    }
+
+    bool operator ==( const compiled_gmatch_iterator & other ) const noexcept
+    {
+        return c == other.c && pos == other.pos;
+    }
+
+    bool operator !=( const compiled_gmatch_iterator & other ) const noexcept
+    {
+        return !( *this == other );
+    }
+
+    /**
+     * \brief Dereferences to a match result.
+     */
+    const auto & operator *() const noexcept
+    {
+        return mr;
+    }
+
+    /**
+     * \brief Returns a pointer to a match result.
+     */
+    const auto operator ->() const noexcept
+    {
+        return &mr;
+    }
+
+private:
+
+    const compiled_context< StrCharT, PatCharT, MR > c;
+    const StrCharT *                                 pos        = nullptr;
+    const StrCharT *                                 last_match = nullptr;
+    MR                                               mr;
+};
+
+/**
+ * \brief Returns a pg::lex::compiled_gmatch_iterator of a compiled context object.
+ *
+ * \see pg::lex::begin
+ */
+template< typename StrCharT, typename PatCharT, typename MR >
+auto begin( const compiled_context< StrCharT, PatCharT, MR > & c )
+{
+    auto it = compiled_gmatch_iterator( c, c.s.begin );
+    return ++it;
+}
+
+/**
+ * \brief Returns a pg::lex::compiled_gmatch_iterator that indicates the end of a compiled context.
+ *
+ * \see pg::lex::end
+ */
+template< typename StrCharT, typename PatCharT, typename MR >
+auto end( const compiled_context< StrCharT, PatCharT, MR > & c ) noexcept
+{
+    return compiled_gmatch_iterator( c, c.s.end + 1 );
+}
+
+namespace detail
+{
+
+template< typename Result, typename StrT, typename PatCharT, typename ReplT,
+          typename std::enable_if< string_traits< ReplT >::is_string, int >::type = 0 >
+void gsub_into( Result & result, StrT&& str, const basic_pattern< PatCharT > & pat, ReplT&& repl, int count, const match_options & opts )
+{
+    using str_char_type  = typename string_traits< StrT >::char_type;
+    using repl_char_type = typename string_traits< ReplT >::char_type;
+
+    const string_context< repl_char_type > r  = { repl };
+    const compiled_context                 c  = { std::forward< StrT >( str ), pat };
+    basic_match_result< str_char_type >    mr;
+    compiled_match_state                   ms = { c.s.begin, c.s.end, pat, mr, opts };
+
+    gsub_aux( ms, pat.anchored(), ms.filter, count, result, [ & ]( auto &result, auto s, auto e )
+    {
+        add_s( result, ms, s, e, r );
+    } );
+}
+
+template< typename Result, typename StrT, typename PatCharT, typename Function,
+          typename std::enable_if< !string_traits< Function >::is_string &&
+                                   !is_replacement< Function >::value, int >::type = 0 >
+void gsub_into( Result & result, StrT&& str, const basic_pattern< PatCharT > & pat, Function&& func, int count, const match_options & opts )
+{
+    using str_char_type = typename string_traits< StrT >::char_type;
+
+    const compiled_context              c  = { std::forward< StrT >( str ), pat };
+    basic_match_result< str_char_type > mr;
+    compiled_match_state                ms = { c.s.begin, c.s.end, pat, mr, opts };
+
+    gsub_aux( ms, pat.anchored(), ms.filter, count, result, [ & ]( auto &result, auto, auto )
+    {
+        add_f< str_char_type >( result, func, mr );
+    } );
+}
+
+template< typename Result, typename StrT, typename PatCharT, typename ReplCharT >
+void gsub_into( Result & result, StrT&& str, const basic_pattern< PatCharT > & pat, const basic_replacement< ReplCharT > & repl, int count, const match_options & opts )
+{
+    using str_char_type = typename string_traits< StrT >::char_type;
+
+    if( repl.max_capture() > std::max< size_t >( pat.captures(), 1 ) )  /* %1 is the whole match of a pattern without captures */
+    {
+        throw lex_error( capture_invalid_index );
+    }
+
+    const compiled_context              c  = { std::forward< StrT >( str ), pat };
+    basic_match_result< str_char_type > mr;
+    compiled_match_state                ms = { c.s.begin, c.s.end, pat, mr, opts };
+
+    gsub_aux( ms, pat.anchored(), ms.filter, count, result, [ & ]( auto &result, auto s, auto e )
+    {
+        add_r( result, ms, s, e, repl );
+    } );
+}
+
+}
+
+/**
+ * \brief Substitutes a replacement for a match of a compiled pattern found in the input string.
+ *
+ * \param str   The input string
+ * \param pat   The compiled pattern used to find matches in the input string
+ * \param repl  The replacement pattern that substitutes the match.
+ * \param count The maximum number of substitutes; negative for unlimited an unlimited count.
+ * \param opts  The options of the matcher.
+ *
+ * \return returns a std::string based on the character type of the input string
+ */
+template< typename StrT, typename PatCharT, typename ReplT,
+          typename std::enable_if< detail::string_traits< ReplT >::is_string, int >::type = 0 >
+auto gsub( StrT&& str, const basic_pattern< PatCharT > & pat, ReplT&& repl, int count = -1, const match_options & opts = {} )
+{
+    std::basic_string< typename detail::string_traits< StrT >::char_type > result;
+    detail::gsub_into( result, std::forward< StrT >( str ), pat, std::forward< ReplT >( repl ), count, opts );
+
+    return result;
+}
+
+/**
+ * \brief Substitutes a replacement for a match of a compiled pattern found in the input string.
+ *
+ * \param str   The input string
+ * \param pat   The compiled pattern used to find matches in the input string
+ * \param repl  A function that accepts a match result and returns the replacement.
+ * \param count The maximum number of substitutes; negative for unlimited an unlimited count.
+ * \param opts  The options of the matcher.
+ *
+ * \return returns a std::string based on the character type of the input string
+ */
+template< typename StrT, typename PatCharT, typename Function,
+          typename std::enable_if< !detail::string_traits< Function >::is_string &&
+                                   !detail::is_replacement< Function >::value, int >::type = 0 >
+auto gsub( StrT&& str, const basic_pattern< PatCharT > & pat, Function&& func, int count = -1, const match_options & opts = {} )
+{
+    std::basic_string< typename detail::string_traits< StrT >::char_type > result;
+    detail::gsub_into( result, std::forward< StrT >( str ), pat, std::forward< Function >( func ), count, opts );
+
+    return result;
+}
+
+/**
+ * \brief Substitutes a decoded replacement for a match of a compiled pattern found in the input string.
+ *
+ * The capture indices of the replacement are checked against the captures of the pattern before matching.
+ *
+ * \param str   The input string
+ * \param pat   The compiled pattern used to find matches in the input string
+ * \param repl  The decoded replacement that substitutes the match.
+ * \param count The maximum number of substitutes; negative for unlimited an unlimited count.
+ * \param opts  The options of the matcher.
+ *
+ * \return returns a std::string based on the character type of the input string
+ */
+template< typename StrT, typename PatCharT, typename ReplCharT >
+auto gsub( StrT&& str, const basic_pattern< PatCharT > & pat, const basic_replacement< ReplCharT > & repl, int count = -1, const match_options & opts = {} )
+{
+    std::basic_string< typename detail::string_traits< StrT >::char_type > result;
+    detail::gsub_into( result, std::forward< StrT >( str ), pat, repl, count, opts );
+
+    return result;
+}
+
+namespace detail
+{
+
+/* An item of a static pattern; like a pattern item, but a set stores its members in the entries of the program */
+struct static_item
+{
+    item_type   type          = item_type::single;
+    class_type  cls           = class_type::literal;
+    quantifier  quant         = quantifier::one;
+    char32_t    c             = 0;  /* the literal, the class letter or the open char of '%b' */
+    char32_t    c2            = 0;  /* the close char of '%b' */
+    int         capture_index = 0;  /* index of a capture or of a back-reference */
+    std::size_t first         = 0;  /* the first entry of a set or a frontier */
+    std::size_t count         = 0;  /* the number of entries of a set or a frontier */
+    bool        negated       = false;
+};
+
+/* A member of a set of a static pattern; a single char is stored as a range of one char */
+struct static_entry
+{
+    bool     is_class = false;
+    char32_t lo       = 0;  /* the first char of the range or the class letter */
+    char32_t hi       = 0;
+};
+
+/* The decoded items of a static pattern; a pattern of N chars has at most N items and N set entries */
+template< std::size_t N >
+struct static_program
+{
+    static_item  items[ N + 1 ]   = {};
+    static_entry entries[ N + 1 ] = {};
+    std::size_t  size             = 0;
+    std::size_t  entry_count      = 0;
+    int          level            = 0;  /* number of captures in the pattern */
+    bool         anchor           = false;
+
+    constexpr bool back_references() const noexcept
+    {
+        for( std::size_t i = 0 ; i < size ; ++i )
+        {
+            if( items[ i ].type == item_type::back_reference )
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+/* Returns the index of the char after the single char class at index 'p'; the constexpr counterpart of compile_classend */
+template< typename CharT >
+constexpr std::size_t static_classend( std::basic_string_view< CharT > pat, std::size_t p )
+{
+    switch( pat[ p++ ] )
+    {
+    case '%':
+        if( p == pat.size() )
+        {
+            throw lex_error( pattern_ends_with_percent );
+        }
+        return p + 1;
+
+    case '[':
+        if( p < pat.size() && pat[ p ] == '^' )
+        {
+            ++p;
+        }
+        do  /* look for a ']' */
+        {
+            if( p == pat.size() )
+            {
+                throw lex_error( pattern_missing_closing_bracket );
+            }
+            if( pat[ p++ ] == '%' && p < pat.size() )
+            {
+                ++p;  /* skip escapes (e.g. '%]') */
+            }
+        } while( p == pat.size() || pat[ p ] != ']' );
+
+        return p + 1;
+
+    default:
+        return p;
+    }
+}
+
+/* Decodes the set from index 'p' up to the ']' at index 'ep' in the entries of the program; the constexpr counterpart of compile_set */
+template< typename CharT, std::size_t N >
+constexpr void static_set( static_program< N > & prog, static_item & item, std::basic_string_view< CharT > pat, std::size_t p, std::size_t ep )
+{
+    using char_type = typename std::make_unsigned< CharT >::type;
+
+    const auto at = [ & ]( std::size_t i ){ return static_cast< char32_t >( static_cast< char_type >( pat[ i ] ) ); };
+
+    item.first = prog.entry_count;
+    if( pat[ p + 1 ] == '^' )
+    {
+        item.negated = true;
+        p++;  /* skip the '^' */
+    }
+    while( ++p < ep )
+    {
+        auto & entry = prog.entries[ prog.entry_count++ ];
+        if( pat[ p ] == '%' )
+        {
+            p++;
+            entry = { is_class( pat[ p ] ), at( p ), at( p ) };
+        }
+        else if( ( pat[ p + 1 ] == '-' ) && ( p + 2 < ep ) )
+        {
+            p += 2;
+            entry = { false, at( p - 2 ), at( p ) };
+        }
+        else
+        {
+            entry = { false, at( p ), at( p ) };
+        }
+    }
+    item.count = prog.entry_count - item.first;
+}
+
+/*
+ * Decodes a static pattern in a constant expression; the constexpr counterpart of compile.
+ * A malformed pattern throws, which is not a constant expression, so the error is reported by the compiler.
+ */
+template< std::size_t N, typename CharT >
+constexpr static_program< N > compile_static( std::basic_string_view< CharT > pat )
+{
+    using char_type = typename std::make_unsigned< CharT >::type;
+
+    const auto at = [ & ]( std::size_t i ){ return static_cast< char32_t >( static_cast< char_type >( pat[ i ] ) ); };
+
+    static_program< N > prog;
+    bool                finished[ MAXCAPTURES ] = {};
+    int                 level                   = 0;
+
+    std::size_t p         = 0;
+    const std::size_t end = pat.size();
+    if( p < end && pat[ p ] == '^' )
+    {
+        prog.anchor = true;
+        ++p;
+    }
+
+    while( p < end )
+    {
+        static_item item;
+
+        switch( pat[ p ] )
+        {
+        case '(':  /* start capture */
+            if( level >= MAXCAPTURES )
+            {
+                throw lex_error( capture_too_many );
+            }
+            item.capture_index = level;
+            if( p + 1 < end && pat[ p + 1 ] == ')' )
+            {
+                item.type         = item_type::position_capture;
+                finished[ level ] = true;
+                p += 2;
+            }
+            else
+            {
+                item.type         = item_type::start_capture;
+                finished[ level ] = false;
+                ++p;
+            }
+            ++level;
+            prog.items[ prog.size++ ] = item;
+            continue;
+
+        case ')':  /* end capture */
+            item.capture_index = level - 1;
+            while( item.capture_index >= 0 && finished[ item.capture_index ] )
+            {
+                --item.capture_index;
+            }
+            if( item.capture_index < 0 )
+            {
+                throw lex_error( capture_invalid_pattern );
+            }
+            item.type                      = item_type::end_capture;
+            finished[ item.capture_index ] = true;
+            ++p;
+            prog.items[ prog.size++ ] = item;
+            continue;
+
+        case '$':
+            if( p + 1 == end )  /* is the '$' the last char in pattern? */
+            {
+                item.type = item_type::end_anchor;
+                ++p;
+                prog.items[ prog.size++ ] = item;
+                continue;
+            }
+            break;
+
+        case '%':  /* escaped sequences not in the format class[*+?-]? */
+            if( p + 1 == end )
+            {
+                throw lex_error( pattern_ends_with_percent );
+            }
+            switch( pat[ p + 1 ] )
+            {
+            case 'b':  /* balanced string? */
+                if( p + 3 >= end )
+                {
+                    throw lex_error( balanced_no_arguments );
+                }
+                item.type = item_type::balance;
+                item.c    = at( p + 2 );
+                item.c2   = at( p + 3 );
+                p += 4;
+                prog.items[ prog.size++ ] = item;
+                continue;
+
+            case 'f':  /* frontier? */
+                p += 2;
+                if( p == end || pat[ p ] != '[' )
+                {
+                    throw lex_error( frontier_no_open_bracket );
+                }
+                else
+                {
+                    const auto ep = static_classend( pat, p );
+                    item.type = item_type::frontier;
+                    static_set( prog, item, pat, p, ep - 1 );
+                    p = ep;
+                }
+                prog.items[ prog.size++ ] = item;
+                continue;
+
+            case '0': case '1': case '2': case '3': case '4':
+            case '5': case '6': case '7': case '8': case '9':  /* capture results (%0-%9)? */
+                item.type          = item_type::back_reference;
+                item.capture_index = static_cast< int >( pat[ p + 1 ] ) - '1';
+                if( item.capture_index < 0 || item.capture_index >= level || !finished[ item.capture_index ] )
+                {
+                    throw lex_error( capture_invalid_index );
+                }
+                p += 2;
+                prog.items[ prog.size++ ] = item;
+                continue;
+            }
+            break;
+        }
+
+        /* pattern class plus optional suffix */
+        const auto ep = static_classend( pat, p );
+        switch( pat[ p ] )
+        {
+        case '.':
+            item.cls = class_type::any;
+            break;
+
+        case '%':
+            item.c = at( p + 1 );
+            if( is_class( pat[ p + 1 ] ) )
+            {
+                item.cls = class_type::escape;
+            }
+            break;
+
+        case '[':
+            item.cls = class_type::set;
+            static_set( prog, item, pat, p, ep - 1 );
+            break;
+
+        default:
+            item.c = at( p );
+            break;
+        }
+
+        p = ep;
+        if( p < end )
+        {
+            switch( pat[ p ] )
+            {
+            case '?': item.quant = quantifier::optional; ++p; break;
+            case '*': item.quant = quantifier::star;     ++p; break;
+            case '+': item.quant = quantifier::plus;     ++p; break;
+            case '-': item.quant = quantifier::minus;    ++p; break;
+            }
+        }
+        prog.items[ prog.size++ ] = item;
+    }
+
+    for( int i = 0 ; i < level ; ++i )
+    {
+        if( !finished[ i ] )
+        {
+            throw lex_error( capture_not_finished );
+        }
+    }
+    prog.level = level;
+
+    return prog;
+}
+
+/* The class mode of a source of a static pattern; the classes of the locale when it has no 'static constexpr class_mode classes' member */
+template< typename Source, typename = void >
+struct source_classes : std::integral_constant< class_mode, class_mode::locale > {};
+
+template< typename Source >
+struct source_classes< Source, std::void_t< decltype( Source::classes ) > > : std::integral_constant< class_mode, Source::classes > {};
+
+/* The decoded program of the pattern of 'Source', a type with a 'static constexpr std::basic_string_view value' member */
+template< typename Source >
+struct static_code
+{
+    using char_type = typename decltype( Source::value )::value_type;
+
+    static constexpr class_mode classes = source_classes< Source >::value;
+
+    static constexpr auto program = compile_static< Source::value.size() >( std::basic_string_view< char_type >( Source::value ) );
+
+    /* The prefilter of the search loops, the same as the one of the pattern compiled at run time */
+    static const prefilter< char_type > & filter()
+    {
+        static const auto f = []
+        {
+            std::vector< pattern_item< char_type > > items;
+            std::vector< bracket_set< char_type > >  sets;
+            compile( pattern_context< char_type >( Source::value ), items, sets, classes );
+            return analyse_prefix( items, sets );
+        }();
+        return f;
+    }
+};
+
+/* Tests a char against class 'Cl' like match_class does; the class is selected when the matcher is instantiated */
+template< char32_t Cl, class_mode Classes >
+bool static_class( char32_t c ) noexcept
+{
+    constexpr bool complement = Cl >= 'A' && Cl <= 'Z';
+    constexpr auto lower      = complement ? Cl - 'A' + 'a' : Cl;
+
+    if constexpr( Classes != class_mode::locale )
+    {
+        constexpr auto wanted = class_bits_of( static_cast< int >( Cl ) );
+
+        std::uint16_t bits = 0;
+        if( c < 128 )
+        {
+            bits = ascii_classes.bits[ c ];
+        }
+        else if( Classes == class_mode::unicode )
+        {
+            bits = unicode_class_bits( c );
+        }
+        return static_cast< bool >( bits & wanted ) != complement;
+    }
+
+    if( c > UCHAR_MAX )  /* the <cctype> functions are only defined for the values of an unsigned char */
+    {
+        return complement;
+    }
+
+    const auto i = static_cast< int >( c );
+    bool res     = false;
+    if constexpr( lower == 'a' )      { res = std::isalpha( i ); }
+    else if constexpr( lower == 'c' ) { res = std::iscntrl( i ); }
+    else if constexpr( lower == 'd' ) { res = std::isdigit( i ); }
+    else if constexpr( lower == 'g' ) { res = std::isgraph( i ); }
+    else if constexpr( lower == 'l' ) { res = std::islower( i ); }
+    else if constexpr( lower == 'p' ) { res = std::ispunct( i ); }
+    else if constexpr( lower == 's' ) { res = std::isspace( i ); }
+    else if constexpr( lower == 'u' ) { res = std::isupper( i ); }
+    else if constexpr( lower == 'w' ) { res = std::isalnum( i ); }
+    else if constexpr( lower == 'x' ) { res = std::isxdigit( i ); }
+    else                              { res = ( i == 0 ); }  /* 'z' */
+
+    return res != complement;
+}
+
+template< typename Code, std::size_t E >
+bool static_entry_test( char32_t c ) noexcept
+{
+    constexpr auto entry = Code::program.entries[ E ];
+
+    if constexpr( entry.is_class )
+    {
+        return static_class< entry.lo, Code::classes >( c );
+    }
+    else if constexpr( entry.lo == entry.hi )
+    {
+        return c == entry.lo;
+    }
+    else
+    {
+        return entry.lo <= c && c <= entry.hi;
+    }
+}
+
+/* Tests if a char is a member of the set of item I; the entries are folded in one expression */
+template< typename Code, std::size_t I, std::size_t... K >
+bool static_set_test( char32_t c, std::index_sequence< K... > ) noexcept
+{
+    constexpr auto item = Code::program.items[ I ];
+
+    return ( static_entry_test< Code, item.first + K >( c ) || ... ) != item.negated;
+}
+
+/* Tests if a char matches the single char class of item I */
+template< typename Code, std::size_t I >
+bool static_single( [[maybe_unused]] char32_t c ) noexcept
+{
+    constexpr auto item = Code::program.items[ I ];
+
+    if constexpr( item.cls == class_type::any )
+    {
+        return true;
+    }
+    else if constexpr( item.cls == class_type::literal )
+    {
+        return c == item.c;
+    }
+    else if constexpr( item.cls == class_type::escape )
+    {
+        return static_class< item.c, Code::classes >( c );
+    }
+    else
+    {
+        return static_set_test< Code, I >( c, std::make_index_sequence< item.count >() );
+    }
+}
+
+template< typename StrCharT >
+char32_t static_char( const StrCharT * s ) noexcept
+{
+    return static_cast< char32_t >( static_cast< typename std::make_unsigned< StrCharT >::type >( *s ) );
+}
+
+/*
+ * Matches item I and the items that follow it from position 's'.
+ * Every item is a separate instantiation so there is no dispatch on the item type;
+ * an item only calls the matchers of the items after it so the recursion is not deeper than the number of items.
+ */
+template< typename Code, std::size_t I, typename MS, typename StrCharT >
+const StrCharT * static_match( MS &ms, const StrCharT * s )
+{
+    if constexpr( I == Code::program.size )
+    {
+        return s;
+    }
+    else
+    {
+        constexpr auto item = Code::program.items[ I ];
+
+        ms.step();
+        ms.count( &match_stats::match_calls );
+
+        if constexpr( ( item.type == item_type::start_capture || item.type == item_type::position_capture || item.type == item_type::end_capture ) &&
+                      MS::skip_captures )
+        {
+            return static_match< Code, I + 1 >( ms, s );
+        }
+        else if constexpr( item.type == item_type::start_capture || item.type == item_type::position_capture )
+        {
+            auto & cap = ms.captures[ item.capture_index ];
+            cap.init   = s;
+            cap.len    = item.type == item_type::position_capture ? cap_state::position : cap_state::unfinished;
+            ++ms.level;
+
+            auto res = static_match< Code, I + 1 >( ms, s );
+            if( !res )
+            {
+                // Undo capture when the match has failed
+                --ms.level;
+                cap.len = cap_state::unfinished;
+            }
+            return res;
+        }
+        else if constexpr( item.type == item_type::end_capture )
+        {
+            auto & cap = ms.captures[ item.capture_index ];
+            cap.len    = static_cast< long >( s - cap.init );
+
+            auto res = static_match< Code, I + 1 >( ms, s );
+            if( !res )
+            {
+                // Undo capture when the match has failed
+                cap.len = cap_state::unfinished;
+            }
+            return res;
+        }
+        else if constexpr( item.type == item_type::end_anchor )
+        {
+            return ( s == ms.s_end ) ? s : nullptr;  /* check end of string */
+        }
+        else if constexpr( item.type == item_type::balance )
+        {
+            if( s >= ms.s_end || static_char( s ) != item.c )
+            {
+                return nullptr;
+            }
+            int count = 1;
+            while( ++s < ms.s_end )
+            {
+                const auto c = static_char( s );
+                if( c == item.c2 )
+                {
+                    if( --count == 0 )
+                    {
+                        return static_match< Code, I + 1 >( ms, s + 1 );
+                    }
+                }
+                else if( c == item.c )
+                {
+                    ++count;
+                }
+            }
+            return nullptr;
+        }
+        else if constexpr( item.type == item_type::frontier )
+        {
+            const auto previous = ( s == ms.s_begin ) ? char32_t( 0 ) : static_char( s - 1 );
+            const auto current  = ( s < ms.s_end ) ? static_char( s ) : char32_t( 0 );
+            constexpr auto seq  = std::make_index_sequence< item.count >();
+
+            if( !static_set_test< Code, I >( previous, seq ) && static_set_test< Code, I >( current, seq ) )
+            {
+                return static_match< Code, I + 1 >( ms, s );
+            }
+            return nullptr;
+        }
+        else if constexpr( item.type == item_type::back_reference )
+        {
+            const auto & cap = ms.captures[ item.capture_index ];
+            const size_t len = cap.len;
+            if( static_cast< size_t >( ms.s_end - s ) >= len &&
+                memcmp( cap.init, s, len * sizeof( StrCharT ) ) == 0 )
+            {
+                return static_match< Code, I + 1 >( ms, s + len );
+            }
+            return nullptr;
+        }
+        else if constexpr( item.quant == quantifier::one )
+        {
+            if( s < ms.s_end && static_single< Code, I >( static_char( s ) ) )
+            {
+                return static_match< Code, I + 1 >( ms, s + 1 );
+            }
+            return nullptr;
+        }
+        else if constexpr( item.quant == quantifier::optional )
+        {
+            if( s < ms.s_end && static_single< Code, I >( static_char( s ) ) )
+            {
+                if( auto res = static_match< Code, I + 1 >( ms, s + 1 ) )
+                {
+                    return res;
+                }
+            }
+            return static_match< Code, I + 1 >( ms, s );
+        }
+        else if constexpr( item.quant == quantifier::minus )
+        {
+            for( ; ; )
+            {
+                if( auto res = static_match< Code, I + 1 >( ms, s ) )
+                {
+                    return res;
+                }
+                else if( s < ms.s_end && static_single< Code, I >( static_char( s ) ) )
+                {
+                    ms.count( &match_stats::min_expansions );
+                    ++s;
+                }
+                else
+                {
+                    return nullptr;
+                }
+            }
+        }
+        else  /* '*' or '+' */
+        {
+            ptrdiff_t i = 0;
+            if constexpr( item.cls == class_type::any )
+            {
+                i = ms.s_end - s;
+            }
+            else
+            {
+                while( s + i < ms.s_end && static_single< Code, I >( static_char( s + i ) ) )
+                {
+                    ++i;
+                }
+            }
+            /* keeps trying to match with the maximum repetitions */
+            constexpr ptrdiff_t min      = item.quant == quantifier::plus ? 1 : 0;
+            const bool          repeated = i > 0;  /* like the interpreter, only the retries of a repetition that matched at least once are counted */
+            for( ; i >= min ; --i )
+            {
+                if( auto res = static_match< Code, I + 1 >( ms, s + i ) )
+                {
+                    return res;
+                }
+                if( repeated )
+                {
+                    ms.count( &match_stats::max_backtracks );
+                }
+            }
+            return nullptr;
+        }
+    }
+}
+
+template< typename StrCharT, typename Code, typename MR >
+struct static_match_state : match_state< StrCharT, typename Code::char_type, MR >
+{
+    static_match_state( const StrCharT * str_begin, const StrCharT * str_end, MR &mr, const match_options & opts = {} )
+        : match_state< StrCharT, typename Code::char_type, MR >( str_begin, str_end, nullptr, nullptr, mr, code_units( opts ) )
+    {}
+
+    /* A static pattern matches the code units of the input string */
+    static match_options code_units( match_options opts ) noexcept
+    {
+        opts.utf8 = false;
+        return opts;
+    }
+
+    void check_captures() const noexcept
+    {
+        // The captures of a static pattern are checked when the pattern is compiled.
+    }
+};
+
+template< typename StrCharT, typename Code, typename MR >
+const StrCharT * start_match( static_match_state< StrCharT, Code, MR > &ms, const StrCharT * s )
+{
+    ms.count( &match_stats::starts );
+    return static_match< Code, 0 >( ms, s );
+}
+
+#if defined( __cpp_nontype_template_args ) && __cpp_nontype_template_args >= 201911L
+
+/* A string literal that can be a template argument */
+template< typename CharT, std::size_t N >
+struct fixed_string
+{
+    constexpr fixed_string( const CharT ( & str )[ N ] ) noexcept
+    {
+        for( std::size_t i = 0 ; i < N ; ++i )
+        {
+            chars[ i ] = str[ i ];
+        }
+    }
+
+    using char_type = CharT;
+
+    static constexpr std::size_t size = N - 1;  /* without the terminating null char */
+
+    CharT chars[ N ] = {};
+};
+
+template< fixed_string Pattern, class_mode Classes >
+struct literal_source
+{
+    static constexpr std::basic_string_view< typename decltype( Pattern )::char_type > value = { Pattern.chars, decltype( Pattern )::size };
+
+    static constexpr class_mode classes = Classes;
+};
+
+#else
+
+/* A constexpr char array with static storage duration as the source of a static pattern */
+template< const auto & Pattern, class_mode Classes >
+struct literal_source
+{
+    using array_type = typename std::remove_reference< decltype( Pattern ) >::type;
+
+    static constexpr std::basic_string_view< typename std::remove_const< typename std::remove_extent< array_type >::type >::type > value =
+        { Pattern, std::extent< array_type >::value - 1 };  /* without the terminating null char */
+
+    static constexpr class_mode classes = Classes;
+};
+
+#endif
+
+}
+
+/**
+ * \brief A pattern that is compiled when the program is compiled.
+ *
+ * The pattern is decoded in a constant expression and every item of the pattern is matched by its own template instantiation.
+ * A malformed pattern is a compile error instead of a pg::lex::lex_error at run time.
+ * The match functions of a static pattern don't recurse deeper than the number of items, match_options::max_depth does not apply.
+ *
+ * \tparam Source A type with a 'static constexpr std::basic_string_view value' member that is the pattern.
+ *
+ * \see pg::lex::static_pattern
+ */
+template< typename Source >
+class basic_static_pattern
+{
+    using code = detail::static_code< Source >;
+
+public:
+
+    using char_type = typename code::char_type;
+
+    /**
+     * \brief Returns the number of captures in the pattern.
+     */
+    static constexpr size_t captures() noexcept { return code::program.level; }
+
+    /**
+     * \brief Returns true when the pattern is anchored at the begin of the input string.
+     */
+    static constexpr bool anchored() noexcept { return code::program.anchor; }
+
+    /**
+     * \brief Returns true when the pattern refers to a capture with '%1' - '%9'.
+     */
+    static constexpr bool has_back_references() noexcept { return code::program.back_references(); }
+};
+
+/**
+ * \brief A static pattern of a string literal or of a constexpr char array.
+ *
+ * Before C++20 the pattern must be a constexpr char array with static storage duration;
+ * C++20 accepts string literals too, e.g. static_pattern< "%d+" >.
+ * 'Classes' selects the definition of the character classes of the pattern.
+ */
+#if defined( __cpp_nontype_template_args ) && __cpp_nontype_template_args >= 201911L
+template< detail::fixed_string Pattern, class_mode Classes = class_mode::locale >
+using static_pattern = basic_static_pattern< detail::literal_source< Pattern, Classes > >;
+#else
+template< const auto & Pattern, class_mode Classes = class_mode::locale >
+using static_pattern = basic_static_pattern< detail::literal_source< Pattern, Classes > >;
+#endif
+
+/**
+ * \brief A static context is an input string combined with a static pattern.
+ *
+ * You can iterate over all matches in a string calling the pg::lex::begin and pg::lex::end functions with a static context object.
+ *
+ * \note A static context keeps a reference to the input string.
+ *
+ * \see pg::lex::gmatch
+ */
+template< typename StrCharT, typename Source >
+struct static_context
+{
+    const detail::string_context< StrCharT > s;
+    const basic_static_pattern< Source >     p;
+    const match_options                      options;
+
+    template< typename StrT >
+    static_context( StrT && s_, basic_static_pattern< Source > p_, const match_options & opts = {} ) noexcept
+        : s( std::forward< StrT >( s_ ) )
+        , p( p_ )
+        , options( opts )
+    {
+        static_assert( detail::string_traits< StrT >::is_string, "String is not one of the supported string-like types!" );
+    }
+
+    bool operator ==( const static_context & other ) const noexcept
+    {
+        return s.begin == other.s.begin && s.end == other.s.end;
+    }
+};
+
+template< typename StrT, typename Source >
+static_context( StrT &&, basic_static_pattern< Source > ) noexcept ->
+static_context< typename detail::string_traits< StrT >::char_type, Source >;
+
+template< typename StrT, typename Source >
+static_context( StrT &&, basic_static_pattern< Source >, const match_options & ) noexcept ->
+static_context< typename detail::string_traits< StrT >::char_type, Source >;
+
+/**
+ * \brief Searches for the first match of a static pattern in an input string.
+ *
+ * \return Returns a match result based on the character type of the input string.
+ */
+template< typename StrT, typename Source >
+auto match( StrT&& str, basic_static_pattern< Source > pat, const match_options & opts = {} )
+{
+    using str_char_type = typename detail::string_traits< StrT >::char_type;
+    using code          = detail::static_code< Source >;
+    using result_type   = basic_match_result< str_char_type >;
+
+    const static_context                                       c  = { std::forward< StrT >( str ), pat };
+    result_type                                                mr;
+    detail::static_match_state< str_char_type, code, result_type > ms = { c.s.begin, c.s.end, mr, opts };
+
+    detail::find_aux( ms, pat.anchored(), code::filter() );
+
+    return mr;
+}
+
+/**
+ * \brief An iterator for pg::lex::static_context objects.
+ *
+ * \see pg::lex::static_context
+ * \see pg::lex::begin
+ */
+template< typename StrCharT, typename Source >
+struct static_gmatch_iterator
+{
+    static_gmatch_iterator( const static_context< StrCharT, Source >& ctx, const StrCharT * start ) noexcept
+        : c( ctx )
+        , pos( start )
+    {}
+
+    /**
+     * \brief Iterates to the next match in the context.
+     *
+     * The match result is empty when the end is reached.
+     */
+    static_gmatch_iterator& operator ++()
+    {
+        using code = detail::static_code< Source >;
+
+        detail::static_match_state< StrCharT, code, basic_match_result< StrCharT > > ms = { c.s.begin, c.s.end, mr, c.options };
+        detail::gmatch_aux( ms, code::filter(), pos, last_match );
+
+        return *this;
+    }
+
+    bool operator ==( const static_gmatch_iterator & other ) const noexcept
+    {
+        return c == other.c && pos == other.pos;
+    }
+
+    bool operator !=( const static_gmatch_iterator & other ) const noexcept
+    {
+        return !( *this == other );
+    }
+
+    /**
+     * \brief Dereferences to a match result.
+     */
+    const auto & operator *() const noexcept
+    {
+        return mr;
+    }
+
+    /**
+     * \brief Returns a pointer to a match result.
+     */
+    const auto operator ->() const noexcept
+    {
+        return &mr;
+    }
+
+private:
+
+    const static_context< StrCharT, Source > c;
+    const StrCharT *                         pos        = nullptr;
+    const StrCharT *                         last_match = nullptr;
+    basic_match_result< StrCharT >           mr;
+};
+
+/**
+ * \brief Returns a static context to iterate over the matches of a static pattern in an input string.
+ *
+ * \see pg::lex::static_context
+ */
+template< typename StrT, typename Source >
+auto gmatch( StrT&& str, basic_static_pattern< Source > pat, const match_options & opts = {} ) noexcept
+{
+    return static_context( std::forward< StrT >( str ), pat, opts );
+}
+
+/**
+ * \brief Returns a pg::lex::static_gmatch_iterator of a static context object.
+ *
+ * \see pg::lex::begin
+ */
+template< typename StrCharT, typename Source >
+auto begin( const static_context< StrCharT, Source > & c )
+{
+    auto it = static_gmatch_iterator( c, c.s.begin );
+    return ++it;
+}
+
+/**
+ * \brief Returns a pg::lex::static_gmatch_iterator that indicates the end of a static context.
+ *
+ * \see pg::lex::end
+ */
+template< typename StrCharT, typename Source >
+auto end( const static_context< StrCharT, Source > & c ) noexcept
+{
+    return static_gmatch_iterator( c, c.s.end + 1 );
+}
+
+namespace detail
+{
+
+template< typename Result, typename StrT, typename Source, typename ReplT,
+          typename std::enable_if< string_traits< ReplT >::is_string, int >::type = 0 >
+void gsub_into( Result & result, StrT&& str, basic_static_pattern< Source > pat, ReplT&& repl, int count, const match_options & opts )
+{
+    using str_char_type  = typename string_traits< StrT >::char_type;
+    using repl_char_type = typename string_traits< ReplT >::char_type;
+    using code           = static_code< Source >;
+    using result_type    = basic_match_result< str_char_type >;
+
+    const string_context< repl_char_type >                 r  = { repl };
+    const static_context                                   c  = { std::forward< StrT >( str ), pat };
+    result_type                                            mr;
+    static_match_state< str_char_type, code, result_type > ms = { c.s.begin, c.s.end, mr, opts };
+
+    gsub_aux( ms, pat.anchored(), code::filter(), count, result, [ & ]( auto &result, auto s, auto e )
+    {
+        add_s( result, ms, s, e, r );
+    } );
+}
+
+template< typename Result, typename StrT, typename Source, typename Function,
+          typename std::enable_if< !string_traits< Function >::is_string &&
+                                   !is_replacement< Function >::value, int >::type = 0 >
+void gsub_into( Result & result, StrT&& str, basic_static_pattern< Source > pat, Function&& func, int count, const match_options & opts )
+{
+    using str_char_type = typename string_traits< StrT >::char_type;
+    using code          = static_code< Source >;
+    using result_type   = basic_match_result< str_char_type >;
+
+    const static_context                                   c  = { std::forward< StrT >( str ), pat };
+    result_type                                            mr;
+    static_match_state< str_char_type, code, result_type > ms = { c.s.begin, c.s.end, mr, opts };
+
+    gsub_aux( ms, pat.anchored(), code::filter(), count, result, [ & ]( auto &result, auto, auto )
+    {
+        add_f< str_char_type >( result, func, mr );
+    } );
+}
+
+template< typename Result, typename StrT, typename Source, typename ReplCharT >
+void gsub_into( Result & result, StrT&& str, basic_static_pattern< Source > pat, const basic_replacement< ReplCharT > & repl, int count, const match_options & opts )
+{
+    using str_char_type = typename string_traits< StrT >::char_type;
+    using code          = static_code< Source >;
+    using result_type   = basic_match_result< str_char_type >;
+
+    const static_context                                   c  = { std::forward< StrT >( str ), pat };
+    result_type                                            mr;
+    static_match_state< str_char_type, code, result_type > ms = { c.s.begin, c.s.end, mr, opts };
+
+    gsub_aux( ms, pat.anchored(), code::filter(), count, result, [ & ]( auto &result, auto s, auto e )
+    {
+        add_r( result, ms, s, e, repl );
+    } );
+}
+
+}
+
+/**
+ * \brief Substitutes a replacement for a match of a static pattern found in the input string.
+ *
+ * \param str   The input string
+ * \param pat   The static pattern used to find matches in the input string
+ * \param repl  The replacement pattern that substitutes the match.
+ * \param count The maximum number of substitutes; negative for unlimited an unlimited count.
+ * \param opts  The options of the matcher.
+ *
+ * \return returns a std::string based on the character type of the input string
+ */
+template< typename StrT, typename Source, typename ReplT,
+          typename std::enable_if< detail::string_traits< ReplT >::is_string, int >::type = 0 >
+auto gsub( StrT&& str, basic_static_pattern< Source > pat, ReplT&& repl, int count = -1, const match_options & opts = {} )
+{
+    std::basic_string< typename detail::string_traits< StrT >::char_type > result;
+    detail::gsub_into( result, std::forward< StrT >( str ), pat, std::forward< ReplT >( repl ), count, opts );
+
+    return result;
+}
+
+/**
+ * \brief Substitutes a replacement for a match of a static pattern found in the input string.
+ *
+ * \param str   The input string
+ * \param pat   The static pattern used to find matches in the input string
+ * \param repl  A function that accepts a match result and returns the replacement.
+ * \param count The maximum number of substitutes; negative for unlimited an unlimited count.
+ * \param opts  The options of the matcher.
+ *
+ * \return returns a std::string based on the character type of the input string
+ */
+template< typename StrT, typename Source, typename Function,
+          typename std::enable_if< !detail::string_traits< Function >::is_string &&
+                                   !detail::is_replacement< Function >::value, int >::type = 0 >
+auto gsub( StrT&& str, basic_static_pattern< Source > pat, Function&& func, int count = -1, const match_options & opts = {} )
+{
+    std::basic_string< typename detail::string_traits< StrT >::char_type > result;
+    detail::gsub_into( result, std::forward< StrT >( str ), pat, std::forward< Function >( func ), count, opts );
+
+    return result;
+}
+
+/**
+ * \brief Substitutes a decoded replacement for a match of a static pattern found in the input string.
+ *
+ * \param str   The input string
+ * \param pat   The static pattern used to find matches in the input string
+ * \param repl  The decoded replacement that substitutes the match.
+ * \param count The maximum number of substitutes; negative for unlimited an unlimited count.
+ * \param opts  The options of the matcher.
+ *
+ * \return returns a std::string based on the character type of the input string
+ */
+template< typename StrT, typename Source, typename ReplCharT >
+auto gsub( StrT&& str, basic_static_pattern< Source > pat, const basic_replacement< ReplCharT > & repl, int count = -1, const match_options & opts = {} )
+{
+    std::basic_string< typename detail::string_traits< StrT >::char_type > result;
+    detail::gsub_into( result, std::forward< StrT >( str ), pat, repl, count, opts );
+
+    return result;
+}
+
+/**
+ * \brief Substitutes a replacement for a match found in the input string and appends the result to a string.
+ *
+ * Works like pg::lex::gsub but reuses the memory of the output string.
+ *
+ * \param out   The string to which the result is appended
+ * \param str   The input string
+ * \param pat   The pattern or compiled pattern used to find matches in the input string
+ * \param repl  The replacement pattern, a decoded replacement or a function that accepts a match result and returns the replacement.
+ * \param count The maximum number of substitutes; negative for unlimited an unlimited count.
+ * \param opts  The options of the matcher.
+ */
+template< typename CharT, typename Traits, typename Allocator, typename StrT, typename PatT, typename ReplT >
+void gsub_to( std::basic_string< CharT, Traits, Allocator > & out, StrT&& str, PatT&& pat, ReplT&& repl, int count = -1, const match_options & opts = {} )
+{
+    static_assert( std::is_same< CharT, typename detail::string_traits< StrT >::char_type >::value, "The output string has not the char type of the input string!" );
+
+    detail::gsub_into( out, std::forward< StrT >( str ), std::forward< PatT >( pat ), std::forward< ReplT >( repl ), count, opts );
+}
+
+/**
+ * \brief Substitutes a replacement for a match found in the input string and writes the result to an output iterator.
+ *
+ * Works like pg::lex::gsub but doesn't allocate memory for the result.
+ *
+ * \param out   The output iterator to which the chars of the result are written
+ * \param str   The input string
+ * \param pat   The pattern or compiled pattern used to find matches in the input string
+ * \param repl  The replacement pattern, a decoded replacement or a function that accepts a match result and returns the replacement.
+ * \param count The maximum number of substitutes; negative for unlimited an unlimited count.
+ * \param opts  The options of the matcher.
+ *
+ * \return Returns the output iterator one past the last written char.
+ */
+template< typename OutIt, typename StrT, typename PatT, typename ReplT >
+OutIt gsub_to( OutIt out, StrT&& str, PatT&& pat, ReplT&& repl, int count = -1, const match_options & opts = {} )
+{
+    detail::output_sink< typename detail::string_traits< StrT >::char_type, OutIt > sink = { out };
+    detail::gsub_into( sink, std::forward< StrT >( str ), std::forward< PatT >( pat ), std::forward< ReplT >( repl ), count, opts );
+
+    return sink.out;
+}
+
+namespace detail
+{
+
+/* A type is an allocator when it has a value type and an allocate function */
+template< typename T, typename = void >
+struct is_allocator : std::false_type {};
+
+template< typename T >
+struct is_allocator< T, std::void_t< typename T::value_type, decltype( std::declval< T & >().allocate( std::size_t() ) ) > > : std::true_type {};
+
+}
+
+/**
+ * \brief Substitutes a replacement for a match found in the input string and returns the result in a string with allocator 'alloc'.
+ *
+ * Works like pg::lex::gsub; a std::pmr::polymorphic_allocator puts the result in a memory resource, e.g. a monotonic arena.
+ *
+ * \param alloc The allocator of the result; it is rebound to the char type of the input string.
+ * \param str   The input string
+ * \param pat   The pattern, compiled pattern or static pattern used to find matches in the input string
+ * \param repl  The replacement pattern, a decoded replacement or a replacement function.
+ * \param count The maximum number of substitutes; negative for unlimited an unlimited count.
+ * \param opts  The options of the matcher.
+ *
+ * \return returns a std::basic_string with the allocator type of 'alloc' and the character type of the input string
+ */
+template< typename Allocator, typename StrT, typename PatT, typename ReplT,
+          typename std::enable_if< detail::is_allocator< Allocator >::value, int >::type = 0 >
+auto gsub( const Allocator & alloc, StrT&& str, PatT&& pat, ReplT&& repl, int count = -1, const match_options & opts = {} )
+{
+    using str_char_type  = typename detail::string_traits< StrT >::char_type;
+    using allocator_type = typename std::allocator_traits< Allocator >::template rebind_alloc< str_char_type >;
+
+    std::basic_string< str_char_type, std::char_traits< str_char_type >, allocator_type > result( ( allocator_type( alloc ) ) );
+    detail::gsub_into( result, std::forward< StrT >( str ), std::forward< PatT >( pat ), std::forward< ReplT >( repl ), count, opts );
+
+    return result;
+}
+
+namespace detail
+{
+
+/* An Aho-Corasick automaton that finds the literal prefixes of the patterns of a pattern set in one pass over the input string. */
+struct prefix_automaton
+{
+    /* Adds the prefix of pattern 'index'; the chars are compared by their unsigned value like the literal items of the matcher. */
+    template< typename CharT >
+    void add( const std::basic_string< CharT > & prefix, std::size_t index )
+    {
+        using unsigned_char_type = typename std::make_unsigned< CharT >::type;
+
+        if( next.empty() )
+        {
+            new_node( 0 );
+        }
+
+        int n = 0;
+        for( const auto c : prefix )
+        {
+            const auto u = static_cast< std::uint32_t >( static_cast< unsigned_char_type >( c ) );
+            auto       v = find( n, u );
+            if( !v )
+            {
+                v = new_node( depth[ n ] + 1 );
+                auto & edges = next[ n ];
+                edges.insert( std::lower_bound( edges.begin(), edges.end(), std::make_pair( u, 0 ) ), { u, v } );
+                if( n == 0 && u < 256 )
+                {
+                    root[ u ] = v;
+                }
+            }
+            n = v;
+        }
+        ends[ n ].push_back( index );
+    }
+
+    /* Computes the failure and output links after all prefixes are added. */
+    void link()
+    {
+        std::vector< int > queue;
+        for( const auto &edge : next[ 0 ] )
+        {
+            queue.push_back( edge.second );
+        }
+        for( std::size_t q = 0 ; q < queue.size() ; ++q )
+        {
+            const auto u = queue[ q ];
+            for( const auto &edge : next[ u ] )
+            {
+                const auto v = edge.second;
+                fail[ v ]    = step( fail[ u ], edge.first );
+                out[ v ]     = ends[ fail[ v ] ].empty() ? out[ fail[ v ] ] : fail[ v ];
+                queue.push_back( v );
+            }
+        }
+    }
+
+    /* Returns the state after char 'c'. */
+    int step( int n, std::uint32_t c ) const noexcept
+    {
+        for( ; ; n = fail[ n ] )
+        {
+            if( n == 0 )
+            {
+                return c < 256 ? root[ c ] : find( 0, c );
+            }
+            if( const auto v = find( n, c ) )
+            {
+                return v;
+            }
+        }
+    }
+
+    bool empty() const noexcept { return next.size() <= 1; }
+
+    /* Returns the node after char 'c' from node 'n' or zero (the root) when there is no such transition. */
+    int find( int n, std::uint32_t c ) const noexcept
+    {
+        const auto & edges = next[ n ];
+        const auto   it    = std::lower_bound( edges.begin(), edges.end(), std::make_pair( c, 0 ) );
+        return it != edges.end() && it->first == c ? it->second : 0;
+    }
+
+    int new_node( int d )
+    {
+        next.emplace_back();
+        fail.push_back( 0 );
+        out.push_back( -1 );
+        depth.push_back( d );
+        ends.emplace_back();
+        return static_cast< int >( next.size() - 1 );
+    }
+
+    std::vector< std::vector< std::pair< std::uint32_t, int > > > next;   /* the sorted transitions of every node */
+    std::vector< int >                                            fail;
+    std::vector< int >                                            out;    /* the nearest node on the failure path where prefixes end; -1 for none */
+    std::vector< int >                                            depth;  /* length of the prefix of the node */
+    std::vector< std::vector< std::size_t > >                     ends;   /* the patterns with the prefix of the node */
+    int                                                           root[ 256 ] = {};
+};
+
+template< typename StrCharT, typename PatCharT, typename Function >
+void match_set( const StrCharT * s_begin, const StrCharT * s_end, const basic_pattern_set< PatCharT > & set, const match_options & opts, Function && f );
+
+}
+
+/**
+ * \brief A set of compiled patterns that are matched together in one pass over the input string.
+ *
+ * The patterns are grouped by their prefilter. The literal prefixes of the patterns are searched with an Aho-Corasick automaton
+ * and the patterns that start with a class or a set are looked up by the char at the position.
+ * The matcher only runs for a pattern at the positions where a match of that pattern can start.
+ * Anchored patterns and patterns without a prefilter are matched separately.
+ *
+ * \tparam CharT The char type of the patterns.
+ */
+template< typename CharT >
+class basic_pattern_set
+{
+    template< typename StrCharT, typename PatCharT, typename Function >
+    friend void detail::match_set( const StrCharT *, const StrCharT *, const basic_pattern_set< PatCharT > &, const match_options &, Function && );
+
+    using first_set = std::pair< std::size_t, detail::bracket_set< CharT > >;
+
+    std::vector< basic_pattern< CharT > > patterns;
+    detail::prefix_automaton              automaton;
+    std::vector< std::size_t >            separate;          /* anchored patterns and patterns without a prefilter */
+    std::vector< first_set >              first_sets;        /* patterns with a set of first chars */
+    std::vector< std::size_t >            by_first[ 256 ];   /* the patterns of 'first_sets' per first char below 256 */
+    std::vector< std::size_t >            at_end;            /* the patterns of 'first_sets' that can match at the end of the input string */
+
+    void build()
+    {
+        for( std::size_t i = 0 ; i < patterns.size() ; ++i )
+        {
+            const auto & pat = patterns[ i ];
+            if( pat.anchored() || pat.filter.type == detail::prefilter_type::none )
+            {
+                separate.push_back( i );
+            }
+            else if( pat.filter.type == detail::prefilter_type::literal )
+            {
+                automaton.add( pat.filter.prefix, i );
+            }
+            else
+            {
+                first_sets.emplace_back( i, pat.filter.first );
+                for( unsigned c = 0 ; c < 256 ; ++c )
+                {
+                    if( pat.filter.first.test( c ) )
+                    {
+                        by_first[ c ].push_back( i );
+                    }
+                }
+                if( pat.filter.at_end )
+                {
+                    at_end.push_back( i );
+                }
+            }
+        }
+        if( !automaton.empty() )
+        {
+            automaton.link();
+        }
+    }
+
+public:
+
+    /**
+     * \brief Compiles the patterns in the range [first, last).
+     */
+    template< typename It >
+    basic_pattern_set( It first, It last )
+    {
+        for( ; first != last ; ++first )
+        {
+            patterns.emplace_back( *first );
+        }
+        build();
+    }
+
+    /**
+     * \brief Compiles a list of patterns.
+     */
+    basic_pattern_set( std::initializer_list< std::basic_string_view< CharT > > pats )
+        : basic_pattern_set( pats.begin(), pats.end() )
+    {}
+
+    /**
+     * \brief Returns the number of patterns in the set.
+     */
+    size_t size() const noexcept { return patterns.size(); }
+
+    /**
+     * \brief Returns the compiled pattern at index 'i'.
+     */
+    const basic_pattern< CharT > & operator []( size_t i ) const noexcept { assert( i < patterns.size() ); return patterns[ i ]; }
+};
+
+extern template class basic_pattern_set< char >;
+extern template class basic_pattern_set< wchar_t >;
+extern template class basic_pattern_set< char16_t >;
+extern template class basic_pattern_set< char32_t >;
+
+using pattern_set    = basic_pattern_set< char >;
+using wpattern_set   = basic_pattern_set< wchar_t >;
+using u16pattern_set = basic_pattern_set< char16_t >;
+using u32pattern_set = basic_pattern_set< char32_t >;
+
+namespace detail
+{
+
+/* Calls 'f' with the index and the match result of the first match of every pattern in the set that matches. */
+template< typename StrCharT, typename PatCharT, typename Function >
+void match_set( const StrCharT * s_begin, const StrCharT * s_end, const basic_pattern_set< PatCharT > & set, const match_options & opts, Function && f )
+{
+    using unsigned_str_char_type = typename std::make_unsigned< StrCharT >::type;
+
+    basic_match_result< StrCharT > mr;
+
+    for( const auto i : set.separate )
+    {
+        compiled_match_state ms = { s_begin, s_end, set.patterns[ i ], mr, opts };
+        find_aux( ms, set.patterns[ i ].anchored(), ms.filter );
+        if( mr )
+        {
+            f( i, std::as_const( mr ) );
+        }
+    }
+
+    std::size_t remaining = set.patterns.size() - set.separate.size();
+    if( remaining == 0 )
+    {
+        return;
+    }
+
+    std::vector< bool > done( set.patterns.size(), false );
+
+    /* A state per attempt is cheap, also when memoizing: the attempts reuse the memo table and clear only the states they visited */
+    const auto attempt = [ & ]( std::size_t i, const StrCharT * s )
+    {
+        if( done[ i ] )
+        {
+            return;
+        }
+        compiled_match_state ms = { s_begin, s_end, set.patterns[ i ], mr, opts };
+        if( const auto e = start_match( ms, s ) )
+        {
+            ms.check_captures();
+            push_captures( ms, s, e );
+            done[ i ] = true;
+            --remaining;
+            f( i, std::as_const( mr ) );
+        }
+    };
+
+    const bool literals = !set.automaton.empty();
+    int        state    = 0;
+    for( auto s = s_begin ; s < s_end && remaining ; ++s )
+    {
+        const auto c = static_cast< unsigned_str_char_type >( *s );
+
+        if( c < 256 )
+        {
+            for( const auto i : set.by_first[ c ] )
+            {
+                attempt( i, s );
+            }
+        }
+        else
+        {
+            for( const auto &first : set.first_sets )
+            {
+                if( first.second.test( c ) )
+                {
+                    attempt( first.first, s );
+                }
+            }
+        }
+
+        if( literals )
+        {
+            state = set.automaton.step( state, static_cast< std::uint32_t >( c ) );
+            for( auto n = set.automaton.ends[ state ].empty() ? set.automaton.out[ state ] : state ; n > 0 ; n = set.automaton.out[ n ] )
+            {
+                for( const auto i : set.automaton.ends[ n ] )
+                {
+                    attempt( i, s + 1 - set.automaton.depth[ n ] );
+                }
+            }
+        }
+    }
+
+    for( const auto i : set.at_end )
+    {
+        attempt( i, s_end );
+    }
+}
+
+}
+
+/**
+ * \brief Matches all patterns of a pattern set in one pass over the input string.
+ *
+ * Calls 'f' with the index of the pattern and the match result for every pattern of the set that matches the input string.
+ * The match result is the same as the result of pg::lex::match with that pattern; the first match in the input string.
+ * The patterns are reported in the order that their matches are found, not in the order of the patterns.
+ *
+ * \param str  The input string
+ * \param set  The pattern set
+ * \param f    A function that accepts an index and a match result
+ * \param opts The options of the matcher.
+ */
+template< typename StrT, typename PatCharT, typename Function >
+void match_each( StrT&& str, const basic_pattern_set< PatCharT > & set, Function && f, const match_options & opts = {} )
+{
+    using str_char_type = typename detail::string_traits< StrT >::char_type;
+
+    const detail::string_context< str_char_type > s = { std::forward< StrT >( str ) };
+
+    detail::match_set( s.begin, s.end, set, opts, std::forward< Function >( f ) );
+}
+
+/**
+ * \brief Matches all patterns of a pattern set in one pass over the input string.
+ *
+ * \param str  The input string
+ * \param set  The pattern set
+ * \param opts The options of the matcher.
+ *
+ * \return Returns the indices of the patterns that match with their match results; ordered by index.
+ */
+template< typename StrT, typename PatCharT >
+auto match( StrT&& str, const basic_pattern_set< PatCharT > & set, const match_options & opts = {} )
+{
+    using str_char_type = typename detail::string_traits< StrT >::char_type;
+
+    std::vector< std::pair< std::size_t, basic_match_result< str_char_type > > > results;
+    match_each( std::forward< StrT >( str ), set, [ & ]( std::size_t i, const auto & mr ){ results.emplace_back( i, mr ); }, opts );
+    std::sort( results.begin(), results.end(), []( const auto &a, const auto &b ){ return a.first < b.first; } );
+
+    return results;
+}
+
+/**
+ * \brief Matches a compiled pattern against an input string that is pushed in chunks.
+ *
+ * The matches are the same as the matches of pg::lex::gmatch over the concatenated chunks.
+ * A match is reported as soon as more input can't change it; the stream keeps only the tail of the input from where a match can still start.
+ *
+ * A match of a pattern with a bounded length (see basic_pattern::max_length) is resolved when the input has more chars than that length after the start of the match.
+ * For a pattern with an unbounded length the stream keeps the input from the first unresolved position unless a maximum lookahead is set.
+ * With a maximum lookahead a position is resolved when that many chars follow it; a match that depends on more chars than the lookahead
+ * can differ from the match over the whole input.
+ *
+ * The captures of the match results point into the buffer of the stream and are valid until the callback returns.
+ * The positions of the match results are offsets from the begin of the stream.
+ *
+ * \note A stream keeps a reference to the compiled pattern.
+ *
+ * \tparam StrCharT The char type of the input string.
+ * \tparam PatCharT The char type of the pattern.
+ */
+template< typename StrCharT, typename PatCharT >
+class basic_match_stream
+{
+    const basic_pattern< PatCharT > & pat;
+    const match_options               options;
+    const std::size_t                 window;               /* chars after a position before it is resolved */
+    std::basic_string< StrCharT >     buffer;
+    std::size_t                       base       = 0;      /* offset in the stream of the first char in the buffer */
+    std::size_t                       src        = 0;      /* offset in the stream where the search continues */
+    std::ptrdiff_t                    last_match = -1;     /* offset in the stream of the end of the last match; -1 for none */
+
+    template< typename Function >
+    void search( bool final, Function && f )
+    {
+        const auto end = buffer.data() + buffer.size();
+        if( !final && ( window == basic_pattern< PatCharT >::unbounded || buffer.size() - ( src - base ) <= window ) )
+        {
+            return;  /* no position is resolved */
+        }
+        const auto last_start = final ? end : end - window - 1;
+
+        basic_match_result< StrCharT > mr;
+        detail::compiled_match_state   ms = { buffer.data(), end, pat, mr, options };
+
+        const StrCharT * s    = buffer.data() + ( src - base );
+        const StrCharT * last = last_match < 0 ? nullptr : buffer.data() + ( last_match - base );
+        while( detail::gmatch_aux( ms, ms.filter, s, last, last_start ) )
+        {
+            ms.pos.first  += static_cast< long >( base );
+            ms.pos.second += static_cast< long >( base );
+            f( std::as_const( mr ) );
+            ms.reprepstate();
+        }
+
+        /* The positions after 'last_start' are searched when more input is pushed; a prefilter that found no candidate skips to the end */
+        if( s > end )
+        {
+            s = last_start + 1;
+        }
+        src        = base + ( s - buffer.data() );
+        last_match = last && last >= s ? static_cast< std::ptrdiff_t >( base + ( last - buffer.data() ) ) : -1;
+
+        /* One char before the search position is kept for a frontier */
+        const auto keep = src > base ? src - 1 : base;
+        if( !final && keep > base )
+        {
+            buffer.erase( 0, keep - base );
+            base = keep;
+        }
+    }
+
+public:
+
+    /**
+     * \brief Creates a stream for a compiled pattern.
+     *
+     * \param p         The compiled pattern
+     * \param lookahead The maximum number of chars after a position before a match at that position is resolved;
+     *                  basic_pattern::unbounded for the maximum length of the pattern.
+     * \param opts      The options of the matcher.
+     */
+    basic_match_stream( const basic_pattern< PatCharT > & p, std::size_t lookahead = basic_pattern< PatCharT >::unbounded, const match_options & opts = {} )
+        : pat( p )
+        , options( opts )
+        , window( std::min( p.max_length(), lookahead ) )
+    {}
+
+    basic_match_stream( const basic_pattern< PatCharT > && , std::size_t = 0, const match_options & = {} ) = delete;
+
+    /**
+     * \brief Appends a chunk to the input and calls 'f' with the match result of every match that is resolved.
+     */
+    template< typename Function >
+    void push( std::basic_string_view< StrCharT > chunk, Function && f )
+    {
+        buffer.append( chunk );
+        search( false, std::forward< Function >( f ) );
+    }
+
+    /**
+     * \brief Ends the input and calls 'f' with the match result of every match that is left.
+     *
+     * The stream can be used again for a new input after it is finished.
+     */
+    template< typename Function >
+    void finish( Function && f )
+    {
+        search( true, std::forward< Function >( f ) );
+        buffer.clear();
+        base       = 0;
+        src        = 0;
+        last_match = -1;
+    }
+
+    /**
+     * \brief Returns the number of chars of the input that the stream keeps.
+     */
+    size_t buffered() const noexcept { return buffer.size(); }
+};
+
+using match_stream    = basic_match_stream< char, char >;
+using wmatch_stream   = basic_match_stream< wchar_t, wchar_t >;
+using u16match_stream = basic_match_stream< char16_t, char16_t >;
+using u32match_stream = basic_match_stream< char32_t, char32_t >;
+
+namespace detail
+{
+
+/* The match result of a match whose captures are not needed; the matchers skip the captures and only record the whole match */
+template< typename CharT >
+struct position_result
+{
+    std::pair< long, long > pos   = { -1, -1 };
+    int                     level = 0;
+    capture< CharT >        captures[ 1 ];
+
+    const std::pair< long, long > & position() const noexcept { return pos; }
+};
+
+template< typename CharT >
+struct records_captures< position_result< CharT > > : std::false_type {};
+
+/*
+ * Returns true when the matcher doesn't need the captures of a pattern string to find its matches.
+ * The captures must not be back-referenced and must be well-formed, so skipping them doesn't skip an error of the pattern.
+ */
+template< typename CharT >
+bool captures_unused( const pattern_context< CharT > & pc ) noexcept
+{
+    int depth = 0;
+    int total = 0;
+    for( auto p = pc.begin ; p < pc.end ; ++p )
+    {
+        switch( *p )
+        {
+        case '(':
+            ++depth;
+            ++total;
+            break;
+
+        case ')':
+            if( --depth < 0 )
+            {
+                return false;
+            }
+            break;
+
+        case '%':
+            if( ++p == pc.end || ( *p >= '0' && *p <= '9' ) )
+            {
+                return false;
+            }
+            if( *p == 'b' )
+            {
+                if( pc.end - p <= 2 )
+                {
+                    return false;
+                }
+                p += 2;  /* the delimiters of the balance */
+            }
+            break;
+
+        case '[':
+            if( ++p < pc.end && *p == '^' )
+            {
+                ++p;
+            }
+            do  /* look for a ']' like classend */
+            {
+                if( p == pc.end )
+                {
+                    return false;
+                }
+                if( *p++ == '%' && p < pc.end )
+                {
+                    ++p;
+                }
+            } while( p < pc.end && *p != ']' );
+            if( p == pc.end )
+            {
+                return false;
+            }
+            break;
+        }
+    }
+    return depth == 0 && total <= MAXCAPTURES;
+}
+
+template< typename CharT >
+bool captures_unused( const basic_pattern< CharT > & pat ) noexcept
+{
+    return !pat.has_back_references();
+}
+
+template< typename Source >
+constexpr bool captures_unused( const basic_static_pattern< Source > & pat ) noexcept
+{
+    return !pat.has_back_references();
+}
+
+/* Calls 'f' with a match result that can record the captures of the pattern of context 'c' */
+template< typename Context, typename Function >
+auto with_result( const Context & c, Function && f )
+{
+    using str_char_type = typename std::remove_const< typename std::remove_pointer< typename std::decay< decltype( c.s.begin ) >::type >::type >::type;
+
+    if( captures_unused( c.p ) )
+    {
+        position_result< str_char_type > mr;
+        return f( mr );
+    }
+
+    basic_match_result< str_char_type > mr;
+    return f( mr );
+}
+
+template< typename StrCharT, typename PatCharT, typename MR >
+auto make_match_state( const context< StrCharT, PatCharT > & c, MR & mr )
+{
+    return match_state< StrCharT, PatCharT, MR >( c.s.begin, c.s.end, c.p.begin, c.p.end, mr, c.options );
+}
+
+template< typename StrCharT, typename PatCharT, typename CMR, typename MR >
+auto make_match_state( const compiled_context< StrCharT, PatCharT, CMR > & c, MR & mr )
+{
+    return compiled_match_state< StrCharT, PatCharT, MR >( c.s.begin, c.s.end, c.p, mr, c.options );
+}
+
+template< typename StrCharT, typename PatCharT, typename CMR, typename MR >
+const prefilter< PatCharT > & prefilter_of( const compiled_match_state< StrCharT, PatCharT, MR > & ms, const compiled_context< StrCharT, PatCharT, CMR > & )
+{
+    return ms.filter;
+}
+
+template< typename StrCharT, typename Source, typename MR >
+auto make_match_state( const static_context< StrCharT, Source > & c, MR & mr )
+{
+    return static_match_state< StrCharT, static_code< Source >, MR >( c.s.begin, c.s.end, mr, c.options );
+}
+
+template< typename MS, typename StrCharT, typename PatCharT >
+auto prefilter_of( const MS &ms, const context< StrCharT, PatCharT > & c )
+{
+    return analyse_prefix( c.p, ms.utf8 );
+}
+
+template< typename MS, typename StrCharT, typename Source >
+const auto & prefilter_of( const MS &, const static_context< StrCharT, Source > & )
+{
+    return static_code< Source >::filter();
+}
+
+/* Returns the position of the first match in the input string of context 'c' */
+template< typename Context >
+std::pair< long, long > find_position( const Context & c, bool anchor )
+{
+    return with_result( c, [ & ]( auto & mr )
+    {
+        auto ms = make_match_state( c, mr );
+        find_aux( ms, anchor, prefilter_of( ms, c ) );
+        return mr.position();
+    } );
+}
+
+/* Returns the number of matches in the input string of context 'c' like the number of iterations of gmatch */
+template< typename Context >
+std::size_t count_matches( const Context & c )
+{
+    return with_result( c, [ & ]( auto & mr )
+    {
+        auto            ms         = make_match_state( c, mr );
+        const auto &    filter     = prefilter_of( ms, c );
+        auto            src        = c.s.begin;
+        decltype( src ) last_match = nullptr;
+
+        std::size_t n = 0;
+        while( gmatch_aux( ms, filter, src, last_match ) )
+        {
+            ++n;
+            ms.reprepstate();
+        }
+        return n;
+    } );
+}
+
+/* Searches for the next match from 'src' like gmatch and returns its position; { -1, -1 } when there are no more matches */
+template< typename Context, typename StrCharT >
+std::pair< long, long > next_position( const Context & c, const StrCharT * & src, const StrCharT * & last_match )
+{
+    return with_result( c, [ & ]( auto & mr )
+    {
+        auto ms = make_match_state( c, mr );
+        gmatch_aux( ms, prefilter_of( ms, c ), src, last_match );
+        return mr.position();
+    } );
+}
+
+}
+
+/**
+ * \brief Searches for the first match of a pattern in an input string and returns only its position.
+ *
+ * The captures of the pattern are not returned, a pattern without captures doesn't need the storage of a match result.
+ *
+ * \return Returns the start index of the match and the index one past the last char of the match; { -1, -1 } when there is no match.
+ */
+template< typename StrT, typename PatT,
+          typename std::enable_if< detail::string_traits< PatT >::is_string, int >::type = 0 >
+std::pair< long, long > find( StrT&& str, PatT&& pat, const match_options & opts = {} )
+{
+    using str_char_type = typename detail::string_traits< StrT >::char_type;
+    using pat_char_type = typename detail::string_traits< PatT >::char_type;
+
+    if constexpr( detail::widens_pattern< str_char_type, pat_char_type > )
+    {
+        return find( std::forward< StrT >( str ), detail::widen_pattern< str_char_type >( pat ), opts );
+    }
+    else
+    {
+        const context c = { std::forward< StrT >( str ), std::forward< PatT >( pat ), opts };
+
+        return detail::find_position( c, c.p.anchor );
+    }
+}
+
+/**
+ * \brief Searches for the first match of a compiled pattern in an input string and returns only its position.
+ *
+ * \return Returns the start index of the match and the index one past the last char of the match; { -1, -1 } when there is no match.
+ */
+template< typename StrT, typename PatCharT >
+std::pair< long, long > find( StrT&& str, const basic_pattern< PatCharT > & pat, const match_options & opts = {} )
+{
+    const compiled_context c = { std::forward< StrT >( str ), pat, opts };
+
+    return detail::find_position( c, pat.anchored() );
+}
+
+/**
+ * \brief Searches for the first match of a static pattern in an input string and returns only its position.
+ *
+ * \return Returns the start index of the match and the index one past the last char of the match; { -1, -1 } when there is no match.
+ */
+template< typename StrT, typename Source >
+std::pair< long, long > find( StrT&& str, basic_static_pattern< Source > pat, const match_options & opts = {} )
+{
+    const static_context c = { std::forward< StrT >( str ), pat, opts };
+
+    return detail::find_position( c, pat.anchored() );
+}
+
+/**
+ * \brief Returns true when a pattern, a compiled pattern or a static pattern matches the input string.
+ *
+ * The captures are not recorded when the pattern has no back-references.
+ */
+template< typename StrT, typename PatT >
+bool matches( StrT&& str, PatT&& pat, const match_options & opts = {} )
+{
+    return lex::find( std::forward< StrT >( str ), std::forward< PatT >( pat ), opts ).first >= 0;
+}
+
+/**
+ * \brief Returns the number of matches of a pattern in an input string; the number of match results that gmatch iterates over.
+ *
+ * The captures are not recorded when the pattern has no back-references.
+ */
+template< typename StrT, typename PatT,
+          typename std::enable_if< detail::string_traits< PatT >::is_string, int >::type = 0 >
+std::size_t count( StrT&& str, PatT&& pat, const match_options & opts = {} )
+{
+    using str_char_type = typename detail::string_traits< StrT >::char_type;
+    using pat_char_type = typename detail::string_traits< PatT >::char_type;
+
+    if constexpr( detail::widens_pattern< str_char_type, pat_char_type > )
+    {
+        return count( std::forward< StrT >( str ), detail::widen_pattern< str_char_type >( pat ), opts );
+    }
+    else
+    {
+        const context c = { std::forward< StrT >( str ), std::forward< PatT >( pat ), opts };
+
+        return detail::count_matches( c );
+    }
+}
+
+/**
+ * \brief Returns the number of matches of a compiled pattern in an input string.
+ */
+template< typename StrT, typename PatCharT >
+std::size_t count( StrT&& str, const basic_pattern< PatCharT > & pat, const match_options & opts = {} )
+{
+    const compiled_context c = { std::forward< StrT >( str ), pat, opts };
+
+    return detail::count_matches( c );
+}
+
+/**
+ * \brief Returns the number of matches of a static pattern in an input string.
+ */
+template< typename StrT, typename Source >
+std::size_t count( StrT&& str, basic_static_pattern< Source > pat, const match_options & opts = {} )
+{
+    const static_context c = { std::forward< StrT >( str ), pat, opts };
+
+    return detail::count_matches( c );
+}
+
+/**
+ * \brief A saved position of a match cursor to resume the iteration later, also on a new context of the same input.
+ */
+struct match_checkpoint
+{
+    std::size_t offset      = 0;      ///< The offset in the input string where the search for the next match starts.
+    bool        after_match = false;  ///< A match ended at 'offset'; an empty match at 'offset' is skipped like gmatch does.
+};
+
+/**
+ * \brief The end of the matches of a match cursor.
+ */
+struct match_sentinel {};
+
+namespace detail
+{
+
+/* The match result of the cursors of a context */
+template< typename Context >
+struct cursor_result
+{
+    using char_type = typename std::remove_const< typename std::remove_pointer< typename std::decay< decltype( std::declval< const Context & >().s.begin ) >::type >::type >::type;
+    using type      = basic_match_result< char_type >;
+};
+
+template< typename StrCharT, typename PatCharT, typename MR >
+struct cursor_result< compiled_context< StrCharT, PatCharT, MR > >
+{
+    using char_type = StrCharT;
+    using type      = MR;
+};
+
+}
+
+/**
+ * \brief A cursor over the matches of a context, compiled context or static context.
+ *
+ * A cursor is a pointer to the context, the position of the search and the match result, so copies are cheap.
+ * The iteration can be saved with 'checkpoint' and resumed from a checkpoint without searching the input before it again.
+ * An iteration ends when the cursor compares equal to a pg::lex::match_sentinel.
+ * A step of a memoizing cursor uses the memo table of the context options, or the one of the calling thread, and clears only the states it visited.
+ *
+ * \note A cursor keeps a pointer to the context; the context must outlive the cursor.
+ *
+ * \tparam Context The type of the context.
+ *
+ * \see pg::lex::cursor
+ */
+template< typename Context >
+class match_cursor
+{
+    using char_type   = typename detail::cursor_result< Context >::char_type;
+    using result_type = typename detail::cursor_result< Context >::type;
+
+    const Context *   c          = nullptr;
+    const char_type * pos        = nullptr;  /* the start of the next search; one past the end of the input string after the last match */
+    const char_type * last_match = nullptr;
+    result_type       mr;
 
-                case '+':   /* 1 or more repetitions */
-                    ++s;    /* 1 match already done */
-                    /* FALLTHROUGH */
-                case '*':   /* 0 or more repetitions */
-                    return max_expand( ms, s, p, ep );
+public:
 
-                case '-':   /* 0 or more repetitions (minimum) */
-                    return min_expand( ms, s, p, ep );
+    /**
+     * \brief Makes a cursor that searches for the first match from a checkpoint.
+     */
+    explicit match_cursor( const Context & ctx, const match_checkpoint & from = {} )
+        : c( &ctx )
+    {
+        const auto size = static_cast< std::size_t >( c->s.end - c->s.begin );
 
-                default:    /* no suffix */
-                    p = ep;
-                    ++s;
-                    goto init;  /* return match( ms, s + 1, ep ); */
-                }
-            }
-            break;
+        pos        = c->s.begin + std::min( from.offset, size + 1 );
+        last_match = from.after_match ? pos : nullptr;
+        ++*this;
+    }
+
+    /**
+     * \brief Searches for the next match; the match result is empty when the end is reached.
+     */
+    match_cursor & operator ++()
+    {
+        if( pos > c->s.end )
+        {
+            mr = {};
+        }
+        else if constexpr( std::is_same< result_type, basic_match_result< char_type > >::value )
+        {
+            auto ms = detail::make_match_state( *c, mr );
+            detail::gmatch_aux( ms, detail::prefilter_of( ms, *c ), pos, last_match );
         }
+        else
+        {
+            basic_match_result< char_type > full;
+            auto                            ms = detail::make_match_state( *c, full );
+            detail::gmatch_aux( ms, detail::prefilter_of( ms, *c ), pos, last_match );
+            mr = full ? result_type( full, c->s.begin ) : result_type();
         }
+
+        return *this;
     }
 
-    return nullptr;
+    /**
+     * \brief Returns the position where the iteration continues after the current match.
+     */
+    match_checkpoint checkpoint() const noexcept
+    {
+        return { static_cast< std::size_t >( pos - c->s.begin ), pos == last_match };
+    }
+
+    /**
+     * \brief Dereferences to the match result of the current match.
+     */
+    const result_type & operator *() const noexcept { return mr; }
+
+    /**
+     * \brief Returns a pointer to the match result of the current match.
+     */
+    const result_type * operator ->() const noexcept { return &mr; }
+
+    friend bool operator ==( const match_cursor & cur, match_sentinel ) noexcept { return cur.pos > cur.c->s.end; }
+    friend bool operator ==( match_sentinel, const match_cursor & cur ) noexcept { return cur.pos > cur.c->s.end; }
+    friend bool operator !=( const match_cursor & cur, match_sentinel s ) noexcept { return !( cur == s ); }
+    friend bool operator !=( match_sentinel s, const match_cursor & cur ) noexcept { return !( cur == s ); }
+};
+
+/**
+ * \brief Returns a cursor at the first match of a context after a checkpoint.
+ */
+template< typename Context >
+match_cursor< Context > cursor( const Context & c, const match_checkpoint & from = {} )
+{
+    return match_cursor< Context >( c, from );
 }
 
+/* The cursor would keep a pointer to the temporary context. */
+template< typename Context >
+match_cursor< Context > cursor( const Context && c, const match_checkpoint & from = {} ) = delete;
 
-template< typename CharT >
-void append_number( std::basic_string< CharT >& str, ptrdiff_t number )
+namespace detail
 {
-    assert( number >= 0 );
 
-    if( number > 9 )
+/* The input string, the pattern and the options of a split view; a compiled pattern is referenced by a pointer so a split view can be assigned */
+template< typename StrCharT, typename Pattern >
+struct split_source
+{
+    std::basic_string_view< StrCharT > str;
+    Pattern                            pat;
+    match_options                      options;
+
+    auto make_context() const
     {
-        append_number( str, number / 10 );
+        if constexpr( std::is_pointer< Pattern >::value )
+        {
+            return compiled_context< StrCharT, typename std::remove_const< typename std::remove_pointer< Pattern >::type >::type::char_type >( str, *pat, options );
+        }
+        else
+        {
+            return context< StrCharT, typename Pattern::value_type >( str, pat, options );
+        }
     }
-    str.append( 1u, '0' + ( number % 10 ) );
+};
+
 }
 
-template< typename CharT >
-struct string_context
+/**
+ * \brief A lazy range of the pieces of an input string between the matches of a separator pattern.
+ *
+ * The separators are found like pg::lex::gmatch finds matches.
+ * The pieces are string views into the input string; nothing is allocated.
+ * A string with n separators has n + 1 pieces, the pieces before the first and after the last separator can be empty.
+ *
+ * \note A split view and its iterators keep a reference to the input string and the (compiled) pattern.
+ *
+ * \tparam StrCharT The char type of the input string.
+ * \tparam Pattern  A string view of a pattern or a pointer to a compiled pattern.
+ */
+template< typename StrCharT, typename Pattern >
+class split_view
 {
-    string_context( const CharT * s ) noexcept
-        : string_context( s, std::char_traits< CharT >::length( s ) )
-    {}
+    detail::split_source< StrCharT, Pattern > source;
 
-    string_context( const CharT * s, size_t l ) noexcept
-        : begin( s )
-        , end( s + l )
-    {}
+public:
 
-    template< size_t N >
-    string_context( const CharT( & s )[ N ] ) noexcept
-        : string_context( s, N )
-    {}
+    /**
+     * \brief A forward iterator over the pieces.
+     */
+    struct iterator
+    {
+        using iterator_category = std::forward_iterator_tag;
+        using value_type        = std::basic_string_view< StrCharT >;
+        using difference_type   = std::ptrdiff_t;
+        using pointer           = const value_type *;
+        using reference         = const value_type &;
 
-    template< typename Traits, typename Allocator >
-    string_context( const std::basic_string< CharT, Traits, Allocator > & s ) noexcept
-        : string_context( s.data(), s.size() )
-    {}
+        iterator() noexcept = default;
 
-    template< typename Traits >
-    string_context( const std::basic_string_view< CharT, Traits > & s ) noexcept
-        : string_context( s.data(), s.size() )
-    {}
+        reference operator *() const noexcept { return piece; }
+        pointer   operator ->() const noexcept { return &piece; }
 
-    const CharT * const begin = nullptr;
-    const CharT * const end   = nullptr;
-};
+        iterator & operator ++()
+        {
+            advance();
+            return *this;
+        }
 
-extern template struct string_context< char >;
-extern template struct string_context< wchar_t >;
-extern template struct string_context< char16_t >;
-extern template struct string_context< char32_t >;
+        iterator operator ++( int )
+        {
+            auto tmp = *this;
+            advance();
+            return tmp;
+        }
 
+        bool operator ==( const iterator & other ) const noexcept
+        {
+            return done == other.done && start == other.start && src == other.src;
+        }
 
-template< typename CharT >
-struct pattern_context
-{
-    pattern_context( const CharT * p ) noexcept
-        : pattern_context( p, std::char_traits< CharT >::length( p ) )
-    {}
+        bool operator !=( const iterator & other ) const noexcept
+        {
+            return !( *this == other );
+        }
 
-    pattern_context( const CharT * p, size_t l ) noexcept
-        : end( p + l )
-        , anchor( p < end && *p == '^' )
-        , begin( anchor ? p + 1 : p )
-    {}
+    private:
+        friend class split_view;
+
+        detail::split_source< StrCharT, Pattern > source     = {};
+        const StrCharT *                          start      = nullptr;  /* the start of the next piece; nullptr after the last piece */
+        const StrCharT *                          src        = nullptr;  /* the position where the search for the next separator starts */
+        const StrCharT *                          last_match = nullptr;
+        value_type                                piece;
+        bool                                      ended      = true;
+        bool                                      done       = true;  /* past the last piece; the pointers can't tell, they are null for a null input string */
+
+        explicit iterator( const detail::split_source< StrCharT, Pattern > & s )
+            : source( s )
+            , ended( false )
+            , done( false )
+        {
+            const auto c = source.make_context();
+            start = src = c.s.begin;
+            advance();
+        }
 
-    template< size_t N >
-    pattern_context( const CharT( & p )[ N ] ) noexcept
-        : pattern_context( p, N )
-    {}
+        void advance()
+        {
+            if( ended )
+            {
+                *this = {};  /* the last piece has been passed */
+                return;
+            }
 
-    template< typename Traits, typename Allocator >
-    pattern_context( const std::basic_string< CharT, Traits, Allocator > & s ) noexcept
-        : pattern_context( s.data(), s.size() )
-    {}
+            const auto c   = source.make_context();
+            const auto pos = detail::next_position( c, src, last_match );
+            if( pos.first < 0 )
+            {
+                piece = { start, static_cast< size_t >( c.s.end - start ) };
+                ended = true;
+                src   = nullptr;
+            }
+            else
+            {
+                piece = { start, static_cast< size_t >( c.s.begin + pos.first - start ) };
+                start = c.s.begin + pos.second;
+            }
+        }
+    };
 
-    template< typename Traits >
-    pattern_context( const std::basic_string_view< CharT, Traits > & s ) noexcept
-        : pattern_context( s.data(), s.size() )
+    split_view( std::basic_string_view< StrCharT > str, Pattern pat, const match_options & opts ) noexcept
+        : source{ str, pat, opts }
     {}
 
-    const CharT * const end    = nullptr;
-    const bool          anchor = false;
-    const CharT * const begin  = nullptr;
+    /**
+     * \brief Returns an iterator to the first piece.
+     */
+    iterator begin() const { return iterator( source ); }
+
+    /**
+     * \brief Returns the end iterator.
+     */
+    iterator end() const noexcept { return {}; }
 };
 
-extern template struct pattern_context< char >;
-extern template struct pattern_context< wchar_t >;
-extern template struct pattern_context< char16_t >;
-extern template struct pattern_context< char32_t >;
+/**
+ * \brief Returns a lazy range of the pieces of an input string between the matches of a separator pattern.
+ */
+template< typename StrT, typename PatT,
+          typename std::enable_if< detail::string_traits< PatT >::is_string, int >::type = 0 >
+auto split( StrT&& str, PatT&& sep, const match_options & opts = {} )
+{
+    using str_char_type = typename detail::string_traits< StrT >::char_type;
+    using pat_char_type = typename detail::string_traits< PatT >::char_type;
 
+    const detail::string_context< str_char_type > s = { std::forward< StrT >( str ) };
+    const detail::string_context< pat_char_type > p = { std::forward< PatT >( sep ) };
+
+    return split_view< str_char_type, std::basic_string_view< pat_char_type > >( { s.begin, static_cast< size_t >( s.end - s.begin ) },
+                                                                                 { p.begin, static_cast< size_t >( p.end - p.begin ) }, opts );
 }
 
 /**
- * \brief A lex context is an input string combined with a pattern.
- *
- * You can iterate over all matches in a string calling the pg::lex::begin and pg::lex::end functions with a context object.
- *
- * \note A lex context keeps a reference to the input string and pattern.
- *
- * \tparam StrCharT The char type of the input string.
- * \tparam PatCharT The char type of the pattern.
+ * \brief Returns a lazy range of the pieces of an input string between the matches of a compiled separator pattern.
+ */
+template< typename StrT, typename PatCharT >
+auto split( StrT&& str, const basic_pattern< PatCharT > & sep, const match_options & opts = {} )
+{
+    using str_char_type = typename detail::string_traits< StrT >::char_type;
+
+    const detail::string_context< str_char_type > s = { std::forward< StrT >( str ) };
+
+    return split_view< str_char_type, const basic_pattern< PatCharT > * >( { s.begin, static_cast< size_t >( s.end - s.begin ) }, &sep, opts );
+}
+
+/* The split view would keep a reference to the temporary pattern. */
+template< typename StrT, typename PatCharT >
+auto split( StrT&& str, const basic_pattern< PatCharT > && sep, const match_options & opts = {} ) = delete;
+
+/**
+ * \brief The matches of a compiled pattern in a batch of strings, stored as arrays instead of a match result per string.
  *
- * \see pg::lex::begin
- * \see pg::lex::end
+ * The rows are the strings of the batch, in the order of the batch.
+ * The offsets of a row are relative to the begin of its string; a row that is longer than UINT32_MAX chars throws a 'string_too_long'.
  */
-template< typename StrCharT, typename PatCharT >
-struct context
+struct batch_result
 {
-    const detail::string_context< StrCharT >  s;
-    const detail::pattern_context< PatCharT > p;
+    /**
+     * \brief The offset and the length of a capture in its row; the length of a position capture is zero.
+     */
+    struct capture
+    {
+        std::uint32_t offset = 0;
+        std::uint32_t length = 0;
+    };
 
-    template< typename StrT, typename PatT >
-    context( StrT && s_, PatT && p_ ) noexcept
-        : s( std::forward< StrT >( s_ ) )
-        , p( std::forward< PatT >( p_ ) )
+    std::size_t                            captures = 0;  ///< The number of captures of every row; one for a pattern without captures.
+    std::vector< std::pair< long, long > > positions;     ///< The position of the match of every row; {-1, -1} for a row without a match.
+    std::vector< capture >                 offsets;       ///< The captures of row 'r' start at index 'r * captures'.
+
+    /**
+     * \brief Returns the number of rows.
+     */
+    std::size_t size() const noexcept { return positions.size(); }
+
+    /**
+     * \brief Returns true when the pattern matched row 'row'.
+     */
+    bool matched( std::size_t row ) const noexcept { return positions[ row ].first >= 0; }
+
+    /**
+     * \brief Returns the offset and the length of capture 'i' of row 'row'.
+     *
+     * Throws a 'capture_out_of_range' when 'i' is not less than the number of captures of a row.
+     * The captures of a row without a match are zero.
+     */
+    const capture & at( std::size_t row, std::size_t i ) const
     {
-        static_assert( detail::string_traits< StrT >::is_string, "String is not one of the supported string-like types!" );
-        static_assert( detail::string_traits< PatT >::is_string, "Pattern is not one of the supported string-like types!" );
+        if( i >= captures )
+        {
+            throw lex_error( capture_out_of_range );
+        }
+        return offsets[ row * captures + i ];
     }
+};
 
-    bool operator ==( const context< StrCharT, PatCharT >& other ) const noexcept
+/**
+ * \brief The results of a substitution in a batch of strings, stored as one buffer of chars and the offsets of the rows in the buffer.
+ */
+template< typename CharT >
+struct basic_batch_strings
+{
+    std::basic_string< CharT > chars;          ///< The chars of all rows, one after another.
+    std::vector< std::size_t > offsets = { 0 };  ///< Row 'r' starts at offsets[ r ] and ends at offsets[ r + 1 ].
+
+    /**
+     * \brief Returns the number of rows.
+     */
+    std::size_t size() const noexcept { return offsets.size() - 1; }
+
+    /**
+     * \brief Returns a view of row 'row'; the view is valid until the strings are modified.
+     */
+    std::basic_string_view< CharT > operator []( std::size_t row ) const noexcept
     {
-        return s.begin == other.s.begin && s.end == other.s.end &&
-               p.begin == other.p.begin && p.end == other.p.end;
+        return { chars.data() + offsets[ row ], offsets[ row + 1 ] - offsets[ row ] };
+    }
+
+    /**
+     * \brief Removes all rows; the memory of the buffers is kept for the next batch.
+     */
+    void clear() noexcept
+    {
+        chars.clear();
+        offsets.resize( 1 );
     }
 };
 
-template< typename StrT, typename PatT >
-context( StrT &&, PatT && ) noexcept ->
-context< typename detail::string_traits< StrT >::char_type,
-         typename detail::string_traits< PatT >::char_type >;
+using batch_strings    = basic_batch_strings< char >;
+using wbatch_strings   = basic_batch_strings< wchar_t >;
+using u16batch_strings = basic_batch_strings< char16_t >;
+using u32batch_strings = basic_batch_strings< char32_t >;
+
+namespace detail
+{
 
+template< typename Rows >
+using row_char_type = typename string_traits< decltype( *std::begin( std::declval< const Rows & >() ) ) >::char_type;
 
-/**
- * \brief Searches for the first match of a pattern in an input string.
- *
- * \return Returns a match result based on the character type of the input string.
- */
-template< typename StrT, typename PatT >
-auto match( StrT&& str, PatT&& pat )
+/* Sizes the arrays of a batch result for 'rows' rows of a pattern; the memory of a previous batch is reused. */
+template< typename PatCharT >
+void prepare_batch( batch_result & out, std::size_t rows, const basic_pattern< PatCharT > & pat )
 {
-    using str_char_type = typename detail::string_traits< StrT >::char_type;
+    out.captures = std::max< std::size_t >( pat.captures(), 1 );
+    out.positions.assign( rows, { -1l, -1l } );
+    out.offsets.assign( rows * out.captures, {} );
+}
+
+/* Matches rows [first, last); the rows share one match result because a state only points into its row, the pattern and the result. */
+template< typename Rows, typename PatCharT >
+void match_rows( const Rows & rows, std::size_t first, std::size_t last, const basic_pattern< PatCharT > & pat, batch_result & out,
+                 const match_options & opts )
+{
+    using str_char_type = row_char_type< Rows >;
 
-    context                             c = { std::forward< StrT >( str ), std::forward< PatT >( pat ) };
+    const auto                          row = std::begin( rows );
     basic_match_result< str_char_type > mr;
-    detail::match_state                 ms = { c.s.begin, c.s.end, c.p.end, mr };
 
-    for( auto s = c.s.begin ; s <= c.s.end ; ++s )
+    for( auto r = first ; r < last ; ++r )
     {
-        if( auto e = detail::match( ms, s, c.p.begin ) )
+        const string_context< str_char_type > s = { row[ r ] };
+        check_compact_length( s.begin, s.end );
+
+        compiled_match_state ms = { s.begin, s.end, pat, mr, opts };
+
+        find_aux( ms, pat.anchored(), ms.filter );
+        if( !mr )
         {
-            ms.check_captures();
-            ms.pos = { static_cast< long >( s - c.s.begin ), static_cast< long >( e - c.s.begin ) };
-            if( ms.level == 0 )
-            {
-                ms.captures[ ms.level ] = { s, static_cast< long >( e - s ) };
-                ++ms.level;
-            }
-            return mr;
+            continue;
         }
 
-        if( c.p.anchor )
+        out.positions[ r ] = mr.position();
+        auto offsets       = out.offsets.data() + r * out.captures;
+        for( size_t i = 0 ; i < mr.size() ; ++i )
         {
-            break;
+            const auto cap = mr.at( i );
+            offsets[ i ]   = { static_cast< std::uint32_t >( cap.data() - s.begin ), static_cast< std::uint32_t >( cap.size() ) };
         }
-
-        ms.reprepstate();
     }
+}
 
-    return mr;
+/* Checks the replacement of a batch once instead of for every row. */
+template< typename PatCharT, typename ReplT >
+void check_batch_replacement( const basic_pattern< PatCharT > & pat, const ReplT & repl )
+{
+    if constexpr( is_replacement< ReplT >::value )
+    {
+        if( repl.max_capture() > std::max< size_t >( pat.captures(), 1 ) )  /* %1 is the whole match of a pattern without captures */
+        {
+            throw lex_error( capture_invalid_index );
+        }
+    }
 }
 
-/**
- * \brief An iterator for pg::lex::context objects.
- *
- * The constructor does not perform the first match so the match result is not yet valid.
- * First you must increase the iterator before dereferencing it to search for the first match result.
- *
- * \see pg::lex::context
- * \see pg::lex::begin
- */
-template< typename StrCharT, typename PatCharT >
-struct gmatch_iterator
+/* Substitutes the matches in rows [first, last) and appends the rows to 'out'; the rows share one match result. */
+template< typename Rows, typename PatCharT, typename ReplT >
+void gsub_rows( const Rows & rows, std::size_t first, std::size_t last, const basic_pattern< PatCharT > & pat, const ReplT & repl, int count,
+                basic_batch_strings< row_char_type< Rows > > & out, const match_options & opts )
 {
-    gmatch_iterator( const context< StrCharT, PatCharT >& ctx, const StrCharT * start ) noexcept
-        : c( ctx )
-        , pos( start )
-    {}
+    using str_char_type = row_char_type< Rows >;
 
-    /**
-     * \brief Iterates to the next match in the context.
-     *
-     * The match result is empty when the end is reached.
-     */
-    gmatch_iterator& operator ++()
+    const auto                          row = std::begin( rows );
+    basic_match_result< str_char_type > mr;
+
+    for( auto r = first ; r < last ; ++r )
     {
-        detail::match_state ms = { c.s.begin, c.s.end, c.p.end, mr };
+        const string_context< str_char_type > s  = { row[ r ] };
+        compiled_match_state                  ms = { s.begin, s.end, pat, mr, opts };
 
-        while( pos <= c.s.end )
+        gsub_aux( ms, pat.anchored(), ms.filter, count, out.chars, [ & ]( auto &result, auto start, auto end )
         {
-            auto e = detail::match( ms, pos, c.p.begin );
-            if( !e || e == last_match )
+            if constexpr( is_replacement< ReplT >::value )
+            {
+                add_r( result, ms, start, end, repl );
+            }
+            else if constexpr( string_traits< ReplT >::is_string )
             {
-                ++pos;
+                add_s( result, ms, start, end, string_context< typename string_traits< ReplT >::char_type >{ repl } );
             }
             else
             {
-                ms.check_captures();
-                ms.pos = { static_cast< long >( pos - c.s.begin ), static_cast< long >( e - c.s.begin ) };
-                if( ms.level == 0 )
-                {
-                    ms.captures[ ms.level ] = { pos, static_cast< long >( e - pos ) };
-                    ++ms.level;
-                }
-                last_match = e;
-                pos        = e;
-
-                return *this;
+                add_f< str_char_type >( result, repl, mr );
             }
-            last_match = e;
+        } );
+        out.offsets.push_back( out.chars.size() );
+    }
+}
 
-            ms.reprepstate();
-        }
+}
 
-        return *this;
-    }
+/**
+ * \brief Searches for the first match of a compiled pattern in every string of a batch.
+ *
+ * The strings are matched one after another with one match result; the arrays of 'out' are reused between batches.
+ *
+ * \param rows A random access range of strings, e.g. a std::vector of std::string_view.
+ * \param pat  The compiled pattern
+ * \param out  The results of the batch; the previous results are replaced.
+ * \param opts The options of the matcher; the step limit applies to every row.
+ */
+template< typename Rows, typename PatCharT >
+void match_batch( const Rows & rows, const basic_pattern< PatCharT > & pat, batch_result & out, const match_options & opts = {} )
+{
+    const auto n = static_cast< std::size_t >( std::distance( std::begin( rows ), std::end( rows ) ) );
 
-    bool operator ==( const gmatch_iterator & other ) const noexcept
-    {
-        return c == other.c && pos == other.pos;
-    }
+    detail::prepare_batch( out, n, pat );
+    detail::match_rows( rows, 0, n, pat, out, opts );
+}
 
-    bool operator !=( const gmatch_iterator & other ) const noexcept
-    {
-        return !( *this == other );
-    }
+/**
+ * \brief Substitutes a replacement for the matches of a compiled pattern in every string of a batch.
+ *
+ * \param rows  A random access range of strings, e.g. a std::vector of std::string_view.
+ * \param pat   The compiled pattern
+ * \param repl  The replacement pattern, a decoded replacement or a function that accepts a match result and returns the replacement.
+ * \param out   The results of the batch; the previous results are replaced.
+ * \param count The maximum number of substitutes in a row; negative for unlimited an unlimited count.
+ * \param opts  The options of the matcher; the step limit applies to every row.
+ */
+template< typename Rows, typename PatCharT, typename ReplT >
+void gsub_batch( const Rows & rows, const basic_pattern< PatCharT > & pat, const ReplT & repl, basic_batch_strings< detail::row_char_type< Rows > > & out,
+                 int count = -1, const match_options & opts = {} )
+{
+    const auto n = static_cast< std::size_t >( std::distance( std::begin( rows ), std::end( rows ) ) );
+
+    detail::check_batch_replacement( pat, repl );
+    out.clear();
+    out.offsets.reserve( n + 1 );
+    detail::gsub_rows( rows, 0, n, pat, repl, count, out, opts );
+}
+
+/**
+ * \brief An ordered list of substitution rules with compiled patterns.
+ *
+ * Applying a chain has the same result as a gsub per rule in the order of the rules, every rule substitutes in the result of the previous rule.
+ * A rule keeps a reference to its compiled pattern; its replacement is decoded and checked when the rule is added.
+ *
+ * \tparam CharT The char type of the patterns and the replacements.
+ */
+template< typename CharT >
+class basic_rule_chain
+{
+public:
 
     /**
-     * \brief Dereferences to a match result.
+     * \brief A compiled pattern, its replacement and the maximum number of substitutes.
      */
-    const auto & operator *() const noexcept
+    struct rule
     {
-        return mr;
-    }
+        const basic_pattern< CharT > * pattern;
+        basic_replacement< CharT >     replacement;
+        int                            count;
+    };
 
     /**
-     * \brief Returns a pointer to a match result.
+     * \brief Appends a rule to the chain.
+     *
+     * Throws a 'capture_invalid_index' when the replacement uses a capture that the pattern doesn't have.
+     *
+     * \param pat   The compiled pattern
+     * \param repl  The replacement pattern
+     * \param count The maximum number of substitutes; negative for unlimited an unlimited count.
      */
-    const auto operator ->() const noexcept
+    basic_rule_chain & add( const basic_pattern< CharT > & pat, basic_replacement< CharT > repl, int count = -1 )
     {
-        return &mr;
+        detail::check_batch_replacement( pat, repl );
+        chain.push_back( { &pat, std::move( repl ), count } );
+        return *this;
     }
 
+    basic_rule_chain & add( const basic_pattern< CharT > && pat, basic_replacement< CharT > repl, int count = -1 ) = delete;
+
+    /**
+     * \brief Returns the rules in the order they are applied.
+     */
+    const std::vector< rule > & rules() const noexcept { return chain; }
+
+    /**
+     * \brief Returns the number of rules.
+     */
+    std::size_t size() const noexcept { return chain.size(); }
+
 private:
 
-    const context< StrCharT, PatCharT > c;
-    const StrCharT *                    pos        = nullptr;
-    const StrCharT *                    last_match = nullptr;
-    basic_match_result< StrCharT >      mr;
+    std::vector< rule > chain;
 };
 
+using rule_chain    = basic_rule_chain< char >;
+using wrule_chain   = basic_rule_chain< wchar_t >;
+using u16rule_chain = basic_rule_chain< char16_t >;
+using u32rule_chain = basic_rule_chain< char32_t >;
+
 /**
- * \brief Returns a pg::lex::gmatch_iterator of a lex context object.
- *
- * When the context contains matches, the iterator has initial the result of the first match.
- * The iterator is equal to the end iterator when the context has no matches.
+ * \brief The buffers of pg::lex::gsub_chain for the results of the rules.
  *
- * \see pg::lex::gmatch_iterator
- * \see pg::lex::end
+ * A rule reads the result of the previous rule from one buffer and writes its result in the other one.
+ * Reusing a scratch for many strings reuses its memory; a scratch must not be shared between threads.
  */
-template< typename StrCharT, typename PatCharT >
-auto begin( const context< StrCharT, PatCharT > & c )
+template< typename CharT >
+struct basic_chain_scratch
 {
-    auto it = gmatch_iterator( c, c.s.begin );
-    return ++it;
-}
+    std::basic_string< CharT > front;  ///< The result of the last rule that substituted a match.
+    std::basic_string< CharT > back;   ///< The result of the rule that is applied.
+};
 
-/**
- * \brief Returns a pg::lex::gmatch_iterator that indicates the end of a lex context.
- *
- * The result of the end iterator is always an empty match result.
- *
- * \see pg::lex::gmatch_iterator
- */
-template< typename StrCharT, typename PatCharT >
-auto end( const context< StrCharT, PatCharT > & c ) noexcept
+using chain_scratch    = basic_chain_scratch< char >;
+using wchain_scratch   = basic_chain_scratch< wchar_t >;
+using u16chain_scratch = basic_chain_scratch< char16_t >;
+using u32chain_scratch = basic_chain_scratch< char32_t >;
+
+namespace detail
 {
-    return gmatch_iterator( c, c.s.end + 1 );
-}
 
-/**
- * \brief Substitutes a replacement for a match found in the input string.
- *
- * \param str   The input string
- * \param pat   The pattern used to find matches in the input string
- * \param repl  The replacement pattern that substitutes the match.
- * \param count The maximum number of substitutes; negative for unlimited an unlimited count.
- *
- * \return returns a std::string based on the character type of the input string
+/*
+ * Applies the rules of a chain to [s, e); returns the result, which is a view of the front buffer of the scratch or [s, e) when no rule substituted.
+ * A rule without a match is skipped without copying; the search of a rule with a match continues from its first match.
  */
-template< typename StrT, typename PatT, typename ReplT,
-          typename std::enable_if< detail::string_traits< ReplT >::is_string, int >::type = 0 >
-auto gsub( StrT&& str, PatT&& pat, ReplT&& repl, int count = -1 )
+template< typename StrCharT, typename PatCharT >
+std::basic_string_view< StrCharT > apply_chain( const StrCharT * s, const StrCharT * e, const basic_rule_chain< PatCharT > & chain,
+                                                basic_chain_scratch< StrCharT > & scratch, basic_match_result< StrCharT > & mr, const match_options & opts )
 {
-    static_assert( detail::string_traits< ReplT >::is_string, "Replacement pattern is not one of the supported string-like types!" );
-
-    using str_char_type  = typename detail::string_traits< StrT >::char_type;
-    using repl_char_type = typename detail::string_traits< ReplT >::char_type;
-
-    const detail::string_context< repl_char_type > r          = { repl };
-    const context                                  c          = { std::forward< StrT >( str ), std::forward< PatT >( pat ) };
-    basic_match_result< str_char_type >            mr;
-    detail::match_state                            ms         = { c.s.begin, c.s.end, c.p.end, mr };
-    const str_char_type *                          last_match = nullptr;
+    std::basic_string_view< StrCharT > current( s, e - s );
 
-    std::basic_string< str_char_type > result;
-    result.reserve( c.s.end - c.s.begin );
-
-    auto s = c.s.begin;
-    while( s <= c.s.end && count != 0 )
+    for( const auto &rule : chain.rules() )
     {
-        if( c.p.anchor )
+        if( rule.count == 0 )
         {
-            count = 0;  // break at first iteration
+            continue;
         }
 
-        auto e = detail::match( ms, s, c.p.begin );
-        if( !e || e == last_match )
+        const auto           begin = current.data();
+        compiled_match_state ms    = { begin, begin + current.size(), *rule.pattern, mr, opts };
+
+        find_aux( ms, rule.pattern->anchored(), ms.filter );
+        if( !mr )
         {
-            ++s;
+            continue;
         }
-        else
-        {
-            --count;
 
-            result.append( last_match ? last_match : c.s.begin, s );
+        const auto first = begin + mr.position().first;
+        ms.reprepstate();
 
-            ms.check_captures();
+        scratch.back.clear();
+        gsub_aux( ms, rule.pattern->anchored(), ms.filter, rule.count, scratch.back, [ & ]( auto &result, auto start, auto end )
+        {
+            add_r( result, ms, start, end, rule.replacement );
+        }, first );
 
-            auto r_begin = r.begin;
-            for( auto find = std::find( r_begin, r.end, '%' ) ;
-                find != r.end ;
-                r_begin = find + 1, find = std::find( r_begin, r.end, '%' ) )
-            {
-                result.append( r_begin, find );     // Copy pattern before '%'
-                ++find;                             // skip ESC
+        std::swap( scratch.front, scratch.back );
+        current = scratch.front;
+    }
 
-                const str_char_type cap_char = *find;
-                if( cap_char == '%' )                // %%
-                {
-                    result.append( 1u, cap_char );
-                }
-                else if( cap_char == '0' )           // %0
-                {
-                    result.append( s, e );
-                }
-                else if( std::isdigit( cap_char ) )  // %n
-                {
-                    if( ms.level == 0 )
-                    {
-                        ms.captures[ ms.level ] = { s, static_cast< long >( e - s ) };
-                        ++ms.level;
-                    }
-                    const auto cap_index = cap_char - '1';
-                    if( cap_index >= ms.level )
-                    {
-                        throw lex_error( capture_invalid_index );
-                    }
-                    const auto& cap = ms.captures[ cap_index ];
-                    if( cap.len == detail::cap_state::position  )
-                    {
-                        const ptrdiff_t pos = 1 + cap.init - c.s.begin;
-                        detail::append_number( result, pos );
-                    }
-                    else
-                    {
-                        assert( cap.len != detail::cap_state::unfinished );
-                        result.append( cap.init, cap.len );
-                    }
-                }
-                else
-                {
-                    throw lex_error( percent_invalid_use_in_replacement );
-                }
-            }
+    return current;
+}
 
-            result.append( r_begin, r.end );
+}
 
-            last_match = e;
-            s          = e;
-        }
-        ms.reprepstate();
-    }
+/**
+ * \brief Applies the rules of a chain to an input string and returns a view of the result.
+ *
+ * The result is the same as a gsub per rule; the intermediate results are written in the buffers of the scratch instead of a new string per rule.
+ *
+ * \param str     The input string
+ * \param chain   The rules
+ * \param scratch The buffers for the results of the rules.
+ * \param opts    The options of the matcher; the step limit applies to every rule.
+ *
+ * \return A view of the result; it points into the scratch or, when no rule substituted a match, into the input string.
+ *         The view is valid until the scratch is used again.
+ */
+template< typename StrT, typename PatCharT >
+auto gsub_chain( StrT&& str, const basic_rule_chain< PatCharT > & chain, basic_chain_scratch< typename detail::string_traits< StrT >::char_type > & scratch,
+                 const match_options & opts = {} )
+{
+    using str_char_type = typename detail::string_traits< StrT >::char_type;
 
-    result.append( last_match ? last_match : c.s.begin, c.s.end );
+    const detail::string_context< str_char_type > s = { std::forward< StrT >( str ) };
+    basic_match_result< str_char_type >           mr;
 
-    return result;
+    return detail::apply_chain( s.begin, s.end, chain, scratch, mr, opts );
 }
 
+/* The view could point into the temporary input string. */
+template< typename CharT, typename Traits, typename Allocator, typename PatCharT >
+auto gsub_chain( std::basic_string< CharT, Traits, Allocator > && str, const basic_rule_chain< PatCharT > & chain, basic_chain_scratch< CharT > & scratch,
+                 const match_options & opts = {} ) = delete;
+
 /**
- * \brief Substitutes a replacement for a match found in the input string.
- *
- * \param str   The input string
- * \param pat   The pattern used to find matches in the input string
- * \param repl  A function that accepts a match result and returns the replacement.
- * \param count The maximum number of substitutes; negative for unlimited an unlimited count.
+ * \brief Applies the rules of a chain to an input string.
  *
  * \return returns a std::string based on the character type of the input string
  */
-template< typename StrT, typename PatT, typename Function,
-          typename std::enable_if< !detail::string_traits< Function >::is_string, int >::type = 0 >
-auto gsub( StrT&& str, PatT&& pat, Function&& func, int count = -1 )
+template< typename StrT, typename PatCharT >
+auto gsub_chain( StrT&& str, const basic_rule_chain< PatCharT > & chain, const match_options & opts = {} )
 {
-    using str_char_type  = typename detail::string_traits< StrT >::char_type;
-
-    const context                       c          = { std::forward< StrT >( str ), std::forward< PatT >( pat ) };
-    basic_match_result< str_char_type > mr;
-    detail::match_state                 ms         = { c.s.begin, c.s.end, c.p.end, mr };
-    const str_char_type *               last_match = nullptr;
+    using str_char_type = typename detail::string_traits< StrT >::char_type;
 
-    std::basic_string< str_char_type > result;
-    result.reserve( c.s.end - c.s.begin );
+    const detail::string_context< str_char_type > s = { std::forward< StrT >( str ) };
+    basic_chain_scratch< str_char_type >          scratch;
+    basic_match_result< str_char_type >           mr;
 
-    auto s = c.s.begin;
-    while( s <= c.s.end && count != 0 )
+    const auto result = detail::apply_chain( s.begin, s.end, chain, scratch, mr, opts );
+    if( result.data() == scratch.front.data() )
     {
-        if( c.p.anchor )
-        {
-            count = 0;  // break at first iteration
-        }
-
-        auto e = detail::match( ms, s, c.p.begin );
-        if( !e || e == last_match )
-        {
-            ++s;
-        }
-        else
-        {
-            --count;
+        return std::move( scratch.front );
+    }
+    return std::basic_string< str_char_type >( result );
+}
 
-            result.append( last_match ? last_match : c.s.begin, s );
+namespace detail
+{
 
-            ms.check_captures();
-            ms.pos = { static_cast< long >( s - c.s.begin ), static_cast< long >( e - c.s.begin ) };
-            if( ms.level == 0 )
-            {
-                ms.captures[ ms.level ] = { s, static_cast< long >( e - s ) };
-                ++ms.level;
-            }
+/* Applies a chain to rows [first, last) and appends the rows to 'out'; the rows share one scratch and one match result. */
+template< typename Rows, typename PatCharT >
+void gsub_chain_rows( const Rows & rows, std::size_t first, std::size_t last, const basic_rule_chain< PatCharT > & chain,
+                      basic_batch_strings< row_char_type< Rows > > & out, const match_options & opts )
+{
+    using str_char_type = row_char_type< Rows >;
 
-            auto repl = func( mr );
-            result.append( repl );
+    const auto                           row = std::begin( rows );
+    basic_chain_scratch< str_char_type > scratch;
+    basic_match_result< str_char_type >  mr;
 
-            last_match = e;
-            s          = e;
-        }
+    for( auto r = first ; r < last ; ++r )
+    {
+        const string_context< str_char_type > s = { row[ r ] };
 
-        ms.reprepstate();
+        out.chars.append( apply_chain( s.begin, s.end, chain, scratch, mr, opts ) );
+        out.offsets.push_back( out.chars.size() );
     }
+}
 
-    result.append( last_match ? last_match : c.s.begin, c.s.end );
+}
+
+/**
+ * \brief Applies the rules of a chain to every string of a batch.
+ *
+ * \param rows  A random access range of strings, e.g. a std::vector of std::string_view.
+ * \param chain The rules
+ * \param out   The results of the batch; the previous results are replaced.
+ * \param opts  The options of the matcher; the step limit applies to every rule of a row.
+ */
+template< typename Rows, typename PatCharT >
+void gsub_chain_batch( const Rows & rows, const basic_rule_chain< PatCharT > & chain, basic_batch_strings< detail::row_char_type< Rows > > & out,
+                       const match_options & opts = {} )
+{
+    const auto n = static_cast< std::size_t >( std::distance( std::begin( rows ), std::end( rows ) ) );
+
+    out.clear();
+    out.offsets.reserve( n + 1 );
+    detail::gsub_chain_rows( rows, 0, n, chain, out, opts );
+}
 
-    return result;
 }
 
 }
 
+#if __cplusplus >= 202002L
+#include <ranges>
+
+/* The pieces of a split view are views into the input string and stay valid when the view is destroyed */
+namespace std::ranges
+{
+template< typename StrCharT, typename Pattern >
+inline constexpr bool enable_borrowed_range< pg::lex::split_view< StrCharT, Pattern > > = true;
 }
+#endif
@@ -0,0 +1,333 @@
+// MIT License
+//
+// Copyright (c) 2020 PG1003
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include "lex.h"
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+
+
+namespace pg
+{
+
+namespace lex
+{
+
+namespace detail
+{
+
+struct cache_access;
+
+}
+
+/**
+ * \brief A thread-safe cache of compiled patterns that are looked up by the text and the class mode of the pattern.
+ *
+ * The cache holds at most about 'capacity' patterns, the least recently used pattern of a shard is evicted when a new pattern doesn't fit.
+ * The order of use is exact in a small shard and approximate in a large shard.
+ * The patterns are spread over shards by the hash of their text; a lookup locks only its shard, and a hit only locks it for reading.
+ * Every thread also remembers its last few patterns, a lookup of such a pattern doesn't touch the shards at all.
+ * A compiled pattern stays valid as long as a returned pointer to it exists, also when it is evicted.
+ *
+ * \tparam CharT The char type of the patterns.
+ */
+template< typename CharT >
+class basic_pattern_cache
+{
+public:
+
+    using pattern_type = basic_pattern< CharT >;
+    using pointer      = std::shared_ptr< const pattern_type >;
+
+    /**
+     * \brief Creates a cache of 'capacity' patterns in 'shards' shards.
+     *
+     * The capacity is divided over the shards, the number of shards is at most the capacity.
+     * One shard gives an exact LRU order, more shards let more threads miss at the same time without waiting.
+     */
+    explicit basic_pattern_cache( std::size_t capacity = 1024, std::size_t shards = 16 )
+        : shard_count( std::max< std::size_t >( 1, std::min( shards, capacity ) ) )
+        , shard_capacity( std::max< std::size_t >( 1, ( capacity + shard_count - 1 ) / shard_count ) )
+        , touch_age( shard_capacity / 8 + 1 )
+        , shards( new shard[ shard_count ] )
+    {}
+
+    basic_pattern_cache( const basic_pattern_cache & ) = delete;
+    basic_pattern_cache & operator =( const basic_pattern_cache & ) = delete;
+
+    /**
+     * \brief Returns the compiled pattern of 'pat' with the character classes of 'classes'; the pattern is compiled and added to the cache when it is not in the cache.
+     *
+     * A malformed pattern throws a pg::lex::lex_error and is not added to the cache.
+     */
+    pointer get( std::basic_string_view< CharT > pat, class_mode classes = class_mode::locale )
+    {
+        const auto & n = acquire( pat, classes );
+        return pointer( n, &n->pattern );
+    }
+
+    /**
+     * \brief Returns the number of patterns in the cache.
+     */
+    std::size_t size() const
+    {
+        std::size_t n = 0;
+        for( std::size_t i = 0 ; i < shard_count ; ++i )
+        {
+            std::shared_lock< std::shared_mutex > lock( shards[ i ].mutex );
+            n += shards[ i ].entries.size();
+        }
+        return n;
+    }
+
+    /**
+     * \brief Returns the maximum number of patterns in the cache.
+     */
+    std::size_t capacity() const noexcept { return shard_count * shard_capacity; }
+
+    /**
+     * \brief Removes all patterns from the cache.
+     */
+    void clear()
+    {
+        generation.fetch_add( 1, std::memory_order_release );  /* forgets the patterns that the threads remember */
+        for( std::size_t i = 0 ; i < shard_count ; ++i )
+        {
+            std::unique_lock< std::shared_mutex > lock( shards[ i ].mutex );
+            shards[ i ].entries.clear();
+        }
+    }
+
+private:
+
+    friend struct detail::cache_access;
+
+    struct node
+    {
+        template< typename PatT >
+        node( PatT && pat, class_mode classes_ )
+            : pattern( pat, classes_ )
+            , text( pat )
+            , classes( classes_ )
+        {}
+
+        bool is( std::basic_string_view< CharT > pat, class_mode classes_ ) const noexcept { return classes == classes_ && text == pat; }
+
+        const pattern_type                 pattern;
+        const std::basic_string< CharT >   text;
+        const class_mode                   classes;
+        std::atomic< std::uint64_t >       stamp = { 0 };  /* the time of the last use */
+    };
+
+    struct shard
+    {
+        mutable std::shared_mutex                                     mutex;
+        std::unordered_map< std::size_t, std::shared_ptr< node > >    entries;  /* keyed by the hash of the text and the class mode of the pattern */
+        std::atomic< std::uint64_t >                                  clock = { 0 };
+    };
+
+    /* A pattern that a thread remembers */
+    struct recent
+    {
+        const basic_pattern_cache * cache      = nullptr;
+        std::uint64_t               generation = 0;
+        std::size_t                 hash       = 0;
+        std::shared_ptr< node >     n;
+    };
+
+    static constexpr std::size_t recent_count = 16;  /* the number of patterns that every thread remembers */
+
+    /*
+     * Returns the node of 'pat' that the calling thread remembers; the reference is valid until the next lookup on the thread.
+     * The time of use of a remembered pattern is only updated when 'touch_age' other uses in its shard came after it,
+     * so the threads that share a hot pattern don't write to its cache line on every hit.
+     */
+    const std::shared_ptr< node > & acquire( std::basic_string_view< CharT > pat, class_mode classes )
+    {
+        thread_local recent remembered[ recent_count ];
+
+        const auto hash = std::hash< std::basic_string_view< CharT > >()( pat ) * 3 + static_cast< std::size_t >( classes );
+        const auto gen  = generation.load( std::memory_order_acquire );
+        auto &     r    = remembered[ hash % recent_count ];
+        if( r.cache == this && r.generation == gen && r.hash == hash && r.n->is( pat, classes ) )
+        {
+            auto & s = shards[ hash % shard_count ];
+            if( s.clock.load( std::memory_order_relaxed ) - r.n->stamp.load( std::memory_order_relaxed ) > touch_age )
+            {
+                touch( s, *r.n );
+            }
+            return r.n;
+        }
+
+        r = { this, gen, hash, lookup( pat, classes, hash ) };
+        return r.n;
+    }
+
+    static void touch( shard & s, node & n ) noexcept
+    {
+        n.stamp.store( s.clock.fetch_add( 1, std::memory_order_relaxed ), std::memory_order_relaxed );
+    }
+
+    std::shared_ptr< node > lookup( std::basic_string_view< CharT > pat, class_mode classes, std::size_t hash )
+    {
+        auto & s = shards[ hash % shard_count ];
+
+        {
+            std::shared_lock< std::shared_mutex > lock( s.mutex );
+            const auto it = s.entries.find( hash );
+            if( it != s.entries.end() && it->second->is( pat, classes ) )
+            {
+                touch( s, *it->second );
+                return it->second;
+            }
+        }
+
+        auto compiled = std::make_shared< node >( pat, classes );  /* compiled without a lock, a malformed pattern throws here */
+
+        std::unique_lock< std::shared_mutex > lock( s.mutex );
+        auto it = s.entries.find( hash );
+        if( it != s.entries.end() && it->second->is( pat, classes ) )
+        {
+            return it->second;  /* added by another thread in the meantime */
+        }
+        if( it == s.entries.end() && s.entries.size() >= shard_capacity )
+        {
+            s.entries.erase( std::min_element( s.entries.begin(), s.entries.end(), []( const auto & a, const auto & b )
+            {
+                return a.second->stamp.load( std::memory_order_relaxed ) < b.second->stamp.load( std::memory_order_relaxed );
+            } ) );
+        }
+
+        touch( s, *compiled );
+        s.entries[ hash ] = compiled;  /* a new entry or a different pattern with the same hash, which is replaced */
+
+        return compiled;
+    }
+
+    const std::size_t            shard_count;
+    const std::size_t            shard_capacity;
+    const std::uint64_t          touch_age;
+    std::unique_ptr< shard[] >   shards;
+    std::atomic< std::uint64_t > generation = { 0 };
+};
+
+using pattern_cache    = basic_pattern_cache< char >;
+using wpattern_cache   = basic_pattern_cache< wchar_t >;
+using u16pattern_cache = basic_pattern_cache< char16_t >;
+using u32pattern_cache = basic_pattern_cache< char32_t >;
+
+namespace detail
+{
+
+/* Gives the cached matchers the remembered pattern of the calling thread */
+struct cache_access
+{
+    template< typename CharT >
+    static const basic_pattern< CharT > & acquire( basic_pattern_cache< CharT > & cache, std::basic_string_view< CharT > pat, class_mode classes )
+    {
+        return cache.acquire( pat, classes )->pattern;
+    }
+};
+
+}
+
+/**
+ * \brief Returns the process-wide pattern cache of the char type; it holds up to 1024 patterns.
+ */
+template< typename CharT >
+basic_pattern_cache< CharT > & default_pattern_cache()
+{
+    static basic_pattern_cache< CharT > cache;
+    return cache;
+}
+
+/**
+ * \brief Searches for the first match of a pattern in an input string with the compiled pattern from a cache.
+ *
+ * The pattern is compiled with the class mode of the options.
+ * Unlike pg::lex::match with a pattern string, a malformed pattern throws even when the malformed part is not reached.
+ * With the utf8 option the pattern string is matched by the text matcher, since compiled patterns match by chars.
+ *
+ * \return Returns a match result based on the character type of the input string.
+ */
+template< typename StrT, typename PatT,
+          typename std::enable_if< detail::string_traits< PatT >::is_string, int >::type = 0 >
+auto match_cached( StrT&& str, PatT&& pat, const match_options & opts = {},
+                   basic_pattern_cache< typename detail::string_traits< PatT >::char_type > & cache = default_pattern_cache< typename detail::string_traits< PatT >::char_type >() )
+{
+    using pat_char_type = typename detail::string_traits< PatT >::char_type;
+
+    const detail::string_context< pat_char_type > p = { std::forward< PatT >( pat ) };
+    const std::basic_string_view< pat_char_type > text( p.begin, static_cast< std::size_t >( p.end - p.begin ) );
+
+    if( opts.utf8 )
+    {
+        return match( std::forward< StrT >( str ), text, opts );
+    }
+
+    /* the match doesn't look up other patterns on this thread, so the remembered pattern stays valid without taking a reference */
+    return match( std::forward< StrT >( str ), detail::cache_access::acquire( cache, text, opts.classes ), opts );
+}
+
+/**
+ * \brief Substitutes a replacement for the matches of a pattern in the input string with the compiled pattern from a cache.
+ *
+ * The pattern is compiled with the class mode of the options.
+ * With the utf8 option the pattern string is matched by the text matcher, since compiled patterns match by chars.
+ *
+ * \param str   The input string
+ * \param pat   The pattern used to find matches in the input string
+ * \param repl  The replacement pattern, a decoded replacement or a function that accepts a match result and returns the replacement.
+ * \param count The maximum number of substitutes; negative for unlimited an unlimited count.
+ * \param opts  The options of the matcher.
+ * \param cache The cache of the compiled patterns.
+ *
+ * \return returns a std::string based on the character type of the input string
+ */
+template< typename StrT, typename PatT, typename ReplT,
+          typename std::enable_if< detail::string_traits< PatT >::is_string, int >::type = 0 >
+auto gsub_cached( StrT&& str, PatT&& pat, ReplT&& repl, int count = -1, const match_options & opts = {},
+                  basic_pattern_cache< typename detail::string_traits< PatT >::char_type > & cache = default_pattern_cache< typename detail::string_traits< PatT >::char_type >() )
+{
+    using pat_char_type = typename detail::string_traits< PatT >::char_type;
+
+    const detail::string_context< pat_char_type > p = { std::forward< PatT >( pat ) };
+    const std::basic_string_view< pat_char_type > text( p.begin, static_cast< std::size_t >( p.end - p.begin ) );
+
+    if( opts.utf8 )
+    {
+        return gsub( std::forward< StrT >( str ), text, std::forward< ReplT >( repl ), count, opts );
+    }
+
+    const auto compiled = cache.get( text, opts.classes );  /* a replacement function can look up patterns too */
+
+    return gsub( std::forward< StrT >( str ), *compiled, std::forward< ReplT >( repl ), count, opts );
+}
+
+}
+
+}
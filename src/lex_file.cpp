@@ -0,0 +1,216 @@
+// MIT License
+//
+// Copyright (c) 2020 PG1003
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "lex_file.h"
+#include <system_error>
+
+#if defined( _WIN32 )
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+/* An empty file isn't mapped; its view points to an empty string */
+static const char empty_file[] = "";
+
+
+void pg::lex::detail::throw_file_error( const std::string & path )
+{
+#if defined( _WIN32 )
+    throw std::system_error( static_cast< int >( GetLastError() ), std::system_category(), path );
+#else
+    throw std::system_error( errno, std::generic_category(), path );
+#endif
+}
+
+
+#if defined( _WIN32 )
+
+pg::lex::mapped_file::mapped_file( const std::string & path, access_hint hint )
+{
+    const DWORD flags = hint == access_hint::sequential ? FILE_FLAG_SEQUENTIAL_SCAN : hint == access_hint::random ? FILE_FLAG_RANDOM_ACCESS : FILE_ATTRIBUTE_NORMAL;
+    const auto  file  = CreateFileA( path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, flags, nullptr );
+    if( file == INVALID_HANDLE_VALUE )
+    {
+        detail::throw_file_error( path );
+    }
+
+    LARGE_INTEGER size;
+    if( !GetFileSizeEx( file, &size ) )
+    {
+        const auto error = GetLastError();
+        CloseHandle( file );
+        SetLastError( error );
+        detail::throw_file_error( path );
+    }
+
+    if( size.QuadPart == 0 )
+    {
+        CloseHandle( file );
+        addr = empty_file;
+        return;
+    }
+
+    mapping = CreateFileMappingA( file, nullptr, PAGE_READONLY, 0, 0, nullptr );
+    const auto error = GetLastError();
+    CloseHandle( file );  /* the mapping keeps the file open */
+    if( !mapping )
+    {
+        SetLastError( error );
+        detail::throw_file_error( path );
+    }
+
+    addr = static_cast< const char * >( MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 ) );
+    if( !addr )
+    {
+        const auto error = GetLastError();
+        CloseHandle( mapping );
+        SetLastError( error );
+        detail::throw_file_error( path );
+    }
+    len = static_cast< std::size_t >( size.QuadPart );
+}
+
+
+void pg::lex::mapped_file::close() noexcept
+{
+    if( mapping )
+    {
+        UnmapViewOfFile( addr );
+        CloseHandle( mapping );
+    }
+    addr    = nullptr;
+    len     = 0;
+    mapping = nullptr;
+}
+
+
+pg::lex::mapped_file::mapped_file( mapped_file && other ) noexcept
+    : addr( other.addr )
+    , len( other.len )
+    , mapping( other.mapping )
+{
+    other.addr    = nullptr;
+    other.len     = 0;
+    other.mapping = nullptr;
+}
+
+
+pg::lex::mapped_file & pg::lex::mapped_file::operator =( mapped_file && other ) noexcept
+{
+    if( this != &other )
+    {
+        close();
+        std::swap( addr, other.addr );
+        std::swap( len, other.len );
+        std::swap( mapping, other.mapping );
+    }
+    return *this;
+}
+
+#else
+
+pg::lex::mapped_file::mapped_file( const std::string & path, access_hint hint )
+{
+    const int fd = ::open( path.c_str(), O_RDONLY | O_CLOEXEC );
+    if( fd < 0 )
+    {
+        detail::throw_file_error( path );
+    }
+
+    struct stat st;
+    if( ::fstat( fd, &st ) != 0 )
+    {
+        const int error = errno;
+        ::close( fd );
+        errno = error;
+        detail::throw_file_error( path );
+    }
+
+    if( st.st_size == 0 )
+    {
+        ::close( fd );
+        addr = empty_file;
+        return;
+    }
+
+    void * p = ::mmap( nullptr, static_cast< std::size_t >( st.st_size ), PROT_READ, MAP_PRIVATE, fd, 0 );
+    const int error = errno;
+    ::close( fd );  /* the mapping keeps the file open */
+    if( p == MAP_FAILED )
+    {
+        errno = error;
+        detail::throw_file_error( path );
+    }
+
+    addr = static_cast< const char * >( p );
+    len  = static_cast< std::size_t >( st.st_size );
+
+    const int advice = hint == access_hint::sequential ? MADV_SEQUENTIAL : hint == access_hint::random ? MADV_RANDOM : MADV_NORMAL;
+    ::madvise( p, len, advice );  /* only a hint; a failure doesn't matter */
+}
+
+
+void pg::lex::mapped_file::close() noexcept
+{
+    if( len )
+    {
+        ::munmap( const_cast< char * >( addr ), len );
+    }
+    addr = nullptr;
+    len  = 0;
+}
+
+
+pg::lex::mapped_file::mapped_file( mapped_file && other ) noexcept
+    : addr( other.addr )
+    , len( other.len )
+{
+    other.addr = nullptr;
+    other.len  = 0;
+}
+
+
+pg::lex::mapped_file & pg::lex::mapped_file::operator =( mapped_file && other ) noexcept
+{
+    if( this != &other )
+    {
+        close();
+        std::swap( addr, other.addr );
+        std::swap( len, other.len );
+    }
+    return *this;
+}
+
+#endif
+
+
+pg::lex::mapped_file::~mapped_file()
+{
+    close();
+}
@@ -0,0 +1,178 @@
+// MIT License
+//
+// Copyright (c) 2020 PG1003
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include "lex.h"
+#include <fstream>
+#include <iterator>
+#include <ostream>
+
+
+namespace pg
+{
+
+namespace lex
+{
+
+/**
+ * \brief The expected access pattern of a mapped file; a hint for the read-ahead of the operating system.
+ */
+enum class access_hint
+{
+    normal,
+    sequential,
+    random
+};
+
+/**
+ * \brief A read-only memory mapping of a file.
+ *
+ * The match results of a mapped file are string views into the mapping; the mapping must outlive them.
+ * Errors of the operating system are reported by throwing a std::system_error.
+ */
+class mapped_file
+{
+    const char * addr = nullptr;
+    std::size_t  len  = 0;
+#if defined( _WIN32 )
+    void *       mapping = nullptr;
+#endif
+
+    void close() noexcept;
+
+public:
+
+    /**
+     * \brief Maps the file at 'path'.
+     */
+    explicit mapped_file( const std::string & path, access_hint hint = access_hint::sequential );
+
+    mapped_file( mapped_file && other ) noexcept;
+    mapped_file & operator =( mapped_file && other ) noexcept;
+
+    mapped_file( const mapped_file & ) = delete;
+    mapped_file & operator =( const mapped_file & ) = delete;
+
+    ~mapped_file();
+
+    /**
+     * \brief Returns a pointer to the first char of the file.
+     */
+    const char * data() const noexcept { return addr; }
+
+    /**
+     * \brief Returns the size of the file.
+     */
+    std::size_t size() const noexcept { return len; }
+
+    /**
+     * \brief Returns a string view of the whole file.
+     */
+    std::string_view view() const noexcept { return { addr, len }; }
+};
+
+/**
+ * \brief Searches for the first match of a pattern in a mapped file.
+ *
+ * \return Returns a match result with captures that point into the mapping.
+ */
+template< typename PatT >
+auto match_file( const mapped_file & file, PatT&& pat, const match_options & opts = {} )
+{
+    return match( file.view(), std::forward< PatT >( pat ), opts );
+}
+
+template< typename PatT >
+auto match_file( const mapped_file && file, PatT&& pat, const match_options & opts = {} ) = delete;
+
+/**
+ * \brief Returns a compiled context to iterate over the matches of a compiled pattern in a mapped file.
+ *
+ * \note The compiled context keeps a reference to the mapped file and the compiled pattern.
+ */
+template< typename PatCharT >
+auto gmatch_file( const mapped_file & file, const basic_pattern< PatCharT > & pat, const match_options & opts = {} )
+{
+    return gmatch( file.view(), pat, opts );
+}
+
+template< typename PatCharT >
+auto gmatch_file( const mapped_file && file, const basic_pattern< PatCharT > & pat, const match_options & opts = {} ) = delete;
+
+/**
+ * \brief Substitutes a replacement for the matches of a pattern in a mapped file and writes the result to a stream.
+ *
+ * The badbit of the stream is set when a write to the stream fails.
+ *
+ * \param file  The mapped file
+ * \param out   The stream to which the result is written
+ * \param pat   The pattern or compiled pattern used to find matches in the file
+ * \param repl  The replacement pattern, a decoded replacement or a function that accepts a match result and returns the replacement.
+ * \param count The maximum number of substitutes; negative for unlimited an unlimited count.
+ * \param opts  The options of the matcher.
+ */
+template< typename PatT, typename ReplT >
+void gsub_file( const mapped_file & file, std::ostream & out, PatT&& pat, ReplT&& repl, int count = -1, const match_options & opts = {} )
+{
+    const auto end = gsub_to( std::ostreambuf_iterator< char >( out ), file.view(), std::forward< PatT >( pat ), std::forward< ReplT >( repl ), count, opts );
+    if( end.failed() )
+    {
+        out.setstate( std::ios::badbit );
+    }
+}
+
+namespace detail
+{
+
+/* Throws a std::system_error with the error of the last failed call of the operating system */
+[[noreturn]] void throw_file_error( const std::string & path );
+
+}
+
+/**
+ * \brief Substitutes a replacement for the matches of a pattern in a mapped file and writes the result to the file at 'path'.
+ *
+ * The output file is replaced; a std::system_error is thrown when it can't be written.
+ * The output file must not be the mapped file.
+ */
+template< typename PatT, typename ReplT >
+void gsub_file( const mapped_file & file, const std::string & path, PatT&& pat, ReplT&& repl, int count = -1, const match_options & opts = {} )
+{
+    std::ofstream out( path, std::ios::binary | std::ios::trunc );
+    if( !out )
+    {
+        detail::throw_file_error( path );
+    }
+
+    gsub_file( file, out, std::forward< PatT >( pat ), std::forward< ReplT >( repl ), count, opts );
+
+    out.close();
+    if( !out )
+    {
+        detail::throw_file_error( path );
+    }
+}
+
+}
+
+}
@@ -0,0 +1,514 @@
+// MIT License
+//
+// Copyright (c) 2020 PG1003
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include "lex.h"
+#include <atomic>
+#include <exception>
+#include <thread>
+#include <tuple>
+
+
+namespace pg
+{
+
+namespace lex
+{
+
+/**
+ * \brief The options of the parallel variants of gmatch and gsub.
+ */
+struct parallel_options
+{
+    unsigned        threads    = 0;        ///< The number of threads; zero for the number of hardware threads.
+    std::size_t     chunk_size = 1 << 20;  ///< The minimum number of chars of a chunk.
+    const pattern * boundary   = nullptr;  ///< Chunks are split after a match of this pattern; nullptr splits at any position.
+};
+
+namespace detail
+{
+
+/* Splits the input string in chunks; returns the start positions of the chunks followed by the end of the input string. */
+template< typename StrCharT >
+std::vector< const StrCharT * > split_chunks( const StrCharT * s_begin, const StrCharT * s_end, unsigned threads, const parallel_options & popts )
+{
+    const auto length = static_cast< std::size_t >( s_end - s_begin );
+    const auto size   = std::max< std::size_t >( { popts.chunk_size, 1, length / ( threads * 4 ) } );  /* a few chunks per thread balances the load */
+
+    std::vector< const StrCharT * > chunks = { s_begin };
+    while( static_cast< std::size_t >( s_end - chunks.back() ) > size )
+    {
+        auto split = chunks.back() + size;
+        if( popts.boundary )
+        {
+            const auto mr = match( std::basic_string_view< StrCharT >( split, s_end - split ), *popts.boundary );
+            if( !mr )
+            {
+                break;
+            }
+            split += std::max( mr.position().second, 1l );
+            if( split >= s_end )
+            {
+                break;
+            }
+        }
+        chunks.push_back( split );
+    }
+    chunks.push_back( s_end );
+
+    return chunks;
+}
+
+/* Calls 'f' with the index of every chunk on 'threads' threads; the first exception in chunk order is rethrown. */
+template< typename Function >
+void for_each_chunk( std::size_t chunks, unsigned threads, Function && f )
+{
+    std::vector< std::exception_ptr > errors( chunks );
+    std::atomic< std::size_t >        next( 0 );
+
+    const auto worker = [ & ]
+    {
+        for( auto i = next++ ; i < chunks ; i = next++ )
+        {
+            try
+            {
+                f( i );
+            }
+            catch( ... )
+            {
+                errors[ i ] = std::current_exception();
+            }
+        }
+    };
+
+    std::vector< std::thread > pool;
+    for( unsigned t = 1 ; t < std::min< std::size_t >( threads, chunks ) ; ++t )
+    {
+        pool.emplace_back( worker );
+    }
+    worker();
+    for( auto &t : pool )
+    {
+        t.join();
+    }
+
+    for( const auto &e : errors )
+    {
+        if( e )
+        {
+            std::rethrow_exception( e );
+        }
+    }
+}
+
+/* A match in the input string; the value is a match result or the place of the replacement of the match. */
+template< typename Value >
+struct chunk_match
+{
+    std::ptrdiff_t start;
+    std::ptrdiff_t end;
+    Value          value;
+};
+
+inline unsigned thread_count( const parallel_options & popts ) noexcept
+{
+    return popts.threads ? popts.threads : std::max( std::thread::hardware_concurrency(), 1u );
+}
+
+/*
+ * Finds the matches of a compiled pattern in the chunks in parallel and merges them in the order of a sequential search.
+ *
+ * The matches of a chunk are searched as if a search starts at the begin of the chunk.
+ * That is the state of the sequential search when the last match of the previous chunks ends before the chunk.
+ * Otherwise the chunk is searched again from the end of that match until a match is the same as a match of the chunk;
+ * from then on both searches are in the same state.
+ *
+ * 'make( k, ms, mr )' returns the value of a match in chunk 'k' and 'accept' receives the merged matches in order until it returns false.
+ */
+template< typename StrCharT, typename PatCharT, typename Make, typename Accept >
+void parallel_matches( const std::vector< const StrCharT * > & chunks, const basic_pattern< PatCharT > & pat, unsigned threads,
+                       match_options opts, Make && make, Accept && accept )
+{
+    using result_type = basic_match_result< StrCharT >;
+    using value_type  = decltype( make( std::size_t(), std::declval< compiled_match_state< StrCharT, PatCharT, result_type > & >(), std::declval< result_type & >() ) );
+
+    opts.stack = nullptr;  /* a stack and a memo table can't be shared between threads */
+    opts.memo  = nullptr;
+
+    const auto s_begin = chunks.front();
+    const auto s_end   = chunks.back();
+    const auto count   = chunks.size() - 1;
+
+    /* the counters aren't atomic, every chunk has its own stats */
+    std::vector< match_stats > stats( opts.stats ? count : 0 );
+
+    /* Passes the matches that start in chunk 'k' from 'src' to 'on_match' until it returns false */
+    const auto scan = [ & ]( std::size_t k, const StrCharT * src, const StrCharT * last_match, auto && on_match )
+    {
+        const auto           last_start = k + 1 == count ? s_end : chunks[ k + 1 ] - 1;
+        auto chunk_opts  = opts;
+        chunk_opts.stats = opts.stats ? &stats[ k ] : nullptr;
+
+        result_type          mr;
+        compiled_match_state ms = { s_begin, s_end, pat, mr, chunk_opts };
+        while( gmatch_aux( ms, ms.filter, src, last_match, last_start ) )
+        {
+            if( !on_match( chunk_match< value_type >{ mr.position().first, mr.position().second, make( k, ms, mr ) } ) )
+            {
+                return;
+            }
+            ms.reprepstate();
+        }
+    };
+
+    std::vector< std::vector< chunk_match< value_type > > > found( count );
+    for_each_chunk( count, threads, [ & ]( std::size_t k )
+    {
+        scan( k, chunks[ k ], static_cast< const StrCharT * >( nullptr ), [ & ]( auto && m ){ found[ k ].push_back( std::move( m ) ); return true; } );
+    } );
+
+    std::ptrdiff_t last_end = -1;
+    bool           done     = false;
+    for( std::size_t k = 0 ; k < count && !done ; ++k )
+    {
+        auto &      matches = found[ k ];
+        std::size_t synced  = 0;
+
+        if( last_end >= chunks[ k ] - s_begin )
+        {
+            bool in_sync = false;
+            scan( k, s_begin + last_end, s_begin + last_end, [ & ]( auto && m )
+            {
+                while( synced < matches.size() && matches[ synced ].start < m.start )
+                {
+                    ++synced;
+                }
+                if( synced < matches.size() && matches[ synced ].start == m.start && matches[ synced ].end == m.end )
+                {
+                    in_sync = true;
+                    return false;
+                }
+                last_end = m.end;
+                done     = !accept( std::move( m ) );
+                return !done;
+            } );
+            if( !in_sync )
+            {
+                synced = matches.size();  /* the search again covered the whole chunk */
+            }
+        }
+
+        for( ; synced < matches.size() && !done ; ++synced )
+        {
+            last_end = matches[ synced ].end;
+            done     = !accept( std::move( matches[ synced ] ) );
+        }
+    }
+
+    for( const auto &chunk : stats )
+    {
+        *opts.stats += chunk;
+    }
+}
+
+}
+
+/**
+ * \brief Returns the match results of all matches of a compiled pattern in an input string; the chunks of the input string are matched in parallel.
+ *
+ * The matches and their order are the same as the matches of pg::lex::gmatch.
+ * Splitting the chunks at a boundary where the matches don't cross, like a newline, avoids searching again after a match that crosses the end of a chunk.
+ *
+ * \param str   The input string
+ * \param pat   The compiled pattern
+ * \param popts The options for the chunks and threads.
+ * \param opts  The options of the matcher; the step limit applies to every chunk.
+ *
+ * \return The match results in order.
+ */
+template< typename StrT, typename PatCharT >
+auto gmatch_parallel( StrT&& str, const basic_pattern< PatCharT > & pat, const parallel_options & popts = {}, const match_options & opts = {} )
+{
+    using str_char_type = typename detail::string_traits< StrT >::char_type;
+
+    const detail::string_context< str_char_type >      s       = { std::forward< StrT >( str ) };
+    const auto                                         threads = detail::thread_count( popts );
+    std::vector< basic_match_result< str_char_type > > results;
+
+    detail::parallel_matches( detail::split_chunks( s.begin, s.end, threads, popts ), pat, threads, opts,
+                              []( std::size_t, auto &, const auto & mr ){ return mr; },
+                              [ & ]( auto && m ){ results.push_back( m.value ); return true; } );
+
+    return results;
+}
+
+/**
+ * \brief Returns compact match results of all matches of a compiled pattern in an input string; the chunks of the input string are matched in parallel.
+ *
+ * Throws a 'capture_too_many' when the pattern has more than N captures and a 'string_too_long' when the input string is longer than UINT32_MAX chars.
+ *
+ * \tparam N The maximum number of captures of the match results.
+ */
+template< size_t N, typename StrT, typename PatCharT >
+auto gmatch_parallel( StrT&& str, const basic_pattern< PatCharT > & pat, const parallel_options & popts = {}, const match_options & opts = {} )
+{
+    using str_char_type = typename detail::string_traits< StrT >::char_type;
+    using result_type   = basic_compact_match_result< str_char_type, N >;
+
+    if( pat.captures() > N )
+    {
+        throw lex_error( capture_too_many );
+    }
+
+    const detail::string_context< str_char_type > s       = { std::forward< StrT >( str ) };
+    const auto                                    threads = detail::thread_count( popts );
+    std::vector< result_type >                    results;
+
+    detail::check_compact_length( s.begin, s.end );
+
+    detail::parallel_matches( detail::split_chunks( s.begin, s.end, threads, popts ), pat, threads, opts,
+                              [ & ]( std::size_t, auto &, const auto & mr ){ return result_type( mr, s.begin ); },
+                              [ & ]( auto && m ){ results.push_back( m.value ); return true; } );
+
+    return results;
+}
+
+/**
+ * \brief Substitutes a replacement for the matches of a compiled pattern; the chunks of the input string are matched and substituted in parallel.
+ *
+ * The result is the same as the result of pg::lex::gsub.
+ * A replacement function is called from several threads and can be called for matches that are discarded when the chunks are merged.
+ *
+ * \param str   The input string
+ * \param pat   The compiled pattern
+ * \param repl  The replacement pattern, a decoded replacement or a function that accepts a match result and returns the replacement.
+ * \param count The maximum number of substitutes; negative for unlimited an unlimited count.
+ * \param popts The options for the chunks and threads.
+ * \param opts  The options of the matcher; the step limit applies to every chunk.
+ *
+ * \return returns a std::string based on the character type of the input string
+ */
+template< typename StrT, typename PatCharT, typename ReplT >
+auto gsub_parallel( StrT&& str, const basic_pattern< PatCharT > & pat, ReplT&& repl, int count = -1,
+                    const parallel_options & popts = {}, const match_options & opts = {} )
+{
+    using str_char_type = typename detail::string_traits< StrT >::char_type;
+    using repl_type     = typename std::decay< ReplT >::type;
+    using buffer_type   = std::basic_string< str_char_type >;
+
+    if constexpr( detail::is_replacement< repl_type >::value )
+    {
+        if( repl.max_capture() > std::max< size_t >( pat.captures(), 1 ) )  /* %1 is the whole match of a pattern without captures */
+        {
+            throw lex_error( capture_invalid_index );
+        }
+    }
+
+    if( pat.anchored() )
+    {
+        return gsub( std::forward< StrT >( str ), pat, std::forward< ReplT >( repl ), count, opts );  /* there is only one position to match */
+    }
+
+    const detail::string_context< str_char_type > s       = { std::forward< StrT >( str ) };
+    const auto                                    threads = detail::thread_count( popts );
+    const auto                                    chunks  = detail::split_chunks( s.begin, s.end, threads, popts );
+
+    /* Every chunk has its own buffer for the replacements of its matches; a value is the chunk, the offset and the length of a replacement */
+    std::vector< buffer_type > buffers( chunks.size() - 1 );
+
+    const auto make = [ & ]( std::size_t k, auto & ms, const auto & mr ) -> std::tuple< std::size_t, std::size_t, std::size_t >
+    {
+        auto &     buffer = buffers[ k ];
+        const auto first  = buffer.size();
+        const auto start  = s.begin + mr.position().first;
+        const auto end    = s.begin + mr.position().second;
+
+        if constexpr( detail::is_replacement< repl_type >::value )
+        {
+            detail::add_r( buffer, ms, start, end, repl );
+        }
+        else if constexpr( detail::string_traits< repl_type >::is_string )
+        {
+            detail::add_s( buffer, ms, start, end, detail::string_context< typename detail::string_traits< repl_type >::char_type >{ repl } );
+        }
+        else
+        {
+            detail::add_f< str_char_type >( buffer, repl, mr );
+        }
+        return { k, first, buffer.size() - first };
+    };
+
+    buffer_type    result;
+    std::ptrdiff_t copied = 0;
+    detail::reserve_more( result, s.end - s.begin );
+
+    detail::parallel_matches( chunks, pat, threads, opts, make, [ & ]( auto && m )
+    {
+        if( count == 0 )
+        {
+            return false;
+        }
+        --count;
+        result.append( s.begin + copied, s.begin + m.start );
+        result.append( buffers[ std::get< 0 >( m.value ) ], std::get< 1 >( m.value ), std::get< 2 >( m.value ) );
+        copied = m.end;
+        return true;
+    } );
+    result.append( s.begin + copied, s.end );
+
+    return result;
+}
+
+namespace detail
+{
+
+/* The number of rows of a block of a batch; a few blocks per thread balances the load. */
+inline std::size_t batch_block_size( std::size_t rows, unsigned threads ) noexcept
+{
+    return std::max< std::size_t >( 256, rows / ( threads * 4 ) );
+}
+
+/* Joins the results of the blocks of a batch in the order of the blocks. */
+template< typename CharT >
+void join_blocks( const std::vector< basic_batch_strings< CharT > > & parts, std::size_t rows, basic_batch_strings< CharT > & out )
+{
+    out.clear();
+    out.offsets.reserve( rows + 1 );
+    for( const auto &part : parts )
+    {
+        const auto base = out.chars.size();
+        out.chars.append( part.chars );
+        for( auto i = part.offsets.begin() + 1 ; i != part.offsets.end() ; ++i )
+        {
+            out.offsets.push_back( base + *i );
+        }
+    }
+}
+
+}
+
+/**
+ * \brief Searches for the first match of a compiled pattern in every string of a batch; blocks of consecutive rows are matched in parallel.
+ *
+ * The results are the same as the results of the sequential match_batch.
+ * Only the number of threads of the parallel options applies; the rows are not split.
+ */
+template< typename Rows, typename PatCharT >
+void match_batch( const Rows & rows, const basic_pattern< PatCharT > & pat, batch_result & out, const parallel_options & popts,
+                  const match_options & opts = {} )
+{
+    const auto n       = static_cast< std::size_t >( std::distance( std::begin( rows ), std::end( rows ) ) );
+    const auto threads = detail::thread_count( popts );
+    const auto size    = detail::batch_block_size( n, threads );
+
+    const auto blocks  = ( n + size - 1 ) / size;
+
+    std::vector< match_stats > stats( opts.stats ? blocks : 0 );
+
+    detail::prepare_batch( out, n, pat );
+    detail::for_each_chunk( blocks, threads, [ & ]( std::size_t k )
+    {
+        auto block_opts  = opts;
+        block_opts.stats = opts.stats ? &stats[ k ] : nullptr;
+        block_opts.memo  = nullptr;  /* every thread has its own memo table */
+        detail::match_rows( rows, k * size, std::min( n, ( k + 1 ) * size ), pat, out, block_opts );  /* the blocks write disjoint parts of the arrays */
+    } );
+
+    for( const auto &block : stats )
+    {
+        *opts.stats += block;
+    }
+}
+
+/**
+ * \brief Substitutes a replacement for the matches of a compiled pattern in every string of a batch; blocks of consecutive rows are substituted in parallel.
+ *
+ * The results are the same as the results of the sequential gsub_batch; every block is substituted in its own buffer and the buffers are joined in order.
+ * Only the number of threads of the parallel options applies; the rows are not split.
+ */
+template< typename Rows, typename PatCharT, typename ReplT >
+void gsub_batch( const Rows & rows, const basic_pattern< PatCharT > & pat, const ReplT & repl, basic_batch_strings< detail::row_char_type< Rows > > & out,
+                 int count, const parallel_options & popts, const match_options & opts = {} )
+{
+    const auto n       = static_cast< std::size_t >( std::distance( std::begin( rows ), std::end( rows ) ) );
+    const auto threads = detail::thread_count( popts );
+    const auto size    = detail::batch_block_size( n, threads );
+    const auto blocks  = ( n + size - 1 ) / size;
+
+    detail::check_batch_replacement( pat, repl );
+
+    std::vector< basic_batch_strings< detail::row_char_type< Rows > > > parts( blocks );
+    std::vector< match_stats >                                          stats( opts.stats ? blocks : 0 );
+    detail::for_each_chunk( blocks, threads, [ & ]( std::size_t k )
+    {
+        auto block_opts  = opts;
+        block_opts.stats = opts.stats ? &stats[ k ] : nullptr;
+        block_opts.memo  = nullptr;  /* every thread has its own memo table */
+        detail::gsub_rows( rows, k * size, std::min( n, ( k + 1 ) * size ), pat, repl, count, parts[ k ], block_opts );
+    } );
+
+    for( const auto &block : stats )
+    {
+        *opts.stats += block;
+    }
+
+    detail::join_blocks( parts, n, out );
+}
+
+/**
+ * \brief Applies the rules of a chain to every string of a batch; blocks of consecutive rows are substituted in parallel.
+ *
+ * The results are the same as the results of the sequential gsub_chain_batch.
+ * Every block has its own scratch and buffer; the buffers are joined in order.
+ * Only the number of threads of the parallel options applies; the rows are not split.
+ */
+template< typename Rows, typename PatCharT >
+void gsub_chain_batch( const Rows & rows, const basic_rule_chain< PatCharT > & chain, basic_batch_strings< detail::row_char_type< Rows > > & out,
+                       const parallel_options & popts, const match_options & opts = {} )
+{
+    const auto n       = static_cast< std::size_t >( std::distance( std::begin( rows ), std::end( rows ) ) );
+    const auto threads = detail::thread_count( popts );
+    const auto size    = detail::batch_block_size( n, threads );
+    const auto blocks  = ( n + size - 1 ) / size;
+
+    std::vector< basic_batch_strings< detail::row_char_type< Rows > > > parts( blocks );
+    std::vector< match_stats >                                          stats( opts.stats ? blocks : 0 );
+    detail::for_each_chunk( blocks, threads, [ & ]( std::size_t k )
+    {
+        auto block_opts  = opts;
+        block_opts.stats = opts.stats ? &stats[ k ] : nullptr;
+        block_opts.memo  = nullptr;  /* every thread has its own memo table */
+        detail::gsub_chain_rows( rows, k * size, std::min( n, ( k + 1 ) * size ), chain, parts[ k ], block_opts );
+    } );
+
+    for( const auto &block : stats )
+    {
+        *opts.stats += block;
+    }
+
+    detail::join_blocks( parts, n, out );
+}
+
+}
+
+}
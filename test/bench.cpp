@@ -0,0 +1,624 @@
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <benchmark/benchmark.h>
+
+#include "lex.h"
+#include "lex_parallel.h"
+#include "lex_cache.h"
+#include "fuzz_input.h"
+
+
+namespace lex = pg::lex;
+
+template< typename CharT >
+static std::basic_string< CharT > widen( std::string_view str )
+{
+    return std::basic_string< CharT >( str.begin(), str.end() );
+}
+
+/* Repeats 'chunk' until the string has 'size' chars. */
+static std::string repeat( std::string_view chunk, size_t size )
+{
+    std::string str;
+    str.reserve( size );
+    while( str.size() < size )
+    {
+        str.append( chunk.substr( 0, size - str.size() ) );
+    }
+    return str;
+}
+
+static std::string log_text( size_t size )
+{
+    return repeat( "2020-05-17 13:37:01 INFO  worker-12 GET /api/items?id=4711 200 took 45ms\n"
+                   "2020-05-17 13:37:02 WARN  worker-3 POST /api/login 401 took 120ms\n"
+                   "2020-05-17 13:37:02 ERROR worker-7 GET /api/report 500 took 3012ms\n", size );
+}
+
+static std::string code_text( size_t size )
+{
+    return repeat( "for( int i_0 = 0 ; i_0 < count ; ++i_0 ) { total += values[ i_0 ] * 42; }\n", size );
+}
+
+static std::string nested_text( size_t size )
+{
+    return repeat( "f(a, (b + c) * (d - (e / f)), g(h(i), j)) + k(l) ", size );
+}
+
+static std::string prose_text( size_t size )
+{
+    return repeat( "THE (quick) brown fox, jumps over the lazy dog; and the dog sleeps on.\n", size );
+}
+
+static std::string backtrack_text( size_t size )
+{
+    return std::string( size, 'a' );
+}
+
+
+struct workload
+{
+    const char * pattern;
+    std::string ( * text )( size_t );
+};
+
+static const workload log_scan     = { "(%u+)%s+worker%-(%d+).-(%d+)ms", log_text };
+static const workload tokenize     = { "[%a_][%w_]*", code_text };
+static const workload balance      = { "%b()", nested_text };
+static const workload words        = { "%f[%w]%w+", prose_text };
+static const workload backtracking = { "a-a-b", backtrack_text };
+static const workload log_tail     = { "(%d%d?%d?%d?)ms\n$", log_text };
+
+static constexpr char log_scan_pattern[] = "(%u+)%s+worker%-(%d+).-(%d+)ms";
+static constexpr char tokenize_pattern[] = "[%a_][%w_]*";
+static constexpr char words_pattern[]    = "%f[%w]%w+";
+
+
+template< typename CharT >
+struct fixture
+{
+    fixture( const workload & w, size_t size )
+        : str( widen< CharT >( w.text( size ) ) )
+        , pat( widen< CharT >( w.pattern ) )
+    {}
+
+    const std::basic_string< CharT > str;
+    const std::basic_string< CharT > pat;
+};
+
+static void set_counters( benchmark::State & state, size_t bytes, size_t matches )
+{
+    state.SetBytesProcessed( static_cast< int64_t >( state.iterations() * bytes ) );
+    state.counters[ "matches" ] = benchmark::Counter( static_cast< double >( matches ), benchmark::Counter::kIsRate );
+}
+
+
+template< typename CharT, bool Compiled >
+static void bm_match( benchmark::State & state, const workload & w )
+{
+    const fixture< CharT >          f( w, state.range( 0 ) );
+    const lex::basic_pattern< CharT > pat( f.pat );
+
+    size_t matches = 0;
+    for( auto _ : state )
+    {
+        if constexpr( Compiled )
+        {
+            auto mr = lex::match( f.str, pat );
+            matches += static_cast< bool >( mr );
+            benchmark::DoNotOptimize( mr );
+        }
+        else
+        {
+            auto mr = lex::match( f.str, f.pat );
+            matches += static_cast< bool >( mr );
+            benchmark::DoNotOptimize( mr );
+        }
+    }
+    set_counters( state, f.str.size() * sizeof( CharT ), matches );
+}
+
+template< typename CharT >
+static void bm_match_memoized( benchmark::State & state, const workload & w )
+{
+    const fixture< CharT >            f( w, state.range( 0 ) );
+    const lex::basic_pattern< CharT > pat( f.pat );
+
+    lex::match_options opts;
+    opts.memoize = true;
+
+    size_t matches = 0;
+    for( auto _ : state )
+    {
+        auto mr = lex::match( f.str, pat, opts );
+        matches += static_cast< bool >( mr );
+        benchmark::DoNotOptimize( mr );
+    }
+    set_counters( state, f.str.size() * sizeof( CharT ), matches );
+}
+
+template< typename CharT, bool Compiled >
+static void bm_gmatch( benchmark::State & state, const workload & w )
+{
+    const fixture< CharT >            f( w, state.range( 0 ) );
+    const lex::basic_pattern< CharT > pat( f.pat );
+
+    size_t matches = 0;
+    for( auto _ : state )
+    {
+        if constexpr( Compiled )
+        {
+            for( auto & mr : lex::gmatch( f.str, pat ) )
+            {
+                benchmark::DoNotOptimize( mr );
+                ++matches;
+            }
+        }
+        else
+        {
+            for( auto & mr : lex::context( f.str, f.pat ) )
+            {
+                benchmark::DoNotOptimize( mr );
+                ++matches;
+            }
+        }
+    }
+    set_counters( state, f.str.size() * sizeof( CharT ), matches );
+}
+
+/* Counts the matches without recording their captures */
+template< typename CharT, bool Compiled >
+static void bm_count( benchmark::State & state, const workload & w )
+{
+    const fixture< CharT >            f( w, state.range( 0 ) );
+    const lex::basic_pattern< CharT > pat( f.pat );
+
+    size_t matches = 0;
+    for( auto _ : state )
+    {
+        if constexpr( Compiled )
+        {
+            matches += lex::count( f.str, pat );
+        }
+        else
+        {
+            matches += lex::count( f.str, f.pat );
+        }
+    }
+    set_counters( state, f.str.size() * sizeof( CharT ), matches );
+}
+
+/* Iterates over the matches of a pattern string with the classes of a class mode */
+template< lex::class_mode Classes >
+static void bm_gmatch_classes( benchmark::State & state, const workload & w )
+{
+    const fixture< char > f( w, state.range( 0 ) );
+    lex::match_options    opts;
+    opts.classes = Classes;
+
+    size_t matches = 0;
+    for( auto _ : state )
+    {
+        for( auto & mr : lex::context( f.str, f.pat, opts ) )
+        {
+            benchmark::DoNotOptimize( mr );
+            ++matches;
+        }
+    }
+    set_counters( state, f.str.size(), matches );
+}
+
+template< typename CharT, bool Compiled >
+static void bm_gsub_string( benchmark::State & state, const workload & w )
+{
+    const fixture< CharT >            f( w, state.range( 0 ) );
+    const lex::basic_pattern< CharT > pat( f.pat );
+    const auto                        repl = widen< CharT >( "<%0>" );
+
+    for( auto _ : state )
+    {
+        if constexpr( Compiled )
+        {
+            benchmark::DoNotOptimize( lex::gsub( f.str, pat, repl ) );
+        }
+        else
+        {
+            benchmark::DoNotOptimize( lex::gsub( f.str, f.pat, repl ) );
+        }
+    }
+    set_counters( state, f.str.size() * sizeof( CharT ), 0 );
+}
+
+template< typename CharT, bool Compiled >
+static void bm_gsub_function( benchmark::State & state, const workload & w )
+{
+    const fixture< CharT >            f( w, state.range( 0 ) );
+    const lex::basic_pattern< CharT > pat( f.pat );
+
+    size_t     matches = 0;
+    const auto func    = [ & ]( const auto & mr )
+    {
+        ++matches;
+        return mr.at( 0 ).substr( 0, 1 );
+    };
+    for( auto _ : state )
+    {
+        if constexpr( Compiled )
+        {
+            benchmark::DoNotOptimize( lex::gsub( f.str, pat, func ) );
+        }
+        else
+        {
+            benchmark::DoNotOptimize( lex::gsub( f.str, f.pat, func ) );
+        }
+    }
+    set_counters( state, f.str.size() * sizeof( CharT ), matches );
+}
+
+template< typename CharT >
+static void bm_gmatch_threaded( benchmark::State & state, const workload & w )
+{
+    const fixture< CharT >            f( w, state.range( 0 ) );
+    const lex::basic_pattern< CharT > pat( f.pat );
+
+    lex::match_options opts;
+    opts.threaded = true;
+
+    size_t matches = 0;
+    for( auto _ : state )
+    {
+        for( auto & mr : lex::gmatch( f.str, pat, opts ) )
+        {
+            benchmark::DoNotOptimize( mr );
+            ++matches;
+        }
+    }
+    set_counters( state, f.str.size() * sizeof( CharT ), matches );
+}
+
+/* The static variant of a workload; 'Pattern' is the pattern of the workload */
+template< const auto & Pattern >
+static void bm_gmatch_static( benchmark::State & state, const workload & w )
+{
+    const fixture< char > f( w, state.range( 0 ) );
+
+    size_t matches = 0;
+    for( auto _ : state )
+    {
+        for( auto & mr : lex::gmatch( f.str, lex::static_pattern< Pattern >() ) )
+        {
+            benchmark::DoNotOptimize( mr );
+            ++matches;
+        }
+    }
+    set_counters( state, f.str.size(), matches );
+}
+
+/* The parallel variants with chunks that are split at newlines */
+template< bool Gsub >
+static void bm_parallel( benchmark::State & state, const workload & w )
+{
+    const fixture< char > f( w, state.range( 0 ) );
+    const lex::pattern    pat( f.pat );
+    const lex::pattern    newline( "\n" );
+
+    lex::parallel_options popts;
+    popts.threads    = static_cast< unsigned >( state.range( 1 ) );
+    popts.chunk_size = 64 << 10;
+    popts.boundary   = &newline;
+
+    for( auto _ : state )
+    {
+        if constexpr( Gsub )
+        {
+            benchmark::DoNotOptimize( lex::gsub_parallel( f.str, pat, "<%0>", -1, popts ) );
+        }
+        else
+        {
+            benchmark::DoNotOptimize( lex::gmatch_parallel< 3 >( f.str, pat, popts ) );
+        }
+    }
+    set_counters( state, f.str.size(), 0 );
+}
+
+/* Matches every line of a log against a list of patterns; with a pattern set or with a match per pattern. */
+template< bool Set >
+static void bm_pattern_set( benchmark::State & state )
+{
+    std::vector< std::string > pats;
+    for( int i = 0 ; i < state.range( 0 ) ; ++i )
+    {
+        const auto n = std::to_string( i );
+        pats.push_back( i % 3 == 0 ? "worker%-" + n + "%s" : i % 3 == 1 ? "/api/item" + n : "took " + n + "%d*ms" );
+    }
+    const lex::pattern_set              set( pats.begin(), pats.end() );
+    const std::vector< lex::pattern >   compiled( pats.begin(), pats.end() );
+    const auto                          text = log_text( 64 << 10 );
+
+    std::vector< std::string_view > lines;
+    for( auto & mr : lex::context( text, "[^\n]+" ) )
+    {
+        lines.push_back( mr.at( 0 ) );
+    }
+
+    size_t matches = 0;
+    for( auto _ : state )
+    {
+        for( const auto line : lines )
+        {
+            if constexpr( Set )
+            {
+                lex::match_each( line, set, [ & ]( size_t, const auto & ){ ++matches; } );
+            }
+            else
+            {
+                for( const auto & pat : compiled )
+                {
+                    matches += static_cast< bool >( lex::match( line, pat ) );
+                }
+            }
+        }
+    }
+    set_counters( state, text.size(), matches );
+}
+
+
+/* Matches every line of a log with a pattern string; with the text matcher or with the compiled pattern from the default cache. */
+template< bool Cached >
+static void bm_cached( benchmark::State & state )
+{
+    static const auto text = log_text( 64 << 10 );
+
+    std::vector< std::string_view > lines;
+    for( auto & mr : lex::context( text, "[^\n]+" ) )
+    {
+        lines.push_back( mr.at( 0 ) );
+    }
+    const std::string pattern = log_scan.pattern;
+
+    size_t matches = 0;
+    for( auto _ : state )
+    {
+        for( const auto line : lines )
+        {
+            if constexpr( Cached )
+            {
+                matches += static_cast< bool >( lex::match_cached( line, pattern ) );
+            }
+            else
+            {
+                matches += static_cast< bool >( lex::match( line, pattern ) );
+            }
+        }
+    }
+    set_counters( state, text.size(), matches );
+}
+
+
+/* Matches every line of a log with a compiled pattern; one call per line or one batch with a shared match result and arrays of results. */
+template< bool Batch >
+static void bm_batch( benchmark::State & state )
+{
+    static const auto text = log_text( 64 << 10 );
+
+    std::vector< std::string_view > lines;
+    for( auto & mr : lex::context( text, "[^\n]+" ) )
+    {
+        lines.push_back( mr.at( 0 ) );
+    }
+    const lex::pattern pat( log_scan.pattern );
+    lex::batch_result  out;
+
+    size_t matches = 0;
+    for( auto _ : state )
+    {
+        if constexpr( Batch )
+        {
+            lex::match_batch( lines, pat, out );
+            for( std::size_t r = 0 ; r < out.size() ; ++r )
+            {
+                matches += out.matched( r );
+            }
+        }
+        else
+        {
+            for( const auto line : lines )
+            {
+                matches += static_cast< bool >( lex::match( line, pat ) );
+            }
+        }
+    }
+    set_counters( state, text.size(), matches );
+}
+
+/* Sanitizes every line of a log with a list of rules; a gsub per rule or a chain of the rules, sequential or on 'state.range( 0 )' threads. */
+template< bool Chain >
+static void bm_sanitize( benchmark::State & state )
+{
+    static const auto text = log_text( 64 << 10 );
+
+    std::vector< std::string_view > lines;
+    for( auto & mr : lex::context( text, "[^\n]+" ) )
+    {
+        lines.push_back( mr.at( 0 ) );
+    }
+
+    const std::vector< lex::pattern > pats = { lex::pattern( "[%w._%-]+@[%w.%-]+%.%a+" ), lex::pattern( "%d+%.%d+%.%d+%.%d+" ),
+                                               lex::pattern( "id=%d+" ),                    lex::pattern( "worker%-%d+" ),
+                                               lex::pattern( "%d%d%d%d%-%d%d%-%d%d" ),      lex::pattern( "%s+" ) };
+    const char * const                repls[] = { "<email>", "<ip>", "id=?", "worker", "<date>", " " };
+
+    lex::rule_chain chain;
+    for( std::size_t i = 0 ; i < pats.size() ; ++i )
+    {
+        chain.add( pats[ i ], repls[ i ] );
+    }
+    lex::batch_strings out;
+
+    for( auto _ : state )
+    {
+        if constexpr( Chain )
+        {
+            lex::gsub_chain_batch( lines, chain, out, lex::parallel_options{ static_cast< unsigned >( state.range( 0 ) ) } );
+        }
+        else
+        {
+            for( const auto line : lines )
+            {
+                std::string str( line );
+                for( std::size_t i = 0 ; i < pats.size() ; ++i )
+                {
+                    str = lex::gsub( str, pats[ i ], repls[ i ] );
+                }
+                benchmark::DoNotOptimize( str );
+            }
+        }
+    }
+    set_counters( state, text.size(), 0 );
+}
+
+/* Replays an input of the slow corpus of the fuzz target; the step limit of the fuzz target bounds the inputs that never finish. */
+template< bool Compiled >
+static void bm_pathological( benchmark::State & state, const std::string & data )
+{
+    fuzz_input in;
+    parse_fuzz_input( reinterpret_cast< const unsigned char * >( data.data() ), data.size(), in );
+
+    lex::match_options opts;
+    opts.max_steps = fuzz_step_limit;
+
+    const auto replay = [ & ]( const auto & pat )
+    {
+        try
+        {
+            benchmark::DoNotOptimize( lex::match( in.subject, pat, opts ) );
+            benchmark::DoNotOptimize( lex::gsub( in.subject, pat, fuzz_replacement, in.count, opts ) );
+        }
+        catch( const lex::lex_error & )
+        {}
+    };
+
+    if constexpr( Compiled )
+    {
+        const lex::pattern pat( in.pattern );
+        for( auto _ : state )
+        {
+            replay( pat );
+        }
+    }
+    else
+    {
+        for( auto _ : state )
+        {
+            replay( in.pattern );
+        }
+    }
+    set_counters( state, in.subject.size(), 0 );
+}
+
+/* Registers the replays of the files in the slow corpus; LEX_BENCH_CORPUS selects another directory than the corpus of the tests. */
+static void register_pathological()
+{
+    const char * const dir = std::getenv( "LEX_BENCH_CORPUS" );
+    const std::filesystem::path corpus = dir ? dir : "corpus/slow";
+    if( !std::filesystem::is_directory( corpus ) )
+    {
+        return;
+    }
+
+    for( const auto &entry : std::filesystem::directory_iterator( corpus ) )
+    {
+        std::ifstream     file( entry.path(), std::ios::binary );
+        const std::string data( ( std::istreambuf_iterator< char >( file ) ), std::istreambuf_iterator< char >() );
+        const auto        name = "bm_pathological/" + entry.path().filename().string();
+
+        fuzz_input in;
+        if( !parse_fuzz_input( reinterpret_cast< const unsigned char * >( data.data() ), data.size(), in ) )
+        {
+            continue;
+        }
+
+        benchmark::RegisterBenchmark( ( name + "/text" ).c_str(), bm_pathological< false >, data )->Unit( benchmark::kMicrosecond );
+        try
+        {
+            const lex::pattern pat( in.pattern );
+            benchmark::RegisterBenchmark( ( name + "/compiled" ).c_str(), bm_pathological< true >, data )->Unit( benchmark::kMicrosecond );
+        }
+        catch( const lex::lex_error & )
+        {}  /* the text matcher can match a prefix of an invalid pattern */
+    }
+}
+
+static void sizes( benchmark::internal::Benchmark * b )
+{
+    b->RangeMultiplier( 32 )->Range( 64, 100 << 20 )->Unit( benchmark::kMicrosecond );
+}
+
+static void small_sizes( benchmark::internal::Benchmark * b )
+{
+    b->RangeMultiplier( 2 )->Range( 16, 256 )->Unit( benchmark::kMicrosecond );
+}
+
+#define LEX_BENCH_CHAR_TYPES( bm, w, range ) \
+    benchmark::RegisterBenchmark( #bm "/" #w "/text_char",      bm< char, false >,    w )->Apply( range ); \
+    benchmark::RegisterBenchmark( #bm "/" #w "/compiled_char",  bm< char, true >,     w )->Apply( range ); \
+    benchmark::RegisterBenchmark( #bm "/" #w "/compiled_wchar", bm< wchar_t, true >,  w )->Apply( range ); \
+    benchmark::RegisterBenchmark( #bm "/" #w "/compiled_u16",   bm< char16_t, true >, w )->Apply( range ); \
+    benchmark::RegisterBenchmark( #bm "/" #w "/compiled_u32",   bm< char32_t, true >, w )->Apply( range );
+
+int main( int argc, char * argv[] )
+{
+    LEX_BENCH_CHAR_TYPES( bm_match,         log_scan,     sizes )
+    LEX_BENCH_CHAR_TYPES( bm_gmatch,        log_scan,     sizes )
+    LEX_BENCH_CHAR_TYPES( bm_gsub_string,   log_scan,     sizes )
+    LEX_BENCH_CHAR_TYPES( bm_gsub_function, log_scan,     sizes )
+    LEX_BENCH_CHAR_TYPES( bm_count,         log_scan,     sizes )
+    LEX_BENCH_CHAR_TYPES( bm_gmatch,        tokenize,     sizes )
+    LEX_BENCH_CHAR_TYPES( bm_gsub_string,   tokenize,     sizes )
+    LEX_BENCH_CHAR_TYPES( bm_gmatch,        balance,      sizes )
+    LEX_BENCH_CHAR_TYPES( bm_gmatch,        words,        sizes )
+    LEX_BENCH_CHAR_TYPES( bm_gsub_function, words,        sizes )
+    LEX_BENCH_CHAR_TYPES( bm_match,         backtracking, small_sizes )
+    LEX_BENCH_CHAR_TYPES( bm_match,         log_tail,     sizes )
+
+    benchmark::RegisterBenchmark( "bm_match_memoized/backtracking/compiled_char", bm_match_memoized< char >, backtracking )->Apply( small_sizes );
+
+    benchmark::RegisterBenchmark( "bm_gmatch/log_scan/threaded_char",  bm_gmatch_threaded< char >,     log_scan )->Apply( sizes );
+    benchmark::RegisterBenchmark( "bm_gmatch/log_scan/threaded_u32",   bm_gmatch_threaded< char32_t >, log_scan )->Apply( sizes );
+    benchmark::RegisterBenchmark( "bm_gmatch/tokenize/threaded_char",  bm_gmatch_threaded< char >,     tokenize )->Apply( sizes );
+    benchmark::RegisterBenchmark( "bm_gmatch/words/threaded_char",     bm_gmatch_threaded< char >,     words )->Apply( sizes );
+    benchmark::RegisterBenchmark( "bm_gmatch/log_scan/static_char", bm_gmatch_static< log_scan_pattern >, log_scan )->Apply( sizes );
+    benchmark::RegisterBenchmark( "bm_gmatch/tokenize/static_char", bm_gmatch_static< tokenize_pattern >, tokenize )->Apply( sizes );
+    benchmark::RegisterBenchmark( "bm_gmatch/words/static_char",    bm_gmatch_static< words_pattern >,    words )->Apply( sizes );
+
+    benchmark::RegisterBenchmark( "bm_gmatch/words/text_char_ascii",    bm_gmatch_classes< lex::class_mode::ascii >,   words )->Apply( sizes );
+    benchmark::RegisterBenchmark( "bm_gmatch/tokenize/text_char_ascii", bm_gmatch_classes< lex::class_mode::ascii >,   tokenize )->Apply( sizes );
+    benchmark::RegisterBenchmark( "bm_gmatch/words/text_char_locale",   bm_gmatch_classes< lex::class_mode::locale >,  words )->Apply( sizes );
+
+    benchmark::RegisterBenchmark( "bm_pattern_set/log_lines/set",      bm_pattern_set< true > )->Range( 4, 400 )->Unit( benchmark::kMicrosecond );
+    benchmark::RegisterBenchmark( "bm_pattern_set/log_lines/separate", bm_pattern_set< false > )->Range( 4, 400 )->Unit( benchmark::kMicrosecond );
+
+    benchmark::RegisterBenchmark( "bm_match_lines/log_scan/text",   bm_cached< false > )->ThreadRange( 1, 8 )->Unit( benchmark::kMicrosecond )->UseRealTime();
+    benchmark::RegisterBenchmark( "bm_match_lines/log_scan/cached", bm_cached< true > )->ThreadRange( 1, 8 )->Unit( benchmark::kMicrosecond )->UseRealTime();
+
+    benchmark::RegisterBenchmark( "bm_match_lines/log_scan/compiled", bm_batch< false > )->Unit( benchmark::kMicrosecond );
+    benchmark::RegisterBenchmark( "bm_match_lines/log_scan/batch",    bm_batch< true > )->Unit( benchmark::kMicrosecond );
+
+    benchmark::RegisterBenchmark( "bm_sanitize_lines/gsub",  bm_sanitize< false > )->Unit( benchmark::kMicrosecond );
+    benchmark::RegisterBenchmark( "bm_sanitize_lines/chain", bm_sanitize< true > )->DenseRange( 1, 4, 3 )->Unit( benchmark::kMicrosecond )->UseRealTime();
+
+    benchmark::RegisterBenchmark( "bm_gmatch_parallel/log_scan", bm_parallel< false >, log_scan )->ArgsProduct( { { 1 << 20, 100 << 20 }, { 1, 4, 32 } } )->Unit( benchmark::kMillisecond )->UseRealTime();
+    benchmark::RegisterBenchmark( "bm_gsub_parallel/log_scan",   bm_parallel< true >,  log_scan )->ArgsProduct( { { 1 << 20, 100 << 20 }, { 1, 4, 32 } } )->Unit( benchmark::kMillisecond )->UseRealTime();
+
+    register_pathological();
+
+    benchmark::Initialize( &argc, argv );
+    benchmark::RunSpecifiedBenchmarks();
+
+    return 0;
+}
@@ -0,0 +1,469 @@
+// MIT License
+//
+// Copyright (c) 2020 PG1003
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+/*
+ * A differential fuzz target of the matchers.
+ *
+ * Every input is matched, iterated and substituted with the pattern string and with the compiled pattern on every engine of the compiled patterns;
+ * the results must be the same. With LEX_FUZZ_LUA defined as 1 the results are also compared with string.find and string.gsub of Lua 5.4.
+ *
+ * The target is built for libFuzzer, or with LEX_FUZZ_MAIN defined as 1 as a program that replays files and generates random inputs.
+ * The inputs that need more steps of the text matcher than every input before are written to the directory in the environment variable
+ * LEX_FUZZ_SLOW_CORPUS; the benchmarks replay the files of that corpus as pathological cases.
+ */
+
+#include "lex.h"
+#include "fuzz_input.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#if !LEX_INSTRUMENTATION
+#error "The fuzz target compares the steps of the matchers; build it and lex.cpp with LEX_INSTRUMENTATION defined as 1."
+#endif
+
+#if LEX_FUZZ_LUA
+extern "C"
+{
+#include <lua.h>
+#include <lualib.h>
+#include <lauxlib.h>
+}
+#endif
+
+
+namespace lex = pg::lex;
+
+namespace
+{
+
+/* What a matcher did with a fuzz input; the positions are offsets in the input string */
+struct outcome
+{
+    bool                                   failed = false;  /* the matcher threw 'error' */
+    lex::error_type                        error  = lex::pattern_too_complex;
+    std::pair< long, long >                position = { -1, -1 };
+    std::vector< std::pair< long, long > > captures;  /* the offset and the length of every capture of the first match */
+    std::vector< std::pair< long, long > > matches;   /* the positions of all matches */
+    std::string                            replaced;
+    std::uint64_t                          steps = 0;
+};
+
+/* A limit of the matcher that the engines hit at different points, so their outcomes aren't comparable */
+bool limited( const outcome & o ) noexcept
+{
+    return o.failed && ( o.error == lex::pattern_too_complex || o.error == lex::match_step_limit_exceeded );
+}
+
+/* Runs a pattern string or a compiled pattern on the input, 'opts' selects the engine of a compiled pattern */
+template< typename PatT >
+outcome run( const fuzz_input & in, const PatT & pat, lex::match_options opts )
+{
+    outcome          o;
+    lex::match_stats stats;
+    opts.max_steps = fuzz_step_limit;
+    opts.stats     = &stats;
+
+    try
+    {
+        const auto mr = lex::match( in.subject, pat, opts );
+        o.position    = mr.position();
+        for( const auto cap : mr )
+        {
+            o.captures.emplace_back( static_cast< long >( cap.data() - in.subject.data() ), static_cast< long >( cap.size() ) );
+        }
+
+        if constexpr( std::is_same< PatT, std::string_view >::value )
+        {
+            for( const auto &m : lex::context( in.subject, pat, opts ) )
+            {
+                o.matches.push_back( m.position() );
+            }
+        }
+        else
+        {
+            for( const auto &m : lex::gmatch( in.subject, pat, opts ) )
+            {
+                o.matches.push_back( m.position() );
+            }
+        }
+
+        o.replaced = lex::gsub( in.subject, pat, fuzz_replacement, in.count, opts );
+    }
+    catch( const lex::lex_error & e )
+    {
+        o.failed = true;
+        o.error  = e.code();
+    }
+    o.steps = stats.steps;
+
+    return o;
+}
+
+std::string escaped( std::string_view str )
+{
+    static const char digits[] = "0123456789abcdef";
+
+    std::string result = "\"";
+    for( const unsigned char c : str )
+    {
+        if( c >= 0x20 && c < 0x7f && c != '"' && c != '\\' )
+        {
+            result.push_back( static_cast< char >( c ) );
+        }
+        else
+        {
+            result += { '\\', 'x', digits[ c >> 4 ], digits[ c & 15 ] };
+        }
+    }
+    return result + '"';
+}
+
+[[noreturn]] void mismatch( const fuzz_input & in, const char * engine, const char * what )
+{
+    std::cerr << "mismatch of " << what << " between the text matcher and " << engine << '\n'
+              << "  pattern: " << escaped( in.pattern ) << '\n'
+              << "  input:   " << escaped( in.subject ) << '\n'
+              << "  count:   " << in.count << '\n';
+    std::abort();  /* libFuzzer saves the input of a crash */
+}
+
+void compare( const fuzz_input & in, const outcome & text, const outcome & other, const char * engine )
+{
+    if( limited( text ) || limited( other ) )
+    {
+        return;
+    }
+    if( text.failed != other.failed || text.error != other.error )
+    {
+        mismatch( in, engine, "the errors" );
+    }
+    if( text.position != other.position || text.captures != other.captures )
+    {
+        mismatch( in, engine, "the first match" );
+    }
+    if( text.matches != other.matches )
+    {
+        mismatch( in, engine, "the iteration" );
+    }
+    if( text.replaced != other.replaced )
+    {
+        mismatch( in, engine, "the substitution" );
+    }
+}
+
+#if LEX_FUZZ_LUA
+lua_State * lua()
+{
+    static lua_State * const state = []
+    {
+        const auto L = luaL_newstate();
+        luaL_openlibs( L );
+        return L;
+    }();
+    return state;
+}
+
+/* Calls string.'function' with the arguments pushed by 'push'; returns false when Lua raised an error. */
+template< typename Push >
+bool call_string_function( const char * function, Push && push )
+{
+    const auto L = lua();
+    lua_settop( L, 0 );
+    lua_getglobal( L, "string" );
+    lua_getfield( L, 1, function );
+    const int args = push( L );
+    return lua_pcall( L, args, LUA_MULTRET, 0 ) == LUA_OK;
+}
+
+/* Compares the first match and the substitution of the text matcher with string.find and string.gsub. */
+void compare_lua( const fuzz_input & in, const outcome & text )
+{
+    if( limited( text ) )
+    {
+        return;  /* Lua has no step limit and its own recursion limit */
+    }
+
+    const auto L    = lua();
+    const auto push = [ & ]( lua_State * L )
+    {
+        lua_pushlstring( L, in.subject.data(), in.subject.size() );
+        lua_pushlstring( L, in.pattern.data(), in.pattern.size() );
+        return 2;
+    };
+
+    if( !call_string_function( "find", push ) )
+    {
+        if( !text.failed )
+        {
+            mismatch( in, "Lua", "the errors" );
+        }
+        return;
+    }
+    if( text.failed )
+    {
+        /* The text matcher checks a pattern when it reaches a part of it, like Lua, but the gmatch and gsub calls can reach more of it */
+        if( !call_string_function( "gsub", [ & ]( lua_State * L ){ push( L ); lua_pushstring( L, fuzz_replacement ); return 3; } ) )
+        {
+            return;
+        }
+        mismatch( in, "Lua", "the errors" );
+    }
+
+    const int results = lua_gettop( L ) - 1;
+    if( lua_isnil( L, 2 ) )
+    {
+        if( text.position.first >= 0 )
+        {
+            mismatch( in, "Lua", "the first match" );
+        }
+    }
+    else
+    {
+        if( text.position.first + 1 != lua_tointeger( L, 2 ) || text.position.second != lua_tointeger( L, 3 ) )
+        {
+            mismatch( in, "Lua", "the first match" );
+        }
+
+        /* Lua returns the captures only when the pattern has captures; the match result has the whole match instead */
+        const auto captures = static_cast< std::size_t >( results - 2 );
+        if( captures > 0 && captures != text.captures.size() )
+        {
+            mismatch( in, "Lua", "the captures" );
+        }
+        for( std::size_t i = 0 ; i < captures ; ++i )
+        {
+            const auto &cap = text.captures[ i ];
+            if( lua_type( L, 4 + static_cast< int >( i ) ) == LUA_TNUMBER )
+            {
+                if( cap.second != 0 || cap.first + 1 != lua_tointeger( L, 4 + static_cast< int >( i ) ) )
+                {
+                    mismatch( in, "Lua", "the position captures" );
+                }
+            }
+            else
+            {
+                std::size_t  len = 0;
+                const auto   str = lua_tolstring( L, 4 + static_cast< int >( i ), &len );
+                if( std::string_view( str, len ) != in.subject.substr( cap.first, cap.second ) )
+                {
+                    mismatch( in, "Lua", "the captures" );
+                }
+            }
+        }
+    }
+
+    const auto gsub_args = [ & ]( lua_State * L )
+    {
+        push( L );
+        lua_pushstring( L, fuzz_replacement );
+        if( in.count < 0 )
+        {
+            lua_pushnil( L );  /* all matches */
+        }
+        else
+        {
+            lua_pushinteger( L, in.count );
+        }
+        return 4;
+    };
+    if( !call_string_function( "gsub", gsub_args ) )
+    {
+        mismatch( in, "Lua", "the errors" );
+    }
+
+    std::size_t len = 0;
+    const auto  str = lua_tolstring( L, 2, &len );
+    if( text.replaced != std::string_view( str, len ) )
+    {
+        mismatch( in, "Lua", "the substitution" );
+    }
+}
+#endif
+
+/* Writes an input that needs more steps than the inputs before it into the slow corpus */
+void record_slow( const std::uint8_t * data, std::size_t size, std::uint64_t steps )
+{
+    static std::uint64_t worst  = 10000;  /* fewer steps aren't pathological */
+    static const char *  corpus = std::getenv( "LEX_FUZZ_SLOW_CORPUS" );
+
+    if( !corpus || steps <= worst )
+    {
+        return;
+    }
+    worst = steps;
+
+    std::uint64_t hash = 14695981039346656037ull;  /* FNV-1a */
+    for( std::size_t i = 0 ; i < size ; ++i )
+    {
+        hash = ( hash ^ data[ i ] ) * 1099511628211ull;
+    }
+
+    char name[ 64 ];
+    std::snprintf( name, sizeof( name ), "steps-%llu-%016llx", static_cast< unsigned long long >( steps ), static_cast< unsigned long long >( hash ) );
+    std::ofstream( std::filesystem::path( corpus ) / name, std::ios::binary ).write( reinterpret_cast< const char * >( data ), size );
+}
+
+}
+
+extern "C" int LLVMFuzzerTestOneInput( const std::uint8_t * data, std::size_t size )
+{
+    fuzz_input in;
+    if( !parse_fuzz_input( data, size, in ) )
+    {
+        return 0;
+    }
+
+    const auto text = run( in, in.pattern, {} );
+    record_slow( data, size, text.steps );
+
+#if LEX_FUZZ_LUA
+    compare_lua( in, text );
+#endif
+
+    std::unique_ptr< lex::pattern > pat;
+    try
+    {
+        pat = std::make_unique< lex::pattern >( in.pattern );
+    }
+    catch( const lex::lex_error & )
+    {
+        /* a pattern is compiled as a whole; the text matcher only checks the parts that it reaches */
+        return 0;
+    }
+
+    lex::match_options iterative;
+    iterative.iterative = true;
+    lex::match_options threaded;
+    threaded.threaded = true;
+    lex::match_options memoized;
+    memoized.memoize = true;
+
+    compare( in, text, run( in, *pat, {} ), "the compiled pattern" );
+    compare( in, text, run( in, *pat, iterative ), "the iterative matcher" );
+    compare( in, text, run( in, *pat, threaded ), "the threaded matcher" );
+    compare( in, text, run( in, *pat, memoized ), "the memoized matcher" );
+
+    return 0;
+}
+
+#if LEX_FUZZ_MAIN
+
+namespace
+{
+
+void run_file( const std::filesystem::path & path )
+{
+    std::ifstream                    file( path, std::ios::binary );
+    const std::vector< std::uint8_t > data( ( std::istreambuf_iterator< char >( file ) ), std::istreambuf_iterator< char >() );
+    LLVMFuzzerTestOneInput( data.data(), data.size() );
+}
+
+/* Generates an input from the parts of patterns, mostly valid ones, and an input string from a few chars that the parts match */
+std::vector< std::uint8_t > random_input( std::mt19937 & rng )
+{
+    static const char * const parts[] =
+    {
+        "a", "b", "ab", ".", "%a", "%d", "%s", "%w", "%p", "%u", "%x", "%A", "%S", "%.", "%%", "[ab]", "[^a]", "[%a_]", "[a-c]", "[]]", "[^%s]",
+        "*", "+", "-", "?", "*", "+", "-", "(", ")", "(", ")", "()", "%1", "%2", "%b()", "%bab", "%f[%w]", "%f[%W]", "%f[%z]", "^", "$", "%"
+    };
+    static const char subject_chars[] = "aab b()_1 2.%\n\xc3\xa9";
+
+    std::vector< std::uint8_t > data = { static_cast< std::uint8_t >( rng() ) };
+
+    const auto parts_count = rng() % 10;
+    for( std::size_t i = 0 ; i < parts_count ; ++i )
+    {
+        for( auto p = parts[ rng() % std::size( parts ) ] ; *p ; ++p )
+        {
+            data.push_back( static_cast< std::uint8_t >( *p ) );
+        }
+    }
+    data.push_back( 0 );
+
+    const auto length = rng() % 8 == 0 ? rng() % 2000 : rng() % 40;
+    for( std::size_t i = 0 ; i < length ; ++i )
+    {
+        data.push_back( static_cast< std::uint8_t >( subject_chars[ rng() % ( sizeof( subject_chars ) - 1 ) ] ) );
+    }
+
+    return data;
+}
+
+}
+
+/*
+ * fuzz [-runs=N] [-seed=S] [file or directory]...
+ *
+ * Replays the files and the files in the directories, then matches N random inputs.
+ */
+int main( int argc, char * argv[] )
+{
+    unsigned long runs = 0;
+    unsigned long seed = std::random_device()();
+
+    for( int i = 1 ; i < argc ; ++i )
+    {
+        const std::string arg = argv[ i ];
+        if( arg.rfind( "-runs=", 0 ) == 0 )
+        {
+            runs = std::stoul( arg.substr( 6 ) );
+        }
+        else if( arg.rfind( "-seed=", 0 ) == 0 )
+        {
+            seed = std::stoul( arg.substr( 6 ) );
+        }
+        else if( std::filesystem::is_directory( arg ) )
+        {
+            for( const auto &entry : std::filesystem::directory_iterator( arg ) )
+            {
+                run_file( entry.path() );
+            }
+        }
+        else
+        {
+            run_file( arg );
+        }
+    }
+
+    std::mt19937 rng( static_cast< std::mt19937::result_type >( seed ) );
+    for( unsigned long i = 0 ; i < runs ; ++i )
+    {
+        const auto data = random_input( rng );
+        LLVMFuzzerTestOneInput( data.data(), data.size() );
+    }
+
+    std::cout << "Random inputs: " << runs << ", seed: " << seed << '\n';
+
+    return 0;
+}
+
+#endif
@@ -0,0 +1,61 @@
+// MIT License
+//
+// Copyright (c) 2020 PG1003
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+
+
+/* The number of matcher steps of a call after which the fuzz target and the replay of the corpus in the benchmarks give up. */
+constexpr long fuzz_step_limit = 1000000;
+
+/* The replacement pattern of the substitutions; '%1' is the whole match of a pattern without captures. */
+constexpr char fuzz_replacement[] = "<%1>";
+
+/*
+ * A fuzz input is a byte with the count of the substitutions, the pattern, a NUL and the input string.
+ * The count is the low two bits of the first byte minus one; -1 substitutes all matches.
+ */
+struct fuzz_input
+{
+    int              count = -1;
+    std::string_view pattern;
+    std::string_view subject;
+};
+
+inline bool parse_fuzz_input( const unsigned char * data, std::size_t size, fuzz_input & in ) noexcept
+{
+    if( size == 0 )
+    {
+        return false;
+    }
+
+    const std::string_view rest( reinterpret_cast< const char * >( data + 1 ), size - 1 );
+    const auto             nul = rest.find( '\0' );
+
+    in.count   = static_cast< int >( data[ 0 ] & 3u ) - 1;
+    in.pattern = rest.substr( 0, nul );
+    in.subject = nul == std::string_view::npos ? std::string_view() : rest.substr( nul + 1 );
+
+    return true;
+}
@@ -7,8 +7,17 @@
 #include <string_view>
 #include <type_traits>
 #include <numeric>
+#include <iterator>
+#include <filesystem>
+#include <fstream>
+#include <system_error>
+#include <thread>
+#include <memory_resource>
 
 #include "lex.h"
+#include "lex_parallel.h"
+#include "lex_file.h"
+#include "lex_cache.h"
 
 
 using namespace pg;
@@ -140,6 +149,7 @@ static void match()
         assert_true( f( "alo alo", "%C+" ) == "alo alo" );
         assert_true( lex::match( "(álo)", "%(á" ).position().first == 0 );
         assert_false( lex::match( "==========", "^([=]*)=%1$" ) );
+        assert_false( lex::match( "a1", "(a)%1" ) );
     }
 
     {
@@ -403,6 +413,80 @@ static void gsub()
         auto result = lex::gsub( "trocar tudo em |teste|b| é |beleza|al|", "|([^|]*)|([^|]*)|", f );
         assert_true( result == "trocar tudo em bbbbb é alalalalalal" );
     }
+
+    {
+        std::string out = "> ";
+        lex::gsub_to( out, "hello world", "(%w+)", "<%1>" );
+        assert_true( out == "> <hello> <world>" );
+        lex::gsub_to( out, "abc", lex::pattern( "%w" ), "%0%0", 2 );
+        assert_true( out == "> <hello> <world>aabbc" );
+        lex::gsub_to( out, "x=1", "%d", []( auto &mr ){ return std::string( mr.at( 0 ) ) + "0"; } );
+        assert_true( out == "> <hello> <world>aabbcx=10" );
+
+        const auto capacity = out.capacity();
+        out.clear();
+        lex::gsub_to( out, "hello world", lex::pattern( "o" ), "0" );
+        assert_true( out == "hell0 w0rld" && out.capacity() == capacity );
+
+        std::vector< char > v;
+        lex::gsub_to( std::back_inserter( v ), "hello world", "o", "[%0]" );
+        assert_true( std::string( v.begin(), v.end() ) == "hell[o] w[o]rld" );
+
+        char buf[ 32 ] = {};
+        auto end = lex::gsub_to( buf, "abc", lex::pattern( "()b" ), "%1%%", -1 );
+        assert_true( std::string_view( buf, end - buf ) == "a2%c" );
+        end = lex::gsub_to( buf, "abc", lex::pattern( "." ), []( auto &mr ){ return mr.at( 0 ) == "b" ? "" : "-"; } );
+        assert_true( std::string_view( buf, end - buf ) == "--" );
+
+        const lex::replacement swap( "%2=%1 (%0) 100%%" );
+        const lex::pattern     assignment( "(%w+)=(%w+)" );
+        assert_true( swap.max_capture() == 2 );
+        assert_true( lex::gsub( "a=b, c=d", assignment, swap ) == "b=a (a=b) 100%, d=c (c=d) 100%" );
+        assert_true( lex::gsub( "a=b, c=d", "(%w+)=(%w+)", swap, 1 ) == "b=a (a=b) 100%, c=d" );
+        assert_true( lex::gsub( "hello", lex::pattern( "l+" ), lex::replacement( "[%1]" ) ) == "he[ll]o" );
+        assert_true( lex::gsub( U"hello", U"l", lex::replacement( "" ) ) == U"heo" );
+        assert_true( lex::gsub( "abc", lex::pattern( "()b()" ), lex::u32replacement( U"%1-%2" ) ) == "a2-3c" );
+
+        std::string swapped;
+        lex::gsub_to( swapped, "x=y", assignment, swap );
+        assert_true( swapped == "y=x (x=y) 100%" );
+
+        for( auto r : { "%", "abc%", "%x", "%%%" } )
+        {
+            assert_true( [ & ]
+            {
+                try
+                {
+                    lex::replacement rp( r );
+                }
+                catch( const lex::lex_error& e )
+                {
+                    return e.code() == lex::percent_invalid_use_in_replacement;
+                }
+                return false;
+            }() );
+        }
+
+        const auto invalid_index = []( auto && f )
+        {
+            try
+            {
+                f();
+            }
+            catch( const lex::lex_error& e )
+            {
+                return e.code() == lex::capture_invalid_index;
+            }
+            return false;
+        };
+        assert_true( invalid_index( [ & ]{ lex::gsub( "no match", assignment, lex::replacement( "%3" ) ); } ) );
+        assert_true( invalid_index( [ & ]{ lex::gsub( "alo", ".", lex::replacement( "%2" ) ); } ) );
+        assert_false( invalid_index( [ & ]{ lex::gsub( "no match", "(%d)", lex::replacement( "%2" ) ); } ) );
+
+        std::u32string u = U"!";
+        lex::gsub_to( u, U"\u4E2D\u6587", ".", "%0 " );
+        assert_true( u == U"!\u4E2D \u6587 " );
+    }
 }
 
 static void exceptions()
@@ -465,6 +549,42 @@ static void exceptions()
     {
         assert_true( e.code() == lex::capture_out_of_range );
     }
+
+    const auto too_complex = []( auto && f ) -> bool
+    {
+        try
+        {
+            f();
+        }
+        catch( const lex::lex_error& e )
+        {
+            return e.code() == lex::pattern_too_complex;
+        }
+        return false;
+    };
+
+    const lex::match_options shallow = { 8 };
+    const lex::pattern       optionals( "a?a?a?a?a?a?a?a?a?a?" );
+    assert_true( lex::match( "aaaaaaaaaa", "a?a?a?a?a?a?a?a?a?a?" ).at( 0 ) == "aaaaaaaaaa" );
+    assert_true( lex::match( "aaaaaaaaaa", optionals ).at( 0 ) == "aaaaaaaaaa" );
+    assert_true( lex::match( "aaaaaaaaaa", "a?a?a?a?", shallow ).at( 0 ) == "aaaa" );
+    assert_true( too_complex( [ & ]{ lex::match( "aaaaaaaaaa", "a?a?a?a?a?a?a?a?a?a?", shallow ); } ) );
+    assert_true( too_complex( [ & ]{ lex::match( "aaaaaaaaaa", optionals, shallow ); } ) );
+    assert_true( too_complex( [ & ]{ lex::gsub( "aaaaaaaaaa", optionals, "", -1, shallow ); } ) );
+    assert_true( too_complex( [ & ]{ lex::gsub( "aaaaaaaaaa", "a?a?a?a?a?a?a?a?a?a?", "", -1, shallow ); } ) );
+    assert_true( too_complex( [ & ]{ for( auto &mr : lex::gmatch( "aaaaaaaaaa", optionals, shallow ) ) { static_cast< void >( mr ); } } ) );
+    assert_true( too_complex( [ & ]{ for( auto &mr : lex::context( "aaaaaaaaaa", "a?a?a?a?a?a?a?a?a?a?", shallow ) ) { static_cast< void >( mr ); } } ) );
+
+    std::string deep;
+    for( int i = 0 ; i < 250 ; ++i )
+    {
+        deep.append( "a?" );
+    }
+    const std::string a250( 250, 'a' );
+    assert_true( too_complex( [ & ]{ lex::match( a250, deep ); } ) );
+    assert_true( too_complex( [ & ]{ lex::match( a250, lex::pattern( deep ) ); } ) );
+    assert_true( lex::match( a250, deep, { 300 } ).at( 0 ).size() == 250 );
+    assert_true( lex::match( a250, lex::pattern( deep ), { 300 } ).at( 0 ).size() == 250 );
 }
 
 static void results()
@@ -622,62 +742,1902 @@ static void string_traits()
     assert_true( ( std::is_same< lex::detail::string_traits< const std::u32string_view & >::char_type, char32_t >::value ) );
 }
 
-static void readme_examples()
+static constexpr std::pair< std::string_view, std::string_view > match_cases[] =
 {
+    { "aaab", ".*b" }, { "aaa", ".*a" }, { "b", ".*b" }, { "aaab", ".+b" }, { "aaa", ".+a" }, { "b", ".+b" },
+    { "aaab", ".?b" }, { "aaa", ".?a" }, { "b", ".?b" }, { "alo xyzK", "(%w+)K" }, { "254 K", "(%d*)K" },
+    { "alo ", "(%w*)$" }, { "alo ", "(%w+)$" }, { "testtset", "^(tes(t+)set)$" }, { "", "" }, { "alo", "" },
+    { "a\0o a\0o a\0o"sv, "a" }, { "a\0a\0a\0a\0\0ab"sv, "b" }, { "a\0\0a\0ab"sv, "b\0"sv }, { "a\0\0a\0ab"sv, "ab" },
+    { "", "\0"sv }, { "alo123alo", "12" }, { "alo123alo", "^12" }, { "aloALO", "%l*" }, { "aLo_ALO", "%a*" },
+    { "  \n\r*&\n\r   xuxu  \n\n", "%g%g%g+" }, { "aaab", "a*" }, { "aaa", "^.*$" }, { "aaa", "b*" }, { "aaa", "ab*a" },
+    { "aba", "ab*a" }, { "aaab", "a+" }, { "aaa", "^.+$" }, { "aaa", "b+" }, { "aaa", "ab+a" }, { "aba", "ab+a" },
+    { "a$a", ".$" }, { "a$a", ".%$" }, { "a$a", ".$." }, { "a$a", "$$" }, { "a$b", "a$" }, { "a$a", "$" }, { "", "b*" },
+    { "aaa", "bb*" }, { "aaab", "a-" }, { "aaa", "^.-$" }, { "aabaaabaaabaaaba", "b.*b" }, { "aabaaabaaabaaaba", "b.-b" },
+    { "alo xo", ".o$" }, { " \n isto é assim", "%S%S*" }, { " \n isto é assim", "%S*$" }, { " \n isto é assim", "[a-z]*$" },
+    { "um caracter ? extra", "[^%sa-z]" }, { "", "a?" }, { "á", "á?" }, { "ábl", "á?b?l?" }, { "aa", "^aa?a?a" },
+    { "0alo alo", "%x*" }, { "alo alo", "%C+" }, { "(álo)", "%(á" }, { "==========", "^([=]*)=%1$" },
+    { "clo alo", "^(((.).).* (%w*))$" }, { "0123456789", "(.+(.?)())" }, { "a", "%f[a]" }, { "a", "%f[^%z]" },
+    { "a", "%f[^%l]" }, { "aba", "%f[a%z]" }, { "aba", "%f[%z]" }, { "aba", "%f[%l%z]" }, { "aba", "%f[^%l%z]" },
+    { " alo aalo allo", "%f[%S].-%f[%s].-%f[%S]" }, { " alo aalo allo", "%f[%S](.-%f[%s].-%f[%S])" },
+    { "ab\0\1\2c"sv, "[\0-\2]+"sv }, { "ab\0\1\2c"sv, "[\0-\0]+"sv }, { "b$a", "$\0?"sv }, { "abc\0efg"sv, "%\0"sv },
+    { "abc\0q\0zyz"sv, "%b\0z"sv }, { "abczqz\0y\0"sv, "%bz\0"sv }, { "abc\0\0\0"sv, "%\0+"sv }, { "abc\0\0\0"sv, "%\0%\0?"sv },
+    { "xuxx uu ppar r", "()(.)%2" }, { "a1", "(a)%1" }, { "aXbXc", "(X).-%1" }, { "[[]] [][] [[[[", "%f[[]." },
+    { "(9 ((8))(\0) 7) \0\0 a b ()(c)() a"sv, "%b()" }, { "alo 'oi' alo", "%b''" }, { "function", "%f[^\x01-\xFF]" },
+    { "x = 17; y = 42", "(%a+)%s*=%s*(%d+)" }, { "hello world from Lua", "(%w+)%s*(%w+)" }, { "-[]^ab", "[%^%[%-a%]%-b]+" },
+    { "a-z]", "[]%%]" }, { "!%]x", "[!-%]]+" }, { "sep__sep", "^(%a+)_*%1$" }
+};
+
+template< typename MR >
+static bool same_result( const MR &a, const MR &b )
+{
+    if( a.size() != b.size() || a.position() != b.position() )
     {
-        std::string str = "Hello world!";
-        auto result = lex::match( str, "^%a+" );
-        assert_true( result.at( 0 ) == "Hello" );
+        return false;
+    }
+    for( size_t i = 0 ; i < a.size() ; ++i )
+    {
+        if( a.at( i ).data() != b.at( i ).data() || a.at( i ).size() != b.at( i ).size() )
+        {
+            return false;
+        }
     }
+    return true;
+}
+
+static void mixed_char_types()
+{
+    /* a char pattern matches a wider string like the same pattern of the char type of that string */
+    const std::pair< std::u16string_view, std::string_view > cases[] = {
+        { u"key = value", "(%w+)%s*=%s*(%w+)" },
+        { u"THE (quick) fox", "%((%a+)%)" },
+        { u"[[x]] [y]", "%b[]" },
+        { u"the fox", "%f[%a]%a+" },
+        { u"hello", "(l)%1" },
+        { u"abcabc", "^(abc)%1$" },
+        { u"x = 1, y = 2", "()%a()" },
+        { u"abc", "[^%s]+$" },
+    };
 
+    for( const auto & [ str, pat ] : cases )
     {
-        std::wstring str = L"Hello PG1003!";
-        auto result = lex::match( str, "(%a+)%d+" );
-        assert_true( result );
-        assert_true( result.at( 0 ) == L"PG" );
+        const std::u16string pat16( pat.begin(), pat.end() );
+
+        assert_true( same_result( lex::match( str, pat ), lex::match( str, pat16 ) ) );
+        assert_true( lex::find( str, pat ) == lex::find( str, pat16 ) );
+        assert_true( lex::gsub( str, pat, "<%0>" ) == lex::gsub( str, pat16, u"<%0>" ) );
+        assert_true( lex::gsub( str, pat, lex::u16replacement( u"[%0]" ) ) == lex::gsub( str, pat16, u"[%0]" ) );
+        const auto first = []( const auto & mr ) { return mr.at( 0 ); };
+        assert_true( lex::gsub( str, pat, first ) == lex::gsub( str, pat16, first ) );
     }
 
+    /* the chars keep their unsigned value */
+    assert_true( lex::match( u"caf\u00E9", "\xE9$" ) );
+    assert_true( lex::match( U"\u00FF", "[\xF0-\xFF]" ) );
+    assert_false( lex::match( "a", U"\u0161" ) );
+
+    /* a back-reference compares whole chars of the input string */
+    std::size_t count = 0;
+    for( const auto & mr : lex::context( u"\u0100\u0200", "(.)%1" ) )
     {
-        std::vector< std::pair< std::u16string_view, std::u16string_view > > results;
+        static_cast< void >( mr );
+        ++count;
+    }
+    assert_true( count == 0 );
+    assert_false( lex::match( U"\U00010041\U00020041", "(.)%1" ) );
+    assert_true( lex::match( U"\U00010041\U00010041", "(.)%1" ) );
+}
 
-        auto str = u"foo = 42;   bar= 1337; baz = PG =1003 ;";
-        for( auto match : lex::context( str, "(%a+)%s*=%s*(%d+)%s*;" ) )
+static void compiled_patterns()
+{
+    for( const auto &c : match_cases )
+    {
+        assert_true( same_result( lex::match( c.first, lex::pattern( c.second ) ), lex::match( c.first, c.second ) ) );
+    }
+
+    {
+        const lex::pattern pat( "(%a+)%s*=%s*(%d+)" );
+        assert_true( pat.captures() == 2 );
+        assert_false( pat.anchored() );
+        assert_true( lex::pattern( "^a" ).anchored() );
+
+        std::vector< std::string_view > v;
+        for( auto &mr : lex::gmatch( "foo = 42, bar= 1337", pat ) )
         {
-            assert_true( match.size() == 2 );
-            results.emplace_back( match.at( 0 ), match.at( 1 ) );
+            v.push_back( mr.at( 0 ) );
+            v.push_back( mr.at( 1 ) );
         }
-        assert_true( results.size() == 3 );
-        assert_true( results[ 0 ].first  == u"foo" );
-        assert_true( results[ 0 ].second == u"42" );
-        assert_true( results[ 1 ].first  == u"bar" );
-        assert_true( results[ 1 ].second == u"1337" );
-        assert_true( results[ 2 ].first  == u"PG" );
-        assert_true( results[ 2 ].second == u"1003" );
+        assert_true( ( v == std::vector< std::string_view >{ "foo", "42", "bar", "1337" } ) );
+
+        assert_true( lex::gsub( "foo = 42, bar= 1337", pat, "%2=%1" ) == "42=foo, 1337=bar" );
+        assert_true( lex::gsub( "foo = 42, bar= 1337", pat, "%2=%1", 1 ) == "42=foo, bar= 1337" );
+        assert_true( lex::gsub( "foo = 42, bar= 1337", pat, []( const lex::match_result &mr ) { return mr.at( 1 ); } ) == "42, 1337" );
     }
 
     {
-        auto str    = "foo =\t42; bar= 1337; pg =1003 ;";
-        auto pat    = "(%a+)%s*=%s*(%d+)%s*;";
-        auto repl   = "%1=%2;";
-        auto result = lex::gsub( str, pat, repl );
+        const lex::u32pattern pat( U"%s*(%w+)" );
+        assert_true( lex::match( U"  hello", pat ).at( 0 ) == U"hello" );
+        assert_true( lex::match( u"  hello", lex::pattern( "%s*(%w+)" ) ).at( 0 ) == u"hello" );
+        assert_true( lex::gsub( "abc", lex::pattern( "" ), "-" ) == "-a-b-c-" );
+        assert_true( lex::gsub( "", lex::pattern( "^" ), "r" ) == "r" );
 
-        assert_true( result == "foo=42; bar=1337; pg=1003;" );
+        const lex::pattern positions( "()" );
+        int i = 0;
+        for( auto &mr : lex::gmatch( "abcde", positions ) )
+        {
+            assert_true( mr.size() == 1 );
+            ++i;
+        }
+        assert_true( i == 6 );
     }
 
+    const auto malform = []( auto pat, lex::error_type ec ) -> bool
     {
-        auto str = "one two three four";
-        auto function = []( const lex::match_result & mr )
+        try
         {
-            if( mr.at( 0 ) == "one" )
+            lex::pattern p( pat );
+        }
+        catch( const lex::lex_error& e )
+        {
+            return e.code() == ec;
+        }
+        return false;
+    };
+
+    // Malformed patterns are rejected when compiled, even when the malformed part would never be reached
+    assert_true( malform( "(.", lex::capture_not_finished ) );
+    assert_true( malform( ".)", lex::capture_invalid_pattern ) );
+    assert_true( malform( "[a", lex::pattern_missing_closing_bracket ) );
+    assert_true( malform( "[]", lex::pattern_missing_closing_bracket ) );
+    assert_true( malform( "[^]", lex::pattern_missing_closing_bracket ) );
+    assert_true( malform( "[a%]", lex::pattern_missing_closing_bracket ) );
+    assert_true( malform( "[a%", lex::pattern_missing_closing_bracket ) );
+    assert_true( malform( "%b", lex::balanced_no_arguments ) );
+    assert_true( malform( "%ba", lex::balanced_no_arguments ) );
+    assert_true( malform( "%", lex::pattern_ends_with_percent ) );
+    assert_true( malform( "%f", lex::frontier_no_open_bracket ) );
+    assert_true( malform( "%fa", lex::frontier_no_open_bracket ) );
+    assert_true( malform( "(%0)", lex::capture_invalid_index ) );
+    assert_true( malform( "(%1)", lex::capture_invalid_index ) );
+    assert_true( malform( "(a)%2", lex::capture_invalid_index ) );
+    assert_true( malform( "b[a", lex::pattern_missing_closing_bracket ) );
+    assert_true( malform( "((((((((((((((((((((((((((((((((()))))))))))))))))))))))))))))))))", lex::capture_too_many ) );
+    assert_false( malform( "(((((((((((((((((((((((((((((((())))))))))))))))))))))))))))))))", lex::capture_too_many ) );
+}
+
+static void character_classes()
+{
+    const char * const classes[] =
+    {
+        ".", "%a", "%A", "%c", "%C", "%d", "%D", "%g", "%G", "%l", "%L", "%p", "%P", "%s", "%S", "%u", "%U",
+        "%w", "%W", "%x", "%X", "%z", "%Z", "%q", "%%", "%]", "a", "\xE9", "[a-z]", "[^a-z]", "[%a_]", "[^%s%d]",
+        "[\xC8-\xD2]", "[]%%]", "[a-]", "[%^%[%-a%]%-b]", "[!-%]]", "[\x01-\xFF]", "[%z]", "[^%W]"
+    };
+
+    {
+        std::array< char, 256 > abc;
+        std::iota( abc.begin(), abc.end(), '\0' );
+        const std::string_view sv( abc.data(), 256 );
+
+        for( auto cl : classes )
+        {
+            const lex::pattern pat( cl );
+            const std::string_view p( cl );
+            for( size_t i = 0 ; i < sv.size() ; ++i )
             {
-                return "PG";
+                const auto c = sv.substr( i, 1 );
+                assert_true( static_cast< bool >( lex::match( c, pat ) ) == static_cast< bool >( lex::match( c, p ) ) );
             }
+        }
+    }
 
-            return "1003";
-        };
+    {
+        std::u32string str;
+        for( char32_t c = 0 ; c < 0x200 ; ++c )
+        {
+            str.push_back( c );
+        }
+        str.append( U"\u4E2D\U0001F600\uFFFF" );
 
-        assert_true( lex::gsub( str, "%s*%w+", function, 2 ) == "PG1003 three four" );
+        for( auto cl : classes )
+        {
+            const lex::pattern pat( cl );
+            const std::string_view p( cl );
+            for( size_t i = 0 ; i < str.size() ; ++i )
+            {
+                const auto c = std::u32string_view( str ).substr( i, 1 );
+                assert_true( static_cast< bool >( lex::match( c, pat ) ) == static_cast< bool >( lex::match( c, p ) ) );
+            }
+        }
+
+        assert_true( lex::match( U"\u4E2D", lex::pattern( "%A" ) ) );
+        assert_false( lex::match( U"\u4E2D", lex::pattern( "%a" ) ) );
+        assert_true( lex::match( U"x\u4E2Dy", lex::u32pattern( U"[\u4E00-\u9FFF]+" ) ).at( 0 ) == U"\u4E2D" );
+        assert_true( lex::match( U"x\u4E2Dy", lex::u32pattern( U"[^\u4E00-\u9FFF]+$" ) ).at( 0 ) == U"y" );
+        assert_true( lex::match( U"x\u4E2Dy", lex::u32pattern( U"%f[\u4E2D]" ) ).position().first == 1 );
+    }
+}
+
+static void prefilters()
+{
+    const std::pair< std::string_view, std::string_view > cases[] =
+    {
+        { "xxabcxxabd", "abd" }, { "xxabcxxabd", "(ab)(d)" }, { "xxabcxx", "ab+c" }, { "aaa", "b" }, { "xxab", "a*b" },
+        { "a1b22c333", "%d+" }, { "a1b22c333", "[bc]%d" }, { "THE (quick) fox", "%f[%a]%a+" }, { "THE (quick) fox", "%f[%z]" },
+        { "THE (quick) fox", "%f[%A]" }, { "if (a(b)c) d", "%b()" }, { "if a d", "%b()" }, { "", "a" }, { "", "%f[%z]" },
+        { "xyz", "y?z" }, { "xyz", "()z" }, { "xyz", "((z))" }, { "xy.z", "%." }, { "x[z", "[[]" }, { "xyz", "z$" }, { "a$", "$" }
+    };
+
+    for( const auto &c : cases )
+    {
+        const lex::pattern pat( c.second );
+        assert_true( same_result( lex::match( c.first, pat ), lex::match( c.first, c.second ) ) );
+        assert_true( lex::gsub( c.first, pat, "<%0>" ) == lex::gsub( c.first, c.second, "<%0>" ) );
+
+        std::vector< std::pair< size_t, size_t > > compiled, text;
+        for( auto &mr : lex::gmatch( c.first, pat ) )
+        {
+            compiled.push_back( mr.position() );
+        }
+        for( auto &mr : lex::context( c.first, c.second ) )
+        {
+            text.push_back( mr.position() );
+        }
+        assert_true( compiled == text );
+    }
+
+    assert_true( lex::gsub( "THE (quick) fox", lex::pattern( "%f[%a]%a+" ), "W" ) == "W (W) W" );
+    assert_true( lex::gsub( "hello world", lex::pattern( "%f[%z]" ), "!" ) == "hello world!" );
+    assert_true( lex::match( U"\u4E2Dxab", lex::pattern( "ab" ) ).position().first == 2 );
+    assert_true( lex::match( "xxab", lex::u32pattern( U"ab" ) ).position().first == 2 );
+    assert_true( lex::match( U"x\u4E2Dab", lex::u32pattern( U"\u4E2Da" ) ).position().first == 1 );
+}
+
+static constexpr char com_suffix[] = "%.com$";
+
+static void length_bounds()
+{
+    const std::pair< std::string_view, std::string_view > cases[] =
+    {
+        { "www.example.com", "%.com$" }, { "www.example.com", "[%w.]+%.com$" }, { "example.org", "%.com$" }, { "abcdef", "%a%a%a$" },
+        { "ab", "%a%a%a$" }, { "ab", "^ab$" }, { "abc", "^ab$" }, { "x11", "(%d)%1$" }, { "x12", "(%d)%1$" }, { "a(b)", "%b()$" },
+        { "a(b)c", "%b()$" }, { "xyz", "y?z?$" }, { "", "$" }, { "", "a?$" }, { "ab", "abc" }, { "a1b22c333", "%d%d%d" },
+        { "a1b22", "()(%d)%2" }, { "abab", "(ab)%1" }, { "abc", "%f[%a]%a%a" }, { "abc", "c" }
+    };
+
+    for( const auto &c : cases )
+    {
+        const lex::pattern pat( c.second );
+        assert_true( same_result( lex::match( c.first, pat ), lex::match( c.first, c.second ) ) );
+        assert_true( lex::find( c.first, pat ) == lex::find( c.first, c.second ) );
+        assert_true( lex::gsub( c.first, pat, "<%0>" ) == lex::gsub( c.first, c.second, "<%0>" ) );
+        assert_true( lex::count( c.first, pat ) == lex::count( c.first, c.second ) );
+    }
+
+    const std::string host = std::string( 1000, 'w' ) + ".example.com";
+    assert_true( lex::find( host, lex::pattern( "%.com$" ) ) == std::make_pair( 1008L, 1012L ) );
+    assert_true( lex::find( host, lex::static_pattern< com_suffix >() ) == std::make_pair( 1008L, 1012L ) );
+    assert_true( lex::gsub( host, lex::pattern( "%.com$" ), ".org" ) == std::string( 1000, 'w' ) + ".example.org" );
+    assert_true( lex::count( host + ".com", lex::pattern( "%.com$" ) ) == 1 );
+
+#if LEX_INSTRUMENTATION
+    const auto starts_of = []( auto && f )
+    {
+        lex::match_stats   stats;
+        lex::match_options opts;
+        opts.stats = &stats;
+        f( opts );
+        return stats.starts;
+    };
+
+    /* only the positions within the maximum length of a match from the end are tried */
+    assert_true( starts_of( [ & ]( const auto &opts ){ lex::match( host, lex::pattern( "%a%a%a$" ), opts ); } ) == 1 );
+    assert_true( starts_of( [ & ]( const auto &opts ){ lex::match( host, lex::pattern( "%.com$" ), opts ); } ) == 1 );
+    assert_true( starts_of( [ & ]( const auto &opts ){ lex::match( host, lex::static_pattern< com_suffix >(), opts ); } ) == 1 );
+    assert_true( starts_of( [ & ]( const auto &opts ){ lex::match( host, lex::pattern( "x?y?$" ), opts ); } ) == 3 );
+
+    /* no position is tried when fewer chars than the minimum length of a match are left */
+    assert_true( starts_of( []( const auto &opts ){ lex::match( "abc", lex::pattern( "%a%a%a%a" ), opts ); } ) == 0 );
+    assert_true( starts_of( []( const auto &opts ){ lex::match( "abcde", lex::pattern( "%a%a%a%a" ), opts ); } ) == 1 );
+    assert_true( starts_of( []( const auto &opts ){ lex::match( "abcd", lex::pattern( "^a%ab$" ), opts ); } ) == 0 );
+    assert_true( starts_of( []( const auto &opts ){ lex::match( "aab", lex::pattern( "(a)%1b" ), opts ); } ) == 1 );
+    assert_true( starts_of( []( const auto &opts ){ lex::match( "x(", lex::pattern( "%b()" ), opts ); } ) == 0 );
+    assert_true( starts_of( []( const auto &opts ){ lex::gsub( "aaaa", lex::pattern( "a+b" ), "", -1, opts ); } ) == 3 );
+#endif
+}
+
+static void class_runs()
+{
+    const char * const patterns[] =
+    {
+        "%s*", "%d+", "[%w_]+", ".-$", "a+", "[^,]*", "%a*%d", "[%z\x80-\xFF]+", "[a-cx-z0-2]+%p", "%x*", ".*b", "%W+"
+    };
+
+    std::string str;
+    for( int i = 0 ; i < 300 ; ++i )
+    {
+        str.push_back( "aaaaaaab9 \t,_zZ\xE9\x80"[ ( i * i + i / 7 ) % 16 ] );
+        if( i % 37 == 0 )
+        {
+            str.append( 40, i % 2 ? 'a' : '5' );
+        }
+    }
+
+    for( auto p : patterns )
+    {
+        const lex::pattern pat( p );
+        for( size_t i = 0 ; i < str.size() ; i += 3 )
+        {
+            const auto sv = std::string_view( str ).substr( i );
+            assert_true( same_result( lex::match( sv, pat ), lex::match( sv, p ) ) );
+        }
+        assert_true( lex::gsub( str, pat, "<%0>" ) == lex::gsub( str, p, "<%0>" ) );
+    }
+
+    const std::string spaces = std::string( 100, ' ' ) + "x";
+    for( size_t n = 0 ; n <= 100 ; ++n )
+    {
+        assert_true( lex::match( std::string_view( spaces ).substr( 100 - n ), lex::pattern( "^%s*" ) ).at( 0 ).size() == n );
+    }
+}
+
+static void iterative_matcher()
+{
+    lex::backtrack_stack     stack;
+    const lex::match_options iterative = { MAXCCALLS, true, &stack };
+    const lex::match_options per_thread = { MAXCCALLS, true };
+
+    for( const auto &c : match_cases )
+    {
+        const lex::pattern pat( c.second );
+        assert_true( same_result( lex::match( c.first, pat, iterative ), lex::match( c.first, c.second ) ) );
+        assert_true( same_result( lex::match( c.first, pat, per_thread ), lex::match( c.first, c.second ) ) );
+        assert_true( lex::gsub( c.first, pat, "<%0>", -1, iterative ) == lex::gsub( c.first, c.second, "<%0>" ) );
+    }
+
+    std::u32string str;
+    for( int i = 0 ; i < 200 ; ++i )
+    {
+        str.push_back( U"ab  ,(x)a1"[ ( i * 7 + i / 3 ) % 10 ] );
+    }
+    for( auto p : { "(a*(.)%w(%s*))", "%b()", "(.-)%s+(%d?)", "a?b?c?%s+$", "()(.)%2", "%f[%w]%w+", ".-b", "(%w+)%s*,?" } )
+    {
+        const lex::pattern pat( p );
+        assert_true( lex::gsub( str, pat, "{%1}", -1, iterative ) == lex::gsub( str, p, "{%1}" ) );
+
+        std::vector< std::pair< long, long > > rec, it;
+        for( auto &mr : lex::gmatch( str, pat ) )
+        {
+            rec.push_back( mr.position() );
+        }
+        for( auto &mr : lex::gmatch( str, pat, iterative ) )
+        {
+            it.push_back( mr.position() );
+        }
+        assert_true( rec == it );
+    }
+
+    std::string captures;
+    for( int i = 0 ; i < MAXCAPTURES ; ++i )
+    {
+        captures.append( "(a?)" );
     }
+    const std::string text( 5000, 'a' );
+    assert_true( lex::match( text, lex::pattern( captures ), iterative ).size() == MAXCAPTURES );
+
+    std::string optionals;
+    for( int i = 0 ; i < 3000 ; ++i )
+    {
+        optionals.append( "a?" );
+    }
+    const lex::pattern many( optionals );
+    assert_true( lex::match( text, many, iterative ).at( 0 ).size() == 3000 );
+    assert_true( lex::match( "b", many, iterative ).position().first == 0 );
+    assert_true( lex::gsub( text.substr( 0, 3001 ), many, "x", 1, iterative ) == "xa" );
+    assert_true( stack.capacity() >= 3000 );
+
+    const lex::pattern lazy( "^(.-)%1$" );
+    assert_true( lex::match( "abcabc", lazy, iterative ).at( 0 ) == "abc" );
+    assert_false( lex::match( "abcab", lazy, iterative ) );
+}
+
+static void threaded_matcher()
+{
+    lex::match_options threaded;
+    threaded.threaded = true;
+
+    for( const auto &c : match_cases )
+    {
+        const lex::pattern pat( c.second );
+        assert_true( same_result( lex::match( c.first, pat, threaded ), lex::match( c.first, c.second ) ) );
+        assert_true( lex::gsub( c.first, pat, "<%0>", -1, threaded ) == lex::gsub( c.first, c.second, "<%0>" ) );
+    }
+
+    std::u32string wide;
+    std::string    str;
+    for( int i = 0 ; i < 200 ; ++i )
+    {
+        wide.push_back( U"ab  ,(x)a1"[ ( i * 7 + i / 3 ) % 10 ] );
+        str.push_back( "ab  ,(x)a1"[ ( i * 7 + i / 3 ) % 10 ] );
+    }
+    for( auto p : { "(a*(.)%w(%s*))", "%b()", "(.-)%s+(%d?)", "a?b?c?%s+$", "()(.)%2", "%f[%w]%w+", ".-b", "(%w+)%s*,?", "[^a]+", "x?%(.-%)", "a-1" } )
+    {
+        const lex::pattern pat( p );
+        assert_true( lex::gsub( wide, pat, "{%1}", -1, threaded ) == lex::gsub( wide, p, "{%1}" ) );
+        assert_true( lex::gsub( str, pat, "{%1}", -1, threaded ) == lex::gsub( str, p, "{%1}" ) );
+
+        std::vector< std::pair< long, long > > rec, thr;
+        for( auto &mr : lex::gmatch( str, pat ) )
+        {
+            rec.push_back( mr.position() );
+        }
+        for( auto &mr : lex::gmatch( str, pat, threaded ) )
+        {
+            thr.push_back( mr.position() );
+        }
+        assert_true( rec == thr );
+    }
+
+    /* an anchored pattern that fails leaves no captures behind */
+    assert_true( lex::match( "b1", lex::pattern( "^(()%d)" ), threaded ).size() == 0 );
+    assert_true( lex::find( "b1", lex::pattern( "^(%d)" ), threaded ) == std::make_pair( -1L, -1L ) );
+
+    // The threaded code does not recurse, so the depth of a pattern is not limited
+    std::string optionals;
+    for( int i = 0 ; i < 3000 ; ++i )
+    {
+        optionals.append( "a?" );
+    }
+    const std::string text( 5000, 'a' );
+    assert_true( lex::match( text, lex::pattern( optionals ), threaded ).at( 0 ).size() == 3000 );
+
+    threaded.max_steps = 100;
+    bool limited       = false;
+    try
+    {
+        lex::match( text, lex::pattern( ".-b" ), threaded );
+    }
+    catch( const lex::lex_error & e )
+    {
+        limited = e.code() == lex::match_step_limit_exceeded;
+    }
+    assert_true( limited );
+}
+
+static void bounded_matching()
+{
+    lex::match_options memoize;
+    memoize.memoize = true;
+    lex::match_options memoize_iterative = memoize;
+    memoize_iterative.iterative = true;
+
+    for( const auto &c : match_cases )
+    {
+        const lex::pattern pat( c.second );
+        assert_true( same_result( lex::match( c.first, pat, memoize ), lex::match( c.first, c.second ) ) );
+        assert_true( same_result( lex::match( c.first, pat, memoize_iterative ), lex::match( c.first, c.second ) ) );
+        assert_true( lex::gsub( c.first, pat, "<%0>", -1, memoize ) == lex::gsub( c.first, c.second, "<%0>" ) );
+        assert_true( lex::gsub( c.first, pat, "<%0>", -1, memoize_iterative ) == lex::gsub( c.first, c.second, "<%0>" ) );
+    }
+
+    const std::string  text( 300, 'a' );
+    const lex::pattern adversarial( ".-.-.-.-.-.-.-.-x" );
+    assert_false( lex::match( text, adversarial, memoize ) );
+    assert_false( lex::match( text, adversarial, memoize_iterative ) );
+    assert_true( lex::gsub( text + "x", adversarial, "y", -1, memoize ) == "y" );
+    assert_true( lex::gsub( text + "x", lex::pattern( "(a-)a-x" ), "%1", -1, memoize_iterative ) == "" );
+    assert_true( lex::match( text + "xbx", lex::pattern( "(.-)x(.)" ), memoize ).at( 1 ) == "b" );
+
+    /* the steps of an iteration share one memo table and clear only the states that they visited */
+    std::string numbers;
+    for( int i = 0 ; numbers.size() < ( 1 << 20 ) ; ++i )
+    {
+        numbers += std::to_string( i ) + ( i % 3 ? " " : ", " );
+    }
+    const lex::pattern digits( "%d+" );
+    lex::memo_table    table;
+    auto               shared = memoize;
+    shared.memo               = &table;
+
+    std::size_t memoized = 0;
+    std::size_t plain    = 0;
+    for( auto &mr : lex::gmatch( numbers, digits, shared ) )
+    {
+        memoized += mr.length();
+    }
+    for( auto &mr : lex::gmatch( numbers, digits ) )
+    {
+        plain += mr.length();
+    }
+    assert_true( memoized == plain );
+    assert_true( table.capacity() >= numbers.size() + 1 && table.capacity() < 2 * ( numbers.size() + 1 ) + 64 );
+    assert_true( lex::count( numbers, digits, memoize ) == lex::count( numbers, digits ) );
+
+    /* a memoized match in the replacement function of a memoized substitution has its own table */
+    const lex::pattern word( "(%a+)" );
+    assert_true( lex::gsub( "ab cd", word, [ & ]( const lex::match_result &mr )
+    {
+        return std::string( lex::match( mr.at( 0 ), lex::pattern( "^.-b" ), shared ) ? "B" : "-" );
+    }, -1, shared ) == "B -" );
+
+    const auto step_limit = []( auto && f ) -> bool
+    {
+        try
+        {
+            f();
+        }
+        catch( const lex::lex_error& e )
+        {
+            return e.code() == lex::match_step_limit_exceeded;
+        }
+        return false;
+    };
+
+    lex::match_options budget;
+    budget.max_steps = 2000000;
+    assert_true( step_limit( [ & ]{ lex::match( text, adversarial, budget ); } ) );
+    assert_true( step_limit( [ & ]{ lex::match( text, ".-.-.-.-.-.-.-.-x", budget ); } ) );
+    assert_true( step_limit( [ & ]{ lex::gsub( text, ".-.-.-.-.-.-.-.-x", "", -1, budget ); } ) );
+    budget.iterative = true;
+    assert_true( step_limit( [ & ]{ lex::match( text, adversarial, budget ); } ) );
+    budget.memoize = true;
+    assert_false( step_limit( [ & ]{ lex::match( text, adversarial, budget ); } ) );
+    assert_true( lex::match( "hello world", "o w", budget ).position().first == 4 );
+
+    budget.max_steps = 0;
+    assert_true( step_limit( [ & ]{ lex::match( "a", "a", budget ); } ) );
+}
+
+template< typename CMR, typename MR >
+static bool same_compact_result( const CMR &a, const MR &b )
+{
+    if( a.size() != b.size() || a.position() != b.position() || ( a && a.length() != b.length() ) )
+    {
+        return false;
+    }
+    for( size_t i = 0 ; i < a.size() ; ++i )
+    {
+        if( a.at( i ) != b.at( i ) || a.at( i ).data() != b.at( i ).data() )
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void compact_results()
+{
+    static_assert( sizeof( lex::compact_match_result< 3 > ) <= 64, "A compact result with 3 captures doesn't fit in a cache line!" );
+    static_assert( sizeof( lex::compact_match_result< 3 > ) < sizeof( lex::match_result ), "A compact result isn't compact!" );
+
+    for( const auto &c : match_cases )
+    {
+        const lex::pattern pat( c.second );
+        if( pat.captures() <= 4 )
+        {
+            assert_true( same_compact_result( lex::match< 4 >( c.first, pat ), lex::match( c.first, pat ) ) );
+            assert_true( same_compact_result( lex::match< 4 >( c.first, c.second ), lex::match( c.first, c.second ) ) );
+        }
+    }
+
+    {
+        const std::u32string str = U"foo = 42;   bar= 1337; baz = PG =1003 ;";
+        const lex::pattern   pat( "(%a+)%s*=%s*(%d+)%s*;" );
+        auto                 full = lex::gmatch( str, pat );
+        auto                 it   = begin( full );
+        for( const auto &mr : lex::gmatch< 2 >( str, pat ) )
+        {
+            assert_true( same_compact_result( mr, *it ) );
+            size_t i = 0;
+            for( auto cap = mr.begin() ; cap != mr.end() ; ++cap, ++i )
+            {
+                assert_true( *cap == it->at( i ) );
+            }
+            assert_true( i == 2 );
+            ++it;
+        }
+        assert_true( it == end( full ) );
+    }
+
+    const auto too_many = []( auto && f ) -> bool
+    {
+        try
+        {
+            f();
+        }
+        catch( const lex::lex_error& e )
+        {
+            return e.code() == lex::capture_too_many;
+        }
+        return false;
+    };
+    const lex::pattern three( "(a)(b)(c)" );
+    assert_true( too_many( [ & ]{ lex::match< 2 >( "abc", three ); } ) );
+    assert_true( too_many( [ & ]{ lex::match< 2 >( "xyz", three ); } ) );
+    assert_true( too_many( [ & ]{ lex::gmatch< 2 >( "abc", three ); } ) );
+    assert_true( too_many( [ & ]{ lex::match< 2 >( "abc", "(a)(b)(c)" ); } ) );
+    assert_false( too_many( [ & ]{ lex::match< 2 >( "xyz", "(a)(b)(c)" ); } ) );
+
+    /* the offsets of a longer input string don't fit in a compact result; the length is checked before a char is read */
+    if constexpr( sizeof( std::size_t ) > sizeof( std::uint32_t ) )
+    {
+        const auto too_long = []( auto && f ) -> bool
+        {
+            try
+            {
+                f();
+            }
+            catch( const lex::lex_error& e )
+            {
+                return e.code() == lex::string_too_long;
+            }
+            return false;
+        };
+        const std::string_view                huge( "abc", std::size_t( UINT32_MAX ) + 1 );
+        const std::vector< std::string_view > rows = { "abc", huge };
+        lex::batch_result                     out;
+        lex::parallel_options                 popts;
+        popts.threads = 2;
+        assert_true( too_long( [ & ]{ lex::match< 3 >( huge, three ); } ) );
+        assert_true( too_long( [ & ]{ lex::match< 3 >( huge, "(a)(b)(c)" ); } ) );
+        assert_true( too_long( [ & ]{ lex::gmatch< 3 >( huge, three ); } ) );
+        assert_true( too_long( [ & ]{ lex::gmatch_parallel< 3 >( huge, three ); } ) );
+        assert_true( too_long( [ & ]{ lex::match_batch( rows, three, out ); } ) );
+        assert_true( too_long( [ & ]{ lex::match_batch( rows, three, out, popts ); } ) );
+        assert_false( too_long( [ & ]{ lex::gmatch< 3 >( huge.substr( 0, 3 ), three ); } ) );
+    }
+
+    const auto empty = lex::match< 1 >( "abc", "x" );
+    assert_false( empty );
+    assert_true( empty.position() == std::make_pair( -1L, -1L ) );
+    assert_true( empty.begin() == empty.end() );
+}
+
+static void pattern_sets()
+{
+    const std::vector< std::string_view > pats = {
+        "ERROR", "WARN", "took (%d+)ms", "^2020", "worker%-(%d+)", "%f[%w]%u+%f[%W]", "[%[/]api/(%a+)", "%d%d:%d%d", ".-x",
+        "lo", "log", "logging", "gin", "in", "%bab", "a*$", "%f[%z]", "^$", "()", "z+", "(%u)%1"
+    };
+    const lex::pattern_set set( pats.begin(), pats.end() );
+    assert_true( set.size() == pats.size() );
+
+    const std::string_view lines[] = {
+        "2020-05-17 13:37:01 INFO  worker-12 GET /api/items?id=4711 200 took 45ms",
+        "2020-05-17 13:37:02 ERROR worker-7 GET /api/report 500 took 3012ms",
+        "logging in, then WARN AA",
+        "xbab", "", "aaa", "lolog"
+    };
+    for( const auto line : lines )
+    {
+        const auto results = lex::match( line, set );
+        size_t     r       = 0;
+        for( size_t i = 0 ; i < pats.size() ; ++i )
+        {
+            const auto expected = lex::match( line, pats[ i ] );
+            if( expected )
+            {
+                assert_true( r < results.size() && results[ r ].first == i && same_result( results[ r ].second, expected ) );
+                ++r;
+            }
+        }
+        assert_true( r == results.size() );
+    }
+
+    const std::u16string wide = u"\u20AC 42 WARN \u20AC";
+    const auto           wide_results = lex::match( wide, lex::pattern_set{ "%d+", "WARN", "[\x80-\xFF]" } );
+    assert_true( wide_results.size() == 2 );
+    assert_true( wide_results[ 0 ].second.at( 0 ) == u"42" && wide_results[ 1 ].second.at( 0 ) == u"WARN" );
+
+    size_t calls = 0;
+    lex::match_each( "no digits here", lex::u32pattern_set{ U"%d", U"here", U"^no" }, [ & ]( size_t i, const auto & mr )
+    {
+        assert_true( i != 0 && mr );
+        ++calls;
+    } );
+    assert_true( calls == 2 );
+
+    /* the attempts of a memoized pass share the memo table */
+    std::string long_line;
+    for( int i = 0 ; long_line.size() < 300000 ; ++i )
+    {
+        long_line += "worker-" + std::to_string( i ) + " took ";
+    }
+    lex::memo_table    table;
+    lex::match_options memoize;
+    memoize.memoize = true;
+    memoize.memo    = &table;
+    const lex::pattern_set workers{ "worker%-%d+x", "took %d+ms", "(%d+) took" };
+    const auto             memoized = lex::match( long_line, workers, memoize );
+    const auto             plain    = lex::match( long_line, workers );
+    assert_true( memoized.size() == 1 && plain.size() == 1 && same_result( memoized[ 0 ].second, plain[ 0 ].second ) );
+    assert_true( table.capacity() >= long_line.size() && table.capacity() < 16 * ( long_line.size() + 1 ) + 64 );
+}
+
+static void parallel_matching()
+{
+    const std::string text = "2020-05-17 INFO worker-12 took 45ms\n2020-05-17 WARN (aa) worker-3 took 120ms\n\n"
+                             "xx ab a b (b) (a(b)c) aaa ERROR worker-7 took 3012ms\n";
+    const std::string_view pats[] = {
+        "(%u+)%s+worker%-(%d+).-(%d+)ms", "%d+", "a*", "x*", "()", "%f[%w]%w+", "%b()", ".-", "[^\n]*", "a-b", "(a)(.-)%1", "\n?"
+    };
+    const lex::pattern newline( "\n" );
+
+    for( const auto p : pats )
+    {
+        const lex::pattern pat( p );
+        std::vector< lex::match_result > expected;
+        for( auto &mr : lex::gmatch( text, pat ) )
+        {
+            expected.push_back( mr );
+        }
+        const auto sequential = lex::gsub( text, pat, "<%0>" );
+
+        for( std::size_t chunk_size : { 1, 2, 3, 5, 8, 13, 64 } )
+        {
+            for( const auto boundary : { static_cast< const lex::pattern * >( nullptr ), &newline } )
+            {
+                lex::parallel_options popts;
+                popts.threads    = 4;
+                popts.chunk_size = chunk_size;
+                popts.boundary   = boundary;
+
+                const auto results = lex::gmatch_parallel( text, pat, popts );
+                bool       same    = results.size() == expected.size();
+                for( size_t i = 0 ; same && i < results.size() ; ++i )
+                {
+                    same = same_result( results[ i ], expected[ i ] );
+                }
+                assert_true( same );
+                assert_true( lex::gsub_parallel( text, pat, "<%0>", -1, popts ) == sequential );
+                assert_true( lex::gsub_parallel( text, pat, lex::replacement( "[%0]" ), 3, popts ) == lex::gsub( text, pat, "[%0]", 3 ) );
+                assert_true( lex::gsub_parallel( text, pat, []( const auto &mr ){ return std::to_string( mr.length() ); }, -1, popts ) ==
+                             lex::gsub( text, pat, []( const auto &mr ){ return std::to_string( mr.length() ); } ) );
+            }
+        }
+    }
+
+    const std::u32string wide = U"k1=v1;k2=v2;;k3=v3";
+    const lex::pattern   pair( "(%w+)=(%w+)" );
+    lex::parallel_options popts;
+    popts.chunk_size = 2;
+    const auto compact = lex::gmatch_parallel< 2 >( wide, pair, popts );
+    assert_true( compact.size() == 3 && compact[ 2 ].at( 1 ) == U"v3" );
+    assert_true( lex::gsub_parallel( wide, pair, "%2=%1", -1, popts ) == U"v1=k1;v2=k2;;v3=k3" );
+    assert_true( lex::gsub_parallel( wide, lex::pattern( "^k" ), "K", -1, popts ) == U"K1=v1;k2=v2;;k3=v3" );
+    assert_true( lex::gmatch_parallel( std::string(), pair ).empty() );
+
+    bool thrown = false;
+    try
+    {
+        lex::gsub_parallel( text, lex::pattern( "(%d)" ), "%2", -1, popts );
+    }
+    catch( const lex::lex_error& e )
+    {
+        thrown = e.code() == lex::capture_invalid_index;
+    }
+    assert_true( thrown );
+}
+
+static void streams()
+{
+    assert_true( lex::pattern( "a?b%d()(c)%2$" ).max_length() == 5 );
+    assert_true( lex::pattern( "%f[%w]abc" ).max_length() == 3 );
+    assert_true( lex::pattern( "a*" ).max_length() == lex::pattern::unbounded );
+    assert_true( lex::pattern( "%bab" ).max_length() == lex::pattern::unbounded );
+    assert_true( lex::pattern( "()%1" ).max_length() == lex::pattern::unbounded );
+
+    const std::string text = "2020-05-17 WARN worker-12 took 45ms\nab aab abc (a(b)c) xx ERROR worker-7 took 3012ms\n";
+    const std::string_view pats[] = {
+        "%d%d%d?", "a?b", "%f[%w]%a%a", "()", "x?", "(a)(b)%2", "%u%u%u+", "%d+ms$", "k$", "%bab", ".-ms", "a*", "%s?%a+"
+    };
+
+    for( const auto p : pats )
+    {
+        const lex::pattern pat( p );
+        std::vector< std::pair< long, long > > expected;
+        for( auto &mr : lex::gmatch( text, pat ) )
+        {
+            expected.push_back( mr.position() );
+        }
+
+        for( size_t lookahead : { lex::pattern::unbounded, text.size() } )
+        {
+            for( size_t chunk_size : { 1, 2, 3, 7, 100 } )
+            {
+                std::vector< std::pair< long, long > > results;
+                bool                                   same_text = true;
+
+                const auto on_match = [ & ]( const lex::match_result &mr )
+                {
+                    results.push_back( mr.position() );
+                    same_text = same_text && ( pat.captures() || mr.at( 0 ) == std::string_view( text ).substr( mr.position().first, mr.length() ) );
+                };
+
+                lex::match_stream stream( pat, lookahead );
+                size_t            buffered = 0;
+                for( size_t i = 0 ; i < text.size() ; i += chunk_size )
+                {
+                    stream.push( std::string_view( text ).substr( i, chunk_size ), on_match );
+                    buffered = std::max( buffered, stream.buffered() );
+                }
+                stream.finish( on_match );
+
+                assert_true( results == expected );
+                assert_true( same_text );
+                if( pat.max_length() != lex::pattern::unbounded )
+                {
+                    assert_true( buffered <= pat.max_length() + chunk_size + 1 );
+                }
+            }
+        }
+    }
+
+    std::vector< std::u16string > words;
+    const lex::u16pattern         word( u"%a+" );
+    lex::u16match_stream          stream( word, 16 );
+    for( const auto chunk : { u"hello wo", u"rld, stre", u"aming" } )
+    {
+        stream.push( chunk, [ & ]( const auto &mr ){ words.emplace_back( mr.at( 0 ) ); } );
+    }
+    stream.finish( [ & ]( const auto &mr ){ words.emplace_back( mr.at( 0 ) ); } );
+    assert_true( words.size() == 3 && words[ 1 ] == u"world" && words[ 2 ] == u"streaming" );
+}
+
+static void mapped_files()
+{
+    const auto dir    = std::filesystem::temp_directory_path();
+    const auto input  = ( dir / "lex_mapped_file_input.txt" ).string();
+    const auto output = ( dir / "lex_mapped_file_output.txt" ).string();
+    const auto empty  = ( dir / "lex_mapped_file_empty.txt" ).string();
+
+    const std::string text = "foo = 42;   bar= 1337; baz = PG =1003 ;";
+    std::ofstream( input, std::ios::binary ) << text;
+    std::ofstream( empty, std::ios::binary );
+
+    {
+        lex::mapped_file file( input );
+        assert_true( file.size() == text.size() && file.view() == text );
+
+        const auto mr = lex::match_file( file, "(%a+)%s*=%s*(%d+)" );
+        assert_true( mr.at( 1 ) == "42" && mr.at( 1 ).data() == file.data() + 6 );
+
+        const lex::pattern pat( "(%a+)%s*=%s*(%d+)%s*;" );
+        size_t             count = 0;
+        for( const auto &m : lex::gmatch_file( file, pat ) )
+        {
+            assert_true( m.at( 0 ).data() >= file.data() && m.at( 0 ).data() < file.data() + file.size() );
+            ++count;
+        }
+        assert_true( count == 3 );
+
+        std::ostringstream out;
+        lex::gsub_file( file, out, pat, "%2=%1;" );
+        assert_true( out.str() == lex::gsub( text, pat, "%2=%1;" ) );
+
+        struct full_buffer : std::streambuf {};  // every write fails
+        full_buffer  full;
+        std::ostream failing( &full );
+        lex::gsub_file( file, failing, pat, "%2=%1;" );
+        assert_true( failing.bad() );
+
+        lex::gsub_file( file, output, "%a+", []( const auto &m ){ return std::string( m.at( 0 ).size(), '*' ); }, 2 );
+        const lex::mapped_file result( output, lex::access_hint::random );
+        assert_true( result.view() == "*** = 42;   ***= 1337; baz = PG =1003 ;" );
+
+        lex::mapped_file moved( std::move( file ) );
+        assert_true( moved.view() == text && file.size() == 0 );
+    }
+
+    {
+        const lex::mapped_file file( empty );
+        assert_true( file.size() == 0 && !lex::match_file( file, "." ) && lex::match_file( file, "^$" ) );
+    }
+
+    bool thrown = false;
+    try
+    {
+        lex::mapped_file missing( ( dir / "lex_mapped_file_missing.txt" ).string() );
+    }
+    catch( const std::system_error& e )
+    {
+        thrown = e.code() == std::errc::no_such_file_or_directory;
+    }
+    assert_true( thrown );
+
+    std::filesystem::remove( input );
+    std::filesystem::remove( output );
+    std::filesystem::remove( empty );
+}
+
+static void find_and_split()
+{
+    for( const auto &c : match_cases )
+    {
+        assert_true( lex::find( c.first, c.second ) == lex::match( c.first, c.second ).position() );
+        assert_true( lex::find( c.first, lex::pattern( c.second ) ) == lex::match( c.first, c.second ).position() );
+    }
+    assert_true( lex::find( U"hello world", "o w" ) == std::make_pair( 4L, 7L ) );
+    assert_true( lex::find( "hello", lex::pattern( "x" ) ) == std::make_pair( -1L, -1L ) );
+
+    const auto pieces = []( auto && range )
+    {
+        std::vector< std::string > result;
+        for( const auto piece : range )
+        {
+            result.emplace_back( piece );
+        }
+        return result;
+    };
+    using strings = std::vector< std::string >;
+
+    const lex::pattern comma( "%s*,%s*" );
+    assert_true( pieces( lex::split( "a, b,c ,, d", comma ) ) == strings( { "a", "b", "c", "", "d" } ) );
+    assert_true( pieces( lex::split( ",a,", "," ) ) == strings( { "", "a", "" } ) );
+    assert_true( pieces( lex::split( "", "," ) ) == strings( { "" } ) );
+    assert_true( pieces( lex::split( std::string_view(), "," ) ) == strings( { "" } ) );  // the data of the view is null
+    assert_true( pieces( lex::split( std::string_view(), comma ) ) == strings( { "" } ) );
+    assert_true( pieces( lex::split( "abc", "" ) ) == strings( { "", "a", "b", "c", "" } ) );
+    assert_true( pieces( lex::split( "key = value", "%s*(=)%s*" ) ) == strings( { "key", "value" } ) );
+    const lex::pattern spaces( "%s*" );
+    assert_true( pieces( lex::split( "one  two", spaces ) ) == strings( { "", "o", "n", "e", "t", "w", "o", "" } ) );
+
+    const std::u16string wide = u"x|y|z";
+    auto                 view = lex::split( wide, "|" );
+    auto                 it   = view.begin();
+    assert_true( *it == u"x" && ( it++ )->data() == wide.data() );
+    assert_true( *it == u"y" && *++it == u"z" );
+    assert_true( ++it == view.end() );
+    assert_true( std::distance( view.begin(), view.end() ) == 3 );
+}
+
+template< size_t I >
+struct case_source
+{
+    static constexpr std::string_view value = match_cases[ I ].second;
+};
+
+template< size_t I >
+static void same_static_results()
+{
+    constexpr auto c   = match_cases[ I ];
+    const auto     pat = lex::basic_static_pattern< case_source< I > >();
+
+    assert_true( same_result( lex::match( c.first, pat ), lex::match( c.first, c.second ) ) );
+    assert_true( lex::find( c.first, pat ) == lex::find( c.first, c.second ) );
+    assert_true( lex::gsub( c.first, pat, "<%0>" ) == lex::gsub( c.first, c.second, "<%0>" ) );
+
+    std::vector< std::pair< long, long > > a, b;
+    for( auto &mr : lex::gmatch( c.first, pat ) )
+    {
+        a.push_back( mr.position() );
+    }
+    for( auto &mr : lex::context( c.first, c.second ) )
+    {
+        b.push_back( mr.position() );
+    }
+    assert_true( a == b );
+    assert_true( lex::count( c.first, pat ) == b.size() );
+    assert_true( lex::matches( c.first, pat ) == static_cast< bool >( lex::match( c.first, c.second ) ) );
+}
+
+template< size_t... I >
+static void same_static_results( std::index_sequence< I... > )
+{
+    ( same_static_results< I >(), ... );
+}
+
+static constexpr char assignment[]    = "(%a+)%s*=%s*(%d+)";
+static constexpr char anchored_word[] = "^%w+";
+static constexpr char32_t wide_word[] = U"%s*([%w_]+)";
+
+static void static_patterns()
+{
+    same_static_results( std::make_index_sequence< std::size( match_cases ) >() );
+
+    const lex::static_pattern< assignment > pat;
+    static_assert( pat.captures() == 2 );
+    static_assert( !pat.anchored() );
+    static_assert( lex::static_pattern< anchored_word >::anchored() );
+
+    std::vector< std::string_view > v;
+    for( auto &mr : lex::gmatch( "foo = 42, bar= 1337", pat ) )
+    {
+        v.push_back( mr.at( 0 ) );
+        v.push_back( mr.at( 1 ) );
+    }
+    assert_true( ( v == std::vector< std::string_view >{ "foo", "42", "bar", "1337" } ) );
+
+    assert_true( lex::gsub( "foo = 42, bar= 1337", pat, "%2=%1" ) == "42=foo, 1337=bar" );
+    assert_true( lex::gsub( "foo = 42, bar= 1337", pat, "%2=%1", 1 ) == "42=foo, bar= 1337" );
+    assert_true( lex::gsub( "foo = 42, bar= 1337", pat, []( const lex::match_result &mr ) { return mr.at( 1 ); } ) == "42, 1337" );
+    assert_true( lex::gsub( "foo = 42", pat, lex::replacement( "%1:%2" ) ) == "foo:42" );
+    assert_true( lex::find( "x = 1", pat ) == std::make_pair( 0L, 5L ) );
+
+    assert_true( lex::match( "word", lex::static_pattern< anchored_word >() ).at( 0 ) == "word" );
+    assert_false( lex::match( " word", lex::static_pattern< anchored_word >() ) );
+    assert_true( lex::match( U"  hello_world", lex::static_pattern< wide_word >() ).at( 0 ) == U"hello_world" );
+    assert_true( lex::match( u"  hello", lex::static_pattern< wide_word >() ).at( 0 ) == u"hello" );
+
+    std::string out;
+    lex::gsub_to( out, "a=1 b=2", pat, "%1" );
+    assert_true( out == "a b" );
+
+    lex::match_options opts;
+    opts.max_steps = 10;
+    bool limited   = false;
+    try
+    {
+        lex::match( std::string( 100, 'a' ), pat, opts );
+    }
+    catch( const lex::lex_error & e )
+    {
+        limited = e.code() == lex::match_step_limit_exceeded;
+    }
+    assert_true( limited );
+}
+
+static void counting()
+{
+    lex::match_options iterative;
+    iterative.iterative = true;
+    lex::match_options threaded;
+    threaded.threaded = true;
+    lex::match_options memoize;
+    memoize.memoize = true;
+
+    for( const auto &c : match_cases )
+    {
+        std::size_t n = 0;
+        for( auto &mr : lex::context( c.first, c.second ) )
+        {
+            static_cast< void >( mr );
+            ++n;
+        }
+        const bool found = lex::match( c.first, c.second );
+        const lex::pattern pat( c.second );
+
+        assert_true( lex::count( c.first, c.second ) == n );
+        assert_true( lex::matches( c.first, c.second ) == found );
+        assert_true( lex::count( c.first, pat ) == n );
+        assert_true( lex::count( c.first, pat, iterative ) == n );
+        assert_true( lex::count( c.first, pat, threaded ) == n );
+        assert_true( lex::count( c.first, pat, memoize ) == n );
+        assert_true( lex::matches( c.first, pat ) == found );
+        assert_true( lex::matches( c.first, pat, iterative ) == found );
+        assert_true( lex::matches( c.first, pat, threaded ) == found );
+    }
+
+    assert_true( lex::count( "one two  three", "%a+" ) == 3 );
+    assert_true( lex::count( u"k1=v1, k2=v2", "(%w+)=(%w+)" ) == 2 );
+    assert_true( lex::count( "abc", "" ) == 4 );
+    assert_true( lex::count( "", "x" ) == 0 );
+    assert_true( lex::count( "aXaaXa", lex::pattern( "(a)X%1" ) ) == 2 );
+    assert_true( lex::matches( "key = 42", lex::static_pattern< assignment >() ) );
+    assert_true( lex::count( "a=1 b=2 c", lex::static_pattern< assignment >() ) == 2 );
+    assert_false( lex::matches( "hello", "^(h)(x)" ) );
+
+    /* captures that are back-referenced or that are malformed are matched like a normal match */
+    using lex::detail::captures_unused;
+    using lex::detail::pattern_context;
+    assert_true( captures_unused( pattern_context< char >( "(%a+)%s*=%s*()(%d+)" ) ) );
+    assert_true( captures_unused( pattern_context< char >( "[(]%b()%)" ) ) );
+    assert_false( captures_unused( pattern_context< char >( "(a)%1" ) ) );
+    assert_false( captures_unused( pattern_context< char >( "(a" ) ) );
+    assert_false( captures_unused( pattern_context< char >( "a)(" ) ) );
+    assert_false( captures_unused( pattern_context< char >( "[(" ) ) );
+    assert_true( lex::pattern( "(a)%1" ).has_back_references() );
+    static_assert( !lex::static_pattern< assignment >::has_back_references() );
+
+    const auto error = []( auto && f, lex::error_type ec ) -> bool
+    {
+        try
+        {
+            f();
+        }
+        catch( const lex::lex_error& e )
+        {
+            return e.code() == ec;
+        }
+        return false;
+    };
+    assert_true( error( []{ return lex::matches( "a", "(a" ); }, lex::capture_not_finished ) );
+    assert_true( error( []{ return lex::count( "a", "a)" ); }, lex::capture_invalid_pattern ) );
+    assert_true( error( []{ return lex::count( "a", "a%2" ); }, lex::capture_invalid_index ) );
+}
+
+static void cursors()
+{
+    const auto positions = []( const auto & c )
+    {
+        std::vector< std::pair< long, long > > result;
+        for( auto cur = lex::cursor( c ) ; cur != lex::match_sentinel() ; ++cur )
+        {
+            result.push_back( cur->position() );
+        }
+        return result;
+    };
+
+    /* resuming from each checkpoint gives the rest of the matches */
+    const auto resumed = []( const auto & c )
+    {
+        std::vector< std::pair< long, long > > result;
+        lex::match_checkpoint                  from;
+        for( ; ; )
+        {
+            const auto cur = lex::cursor( c, from );
+            if( cur == lex::match_sentinel() )
+            {
+                break;
+            }
+            result.push_back( cur->position() );
+            from = cur.checkpoint();
+        }
+        return result;
+    };
+
+    for( const auto &c : match_cases )
+    {
+        std::vector< std::pair< long, long > > expected;
+        for( auto &mr : lex::context( c.first, c.second ) )
+        {
+            expected.push_back( mr.position() );
+        }
+
+        const lex::context          text( c.first, c.second );
+        const lex::pattern          pat( c.second );
+        const lex::compiled_context compiled( c.first, pat );
+        const auto                  compact = lex::gmatch< 4 >( c.first, pat );
+
+        assert_true( positions( text ) == expected );
+        assert_true( positions( compiled ) == expected );
+        assert_true( positions( compact ) == expected );
+        assert_true( resumed( text ) == expected );
+        assert_true( resumed( compiled ) == expected );
+        assert_true( resumed( compact ) == expected );
+    }
+
+    /* an empty match at the end of the previous match is skipped after a resume */
+    const std::string           str = "ab cd";
+    const lex::pattern          letters( "%a*" );
+    const lex::compiled_context c( str, letters );
+    auto                        cur = lex::cursor( c );
+    assert_true( cur->at( 0 ) == "ab" );
+    const auto checkpoint = cur.checkpoint();
+    assert_true( checkpoint.offset == 2 && checkpoint.after_match );
+    assert_true( lex::cursor( c, checkpoint )->at( 0 ) == "cd" );
+    assert_true( lex::cursor( c, { 2, false } )->at( 0 ).empty() );
+
+    /* checkpoints are offsets, so they can be resumed on a new context of the same input */
+    const std::string           copy = str;
+    const lex::compiled_context other( copy, letters );
+    assert_true( lex::cursor( other, checkpoint )->at( 0 ) == "cd" );
+
+    const auto copied = cur;
+    ++cur;
+    assert_true( copied->at( 0 ) == "ab" && cur->at( 0 ) == "cd" );
+    ++cur;
+    ++cur;
+    assert_true( cur == lex::match_sentinel() && !*cur );
+    assert_true( lex::cursor( c, { 100, false } ) == lex::match_sentinel() );
+
+    const lex::static_context word( "x = 1, y = 2", lex::static_pattern< assignment >() );
+    auto                      w = lex::cursor( word );
+    assert_true( w->at( 0 ) == "x" && w->at( 1 ) == "1" );
+    assert_true( lex::cursor( word, w.checkpoint() )->at( 0 ) == "y" );
+
+    lex::match_options utf8;
+    utf8.utf8 = true;
+    const lex::context text( "\xC3\xA9\xC3\xA9", ".", utf8 );
+    assert_true( positions( text ) == ( std::vector< std::pair< long, long > >{ { 0, 2 }, { 2, 4 } } ) );
+
+    /* the steps of a memoizing cursor share the memo table of the context options */
+    std::string numbers;
+    for( int i = 0 ; numbers.size() < ( 1 << 20 ) ; ++i )
+    {
+        numbers += std::to_string( i ) + " ";
+    }
+    const lex::pattern digits( "(%d+) " );
+    lex::memo_table    table;
+    lex::match_options memoize;
+    memoize.memoize = true;
+    memoize.memo    = &table;
+
+    const lex::compiled_context long_text( numbers, digits, memoize );
+    const auto                  long_compact = lex::gmatch< 2 >( numbers, digits, memoize );
+
+    std::size_t memoized = 0;
+    std::size_t compact  = 0;
+    std::size_t plain    = 0;
+    for( auto cur = lex::cursor( long_text ) ; cur != lex::match_sentinel() ; ++cur )
+    {
+        memoized += cur->at( 0 ).size();
+    }
+    for( auto cur = lex::cursor( long_compact ) ; cur != lex::match_sentinel() ; ++cur )
+    {
+        compact += cur->at( 0 ).size();
+    }
+    for( auto &mr : lex::gmatch( numbers, digits ) )
+    {
+        plain += mr.at( 0 ).size();
+    }
+    assert_true( memoized == plain && compact == plain );
+    assert_true( table.capacity() >= numbers.size() + 1 && table.capacity() < 8 * ( numbers.size() + 1 ) + 64 );
+
+    static_assert( sizeof( lex::match_cursor< lex::compiled_context< char, char, lex::basic_compact_match_result< char, 2 > > > ) < sizeof( lex::match_result ) );
+}
+
+static void replacement_outputs()
+{
+    /* a replacement function can return a string view into the input string */
+    const auto initial = []( const lex::match_result & mr ) { return mr.at( 0 ).substr( 0, 1 ); };
+    assert_true( lex::gsub( "hello big world", "%a+", initial ) == "h b w" );
+    assert_true( lex::gsub( "hello big world", lex::pattern( "%a+" ), initial, 2 ) == "h b world" );
+
+    /* or write the replacement to a sink */
+    const auto bracket = []( const lex::match_result & mr, lex::replacement_sink & out )
+    {
+        out.push_back( '<' );
+        out.append( mr.at( 0 ) );
+        out.push_back( '>' );
+    };
+    assert_true( lex::gsub( "k=v, x=y", "(%w+)=(%w+)", bracket ) == "<k>, <x>" );
+    assert_true( lex::gsub( "k=v, x=y", lex::pattern( "(%w+)=(%w+)" ), bracket ) == "<k>, <x>" );
+    assert_true( lex::gsub( "k=1, x=2", lex::static_pattern< assignment >(), bracket ) == "<k>, <x>" );
+    assert_true( lex::gsub( "a b", "%a", []( const auto & mr, auto & out ) { out.append( mr.at( 0 ) ); out.append( mr.at( 0 ) ); } ) == "aa bb" );
+    assert_true( lex::gsub( U"\u00E9t\u00E9", U"\u00E9", []( const lex::u32match_result &, lex::u32replacement_sink & out ) { out.append( U"e" ); } ) == U"ete" );
+
+    std::string out;
+    lex::gsub_to( out, "a b", "%a", bracket );
+    assert_true( out == "<a> <b>" );
+    std::ostringstream stream;
+    lex::gsub_to( std::ostreambuf_iterator< char >( stream ), "a b", "%a", bracket );
+    assert_true( stream.str() == "<a> <b>" );
+
+    const lex::pattern                  word( "%a+" );
+    const std::vector< std::string_view > rows = { "ab cd", "", "e" };
+    lex::batch_strings                  subs;
+    lex::gsub_batch( rows, word, bracket, subs );
+    assert_true( subs.size() == 3 && subs[ 0 ] == "<ab> <cd>" && subs[ 1 ].empty() && subs[ 2 ] == "<e>" );
+
+    std::string text;
+    for( int i = 0 ; i < 1000 ; ++i )
+    {
+        text += "word" + std::to_string( i ) + " ";
+    }
+    lex::parallel_options popts;
+    popts.threads    = 4;
+    popts.chunk_size = 100;
+    assert_true( lex::gsub_parallel( text, word, bracket, -1, popts ) == lex::gsub( text, word, "<%0>" ) );
+
+    /* the result can use an allocator, e.g. of a monotonic arena */
+    std::pmr::monotonic_buffer_resource arena;
+    const std::pmr::polymorphic_allocator< char > alloc( &arena );
+
+    const std::pmr::string r = lex::gsub( alloc, "a b", "%a", "<%0>" );
+    assert_true( r == "<a> <b>" && r.get_allocator().resource() == &arena );
+    assert_true( lex::gsub( alloc, "a b c", word, lex::replacement( "[%0]" ), 2 ) == "[a] [b] c" );
+    assert_true( lex::gsub( alloc, "k=1 x", lex::static_pattern< assignment >(), bracket ) == "<k> x" );
+    assert_true( lex::gsub( alloc, "k=v", "(%w+)=(%w+)", initial ) == "k" );
+
+    const std::pmr::u16string wide = lex::gsub( alloc, u"ab", "%a", u"%0%0" );
+    assert_true( wide == u"aabb" && wide.get_allocator().resource() == &arena );
+    const std::basic_string< wchar_t > std_alloc = lex::gsub( std::allocator< char >(), L"x", L"x", L"y" );
+    assert_true( std_alloc == L"y" );
+}
+
+static void pattern_caches()
+{
+    for( const auto &c : match_cases )
+    {
+        assert_true( same_result( lex::match_cached( c.first, c.second ), lex::match( c.first, c.second ) ) );
+        assert_true( lex::gsub_cached( c.first, c.second, "<%0>" ) == lex::gsub( c.first, c.second, "<%0>" ) );
+    }
+    assert_true( lex::match_cached( U"  hello", U"%s*(%w+)" ).at( 0 ) == U"hello" );
+    assert_true( lex::gsub_cached( "a=1, b=2", "(%w+)=(%w+)", []( const lex::match_result &mr ) { return mr.at( 1 ); } ) == "1, 2" );
+
+    /* the class mode of the options is part of the key of a cached pattern */
+    lex::match_options unicode;
+    unicode.classes = lex::class_mode::unicode;
+    assert_true( !lex::match_cached( U"\u00E9", U"%a+" ) );
+    assert_true( lex::match_cached( U"\u00E9", U"%a+", unicode ).at( 0 ) == U"\u00E9" );
+    assert_true( !lex::match_cached( U"\u00E9", U"%a+" ) );
+    assert_true( lex::gsub_cached( U"a\u00E9b", U"%a", U"x", -1, unicode ) == U"xxx" );
+    assert_true( lex::gsub_cached( U"a\u00E9b", U"%a", U"x" ) == U"x\u00E9x" );
+
+    lex::pattern_cache cache( 2, 1 );
+    assert_true( cache.capacity() == 2 );
+    const auto a = cache.get( "a+" );
+    assert_true( cache.get( "a+" ) == a );
+    assert_true( cache.get( std::string( "a+" ) ) == a );
+    const auto b = cache.get( "b+" );
+    assert_true( cache.size() == 2 );
+    cache.get( "a+" );  // 'b+' is now the least recently used pattern
+    const auto c = cache.get( "c+" );
+    assert_true( cache.size() == 2 );
+    bool evicted = false;
+    bool kept    = false;
+    std::thread( [ & ]  // a thread that doesn't remember the patterns of this thread
+    {
+        kept    = cache.get( "a+" ) == a && cache.get( "c+" ) == c;
+        evicted = cache.get( "b+" ) != b;
+    } ).join();
+    assert_true( kept );
+    assert_true( evicted );
+    assert_true( lex::match( "xbbb", *b ).at( 0 ) == "bbb" );  // an evicted pattern stays valid
+    assert_true( cache.get( "c+", lex::class_mode::ascii ) != c && cache.get( "c+" ) == c );
+
+    bool malformed = false;
+    try
+    {
+        cache.get( "(a" );
+    }
+    catch( const lex::lex_error & e )
+    {
+        malformed = e.code() == lex::capture_not_finished;
+    }
+    assert_true( malformed );
+    assert_true( cache.size() == 2 );
+
+    assert_true( lex::match_cached( "xaa", "a+", {}, cache ).at( 0 ) == "aa" );
+    cache.clear();
+    assert_true( cache.size() == 0 );
+    assert_true( cache.get( "a+" ) != a );
+
+    lex::pattern_cache shared( 8 );
+    assert_true( shared.capacity() >= 8 );
+    std::vector< std::thread > workers;
+    std::atomic< int >         failures( 0 );
+    for( int t = 0 ; t < 4 ; ++t )
+    {
+        workers.emplace_back( [ &, t ]
+        {
+            for( int i = 0 ; i < 2000 ; ++i )
+            {
+                const auto n   = std::to_string( ( i * 7 + t ) % 20 );
+                const auto str = "x" + n + "y";
+                if( lex::match_cached( str, "x(" + n + ")y", {}, shared ).at( 0 ) != n )
+                {
+                    ++failures;
+                }
+            }
+        } );
+    }
+    for( auto &w : workers )
+    {
+        w.join();
+    }
+    assert_true( failures == 0 );
+    assert_true( shared.size() <= shared.capacity() );
+}
+
+static void batch_matching()
+{
+    std::vector< std::string_view > rows;
+    for( const auto &c : match_cases )
+    {
+        rows.push_back( c.first );
+    }
+
+    for( const auto p : { "(%w+)=(%w+)", "%d+", "()a*()", "^%s*(%a+)", "x*", "(h)(e)(l)(l)(o)" } )
+    {
+        const lex::pattern pat( p );
+        lex::batch_result  out;
+        lex::batch_strings subs;
+
+        lex::match_batch( rows, pat, out );
+        lex::gsub_batch( rows, pat, "<%0>", subs );
+        assert_true( out.size() == rows.size() );
+        assert_true( subs.size() == rows.size() );
+        assert_true( out.captures == std::max< std::size_t >( pat.captures(), 1 ) );
+
+        for( std::size_t r = 0 ; r < rows.size() ; ++r )
+        {
+            const auto mr = lex::match( rows[ r ], pat );
+            assert_true( out.matched( r ) == static_cast< bool >( mr ) );
+            assert_true( out.positions[ r ] == mr.position() );
+            for( std::size_t i = 0 ; i < mr.size() ; ++i )
+            {
+                const auto &cap = out.at( r, i );
+                assert_true( rows[ r ].substr( cap.offset, cap.length ) == mr.at( i ) );
+            }
+            assert_true( subs[ r ] == lex::gsub( rows[ r ], pat, "<%0>" ) );
+        }
+
+        for( unsigned threads : { 1, 2, 3 } )
+        {
+            const std::vector< std::string_view > many( 1000, rows[ 0 ] );
+            lex::batch_result                     parallel;
+            lex::batch_result                     sequential;
+            lex::batch_strings                    parallel_subs;
+            lex::batch_strings                    sequential_subs;
+
+            lex::match_batch( many, pat, sequential );
+            lex::match_batch( many, pat, parallel, lex::parallel_options{ threads } );
+            lex::gsub_batch( many, pat, "[%0]", sequential_subs, 1 );
+            lex::gsub_batch( many, pat, "[%0]", parallel_subs, 1, lex::parallel_options{ threads } );
+            assert_true( parallel.positions == sequential.positions );
+            assert_true( parallel_subs.chars == sequential_subs.chars );
+            assert_true( parallel_subs.offsets == sequential_subs.offsets );
+        }
+    }
+
+    {
+        const std::vector< std::string > lines = { "a=1", "no match", "", "key=value" };
+        const lex::pattern               pat( "(%w+)=()(%w+)" );
+        lex::batch_result                out;
+        lex::batch_strings               subs;
+
+        lex::match_batch( lines, pat, out );
+        assert_true( out.captures == 3 );
+        assert_true( out.matched( 0 ) && !out.matched( 1 ) && !out.matched( 2 ) && out.matched( 3 ) );
+        assert_true( out.positions[ 1 ] == std::pair( -1l, -1l ) );
+        assert_true( out.at( 3, 1 ).offset == 4 && out.at( 3, 1 ).length == 0 );
+        assert_true( out.at( 3, 2 ).offset == 4 && out.at( 3, 2 ).length == 5 );
+        assert_true( out.at( 1, 0 ).offset == 0 && out.at( 1, 0 ).length == 0 );
+        try
+        {
+            out.at( 0, 3 );
+            assert_true( 0 );
+        }
+        catch( const lex::lex_error& e )
+        {
+            assert_true( e.code() == lex::capture_out_of_range );
+        }
+
+        lex::match_batch( std::vector< std::string >{ "b=2" }, pat, out );  /* the arrays are reused */
+        assert_true( out.size() == 1 && out.offsets.size() == 3 && out.at( 0, 2 ).offset == 2 );
+
+        lex::gsub_batch( lines, pat, lex::replacement( "%3:%1" ), subs );
+        assert_true( subs.size() == 4 && subs[ 0 ] == "1:a" && subs[ 1 ] == "no match" && subs[ 2 ] == "" && subs[ 3 ] == "value:key" );
+        lex::gsub_batch( lines, pat, []( const lex::match_result &mr ) { return mr.at( 0 ); }, subs );
+        assert_true( subs.size() == 4 && subs[ 3 ] == "key" );
+        try
+        {
+            lex::gsub_batch( lines, pat, lex::replacement( "%4" ), subs );
+            assert_true( 0 );
+        }
+        catch( const lex::lex_error& e )
+        {
+            assert_true( e.code() == lex::capture_invalid_index );
+        }
+
+        const std::u32string  wide[] = { U"x y", U"zz" };
+        lex::u32batch_strings wide_subs;
+        lex::gsub_batch( wide, lex::u32pattern( U"%a" ), U"-", wide_subs );
+        assert_true( wide_subs[ 0 ] == U"- -" && wide_subs[ 1 ] == U"--" );
+        lex::match_batch( wide, lex::pattern( "%a$" ), out );
+        assert_true( out.positions[ 0 ] == std::pair( 2l, 3l ) && out.positions[ 1 ] == std::pair( 1l, 2l ) );
+    }
+}
+
+static void rule_chains()
+{
+    const lex::pattern email( "[%w._%-]+@[%w.%-]+%.%a+" );
+    const lex::pattern ip( "%d+%.%d+%.%d+%.%d+" );
+    const lex::pattern spaces( "%s+" );
+    const lex::pattern trim( "^ ?(.-) ?$" );
+    const lex::pattern digit( "%d" );
+    const lex::pattern empty( "x*" );
+
+    lex::rule_chain chain;
+    chain.add( email, "<email>" ).add( ip, "<ip>" ).add( spaces, " " ).add( trim, "%1" ).add( digit, "#", 2 ).add( empty, "" ).add( digit, "?", 0 );
+    assert_true( chain.size() == 7 && chain.rules()[ 4 ].count == 2 );
+
+    const auto sequential = [ & ]( std::string str )
+    {
+        for( const auto &rule : chain.rules() )
+        {
+            str = lex::gsub( str, *rule.pattern, rule.replacement, rule.count );
+        }
+        return str;
+    };
+
+    std::vector< std::string > docs;
+    for( const auto &c : match_cases )
+    {
+        docs.emplace_back( c.first );
+    }
+    docs.insert( docs.end(), { "  mail  bob@example.com\tfrom 10.0.0.1 \n", "no rule matches", "", "1 2 3 4", "x" } );
+
+    lex::chain_scratch scratch;
+    for( const auto &doc : docs )
+    {
+        const auto expected = sequential( doc );
+        assert_true( lex::gsub_chain( doc, chain ) == expected );
+        assert_true( lex::gsub_chain( doc, chain, scratch ) == expected );  /* the scratch is reused */
+    }
+    assert_true( lex::gsub_chain( "  mail  bob@example.com\tfrom 10.0.0.1 \n", chain ) == "mail <email> from <ip>" );
+
+    /* the result is a view of the input string when no rule substitutes a match */
+    const std::string unchanged = "abc";
+    lex::rule_chain   digits;
+    digits.add( digit, "#" );
+    assert_true( lex::gsub_chain( unchanged, digits, scratch ).data() == unchanged.data() );
+    assert_true( lex::gsub_chain( "a1b2", digits, scratch ) == "a#b#" );
+    assert_true( lex::gsub_chain( "a1b2", lex::rule_chain() ) == "a1b2" );
+    assert_true( lex::gsub_chain( U"x1", lex::rule_chain().add( digit, "#" ) ) == U"x#" );
+
+    try
+    {
+        lex::rule_chain().add( digit, "%2" );
+        assert_true( 0 );
+    }
+    catch( const lex::lex_error& e )
+    {
+        assert_true( e.code() == lex::capture_invalid_index );
+    }
+
+    lex::batch_strings out;
+    lex::gsub_chain_batch( docs, chain, out );
+    assert_true( out.size() == docs.size() );
+    for( std::size_t r = 0 ; r < docs.size() ; ++r )
+    {
+        assert_true( out[ r ] == sequential( docs[ r ] ) );
+    }
+
+    for( unsigned threads : { 1, 2, 3 } )
+    {
+        std::vector< std::string > many;
+        for( std::size_t i = 0 ; i < 1000 ; ++i )
+        {
+            many.push_back( docs[ i % docs.size() ] );
+        }
+        lex::batch_strings parallel;
+        lex::batch_strings sequential_out;
+        lex::gsub_chain_batch( many, chain, sequential_out );
+        lex::gsub_chain_batch( many, chain, parallel, lex::parallel_options{ threads } );
+        assert_true( parallel.chars == sequential_out.chars );
+        assert_true( parallel.offsets == sequential_out.offsets );
+    }
+}
+
+static void readme_examples()
+{
+    {
+        std::string str = "Hello world!";
+        auto result = lex::match( str, "^%a+" );
+        assert_true( result.at( 0 ) == "Hello" );
+    }
+
+    {
+        std::wstring str = L"Hello PG1003!";
+        auto result = lex::match( str, "(%a+)%d+" );
+        assert_true( result );
+        assert_true( result.at( 0 ) == L"PG" );
+    }
+
+    {
+        std::vector< std::pair< std::u16string_view, std::u16string_view > > results;
+
+        auto str = u"foo = 42;   bar= 1337; baz = PG =1003 ;";
+        for( auto match : lex::context( str, "(%a+)%s*=%s*(%d+)%s*;" ) )
+        {
+            assert_true( match.size() == 2 );
+            results.emplace_back( match.at( 0 ), match.at( 1 ) );
+        }
+        assert_true( results.size() == 3 );
+        assert_true( results[ 0 ].first  == u"foo" );
+        assert_true( results[ 0 ].second == u"42" );
+        assert_true( results[ 1 ].first  == u"bar" );
+        assert_true( results[ 1 ].second == u"1337" );
+        assert_true( results[ 2 ].first  == u"PG" );
+        assert_true( results[ 2 ].second == u"1003" );
+    }
+
+    {
+        auto str    = "foo =\t42; bar= 1337; pg =1003 ;";
+        auto pat    = "(%a+)%s*=%s*(%d+)%s*;";
+        auto repl   = "%1=%2;";
+        auto result = lex::gsub( str, pat, repl );
+
+        assert_true( result == "foo=42; bar=1337; pg=1003;" );
+    }
+
+    {
+        auto str = "one two three four";
+        auto function = []( const lex::match_result & mr )
+        {
+            if( mr.at( 0 ) == "one" )
+            {
+                return "PG";
+            }
+
+            return "1003";
+        };
+
+        assert_true( lex::gsub( str, "%s*%w+", function, 2 ) == "PG1003 three four" );
+    }
+}
+
+static constexpr char greedy_rest[] = "a*ab";
+static constexpr char lazy_rest[]   = "a-b";
+
+static void match_statistics()
+{
+    const auto stats_of = []( auto && f )
+    {
+        lex::match_stats    stats;
+        lex::match_options  opts;
+        opts.stats = &stats;
+        f( opts );
+        return stats;
+    };
+
+#if LEX_INSTRUMENTATION
+    const lex::pattern greedy( greedy_rest );
+    const lex::pattern lazy( lazy_rest );
+
+    lex::match_options iterative;
+    iterative.iterative = true;
+    lex::match_options threaded;
+    threaded.threaded = true;
+
+    for( const auto &engine : { lex::match_options{}, iterative, threaded } )
+    {
+        const auto with = [ & ]( const lex::match_options & opts )
+        {
+            auto o  = engine;
+            o.stats = opts.stats;
+            return o;
+        };
+
+        const auto text     = stats_of( [ & ]( const auto &opts ){ lex::match( "xaaab", greedy_rest, with( opts ) ); } );
+        const auto compiled = stats_of( [ & ]( const auto &opts ){ lex::match( "xaaab", greedy, with( opts ) ); } );
+        assert_true( text.searches == 1 && compiled.searches == 1 );
+        assert_true( text.starts == 2 );
+        assert_true( text.max_backtracks == 1 && compiled.max_backtracks == 1 );
+        assert_true( text.min_expansions == 0 && compiled.min_expansions == 0 );
+        assert_true( text.steps > 0 && compiled.steps > 0 );
+        assert_true( text.match_calls > 0 && text.peak_depth > 0 && compiled.peak_depth > 0 );
+
+        const auto failed = stats_of( [ & ]( const auto &opts ){ lex::match( "aaa", greedy, with( opts ) ); } );
+        assert_true( failed.starts == 2 );                  /* a match needs at least two chars */
+        assert_true( failed.max_backtracks == 4 + 3 );
+
+        const auto minimal = stats_of( [ & ]( const auto &opts ){ lex::match( "aaab", lazy, with( opts ) ); } );
+        assert_true( minimal.min_expansions == 3 && minimal.max_backtracks == 0 );
+        assert_true( minimal.steps == stats_of( [ & ]( const auto &opts ){ lex::match( "aaab", lazy_rest, with( opts ) ); } ).steps );
+    }
+
+    const auto fixed = stats_of( []( const auto &opts ){ lex::match( "xaaab", lex::static_pattern< greedy_rest >(), opts ); } );
+    assert_true( fixed.searches == 1 && fixed.starts == 2 && fixed.max_backtracks == 1 && fixed.match_calls > 0 );
+    assert_true( stats_of( []( const auto &opts ){ lex::match( "aaab", lex::static_pattern< lazy_rest >(), opts ); } ).min_expansions == 3 );
+
+    /* the counters of calls with the same stats accumulate */
+    const auto each = stats_of( [ & ]( const auto &opts )
+    {
+        const lex::pattern letter( "%a" );
+        for( auto &mr : lex::gmatch( "a=1, b=2, c=3", letter, opts ) )
+        {
+            static_cast< void >( mr );
+        }
+        lex::gsub( "a=1, b=2", "%d", "#", -1, opts );
+    } );
+    assert_true( each.searches == 4 + 1 );
+
+    const auto sum = []( lex::match_stats a, const lex::match_stats & b ) { return a += b; };
+
+    const std::string  log  = "INFO x took 1ms\nWARN y took 22ms\nERROR z took 333ms\n";
+    const lex::pattern took( "(%u+) (%a) took (%d+)ms" );
+    const auto         seq  = stats_of( [ & ]( const auto &opts ){ lex::gmatch_parallel( log, took, lex::parallel_options{ 1 }, opts ); } );
+    const auto         par  = stats_of( [ & ]( const auto &opts ){ lex::gmatch_parallel( log, took, lex::parallel_options{ 3, 8 }, opts ); } );
+    assert_true( seq.searches == 4 && par.searches >= 4 );
+    assert_true( par.steps >= seq.steps && par.starts >= seq.starts );
+    assert_true( sum( seq, par ).steps == seq.steps + par.steps );
+
+    const std::vector< std::string_view > rows( 1000, "key=value" );
+    lex::batch_result                     out;
+    const auto batch    = stats_of( [ & ]( const auto &opts ){ lex::match_batch( rows, lex::pattern( "(%w+)=(%w+)" ), out, opts ); } );
+    const auto parallel = stats_of( [ & ]( const auto &opts ){ lex::match_batch( rows, lex::pattern( "(%w+)=(%w+)" ), out, lex::parallel_options{ 2 }, opts ); } );
+    assert_true( batch.searches == rows.size() && parallel.searches == rows.size() && parallel.steps == batch.steps );
+#else
+    /* nothing is recorded when the instrumentation is compiled out */
+    const auto none = stats_of( []( const auto &opts ){ lex::match( "xaaab", greedy_rest, opts ); lex::gsub( "aaab", lazy_rest, "", -1, opts ); } );
+    assert_true( none.searches == 0 && none.starts == 0 && none.steps == 0 && none.peak_depth == 0 );
+#endif
+}
+
+static constexpr char32_t unicode_word[] = U"(%a+)%s*(%d*)";
+static constexpr char     ascii_word[]   = "[%w_]+";
+
+static void class_modes()
+{
+    using lex::class_mode;
+
+    const std::string classes = "acdglpsuwxzACDGLPSUWXZ";
+
+    /* the ASCII tables are the classes of the "C" locale */
+    for( int c = 0 ; c < 256 ; ++c )
+    {
+        for( const auto cl : classes )
+        {
+            const bool ascii = lex::detail::match_class( c, cl, class_mode::ascii );
+            if( c < 128 )
+            {
+                assert_true( ascii == lex::detail::match_class( c, cl ) );
+            }
+            else
+            {
+                assert_true( ascii == ( cl < 'a' ) );
+            }
+            if( c < 128 )
+            {
+                assert_true( lex::detail::match_class( c, cl, class_mode::unicode ) == ascii );
+            }
+        }
+    }
+    assert_true( lex::detail::match_class( '.', '.', class_mode::ascii ) );
+    assert_false( lex::detail::match_class( 'a', '.', class_mode::unicode ) );
+
+    lex::match_options unicode;
+    unicode.classes = class_mode::unicode;
+    lex::match_options ascii;
+    ascii.classes = class_mode::ascii;
+
+    const std::pair< std::u32string_view, std::u32string_view > unicode_cases[][ 2 ] = {
+        { { U"caf\u00E9 42", U"%a+" },              { U"caf\u00E9", U"caf" } },
+        { { U"\u00C9cole", U"%u" },                 { U"\u00C9", U"" } },
+        { { U"x\u00C9", U"%l+" },                   { U"x", U"x" } },
+        { { U"n\u0663\u0664", U"%d+" },             { U"\u0663\u0664", U"" } },
+        { { U"a\u3000b", U"%s" },                   { U"\u3000", U"" } },
+        { { U"1\u20AC", U"%p" },                    { U"\u20AC", U"" } },
+        { { U"\u4E2D\u6587!", U"%w+" },             { U"\u4E2D\u6587", U"" } },
+        { { U"\u4E2D!", U"[^%a]" },                 { U"!", U"\u4E2D" } },
+        { { U"\u0085\u200Bz", U"%g" },              { U"z", U"z" } },
+        { { U"\u00E9t\u00E9", U"%f[%a]%a+%f[%A]" }, { U"\u00E9t\u00E9", U"t" } },
+        { { U"\U0001D400x", U"^%u" },               { U"\U0001D400", U"" } },
+    };
+
+    for( const auto & [ c, expected ] : unicode_cases )
+    {
+        const auto & [ str, pat ]     = c;
+        const auto & [ wide, narrow ] = expected;
+
+        const auto text = lex::match( str, pat, unicode );
+        assert_true( text.size() && text.at( 0 ) == wide );
+        const auto locale = lex::match( str, pat );
+        assert_true( locale ? locale.at( 0 ) == narrow : narrow.empty() );
+        assert_true( lex::match( str, pat, ascii ) ? lex::match( str, pat, ascii ).at( 0 ) == narrow : narrow.empty() );
+
+        const lex::u32pattern compiled( pat, class_mode::unicode );
+        lex::match_options    opts;
+        assert_true( same_result( lex::match( str, compiled, opts ), text ) );
+        opts.iterative = true;
+        assert_true( same_result( lex::match( str, compiled, opts ), text ) );
+        opts.threaded = true;
+        assert_true( same_result( lex::match( str, compiled, opts ), text ) );
+        assert_true( same_result( lex::match( str, lex::u32pattern( pat ) ), locale ) );
+        assert_true( lex::gsub( str, compiled, U"<%0>" ) == lex::gsub( str, pat, U"<%0>", -1, unicode ) );
+    }
+
+    /* a compiled pattern has the classes it was compiled with, the option applies to pattern strings */
+    assert_false( lex::match( U"\u00E9", lex::u32pattern( U"%a" ), unicode ) );
+    assert_true( lex::match( U"\u00E9", lex::u32pattern( U"%a", class_mode::unicode ) ) );
+    assert_true( lex::match( "\xC3\xA9", lex::pattern( "%A%A", class_mode::ascii ) ) );
+
+    const auto words = lex::match( U"  \u00FCber \u0661\u0662", lex::static_pattern< unicode_word, class_mode::unicode >() );
+    assert_true( words.size() == 2 && words.at( 0 ) == U"\u00FCber" && words.at( 1 ) == U"\u0661\u0662" );
+    assert_true( lex::match( U"  \u00FCber", lex::static_pattern< unicode_word >() ).at( 0 ) == U"ber" );
+    assert_true( lex::match( "x_1 y", lex::static_pattern< ascii_word, class_mode::ascii >() ).at( 0 ) == "x_1" );
+    assert_true( lex::gsub( "a1 b2", lex::static_pattern< ascii_word, class_mode::ascii >(), "<%0>" ) == "<a1> <b2>" );
+
+    assert_true( lex::detail::unicode_class_bits( 0x110000 ) == 0 );
+    assert_true( lex::detail::unicode_class_bits( 0x10FFFF ) == 0 );  /* not assigned */
+    assert_true( lex::detail::unicode_class_bits( 0xE9 ) == ( lex::detail::alpha_bit | lex::detail::graph_bit | lex::detail::lower_bit ) );
+}
+
+/* Encodes a UTF-32 string in UTF-8 */
+static std::string to_utf8( std::u32string_view str )
+{
+    std::string result;
+    for( const char32_t c : str )
+    {
+        if( c < 0x80 )
+        {
+            result += static_cast< char >( c );
+        }
+        else if( c < 0x800 )
+        {
+            result += static_cast< char >( 0xC0 | ( c >> 6 ) );
+            result += static_cast< char >( 0x80 | ( c & 0x3F ) );
+        }
+        else if( c < 0x10000 )
+        {
+            result += static_cast< char >( 0xE0 | ( c >> 12 ) );
+            result += static_cast< char >( 0x80 | ( ( c >> 6 ) & 0x3F ) );
+            result += static_cast< char >( 0x80 | ( c & 0x3F ) );
+        }
+        else
+        {
+            result += static_cast< char >( 0xF0 | ( c >> 18 ) );
+            result += static_cast< char >( 0x80 | ( ( c >> 12 ) & 0x3F ) );
+            result += static_cast< char >( 0x80 | ( ( c >> 6 ) & 0x3F ) );
+            result += static_cast< char >( 0x80 | ( c & 0x3F ) );
+        }
+    }
+    return result;
+}
+
+static void utf8_matching()
+{
+    lex::match_options utf8;
+    utf8.utf8    = true;
+    utf8.classes = lex::class_mode::unicode;
+
+    /* matching the UTF-8 encoding of a string gives the encoding of the results of matching the code points */
+    const std::u32string_view cases[][ 2 ] = {
+        { U"h\u00E9llo w\u00F6rld", U"%a+" },
+        { U"h\u00E9llo w\u00F6rld", U"(.)(.)" },
+        { U"h\u00E9llo", U"^h.l" },
+        { U"\u00E0\u00E9\u00FF\u0100", U"[\u00E0-\u00FF]+" },
+        { U"\u00E0\u00E9\u00FF\u0100", U"[^\u00E9]" },
+        { U"\u4E2D\u6587\u4E2D", U"\u6587?\u4E2D" },
+        { U"\u00E9\u00E9\u00E9x", U"\u00E9*x" },
+        { U"\u00E9\u00E9\u00E9x", U"\u00E9-" },
+        { U"\u00E9\u00E9\u00E9x", U"\u00E9+\u00E9x" },
+        { U"\u00E9\u00E9\u00E9x", U"\u00E9-\u00E9x" },
+        { U"\u00E9\u00E9\u00E9x", U"\u00E9*" },
+        { U"x\u00E9t\u00E9 \u00E9", U"%f[%a]%a+%f[%A]" },
+        { U"a\u00AB b \u00AB\u00AB c \u00BB\u00BB", U"%b\u00AB\u00BB" },
+        { U"\U0001F600\U0001F601", U"[\U0001F600-\U0001F64F]" },
+        { U"\u00E9%\u00E9", U"%\u00E9" },
+        { U"a\u3000b", U"%S+" },
+        { U"\u00E9t\u00E9", U"(\u00E9)t%1" },
+        { U"\u00E9t\u00E9", U"" },
+        { U"\u00E9t\u00E9", U"x*" },
+    };
+
+    for( const auto & [ str, pat ] : cases )
+    {
+        const auto s = to_utf8( str );
+        const auto p = to_utf8( pat );
+
+        const auto wide   = lex::match( str, pat, utf8 );
+        const auto narrow = lex::match( s, p, utf8 );
+        assert_true( wide.size() == narrow.size() );
+        for( std::size_t i = 0 ; i < wide.size() && i < narrow.size() ; ++i )
+        {
+            assert_true( to_utf8( wide.at( i ) ) == narrow.at( i ) );
+        }
+
+        assert_true( to_utf8( lex::gsub( str, pat, U"<%0>", -1, utf8 ) ) == lex::gsub( s, p, "<%0>", -1, utf8 ) );
+
+        std::size_t wide_count = 0;
+        for( const auto & m : lex::context( str, pat, utf8 ) )
+        {
+            static_cast< void >( m );
+            ++wide_count;
+        }
+        std::size_t narrow_count = 0;
+        for( const auto & m : lex::context( s, p, utf8 ) )
+        {
+            static_cast< void >( m );
+            ++narrow_count;
+        }
+        assert_true( wide_count == narrow_count );
+    }
+
+    /* the positions of a match are byte offsets */
+    const auto pos = lex::find( to_utf8( U"h\u00E9llo" ), "l+", utf8 );
+    assert_true( pos.first == 3 && pos.second == 5 );
+    assert_true( lex::gsub( to_utf8( U"\u00E9\u00E9" ), "()..()", "%1-%2", -1, utf8 ) == "1-5" );
+
+    /* bytes that are not part of a valid UTF-8 sequence are chars */
+    assert_true( lex::gsub( "a\xFF\xC3", ".", "<%0>", -1, utf8 ) == "<a><\xFF><\xC3>" );
+    assert_true( lex::gsub( "\xC0\x80\xED\xA0\x80", ".", "<%0>", -1, utf8 ) == "<\xC0><\x80><\xED><\xA0><\x80>" );  /* overlong and surrogate */
+    assert_true( lex::gsub( "\xF4\x90\x80\x80", ".", "<%0>", -1, utf8 ) == "<\xF4><\x90><\x80><\x80>" );          /* beyond U+10FFFF */
+    assert_true( lex::match( "\xE2\x82\xAC\x80", "^.\x80$", utf8 ) );
+
+    /* the default mode matches bytes; a compiled pattern is always matched by bytes */
+    assert_false( lex::match( to_utf8( U"\u00E9" ), "^.$" ) );
+    assert_true( lex::match( to_utf8( U"\u00E9" ), "^.$", utf8 ) );
+    assert_false( lex::match( to_utf8( U"\u00E9" ), lex::pattern( "^.$" ), utf8 ) );
+    assert_true( lex::match( to_utf8( U"\u00E9" ), lex::pattern( "^..$" ), utf8 ) );
+
+    /* the cached matchers match by code points with the text matcher */
+    assert_true( lex::match_cached( to_utf8( U"\u00E9" ), "^.$", utf8 ) );
+    assert_true( lex::gsub_cached( to_utf8( U"h\u00E9" ), ".", "<%0>", -1, utf8 ) == to_utf8( U"<h><\u00E9>" ) );
+    assert_false( lex::match_cached( to_utf8( U"\u00E9" ), "^.$" ) );
 }
 
 int main( int /* argc */, char * /* argv */[] )
@@ -690,8 +2650,33 @@ int main( int /* argc */, char * /* argv */[] )
         exceptions();
         results();
         string_types();
+        mixed_char_types();
         string_traits();
         readme_examples();
+        compiled_patterns();
+        character_classes();
+        prefilters();
+        length_bounds();
+        class_runs();
+        iterative_matcher();
+        threaded_matcher();
+        bounded_matching();
+        compact_results();
+        pattern_sets();
+        parallel_matching();
+        streams();
+        mapped_files();
+        find_and_split();
+        counting();
+        cursors();
+        replacement_outputs();
+        static_patterns();
+        pattern_caches();
+        batch_matching();
+        rule_chains();
+        match_statistics();
+        class_modes();
+        utf8_matching();
 
         std::cout << "Total tests: " << total_checks << ", Tests failed: " << failed_checks << '\n';
 
@@ -0,0 +1,81 @@
+#!/usr/bin/env python3
+# MIT License
+#
+# Copyright (c) 2020 PG1003
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+"""Generates src/lex_unicode.inc, the class table of class_mode::unicode, from the Unicode database of Python.
+
+Usage: python3 tools/unicode_classes.py > src/lex_unicode.inc
+"""
+
+import sys
+import unicodedata
+
+# The bits of pg::lex::detail::class_bits
+ALPHA, CNTRL, DIGIT, GRAPH, LOWER, PUNCT, SPACE, UPPER = ( 1 << i for i in range( 8 ) )
+
+
+def class_bits( c ):
+    ch       = chr( c )
+    category = unicodedata.category( ch )
+    bits     = 0
+    if category[ 0 ] == 'L':
+        bits |= ALPHA
+    if category == 'Cc':
+        bits |= CNTRL
+    if category == 'Nd':
+        bits |= DIGIT
+    if category[ 0 ] not in 'CZ':
+        bits |= GRAPH
+    if category == 'Ll':
+        bits |= LOWER
+    if category[ 0 ] in 'PS':
+        bits |= PUNCT
+    if ch.isspace():
+        bits |= SPACE
+    if category == 'Lu':
+        bits |= UPPER
+    return bits
+
+
+def main():
+    runs     = []
+    previous = None
+    for c in range( 128, sys.maxunicode + 1 ):
+        bits = class_bits( c )
+        if bits != previous:
+            runs.append( ( c << 8 ) | bits )
+            previous = bits
+
+    print( '// Generated by tools/unicode_classes.py from the Unicode Character Database %s; do not edit.' % unicodedata.unidata_version )
+    print( '//' )
+    print( '// Every entry starts a run of code points with the same class bits; the first code point of the run is shifted left by 8' )
+    print( '// and the low byte holds the class bits. The runs start at code point 128 and continue up to the last code point.' )
+    print()
+    print( 'constexpr std::uint32_t unicode_class_runs[] =' )
+    print( '{' )
+    for i in range( 0, len( runs ), 8 ):
+        print( '    ' + ', '.join( '0x%08x' % r for r in runs[ i : i + 8 ] ) + ',' )
+    print( '};' )
+
+
+if __name__ == '__main__':
+    main()